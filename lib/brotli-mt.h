@@ -23,6 +23,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>   /* size_t */
+#include "mtstat.h"   /* mtstat_t */
 
 /* current maximum the library will accept */
 #define BROTLIMT_THREAD_MAX 128
@@ -74,6 +75,8 @@ typedef struct {
  * - just write some wrapper on your own
  * - a sample is given in 7-Zip ZS or bromt.c
  * - the function should return -1 on error and zero on success
+ * - at compression, fn_read may return 1 instead of zero, when no more
+ *   input is ready and the next read would block, like live streams
  * - the read or written bytes will go to in->size or out->size
  */
 typedef int (fn_read) (void *args, BROTLIMT_Buffer * in);
@@ -103,6 +106,42 @@ typedef struct BROTLIMT_CCtx_s BROTLIMT_CCtx;
  */
 BROTLIMT_CCtx *BROTLIMT_createCCtx(int threads, int level, int inputsize);
 
+/**
+ * 1b) change some advanced setting of the encoder, before 2)
+ * - return zero or an error code
+ *
+ * BROTLIMT_p_window: lgwin, 10 .. 24 (default), up to 30 with large window
+ * BROTLIMT_p_block:  lgblock, 16 .. 24, zero for auto (default)
+ * BROTLIMT_p_mode:   BROTLIMT_MODE_GENERIC (default), _TEXT, _FONT or
+ *                    _AUTO, which selects text or generic for each frame
+ * BROTLIMT_p_large_window: 1 = windows above 16 MiB, the frames are no
+ *                    standard brotli streams then, brotli-mt reads them
+ */
+typedef enum {
+	BROTLIMT_p_window,
+	BROTLIMT_p_block,
+	BROTLIMT_p_mode,
+	BROTLIMT_p_large_window
+} BROTLIMT_cParameter;
+
+#define BROTLIMT_MODE_GENERIC 0
+#define BROTLIMT_MODE_TEXT    1
+#define BROTLIMT_MODE_FONT    2
+#define BROTLIMT_MODE_AUTO    3
+
+size_t BROTLIMT_setCCtxParameter(BROTLIMT_CCtx * ctx,
+				 BROTLIMT_cParameter param, int value);
+
+/**
+ * 1c) compress all frames with a raw dictionary, before 2)
+ * - return zero or an error code
+ * - the dictionary is copied and prepared once, all workers share it
+ * - the frames can only be decompressed with the same dictionary
+ * - needs brotli v1.1.0 or newer, zero size removes the dictionary
+ */
+size_t BROTLIMT_setCCtxDictionary(BROTLIMT_CCtx * ctx, const void *dict,
+				  size_t size);
+
 /**
  * 2) threaded compression
  * - errorcheck via 
@@ -115,6 +154,12 @@ size_t BROTLIMT_compressCCtx(BROTLIMT_CCtx * ctx, BROTLIMT_RdWr_t * rdwr);
 size_t BROTLIMT_GetFramesCCtx(BROTLIMT_CCtx * ctx);
 size_t BROTLIMT_GetInsizeCCtx(BROTLIMT_CCtx * ctx);
 size_t BROTLIMT_GetOutsizeCCtx(BROTLIMT_CCtx * ctx);
+void BROTLIMT_GetStatsCCtx(BROTLIMT_CCtx * ctx, mtstat_t * st);
+int BROTLIMT_GetWorkerStatsCCtx(BROTLIMT_CCtx * ctx, mtstat_t * st, int count);
+void BROTLIMT_setProgressCCtx(BROTLIMT_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void BROTLIMT_setTraceCCtx(BROTLIMT_CCtx * ctx, mttrace_fn * fn, void *arg);
+void BROTLIMT_setExecutorCCtx(BROTLIMT_CCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
@@ -137,6 +182,13 @@ typedef struct BROTLIMT_DCtx_s BROTLIMT_DCtx;
  */
 BROTLIMT_DCtx *BROTLIMT_createDCtx(int threads, int inputsize);
 
+/**
+ * 1b) the dictionary of BROTLIMT_setCCtxDictionary(), before 2)
+ * - return zero or an error code
+ */
+size_t BROTLIMT_setDCtxDictionary(BROTLIMT_DCtx * ctx, const void *dict,
+				  size_t size);
+
 /**
  * 2) threaded compression
  * - return -1 on error
@@ -149,6 +201,13 @@ size_t BROTLIMT_decompressDCtx(BROTLIMT_DCtx * ctx, BROTLIMT_RdWr_t * rdwr);
 size_t BROTLIMT_GetFramesDCtx(BROTLIMT_DCtx * ctx);
 size_t BROTLIMT_GetInsizeDCtx(BROTLIMT_DCtx * ctx);
 size_t BROTLIMT_GetOutsizeDCtx(BROTLIMT_DCtx * ctx);
+void BROTLIMT_GetStatsDCtx(BROTLIMT_DCtx * ctx, mtstat_t * st);
+int BROTLIMT_GetWorkerStatsDCtx(BROTLIMT_DCtx * ctx, mtstat_t * st, int count);
+void BROTLIMT_setProgressDCtx(BROTLIMT_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void BROTLIMT_setTraceDCtx(BROTLIMT_DCtx * ctx, mttrace_fn * fn, void *arg);
+void BROTLIMT_setOutputDCtx(BROTLIMT_DCtx * ctx, mtoutput_fn * fn, void *arg);
+void BROTLIMT_setExecutorDCtx(BROTLIMT_DCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
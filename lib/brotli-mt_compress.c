@@ -18,8 +18,12 @@
 
 #include "brotli-mt.h"
 #include "memmt.h"
-#include "threading.h"
-#include "list.h"
+#include "mtpipe.h"
+
+/* prepared dictionaries came with brotli v1.1.0 */
+#ifdef SHARED_BROTLI_MAX_COMPOUND_DICTS
+#define BROTLIMT_DICT
+#endif
 
 /**
  * multi threaded brotli - multiple workers version
@@ -32,332 +36,322 @@
  *   2) release read mutex and do compression
  *   3) get write mutex and write result
  *   4) begin with step 1 again, until no input
+ * - the workers are run by mtpipe, this file only does the brotli part
  */
 
-/* worker for compression */
+/**
+ * brotli can't reset an encoder, so each frame gets a new one, but the
+ * memory of the old one is kept for it: freed blocks go to the cache of
+ * the worker and the next encoder takes them again
+ */
+#define BCACHE_MAX  64
+#define BCACHE_HDR  16		/* keeps the alignment of malloc() */
+
 typedef struct {
-	BROTLIMT_CCtx *ctx;
-	pthread_t pthread;
-} cwork_t;
-
-struct writelist;
-struct writelist {
-	size_t frame;
-	BROTLIMT_Buffer out;
-	struct list_head node;
-};
+	int count;
+	void *block[BCACHE_MAX];
+} bcache_t;
 
 struct BROTLIMT_CCtx_s {
 	int level;
 
-	/* threads: 1..BROTLIMT_THREAD_MAX */
-	int threads;
-
-	/* should be used for read from input */
-	int inputsize;
-
-	/* statistic */
-	size_t insize;
-	size_t outsize;
-	size_t curframe;
-	size_t frames;
-
-	/* threading */
-	cwork_t *cwork;
+	/* encoder parameters, see BROTLIMT_setCCtxParameter() */
+	int window;
+	int block;
+	int mode;
+	int large_window;
 
-	/* reading input */
-	pthread_mutex_t read_mutex;
-	fn_read *fn_read;
-	void *arg_read;
+	/* memory cache of the encoder of each worker */
+	bcache_t *cache;
 
-	/* writing output */
-	pthread_mutex_t write_mutex;
-	fn_write *fn_write;
-	void *arg_write;
+#ifdef BROTLIMT_DICT
+	/* the dictionary, prepared once and attached to each encoder */
+	void *dict;
+	BrotliEncoderPreparedDictionary *prepared;
+#endif
 
-	/* lists for writing queue */
-	struct list_head writelist_free;
-	struct list_head writelist_busy;
-	struct list_head writelist_done;
+	/* the frame pipeline, see mtpipe.h */
+	mtpipe pipe;
 };
 
 /* **************************************
  * Compression
  ****************************************/
 
-BROTLIMT_CCtx *BROTLIMT_createCCtx(int threads, int level, int inputsize)
+static void *bcache_alloc(void *opaque, size_t size)
 {
-	BROTLIMT_CCtx *ctx;
-	int t;
+	bcache_t *c = (bcache_t *) opaque;
+	unsigned char *p;
+	int i;
+
+	for (i = 0; i < c->count; i++) {
+		p = (unsigned char *)c->block[i];
+		if (*(size_t *) p == size) {
+			c->block[i] = c->block[--c->count];
+			return p + BCACHE_HDR;
+		}
+	}
 
-	/* allocate ctx */
-	ctx = (BROTLIMT_CCtx *) malloc(sizeof(BROTLIMT_CCtx));
-	if (!ctx)
+	p = (unsigned char *)malloc(size + BCACHE_HDR);
+	if (!p)
 		return 0;
+	*(size_t *) p = size;
 
-	/* check threads value */
-	if (threads < 1 || threads > BROTLIMT_THREAD_MAX)
-		return 0;
+	return p + BCACHE_HDR;
+}
 
-	/* check level */
-	if (level < BROTLIMT_LEVEL_MIN || level > BROTLIMT_LEVEL_MAX)
-		return 0;
+static void bcache_free(void *opaque, void *address)
+{
+	bcache_t *c = (bcache_t *) opaque;
+	unsigned char *p = (unsigned char *)address;
 
-	/* calculate chunksize for one thread */
-	if (inputsize)
-		ctx->inputsize = inputsize;
+	if (!p)
+		return;
+
+	p -= BCACHE_HDR;
+	if (c->count < BCACHE_MAX)
+		c->block[c->count++] = p;
 	else
-		ctx->inputsize = 1024 * 1024 * (level ? level : 1);
+		free(p);
+}
 
-	/* setup ctx */
-	ctx->level = level;
-	ctx->threads = threads;
-	ctx->insize = 0;
-	ctx->outsize = 0;
-	ctx->frames = 0;
-	ctx->curframe = 0;
-
-	pthread_mutex_init(&ctx->read_mutex, NULL);
-	pthread_mutex_init(&ctx->write_mutex, NULL);
-
-	/* free -> busy -> out -> free -> ... */
-	INIT_LIST_HEAD(&ctx->writelist_free);	/* free, can be used */
-	INIT_LIST_HEAD(&ctx->writelist_busy);	/* busy */
-	INIT_LIST_HEAD(&ctx->writelist_done);	/* can be written */
-
-	ctx->cwork = (cwork_t *) malloc(sizeof(cwork_t) * threads);
-	if (!ctx->cwork)
-		goto err_cwork;
-
-	for (t = 0; t < threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		w->ctx = ctx;
-	}
+/* text, when a sample of the frame has (almost) no control bytes */
+static int brotlimt_mode(const unsigned char *buf, size_t size)
+{
+	size_t i, n = size < 4096 ? size : 4096, ctrl = 0;
 
-	return ctx;
+	for (i = 0; i < n; i++) {
+		unsigned char c = buf[i];
+		if ((c < 0x20 && c != '\t' && c != '\n' && c != '\r')
+		    || c == 0x7f)
+			ctrl++;
+	}
 
- err_cwork:
-	free(ctx);
+	if (ctrl * 100 > n)
+		return BROTLI_MODE_GENERIC;
 
-	return 0;
+	return BROTLI_MODE_TEXT;
 }
 
-/**
- * mt_error - return mt lib specific error code
- */
-static size_t mt_error(int rv)
-{
-	switch (rv) {
-	case -1:
-		return MT_ERROR(read_fail);
-	case -2:
-		return MT_ERROR(canceled);
-	case -3:
-		return MT_ERROR(memory_allocation);
-	}
+static const size_t errors[] = MTPIPE_ERRORS(MT_ERROR);
 
-	return MT_ERROR(read_fail);
+static size_t brotlimt_bound(void *arg, size_t insize)
+{
+	(void)arg;
+	return BrotliEncoderMaxCompressedSize(insize) + 16;
 }
 
-/**
- * pt_write - queue for compressed output
- */
-static size_t pt_write(BROTLIMT_CCtx * ctx, struct writelist *wl)
+static size_t brotlimt_compress(void *arg, int worker, mtpipe_buf * out,
+				const mtpipe_buf * in)
 {
-	struct list_head *entry;
-
-	/* move the entry to the done list */
-	list_move(&wl->node, &ctx->writelist_done);
+	BROTLIMT_CCtx *ctx = (BROTLIMT_CCtx *) arg;
+	size_t inputsize = ctx->pipe.inputsize;
+	const uint8_t *ibuf = in->buf;
+	uint8_t *obuf = (uint8_t *) out->buf + 16;
+	size_t avail_in = in->size;
+	size_t avail_out = out->allocated - 16;
+	BrotliEncoderState *s;
+	U16 hintsize;
+	int mode, rv;
+
+	s = BrotliEncoderCreateInstance(bcache_alloc, bcache_free,
+					&ctx->cache[worker]);
+	if (!s)
+		return MT_ERROR(memory_allocation);
 
-	/* the entry isn't the currently needed, return...  */
-	if (wl->frame != ctx->curframe)
-		return 0;
+	switch (ctx->mode) {
+	case BROTLIMT_MODE_TEXT:
+		mode = BROTLI_MODE_TEXT;
+		break;
+	case BROTLIMT_MODE_FONT:
+		mode = BROTLI_MODE_FONT;
+		break;
+	case BROTLIMT_MODE_AUTO:
+		mode = brotlimt_mode(ibuf, in->size);
+		break;
+	default:
+		mode = BROTLI_MODE_GENERIC;
+	}
 
- again:
-	/* check, what can be written ... */
-	list_for_each(entry, &ctx->writelist_done) {
-		wl = list_entry(entry, struct writelist, node);
-		if (wl->frame == ctx->curframe) {
-			int rv = ctx->fn_write(ctx->arg_write, &wl->out);
-			if (rv != 0)
-				return mt_error(rv);
-			ctx->outsize += wl->out.size;
-			ctx->curframe++;
-			list_move(entry, &ctx->writelist_free);
-			goto again;
-		}
+	BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, ctx->level);
+	BrotliEncoderSetParameter(s, BROTLI_PARAM_LGWIN, ctx->window);
+	if (ctx->block)
+		BrotliEncoderSetParameter(s, BROTLI_PARAM_LGBLOCK, ctx->block);
+	BrotliEncoderSetParameter(s, BROTLI_PARAM_MODE, mode);
+	BrotliEncoderSetParameter(s, BROTLI_PARAM_LARGE_WINDOW,
+				  ctx->large_window);
+	BrotliEncoderSetParameter(s, BROTLI_PARAM_SIZE_HINT, (U32) in->size);
+#ifdef BROTLIMT_DICT
+	if (ctx->prepared &&
+	    !BrotliEncoderAttachPreparedDictionary(s, ctx->prepared)) {
+		BrotliEncoderDestroyInstance(s);
+		return MT_ERROR(compression_library);
 	}
+#endif
+
+	rv = BrotliEncoderCompressStream(s, BROTLI_OPERATION_FINISH,
+					 &avail_in, &ibuf, &avail_out, &obuf,
+					 0);
+	if (rv == BROTLI_FALSE || !BrotliEncoderIsFinished(s)) {
+		BrotliEncoderDestroyInstance(s);
+		return MT_ERROR(frame_compress);
+	}
+	BrotliEncoderDestroyInstance(s);
+	out->size = out->allocated - 16 - avail_out;
+
+	/* write skippable frame */
+	MEM_writeLE32((unsigned char *)out->buf + 0, BROTLIMT_MAGIC_SKIPPABLE);
+	MEM_writeLE32((unsigned char *)out->buf + 4, 8);
+	MEM_writeLE32((unsigned char *)out->buf + 8, (U32) out->size);
+	/* BR */
+	MEM_writeLE16((unsigned char *)out->buf + 12,
+		      (U16) BROTLIMT_MAGICNUMBER);
+
+	/* number of 64KB blocks needed for decompression */
+	if (inputsize > in->size) {
+		hintsize = (U16)(in->size >> 16);
+		hintsize += 1;
+	} else
+		hintsize = (U16)(inputsize >> 16);
+	MEM_writeLE16((unsigned char *)out->buf + 14, hintsize);
+
+	out->size += 16;
 
 	return 0;
 }
 
-static void *pt_compress(void *arg)
+static const mtpipe_codec brotlimt_codec = {
+	16, BROTLIMT_isError, errors, brotlimt_bound, brotlimt_compress, 0
+};
+
+BROTLIMT_CCtx *BROTLIMT_createCCtx(int threads, int level, int inputsize)
 {
-	cwork_t *w = (cwork_t *) arg;
-	BROTLIMT_CCtx *ctx = w->ctx;
-	size_t result;
-	BROTLIMT_Buffer in;
-
-	/* inbuf is constant */
-	in.size = ctx->inputsize;
-	in.buf = malloc(in.size);
-	if (!in.buf)
-		return (void *)MT_ERROR(memory_allocation);
-
-	for (;;) {
-		struct list_head *entry;
-		struct writelist *wl;
-		int rv;
-
-		/* allocate space for new output */
-		pthread_mutex_lock(&ctx->write_mutex);
-		if (!list_empty(&ctx->writelist_free)) {
-			/* take unused entry */
-			entry = list_first(&ctx->writelist_free);
-			wl = list_entry(entry, struct writelist, node);
-			wl->out.size =
-			    BrotliEncoderMaxCompressedSize(ctx->inputsize) + 16;
-			list_move(entry, &ctx->writelist_busy);
-		} else {
-			/* allocate new one */
-			wl = (struct writelist *)
-			    malloc(sizeof(struct writelist));
-			if (!wl) {
-				pthread_mutex_unlock(&ctx->write_mutex);
-				return (void *)MT_ERROR(memory_allocation);
-			}
-			wl->out.size =
-			    BrotliEncoderMaxCompressedSize(ctx->inputsize) + 16;
-			wl->out.buf = malloc(wl->out.size);
-			if (!wl->out.buf) {
-				pthread_mutex_unlock(&ctx->write_mutex);
-				return (void *)MT_ERROR(memory_allocation);
-			}
-			list_add(&wl->node, &ctx->writelist_busy);
-		}
-		pthread_mutex_unlock(&ctx->write_mutex);
-
-		/* read new input */
-		pthread_mutex_lock(&ctx->read_mutex);
-		in.size = ctx->inputsize;
-		rv = ctx->fn_read(ctx->arg_read, &in);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return (void *)mt_error(rv);
-		}
+	BROTLIMT_CCtx *ctx;
 
-		/* eof */
-		if (in.size == 0 && ctx->frames > 0) {
-			free(in.buf);
-			pthread_mutex_unlock(&ctx->read_mutex);
+	/* check threads value */
+	if (threads < 1 || threads > BROTLIMT_THREAD_MAX)
+		return 0;
 
-			pthread_mutex_lock(&ctx->write_mutex);
-			list_move(&wl->node, &ctx->writelist_free);
-			pthread_mutex_unlock(&ctx->write_mutex);
+	/* check level */
+	if (level < BROTLIMT_LEVEL_MIN || level > BROTLIMT_LEVEL_MAX)
+		return 0;
 
-			goto okay;
-		}
-		ctx->insize += in.size;
-		wl->frame = ctx->frames++;
-		pthread_mutex_unlock(&ctx->read_mutex);
-
-		/* compress whole frame */
-		{
-			const uint8_t *ibuf = in.buf;
-			uint8_t *obuf = (uint8_t*)wl->out.buf + 16;
-			wl->out.size -= 16;
-			rv = BrotliEncoderCompress(ctx->level,
-						   BROTLI_MAX_WINDOW_BITS,
-						   BROTLI_MODE_GENERIC, in.size,
-						   ibuf, &wl->out.size, obuf);
-
-			/* printf("BrotliEncoderCompress() rv=%d in=%zu out=%zu\n", rv, in.size, wl->out.size); */
-
-			if (rv == BROTLI_FALSE) {
-				pthread_mutex_lock(&ctx->write_mutex);
-				list_move(&wl->node, &ctx->writelist_free);
-				pthread_mutex_unlock(&ctx->write_mutex);
-				return (void *)MT_ERROR(frame_compress);
-			}
-		}
+	/* allocate ctx */
+	ctx = (BROTLIMT_CCtx *) malloc(sizeof(BROTLIMT_CCtx));
+	if (!ctx)
+		return 0;
 
-		/* write skippable frame */
-		MEM_writeLE32((unsigned char *)wl->out.buf + 0,
-			      BROTLIMT_MAGIC_SKIPPABLE);
-		MEM_writeLE32((unsigned char *)wl->out.buf + 4, 8);
-		MEM_writeLE32((unsigned char *)wl->out.buf + 8,
-			      (U32) wl->out.size);
-		/* BR */
-		MEM_writeLE16((unsigned char *)wl->out.buf + 12,
-			      (U16) BROTLIMT_MAGICNUMBER);
-
-		/* number of 64KB blocks needed for decompression */
-		{
-		U16 hintsize;
-		if (ctx->inputsize > (int)in.size) {
-			hintsize = (U16)(in.size >> 16);
-			hintsize += 1;
-		} else
-			hintsize = ctx->inputsize >> 16;
-		MEM_writeLE16((unsigned char *)wl->out.buf + 14,
-			      hintsize);
-		}
+	/* calculate chunksize for one thread */
+	if (!inputsize)
+		inputsize = 1024 * 1024 * (level ? level : 1);
 
-		wl->out.size += 16;
+	/* setup ctx */
+	ctx->level = level;
+	ctx->window = BROTLI_MAX_WINDOW_BITS;
+	ctx->block = 0;
+	ctx->mode = BROTLIMT_MODE_GENERIC;
+	ctx->large_window = 0;
+#ifdef BROTLIMT_DICT
+	ctx->dict = 0;
+	ctx->prepared = 0;
+#endif
+	if (mtpipe_init(&ctx->pipe, &brotlimt_codec, ctx, threads, inputsize))
+		goto err_pipe;
+
+	ctx->cache = (bcache_t *) calloc(threads, sizeof(bcache_t));
+	if (!ctx->cache)
+		goto err_cache;
 
-		/* write result */
-		pthread_mutex_lock(&ctx->write_mutex);
-		result = pt_write(ctx, wl);
-		pthread_mutex_unlock(&ctx->write_mutex);
-		if (BROTLIMT_isError(result))
-			return (void *)result;
-	}
+	return ctx;
+
+ err_cache:
+	mtpipe_free(&ctx->pipe);
+ err_pipe:
+	free(ctx);
 
- okay:
 	return 0;
 }
 
-size_t BROTLIMT_compressCCtx(BROTLIMT_CCtx * ctx, BROTLIMT_RdWr_t * rdwr)
+size_t BROTLIMT_setCCtxParameter(BROTLIMT_CCtx * ctx,
+				 BROTLIMT_cParameter param, int value)
 {
-	int t;
-	void *retval_of_thread = 0;
+	if (!ctx)
+		return MT_ERROR(compressionParameter_unsupported);
 
+	switch (param) {
+	case BROTLIMT_p_window:
+		if (value < BROTLI_MIN_WINDOW_BITS
+		    || value > BROTLI_LARGE_MAX_WINDOW_BITS)
+			break;
+		ctx->window = value;
+		return 0;
+	case BROTLIMT_p_block:
+		if (value && (value < BROTLI_MIN_INPUT_BLOCK_BITS
+			      || value > BROTLI_MAX_INPUT_BLOCK_BITS))
+			break;
+		ctx->block = value;
+		return 0;
+	case BROTLIMT_p_mode:
+		if (value < BROTLIMT_MODE_GENERIC || value > BROTLIMT_MODE_AUTO)
+			break;
+		ctx->mode = value;
+		return 0;
+	case BROTLIMT_p_large_window:
+		ctx->large_window = value ? 1 : 0;
+		return 0;
+	}
+
+	return MT_ERROR(compressionParameter_unsupported);
+}
+
+size_t BROTLIMT_setCCtxDictionary(BROTLIMT_CCtx * ctx, const void *dict,
+				  size_t size)
+{
+#ifdef BROTLIMT_DICT
 	if (!ctx)
 		return MT_ERROR(compressionParameter_unsupported);
 
-	/* init reading and writing functions */
-	ctx->fn_read = rdwr->fn_read;
-	ctx->fn_write = rdwr->fn_write;
-	ctx->arg_read = rdwr->arg_read;
-	ctx->arg_write = rdwr->arg_write;
+	if (ctx->prepared)
+		BrotliEncoderDestroyPreparedDictionary(ctx->prepared);
+	free(ctx->dict);
+	ctx->prepared = 0;
+	ctx->dict = 0;
+	if (!size)
+		return 0;
 
-	/* start all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		pthread_create(&w->pthread, NULL, pt_compress, w);
+	/* the prepared dictionary refers to the data, so keep a copy */
+	ctx->dict = malloc(size);
+	if (!ctx->dict)
+		return MT_ERROR(memory_allocation);
+	memcpy(ctx->dict, dict, size);
+
+	ctx->prepared = BrotliEncoderPrepareDictionary(
+		BROTLI_SHARED_DICTIONARY_RAW, size, (const uint8_t *)ctx->dict,
+		ctx->level, 0, 0, 0);
+	if (!ctx->prepared) {
+		free(ctx->dict);
+		ctx->dict = 0;
+		return MT_ERROR(compression_library);
 	}
 
-	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(w->pthread, &p);
-		if (p)
-			retval_of_thread = p;
-	}
+	return 0;
+#else
+	(void)ctx;
+	(void)dict;
+	(void)size;
 
-	/* clean up lists */
-	while (!list_empty(&ctx->writelist_free)) {
-		struct writelist *wl;
-		struct list_head *entry;
-		entry = list_first(&ctx->writelist_free);
-		wl = list_entry(entry, struct writelist, node);
-		free(wl->out.buf);
-		list_del(&wl->node);
-		free(wl);
-	}
+	return MT_ERROR(compressionParameter_unsupported);
+#endif
+}
 
-	return (size_t) retval_of_thread;
+size_t BROTLIMT_compressCCtx(BROTLIMT_CCtx * ctx, BROTLIMT_RdWr_t * rdwr)
+{
+	if (!ctx)
+		return MT_ERROR(compressionParameter_unsupported);
+
+	return mtpipe_compress(&ctx->pipe, (mtpipe_fn *) rdwr->fn_read,
+			       rdwr->arg_read, (mtpipe_fn *) rdwr->fn_write,
+			       rdwr->arg_write);
 }
 
 /* returns current uncompressed data size */
@@ -366,7 +360,7 @@ size_t BROTLIMT_GetInsizeCCtx(BROTLIMT_CCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->insize;
+	return mt_atomic_get(&ctx->pipe.insize);
 }
 
 /* returns the current compressed data size */
@@ -375,7 +369,7 @@ size_t BROTLIMT_GetOutsizeCCtx(BROTLIMT_CCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->outsize;
+	return mt_atomic_get(&ctx->pipe.outsize);
 }
 
 /* returns the current compressed frames */
@@ -384,17 +378,75 @@ size_t BROTLIMT_GetFramesCCtx(BROTLIMT_CCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->curframe;
+	return mt_atomic_get(&ctx->pipe.curframe);
+}
+
+/* returns the counters of all workers together */
+void BROTLIMT_GetStatsCCtx(BROTLIMT_CCtx * ctx, mtstat_t * st)
+{
+	if (!ctx) {
+		memset(st, 0, sizeof(*st));
+		return;
+	}
+
+	mtpipe_stats(&ctx->pipe, st);
+}
+
+/* returns the number of workers, up to count of them are copied to st */
+int BROTLIMT_GetWorkerStatsCCtx(BROTLIMT_CCtx * ctx, mtstat_t * st, int count)
+{
+	if (!ctx)
+		return 0;
+
+	return mtpipe_worker_stats(&ctx->pipe, st, count);
+}
+
+/* register a progress callback, see mtprogress_init() */
+void BROTLIMT_setProgressCCtx(BROTLIMT_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes)
+{
+	if (!ctx)
+		return;
+
+	mtprogress_init(&ctx->pipe.progress, fn, arg, ms, bytes);
+}
+
+/* register a trace callback, see mttrace_fn in mtstat.h */
+void BROTLIMT_setTraceCCtx(BROTLIMT_CCtx * ctx, mttrace_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.trace = fn;
+	ctx->pipe.trace_arg = arg;
+}
+
+/* run the workers as tasks of ex, or on threads again, when ex is zero */
+void BROTLIMT_setExecutorCCtx(BROTLIMT_CCtx * ctx, const mt_executor * ex)
+{
+	if (!ctx)
+		return;
+
+	mtpipe_executor(&ctx->pipe, ex);
 }
 
 void BROTLIMT_freeCCtx(BROTLIMT_CCtx * ctx)
 {
+	int t, i;
+
 	if (!ctx)
 		return;
 
-	pthread_mutex_destroy(&ctx->read_mutex);
-	pthread_mutex_destroy(&ctx->write_mutex);
-	free(ctx->cwork);
+	for (t = 0; t < ctx->pipe.threads; t++)
+		for (i = 0; i < ctx->cache[t].count; i++)
+			free(ctx->cache[t].block[i]);
+	mtpipe_free(&ctx->pipe);
+#ifdef BROTLIMT_DICT
+	if (ctx->prepared)
+		BrotliEncoderDestroyPreparedDictionary(ctx->prepared);
+	free(ctx->dict);
+#endif
+	free(ctx->cache);
 	free(ctx);
 	ctx = 0;
 
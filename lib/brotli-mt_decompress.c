@@ -18,8 +18,12 @@
 
 #include "brotli-mt.h"
 #include "memmt.h"
-#include "threading.h"
-#include "list.h"
+#include "mtpipe.h"
+
+/* shared dictionaries came with brotli v1.1.0 */
+#ifdef SHARED_BROTLI_MAX_COMPOUND_DICTS
+#define BROTLIMT_DICT
+#endif
 
 /**
  * multi threaded brotli - multiple workers version
@@ -32,108 +36,135 @@
  *   2) release read mutex and do compression
  *   3) get write mutex and write result
  *   4) begin with step 1 again, until no input
+ * - the workers are run by mtpipe, this file only does the brotli part
  */
 
-/* worker for compression */
-typedef struct {
-	BROTLIMT_DCtx *ctx;
-	pthread_t pthread;
-	BROTLIMT_Buffer in;
-} cwork_t;
+struct BROTLIMT_DCtx_s {
 
-struct writelist;
-struct writelist {
-	size_t frame;
-	BROTLIMT_Buffer out;
-	struct list_head node;
+	/* copy of the dictionary, attached to each decoder */
+	void *dict;
+	size_t dictsize;
+
+	/* the frame pipeline, see mtpipe.h */
+	mtpipe pipe;
 };
 
-struct BROTLIMT_DCtx_s {
+/* **************************************
+ * Decompression
+ ****************************************/
+
+static const size_t errors[] = MTPIPE_ERRORS(MT_ERROR);
 
-	/* threads: 1..BROTLIMT_THREAD_MAX */
-	int threads;
+static size_t brotlimt_decompress(void *arg, int worker, mtpipe_buf * out,
+				  const mtpipe_buf * in,
+				  const unsigned char *hdr)
+{
+	BROTLIMT_DCtx *ctx = (BROTLIMT_DCtx *) arg;
+	const uint8_t *ibuf = in->buf;
+	uint8_t *obuf;
+	size_t avail_in = in->size, avail_out;
+	BrotliDecoderState *s;
+	int rv;
 
-	/* should be used for read from input */
-	size_t inputsize;
+	(void)worker;
+	if (MEM_readLE16(hdr + 12) != BROTLIMT_MAGICNUMBER)
+		return MT_ERROR(data_error);
 
-	/* statistic */
-	size_t insize;
-	size_t outsize;
-	size_t curframe;
-	size_t frames;
+	/* get uncompressed size for output buffer */
+	avail_out = (size_t)MEM_readLE16(hdr + 14) << 16;
+	if (mtpipe_reserve(out, avail_out))
+		return MT_ERROR(memory_allocation);
+	out->size = avail_out;
+	obuf = out->buf;
 
-	/* threading */
-	cwork_t *cwork;
+	/* the frames may use a large window, see BROTLIMT_p_large_window */
+	s = BrotliDecoderCreateInstance(0, 0, 0);
+	if (!s)
+		return MT_ERROR(memory_allocation);
+	BrotliDecoderSetParameter(s, BROTLI_DECODER_PARAM_LARGE_WINDOW, 1);
+#ifdef BROTLIMT_DICT
+	if (ctx->dict &&
+	    !BrotliDecoderAttachDictionary(s, BROTLI_SHARED_DICTIONARY_RAW,
+					   ctx->dictsize,
+					   (const uint8_t *)ctx->dict)) {
+		BrotliDecoderDestroyInstance(s);
+		return MT_ERROR(compression_library);
+	}
+#else
+	(void)ctx;
+#endif
 
-	/* reading input */
-	pthread_mutex_t read_mutex;
-	fn_read *fn_read;
-	void *arg_read;
+	rv = BrotliDecoderDecompressStream(s, &avail_in, &ibuf, &avail_out,
+					   &obuf, 0);
+	BrotliDecoderDestroyInstance(s);
+	if (rv != BROTLI_DECODER_RESULT_SUCCESS)
+		return MT_ERROR(frame_decompress);
+	out->size -= avail_out;
 
-	/* writing output */
-	pthread_mutex_t write_mutex;
-	fn_write *fn_write;
-	void *arg_write;
+	return 0;
+}
 
-	/* lists for writing queue */
-	struct list_head writelist_free;
-	struct list_head writelist_busy;
-	struct list_head writelist_done;
+static const mtpipe_codec brotlimt_codec = {
+	16, BROTLIMT_isError, errors, 0, 0, brotlimt_decompress
 };
 
-/* **************************************
- * Decompression
- ****************************************/
-
 BROTLIMT_DCtx *BROTLIMT_createDCtx(int threads, int inputsize)
 {
 	BROTLIMT_DCtx *ctx;
-	int t;
-
-	/* allocate ctx */
-	ctx = (BROTLIMT_DCtx *) malloc(sizeof(BROTLIMT_DCtx));
-	if (!ctx)
-		return 0;
 
 	/* check threads value */
 	if (threads < 1 || threads > BROTLIMT_THREAD_MAX)
 		return 0;
 
-	/* setup ctx */
-	ctx->threads = threads;
-	ctx->insize = 0;
-	ctx->outsize = 0;
-	ctx->frames = 0;
-	ctx->curframe = 0;
+	/* allocate ctx */
+	ctx = (BROTLIMT_DCtx *) malloc(sizeof(BROTLIMT_DCtx));
+	if (!ctx)
+		return 0;
 
 	/* will be used for single stream only */
-	if (inputsize)
-		ctx->inputsize = inputsize;
-	else
-		ctx->inputsize = 1024 * 64;	/* 64K buffer */
+	if (!inputsize)
+		inputsize = 1024 * 64;	/* 64K buffer */
 
-	pthread_mutex_init(&ctx->read_mutex, NULL);
-	pthread_mutex_init(&ctx->write_mutex, NULL);
+	ctx->dict = 0;
+	ctx->dictsize = 0;
+	if (mtpipe_init(&ctx->pipe, &brotlimt_codec, ctx, threads, inputsize))
+		goto err_pipe;
 
-	INIT_LIST_HEAD(&ctx->writelist_free);
-	INIT_LIST_HEAD(&ctx->writelist_busy);
-	INIT_LIST_HEAD(&ctx->writelist_done);
+	return ctx;
 
-	ctx->cwork = (cwork_t *) malloc(sizeof(cwork_t) * threads);
-	if (!ctx->cwork)
-		goto err_cwork;
+ err_pipe:
+	free(ctx);
 
-	for (t = 0; t < threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		w->ctx = ctx;
-	}
+	return 0;
+}
 
-	return ctx;
+size_t BROTLIMT_setDCtxDictionary(BROTLIMT_DCtx * ctx, const void *dict,
+				  size_t size)
+{
+	if (!ctx)
+		return MT_ERROR(compressionParameter_unsupported);
 
- err_cwork:
-	free(ctx);
+#ifdef BROTLIMT_DICT
+	free(ctx->dict);
+	ctx->dict = 0;
+	ctx->dictsize = 0;
+	if (!size)
+		return 0;
+
+	/* the decoders refer to the data, so keep a copy */
+	ctx->dict = malloc(size);
+	if (!ctx->dict)
+		return MT_ERROR(memory_allocation);
+	memcpy(ctx->dict, dict, size);
+	ctx->dictsize = size;
 
 	return 0;
+#else
+	(void)dict;
+	(void)size;
+
+	return MT_ERROR(compressionParameter_unsupported);
+#endif
 }
 
 /**
@@ -154,303 +185,32 @@ static size_t mt_error(int rv)
 	return MT_ERROR(read_fail);
 }
 
-/**
- * pt_write - queue for decompressed output
- */
-static size_t pt_write(BROTLIMT_DCtx * ctx, struct writelist *wl)
-{
-	struct list_head *entry;
-
-	/* move the entry to the done list */
-	list_move(&wl->node, &ctx->writelist_done);
- again:
-	/* check, what can be written ... */
-	list_for_each(entry, &ctx->writelist_done) {
-		wl = list_entry(entry, struct writelist, node);
-		if (wl->frame == ctx->curframe) {
-			int rv = ctx->fn_write(ctx->arg_write, &wl->out);
-			if (rv != 0)
-				return mt_error(rv);
-			ctx->outsize += wl->out.size;
-			ctx->curframe++;
-			list_move(entry, &ctx->writelist_free);
-			goto again;
-		}
-	}
-
-	return 0;
-}
-
-/**
- * pt_read - read compressed output
- */
-static size_t pt_read(BROTLIMT_DCtx * ctx, BROTLIMT_Buffer * in, size_t * frame, size_t * uncompressed)
-{
-	unsigned char hdrbuf[16];
-	BROTLIMT_Buffer hdr;
-	int rv;
-
-	/* read skippable frame (12 or 16 bytes) */
-	pthread_mutex_lock(&ctx->read_mutex);
-
-	/* special case, first 4 bytes already read */
-	if (ctx->frames == 0) {
-		hdr.buf = hdrbuf + 4;
-		hdr.size = 12;
-		rv = ctx->fn_read(ctx->arg_read, &hdr);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		if (hdr.size != 12)
-			goto error_read;
-		hdr.buf = hdrbuf;
-	} else {
-		hdr.buf = hdrbuf;
-		hdr.size = 16;
-		rv = ctx->fn_read(ctx->arg_read, &hdr);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		/* eof reached ? */
-		if (hdr.size == 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			in->size = 0;
-			return 0;
-		}
-		if (hdr.size != 16)
-			goto error_read;
-		if (MEM_readLE32((unsigned char *)hdr.buf + 0) !=
-		    BROTLIMT_MAGIC_SKIPPABLE)
-			goto error_data;
-	}
-
-	/* check header data */
-	if (MEM_readLE32((unsigned char *)hdr.buf + 4) != 8)
-		goto error_data;
-	if (MEM_readLE16((unsigned char *)hdr.buf + 12) != BROTLIMT_MAGICNUMBER)
-		goto error_data;
-
-	/* get uncompressed size for output buffer */
-	{
-		U16 hintsize = MEM_readLE16((unsigned char *)hdr.buf + 14);
-		*uncompressed = hintsize << 16;
-	}
-
-	ctx->insize += 16;
-	/* read new inputsize */
-	{
-		size_t toRead = MEM_readLE32((unsigned char *)hdr.buf + 8);
-		if (in->allocated < toRead) {
-			/* need bigger input buffer */
-			if (in->allocated)
-				in->buf = realloc(in->buf, toRead);
-			else
-				in->buf = malloc(toRead);
-			if (!in->buf)
-				goto error_nomem;
-			in->allocated = toRead;
-		}
-
-		in->size = toRead;
-		rv = ctx->fn_read(ctx->arg_read, in);
-		/* generic read failure! */
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		/* needed more bytes! */
-		if (in->size != toRead)
-			goto error_data;
-
-		ctx->insize += in->size;
-	}
-	*frame = ctx->frames++;
-	pthread_mutex_unlock(&ctx->read_mutex);
-
-	/* done, no error */
-	return 0;
-
- error_data:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return MT_ERROR(data_error);
- error_read:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return MT_ERROR(read_fail);
- error_nomem:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return MT_ERROR(memory_allocation);
-}
-
-static void *pt_decompress(void *arg)
-{
-	cwork_t *w = (cwork_t *) arg;
-	BROTLIMT_Buffer *in = &w->in;
-	BROTLIMT_DCtx *ctx = w->ctx;
-	size_t result = 0;
-	struct writelist *wl;
-
-	for (;;) {
-		struct list_head *entry;
-		BROTLIMT_Buffer *out;
-		int rv;
-
-		/* allocate space for new output */
-		pthread_mutex_lock(&ctx->write_mutex);
-		if (!list_empty(&ctx->writelist_free)) {
-			/* take unused entry */
-			entry = list_first(&ctx->writelist_free);
-			wl = list_entry(entry, struct writelist, node);
-			list_move(entry, &ctx->writelist_busy);
-		} else {
-			/* allocate new one */
-			wl = (struct writelist *)
-			    malloc(sizeof(struct writelist));
-			if (!wl) {
-				result = MT_ERROR(memory_allocation);
-				goto error_unlock;
-			}
-			wl->out.buf = 0;
-			wl->out.size = 0;
-			wl->out.allocated = 0;
-			list_add(&wl->node, &ctx->writelist_busy);
-		}
-		pthread_mutex_unlock(&ctx->write_mutex);
-		out = &wl->out;
-
-		/* zero should not happen here! */
-		result = pt_read(ctx, in, &wl->frame, &wl->out.size);
-		if (BROTLIMT_isError(result)) {
-			list_move(&wl->node, &ctx->writelist_free);
-			goto error_lock;
-		}
-
-		if (in->size == 0)
-			break;
-
-		if (out->allocated < out->size) {
-			if (out->allocated)
-				out->buf = realloc(out->buf, out->size);
-			else
-				out->buf = malloc(out->size);
-			if (!out->buf) {
-				result = MT_ERROR(memory_allocation);
-				goto error_lock;
-			}
-			out->allocated = out->size;
-		}
-
-		rv =
-		    BrotliDecoderDecompress(in->size, in->buf, &out->size,
-					    out->buf);
-
-		if (rv != BROTLI_DECODER_RESULT_SUCCESS) {
-			result = MT_ERROR(frame_decompress);
-			goto error_lock;
-		}
-
-		/* write result */
-		pthread_mutex_lock(&ctx->write_mutex);
-		result = pt_write(ctx, wl);
-		if (BROTLIMT_isError(result))
-			goto error_unlock;
-		pthread_mutex_unlock(&ctx->write_mutex);
-	}
-
-	/* everything is okay */
-	pthread_mutex_lock(&ctx->write_mutex);
-	list_move(&wl->node, &ctx->writelist_free);
-	pthread_mutex_unlock(&ctx->write_mutex);
-	if (in->allocated)
-		free(in->buf);
-	return 0;
-
- error_lock:
-	pthread_mutex_lock(&ctx->write_mutex);
- error_unlock:
-	list_move(&wl->node, &ctx->writelist_free);
-	pthread_mutex_unlock(&ctx->write_mutex);
-	if (in->allocated)
-		free(in->buf);
-	return (void *)result;
-}
-
 size_t BROTLIMT_decompressDCtx(BROTLIMT_DCtx * ctx, BROTLIMT_RdWr_t * rdwr)
 {
 	unsigned char buf[4];
-	int t, rv;
-	cwork_t *w = &ctx->cwork[0];
-	BROTLIMT_Buffer *in = &w->in;
-	void *retval_of_thread = 0;
+	BROTLIMT_Buffer in;
+	int rv;
 
 	if (!ctx)
 		return MT_ERROR(compressionParameter_unsupported);
 
-	/* init reading and writing functions */
-	ctx->fn_read = rdwr->fn_read;
-	ctx->fn_write = rdwr->fn_write;
-	ctx->arg_read = rdwr->arg_read;
-	ctx->arg_write = rdwr->arg_write;
-
 	/* check for BROTLIMT_MAGIC_SKIPPABLE */
-	in->buf = buf;
-	in->size = 4;
-	rv = ctx->fn_read(ctx->arg_read, in);
+	in.buf = buf;
+	in.size = 4;
+	rv = rdwr->fn_read(rdwr->arg_read, &in);
 	if (rv != 0)
 		return mt_error(rv);
-	if (in->size != 4)
+	if (in.size != 4)
 		return MT_ERROR(data_error);
 
 	/* single threaded with unknown sizes */
 	if (MEM_readLE32(buf) != BROTLIMT_MAGIC_SKIPPABLE)
 		return MT_ERROR(data_error);
 
-	/* mark unused */
-	in->buf = 0;
-	in->size = 0;
-	in->allocated = 0;
-
-	/* single threaded, but with known sizes */
-	if (ctx->threads == 1) {
-		/* no pthread_create() needed! */
-		void *p = pt_decompress(w);
-		if (p)
-			return (size_t) p;
-		goto okay;
-	}
-
-	/* multi threaded */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		wt->in.buf = 0;
-		wt->in.size = 0;
-		wt->in.allocated = 0;
-		pthread_create(&wt->pthread, NULL, pt_decompress, wt);
-	}
-
-	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(wt->pthread, &p);
-		if (p)
-			retval_of_thread = p;
-	}
-
- okay:
-	/* clean up the buffers */
-	while (!list_empty(&ctx->writelist_free)) {
-		struct writelist *wl;
-		struct list_head *entry;
-		entry = list_first(&ctx->writelist_free);
-		wl = list_entry(entry, struct writelist, node);
-		free(wl->out.buf);
-		list_del(&wl->node);
-		free(wl);
-	}
-
-	return (size_t) retval_of_thread;
+	/* known sizes, the frames are decompressed by the workers */
+	return mtpipe_decompress(&ctx->pipe, (mtpipe_fn *) rdwr->fn_read,
+				 rdwr->arg_read, (mtpipe_fn *) rdwr->fn_write,
+				 rdwr->arg_write, buf, 4);
 }
 
 /* returns current uncompressed data size */
@@ -459,7 +219,7 @@ size_t BROTLIMT_GetInsizeDCtx(BROTLIMT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->insize;
+	return mt_atomic_get(&ctx->pipe.insize);
 }
 
 /* returns the current compressed data size */
@@ -468,7 +228,7 @@ size_t BROTLIMT_GetOutsizeDCtx(BROTLIMT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->outsize;
+	return mt_atomic_get(&ctx->pipe.outsize);
 }
 
 /* returns the current compressed frames */
@@ -477,7 +237,66 @@ size_t BROTLIMT_GetFramesDCtx(BROTLIMT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->curframe;
+	return mt_atomic_get(&ctx->pipe.curframe);
+}
+
+/* returns the counters of all workers together */
+void BROTLIMT_GetStatsDCtx(BROTLIMT_DCtx * ctx, mtstat_t * st)
+{
+	if (!ctx) {
+		memset(st, 0, sizeof(*st));
+		return;
+	}
+
+	mtpipe_stats(&ctx->pipe, st);
+}
+
+/* returns the number of workers, up to count of them are copied to st */
+int BROTLIMT_GetWorkerStatsDCtx(BROTLIMT_DCtx * ctx, mtstat_t * st, int count)
+{
+	if (!ctx)
+		return 0;
+
+	return mtpipe_worker_stats(&ctx->pipe, st, count);
+}
+
+/* register a progress callback, see mtprogress_init() */
+void BROTLIMT_setProgressDCtx(BROTLIMT_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes)
+{
+	if (!ctx)
+		return;
+
+	mtprogress_init(&ctx->pipe.progress, fn, arg, ms, bytes);
+}
+
+/* register a trace callback, see mttrace_fn in mtstat.h */
+void BROTLIMT_setTraceDCtx(BROTLIMT_DCtx * ctx, mttrace_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.trace = fn;
+	ctx->pipe.trace_arg = arg;
+}
+
+/* register an output callback, see mtoutput_fn in mtstat.h */
+void BROTLIMT_setOutputDCtx(BROTLIMT_DCtx * ctx, mtoutput_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.output = fn;
+	ctx->pipe.output_arg = arg;
+}
+
+/* run the workers as tasks of ex, or on threads again, when ex is zero */
+void BROTLIMT_setExecutorDCtx(BROTLIMT_DCtx * ctx, const mt_executor * ex)
+{
+	if (!ctx)
+		return;
+
+	mtpipe_executor(&ctx->pipe, ex);
 }
 
 void BROTLIMT_freeDCtx(BROTLIMT_DCtx * ctx)
@@ -485,9 +304,8 @@ void BROTLIMT_freeDCtx(BROTLIMT_DCtx * ctx)
 	if (!ctx)
 		return;
 
-	pthread_mutex_destroy(&ctx->read_mutex);
-	pthread_mutex_destroy(&ctx->write_mutex);
-	free(ctx->cwork);
+	mtpipe_free(&ctx->pipe);
+	free(ctx->dict);
 	free(ctx);
 	ctx = 0;
 
@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) 2024 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+#include "memmt.h"
+#include "crc32c.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define CRC32C_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+static U32 crc32c_table[8][256];
+static int crc32c_initdone = 0;
+static int crc32c_hassse42 = 0;
+
+void mt_crc32c_init(void)
+{
+	U32 b, i, r, poly32 = 0x82F63B78U;
+
+	if (crc32c_initdone)
+		return;
+
+	for (b = 0; b < 256; ++b) {
+		r = b;
+		for (i = 0; i < 8; ++i) {
+			if (r & 1)
+				r = (r >> 1) ^ poly32;
+			else
+				r >>= 1;
+		}
+		crc32c_table[0][b] = r;
+	}
+
+	/* table k gives the crc of a byte followed by k zero bytes */
+	for (i = 1; i < 8; ++i)
+		for (b = 0; b < 256; ++b) {
+			r = crc32c_table[i - 1][b];
+			crc32c_table[i][b] = (r >> 8) ^ crc32c_table[0][r & 0xFF];
+		}
+
+#ifdef CRC32C_SSE42
+	__builtin_cpu_init();
+	crc32c_hassse42 = __builtin_cpu_supports("sse4.2");
+#endif
+	crc32c_initdone = 1;
+}
+
+/* slicing-by-8, works on the inverted crc */
+static U32 crc32c_slice8(const unsigned char *buf, size_t size, U32 crc)
+{
+	const U32 (*t)[256] = (const U32 (*)[256])crc32c_table;
+
+	while (size >= 8) {
+		U32 a = MEM_readLE32(buf) ^ crc;
+		U32 b = MEM_readLE32(buf + 4);
+
+		crc = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF] ^
+		    t[5][(a >> 16) & 0xFF] ^ t[4][a >> 24] ^
+		    t[3][b & 0xFF] ^ t[2][(b >> 8) & 0xFF] ^
+		    t[1][(b >> 16) & 0xFF] ^ t[0][b >> 24];
+
+		buf += 8;
+		size -= 8;
+	}
+
+	while (size != 0) {
+		crc = t[0][*buf++ ^ (crc & 0xFF)] ^ (crc >> 8);
+		--size;
+	}
+
+	return crc;
+}
+
+#ifdef CRC32C_SSE42
+/* the crc32 instruction, 8 bytes per step on 64 bit */
+__attribute__((target("sse4.2")))
+static U32 crc32c_sse42(const unsigned char *buf, size_t size, U32 crc)
+{
+#if defined(__x86_64__)
+	U64 crc64 = crc;
+
+	while (size >= 8) {
+		crc64 = _mm_crc32_u64(crc64, MEM_readLE64(buf));
+		buf += 8;
+		size -= 8;
+	}
+	crc = (U32)crc64;
+#endif
+
+	while (size >= 4) {
+		crc = _mm_crc32_u32(crc, MEM_readLE32(buf));
+		buf += 4;
+		size -= 4;
+	}
+
+	while (size != 0) {
+		crc = _mm_crc32_u8(crc, *buf++);
+		--size;
+	}
+
+	return crc;
+}
+#endif
+
+unsigned int mt_crc32c(const void *buf, size_t size, unsigned int crc)
+{
+	if (unlikely(!crc32c_initdone))
+		mt_crc32c_init();
+
+	crc = ~crc;
+
+#ifdef CRC32C_SSE42
+	if (crc32c_hassse42)
+		return ~crc32c_sse42((const unsigned char *)buf, size, crc);
+#endif
+
+	return ~crc32c_slice8((const unsigned char *)buf, size, crc);
+}
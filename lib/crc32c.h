@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) 2024 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/**
+ * mt_crc32c() - crc32c (Castagnoli, like iSCSI) of buf, continuing from crc
+ *
+ * Uses the crc32 instruction of SSE4.2 when the cpu supports it,
+ * slicing-by-8 tables otherwise. The implementation is selected on the
+ * first call, call mt_crc32c_init() before starting threads.
+ */
+extern unsigned int mt_crc32c(const void *buf, size_t size, unsigned int crc);
+extern void mt_crc32c_init(void);
+
+/* the masked crc of the snappy framing format */
+#define MT_CRC32C_MASK(crc) \
+	((unsigned int)(((crc) >> 15) | ((crc) << 17)) + 0xa282ead8U)
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* CRC32C_H */
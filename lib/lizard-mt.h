@@ -23,6 +23,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>   /* size_t */
+#include "mtstat.h"   /* mtstat_t */
 
 /* current maximum the library will accept */
 #define LIZARDMT_THREAD_MAX 128
@@ -76,6 +77,8 @@ typedef struct {
  * - just write some wrapper on your own
  * - a sample is given in 7-Zip ZS or lizardmt.c
  * - the function should return -1 on error and zero on success
+ * - at compression, fn_read may return 1 instead of zero, when no more
+ *   input is ready and the next read would block, like live streams
  * - the read or written bytes will go to in->size or out->size
  */
 typedef int (fn_read) (void *args, LIZARDMT_Buffer * in);
@@ -117,6 +120,12 @@ size_t LIZARDMT_compressCCtx(LIZARDMT_CCtx * ctx, LIZARDMT_RdWr_t * rdwr);
 size_t LIZARDMT_GetFramesCCtx(LIZARDMT_CCtx * ctx);
 size_t LIZARDMT_GetInsizeCCtx(LIZARDMT_CCtx * ctx);
 size_t LIZARDMT_GetOutsizeCCtx(LIZARDMT_CCtx * ctx);
+void LIZARDMT_GetStatsCCtx(LIZARDMT_CCtx * ctx, mtstat_t * st);
+int LIZARDMT_GetWorkerStatsCCtx(LIZARDMT_CCtx * ctx, mtstat_t * st, int count);
+void LIZARDMT_setProgressCCtx(LIZARDMT_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void LIZARDMT_setTraceCCtx(LIZARDMT_CCtx * ctx, mttrace_fn * fn, void *arg);
+void LIZARDMT_setExecutorCCtx(LIZARDMT_CCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
@@ -151,6 +160,13 @@ size_t LIZARDMT_decompressDCtx(LIZARDMT_DCtx * ctx, LIZARDMT_RdWr_t * rdwr);
 size_t LIZARDMT_GetFramesDCtx(LIZARDMT_DCtx * ctx);
 size_t LIZARDMT_GetInsizeDCtx(LIZARDMT_DCtx * ctx);
 size_t LIZARDMT_GetOutsizeDCtx(LIZARDMT_DCtx * ctx);
+void LIZARDMT_GetStatsDCtx(LIZARDMT_DCtx * ctx, mtstat_t * st);
+int LIZARDMT_GetWorkerStatsDCtx(LIZARDMT_DCtx * ctx, mtstat_t * st, int count);
+void LIZARDMT_setProgressDCtx(LIZARDMT_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void LIZARDMT_setTraceDCtx(LIZARDMT_DCtx * ctx, mttrace_fn * fn, void *arg);
+void LIZARDMT_setOutputDCtx(LIZARDMT_DCtx * ctx, mtoutput_fn * fn, void *arg);
+void LIZARDMT_setExecutorDCtx(LIZARDMT_DCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
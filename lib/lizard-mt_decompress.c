@@ -18,8 +18,7 @@
 #include "lizard_frame.h"
 
 #include "memmt.h"
-#include "threading.h"
-#include "list.h"
+#include "mtpipe.h"
 #include "lizard-mt.h"
 
 /**
@@ -33,109 +32,99 @@
  *   2) release read mutex and do compression
  *   3) get write mutex and write result
  *   4) begin with step 1 again, until no input
+ * - the workers are run by mtpipe, this file only does the lizard part
  */
 
-/* worker for compression */
-typedef struct {
-	LIZARDMT_DCtx *ctx;
-	pthread_t pthread;
-	LIZARDMT_Buffer in;
-	LizardF_decompressionContext_t dctx;
-} cwork_t;
-
-struct writelist;
-struct writelist {
-	size_t frame;
-	LIZARDMT_Buffer out;
-	struct list_head node;
+struct LIZARDMT_DCtx_s {
+
+	/* one decompression context per worker */
+	LizardF_decompressionContext_t *dctx;
+
+	/* the frame pipeline, see mtpipe.h, its inputsize is used for
+	 * single stream only */
+	mtpipe pipe;
 };
 
-struct LIZARDMT_DCtx_s {
+/* **************************************
+ * Decompression
+ ****************************************/
 
-	/* threads: 1..LIZARDMT_THREAD_MAX */
-	int threads;
+static const size_t errors[] = MTPIPE_ERRORS(ERROR);
 
-	/* should be used for read from input */
-	size_t inputsize;
+static size_t lizardmt_decompress(void *arg, int worker, mtpipe_buf * out,
+			       const mtpipe_buf * in,
+			       const unsigned char *hdr)
+{
+	LIZARDMT_DCtx *ctx = (LIZARDMT_DCtx *) arg;
+	unsigned char *src = (unsigned char *)in->buf;
+	size_t size = in->size;
+	size_t result;
 
-	/* statistic */
-	size_t insize;
-	size_t outsize;
-	size_t curframe;
-	size_t frames;
+	(void)hdr;
+	if (size < 6)
+		return ERROR(data_error);
 
-	/* threading */
-	cwork_t *cwork;
+	/* get frame size for output buffer, minimal frames have none */
+	if (src[4] & 0x08)
+		out->size = (size_t) MEM_readLE64(src + 6);
+	else
+		out->size = 1024 * 64;
+	if (mtpipe_reserve(out, out->size))
+		return ERROR(memory_allocation);
 
-	/* reading input */
-	pthread_mutex_t read_mutex;
-	fn_read *fn_read;
-	void *arg_read;
+	result =
+	    LizardF_decompress(ctx->dctx[worker], out->buf, &out->size,
+			    in->buf, &size, 0);
+	if (LizardF_isError(result)) {
+		lizardmt_errcode = result;
+		return ERROR(compression_library);
+	}
 
-	/* writing output */
-	pthread_mutex_t write_mutex;
-	fn_write *fn_write;
-	void *arg_write;
+	if (result != 0)
+		return ERROR(frame_decompress);
 
-	/* lists for writing queue */
-	struct list_head writelist_free;
-	struct list_head writelist_busy;
-	struct list_head writelist_done;
-};
+	return 0;
+}
 
-/* **************************************
- * Decompression
- ****************************************/
+static const mtpipe_codec lizardmt_codec = {
+	12, LIZARDMT_isError, errors, 0, 0, lizardmt_decompress
+};
 
 LIZARDMT_DCtx *LIZARDMT_createDCtx(int threads, int inputsize)
 {
 	LIZARDMT_DCtx *ctx;
 	int t;
 
-	/* allocate ctx */
-	ctx = (LIZARDMT_DCtx *) malloc(sizeof(LIZARDMT_DCtx));
-	if (!ctx)
-		return 0;
-
 	/* check threads value */
 	if (threads < 1 || threads > LIZARDMT_THREAD_MAX)
 		return 0;
 
-	/* setup ctx */
-	ctx->threads = threads;
-	ctx->insize = 0;
-	ctx->outsize = 0;
-	ctx->frames = 0;
-	ctx->curframe = 0;
+	/* allocate ctx */
+	ctx = (LIZARDMT_DCtx *) malloc(sizeof(LIZARDMT_DCtx));
+	if (!ctx)
+		return 0;
 
 	/* will be used for single stream only */
-	if (inputsize)
-		ctx->inputsize = inputsize;
-	else
-		ctx->inputsize = 1024 * 64;	/* 64K buffer */
-
-	pthread_mutex_init(&ctx->read_mutex, NULL);
-	pthread_mutex_init(&ctx->write_mutex, NULL);
+	if (!inputsize)
+		inputsize = 1024 * 64;	/* 64K buffer */
 
-	INIT_LIST_HEAD(&ctx->writelist_free);
-	INIT_LIST_HEAD(&ctx->writelist_busy);
-	INIT_LIST_HEAD(&ctx->writelist_done);
+	if (mtpipe_init(&ctx->pipe, &lizardmt_codec, ctx, threads, inputsize))
+		goto err_pipe;
 
-	ctx->cwork = (cwork_t *) malloc(sizeof(cwork_t) * threads);
-	if (!ctx->cwork)
-		goto err_cwork;
+	ctx->dctx = (LizardF_decompressionContext_t *)
+	    malloc(sizeof(LizardF_decompressionContext_t) * threads);
+	if (!ctx->dctx)
+		goto err_dctx;
 
-	for (t = 0; t < threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		w->ctx = ctx;
-
-		/* setup thread work */
-		LizardF_createDecompressionContext(&w->dctx, LIZARDF_VERSION);
-	}
+	/* setup thread work */
+	for (t = 0; t < threads; t++)
+		LizardF_createDecompressionContext(&ctx->dctx[t], LIZARDF_VERSION);
 
 	return ctx;
 
- err_cwork:
+ err_dctx:
+	mtpipe_free(&ctx->pipe);
+ err_pipe:
 	free(ctx);
 
 	return 0;
@@ -159,256 +148,26 @@ static size_t mt_error(int rv)
 	return ERROR(read_fail);
 }
 
-/**
- * pt_write - queue for decompressed output
- */
-static size_t pt_write(LIZARDMT_DCtx * ctx, struct writelist *wl)
-{
-	struct list_head *entry;
-
-	/* move the entry to the done list */
-	list_move(&wl->node, &ctx->writelist_done);
- again:
-	/* check, what can be written ... */
-	list_for_each(entry, &ctx->writelist_done) {
-		wl = list_entry(entry, struct writelist, node);
-		if (wl->frame == ctx->curframe) {
-			int rv = ctx->fn_write(ctx->arg_write, &wl->out);
-			if (rv != 0)
-				return mt_error(rv);
-			ctx->outsize += wl->out.size;
-			ctx->curframe++;
-			list_move(entry, &ctx->writelist_free);
-			goto again;
-		}
-	}
-
-	return 0;
-}
-
-/**
- * pt_read - read compressed output
- */
-static size_t pt_read(LIZARDMT_DCtx * ctx, LIZARDMT_Buffer * in, size_t * frame)
-{
-	unsigned char hdrbuf[12];
-	LIZARDMT_Buffer hdr;
-	int rv;
-
-	/* read skippable frame (8 or 12 bytes) */
-	pthread_mutex_lock(&ctx->read_mutex);
-
-	/* special case, first 4 bytes already read */
-	if (ctx->frames == 0) {
-		hdr.buf = hdrbuf + 4;
-		hdr.size = 8;
-		rv = ctx->fn_read(ctx->arg_read, &hdr);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		if (hdr.size != 8)
-			goto error_read;
-		hdr.buf = hdrbuf;
-	} else {
-		hdr.buf = hdrbuf;
-		hdr.size = 12;
-		rv = ctx->fn_read(ctx->arg_read, &hdr);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		/* eof reached ? */
-		if (hdr.size == 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			in->size = 0;
-			return 0;
-		}
-		if (hdr.size != 12)
-			goto error_read;
-		if (MEM_readLE32((unsigned char *)hdr.buf + 0) !=
-		    LIZARDFMT_MAGIC_SKIPPABLE)
-			goto error_data;
-	}
-
-	/* check header data */
-	if (MEM_readLE32((unsigned char *)hdr.buf + 4) != 4)
-		goto error_data;
-
-	ctx->insize += 12;
-	/* read new inputsize */
-	{
-		size_t toRead = MEM_readLE32((unsigned char *)hdr.buf + 8);
-		if (in->allocated < toRead) {
-			/* need bigger input buffer */
-			if (in->allocated)
-				in->buf = realloc(in->buf, toRead);
-			else
-				in->buf = malloc(toRead);
-			if (!in->buf)
-				goto error_nomem;
-			in->allocated = toRead;
-		}
-
-		in->size = toRead;
-		rv = ctx->fn_read(ctx->arg_read, in);
-		/* generic read failure! */
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		/* needed more bytes! */
-		if (in->size != toRead)
-			goto error_data;
-
-		ctx->insize += in->size;
-	}
-	*frame = ctx->frames++;
-	pthread_mutex_unlock(&ctx->read_mutex);
-
-	/* done, no error */
-	return 0;
-
- error_data:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return ERROR(data_error);
- error_read:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return ERROR(read_fail);
- error_nomem:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return ERROR(memory_allocation);
-}
-
-static void *pt_decompress(void *arg)
-{
-	cwork_t *w = (cwork_t *) arg;
-	LIZARDMT_Buffer *in = &w->in;
-	LIZARDMT_DCtx *ctx = w->ctx;
-	size_t result = 0;
-	struct writelist *wl;
-
-	for (;;) {
-		struct list_head *entry;
-		LIZARDMT_Buffer *out;
-
-		/* allocate space for new output */
-		pthread_mutex_lock(&ctx->write_mutex);
-		if (!list_empty(&ctx->writelist_free)) {
-			/* take unused entry */
-			entry = list_first(&ctx->writelist_free);
-			wl = list_entry(entry, struct writelist, node);
-			list_move(entry, &ctx->writelist_busy);
-		} else {
-			/* allocate new one */
-			wl = (struct writelist *)
-			    malloc(sizeof(struct writelist));
-			if (!wl) {
-				result = ERROR(memory_allocation);
-				goto error_unlock;
-			}
-			wl->out.buf = 0;
-			wl->out.size = 0;
-			wl->out.allocated = 0;
-			list_add(&wl->node, &ctx->writelist_busy);
-		}
-		pthread_mutex_unlock(&ctx->write_mutex);
-		out = &wl->out;
-
-		/* zero should not happen here! */
-		result = pt_read(ctx, in, &wl->frame);
-		if (LIZARDMT_isError(result)) {
-			list_move(&wl->node, &ctx->writelist_free);
-			goto error_lock;
-		}
-
-		if (in->size == 0)
-			break;
-
-		/* mininmal frame */
-		if (in->size < 40 && ctx->frames == 1) {
-			out->size = 1024 * 64;
-		} else {
-			/* get frame size for output buffer */
-			unsigned char *src = (unsigned char *)in->buf + 6;
-			out->size = (size_t) MEM_readLE64(src);
-		}
-
-
-		if (out->allocated < out->size) {
-			if (out->allocated)
-				out->buf = realloc(out->buf, out->size);
-			else
-				out->buf = malloc(out->size);
-			if (!out->buf) {
-				result = ERROR(memory_allocation);
-				goto error_lock;
-			}
-			out->allocated = out->size;
-		}
-
-		result =
-		    LizardF_decompress(w->dctx, out->buf, &out->size,
-				    in->buf, &in->size, 0);
-
-		if (LizardF_isError(result)) {
-			lizardmt_errcode = result;
-			result = ERROR(compression_library);
-			goto error_lock;
-		}
-
-		if (result != 0) {
-			result = ERROR(frame_decompress);
-			goto error_lock;
-		}
-
-		/* write result */
-		pthread_mutex_lock(&ctx->write_mutex);
-		result = pt_write(ctx, wl);
-		if (LIZARDMT_isError(result))
-			goto error_unlock;
-		pthread_mutex_unlock(&ctx->write_mutex);
-	}
-
-	/* everything is okay */
-	pthread_mutex_lock(&ctx->write_mutex);
-	list_move(&wl->node, &ctx->writelist_free);
-	pthread_mutex_unlock(&ctx->write_mutex);
-	if (in->allocated)
-		free(in->buf);
-	return 0;
-
- error_lock:
-	pthread_mutex_lock(&ctx->write_mutex);
- error_unlock:
-	list_move(&wl->node, &ctx->writelist_free);
-	pthread_mutex_unlock(&ctx->write_mutex);
-	if (in->allocated)
-		free(in->buf);
-	return (void *)result;
-}
-
 /* single threaded */
-static size_t st_decompress(void *arg)
+static size_t st_decompress(LIZARDMT_DCtx * ctx, LIZARDMT_RdWr_t * rdwr,
+			    const void *magic)
 {
-	LIZARDMT_DCtx *ctx = (LIZARDMT_DCtx *) arg;
 	LizardF_errorCode_t nextToLoad = 0;
-	cwork_t *w = &ctx->cwork[0];
-	LIZARDMT_Buffer Out;
+	size_t inputsize = ctx->pipe.inputsize;
+	LIZARDMT_Buffer In, Out;
+	LIZARDMT_Buffer *in = &In;
 	LIZARDMT_Buffer *out = &Out;
-	LIZARDMT_Buffer *in = &w->in;
-	void *magic = in->buf;
 	size_t pos = 0;
 	int rv;
 
 	/* allocate space for input buffer */
-	in->size = ctx->inputsize;
+	in->size = inputsize;
 	in->buf = malloc(in->size);
 	if (!in->buf)
 		return ERROR(memory_allocation);
 
 	/* allocate space for output buffer */
-	out->size = ctx->inputsize;
+	out->size = inputsize;
 	out->buf = malloc(out->size);
 	if (!out->buf) {
 		free(in->buf);
@@ -420,7 +179,8 @@ static size_t st_decompress(void *arg)
 	memcpy(in->buf, magic, in->size);
 
 	nextToLoad =
-	    LizardF_decompress(w->dctx, out->buf, &pos, in->buf, &in->size, 0);
+	    LizardF_decompress(ctx->dctx[0], out->buf, &pos, in->buf,
+			    &in->size, 0);
 	if (LizardF_isError(nextToLoad)) {
 		free(in->buf);
 		free(out->buf);
@@ -428,12 +188,12 @@ static size_t st_decompress(void *arg)
 	}
 
 	for (; nextToLoad; pos = 0) {
-		if (nextToLoad > ctx->inputsize)
-			nextToLoad = ctx->inputsize;
+		if (nextToLoad > inputsize)
+			nextToLoad = inputsize;
 
 		/* read new input */
 		in->size = nextToLoad;
-		rv = ctx->fn_read(ctx->arg_read, in);
+		rv = rdwr->fn_read(rdwr->arg_read, in);
 		if (rv != 0) {
 			free(in->buf);
 			free(out->buf);
@@ -445,13 +205,14 @@ static size_t st_decompress(void *arg)
 			break;
 
 		/* still to read, or still to flush */
-		while ((pos < in->size) || (out->size == ctx->inputsize)) {
+		while ((pos < in->size) || (out->size == inputsize)) {
 			size_t remaining = in->size - pos;
-			out->size = ctx->inputsize;
+			out->size = inputsize;
 
 			/* decompress */
 			nextToLoad =
-			    LizardF_decompress(w->dctx, out->buf, &out->size,
+			    LizardF_decompress(ctx->dctx[0], out->buf,
+					    &out->size,
 					    (unsigned char *)in->buf + pos,
 					    &remaining, NULL);
 			if (LizardF_isError(nextToLoad)) {
@@ -462,7 +223,7 @@ static size_t st_decompress(void *arg)
 
 			/* have some output */
 			if (out->size) {
-				rv = ctx->fn_write(ctx->arg_write, out);
+				rv = rdwr->fn_write(rdwr->arg_write, out);
 				if (rv != 0) {
 					free(in->buf);
 					free(out->buf);
@@ -486,27 +247,19 @@ static size_t st_decompress(void *arg)
 size_t LIZARDMT_decompressDCtx(LIZARDMT_DCtx * ctx, LIZARDMT_RdWr_t * rdwr)
 {
 	unsigned char buf[4];
-	int t, rv;
-	cwork_t *w = &ctx->cwork[0];
-	LIZARDMT_Buffer *in = &w->in;
-	void *retval_of_thread = 0;
+	LIZARDMT_Buffer in;
+	int rv;
 
 	if (!ctx)
 		return ERROR(compressionParameter_unsupported);
 
-	/* init reading and writing functions */
-	ctx->fn_read = rdwr->fn_read;
-	ctx->fn_write = rdwr->fn_write;
-	ctx->arg_read = rdwr->arg_read;
-	ctx->arg_write = rdwr->arg_write;
-
 	/* check for LIZARDFMT_MAGIC_SKIPPABLE */
-	in->buf = buf;
-	in->size = 4;
-	rv = ctx->fn_read(ctx->arg_read, in);
+	in.buf = buf;
+	in.size = 4;
+	rv = rdwr->fn_read(rdwr->arg_read, &in);
 	if (rv != 0)
 		return mt_error(rv);
-	if (in->size != 4)
+	if (in.size != 4)
 		return ERROR(data_error);
 
 	/* single threaded with unknown sizes */
@@ -517,54 +270,13 @@ size_t LIZARDMT_decompressDCtx(LIZARDMT_DCtx * ctx, LIZARDMT_RdWr_t * rdwr)
 			return ERROR(data_error);
 
 		/* decompress single threaded */
-		return st_decompress(ctx);
-	}
-
-	/* mark unused */
-	in->buf = 0;
-	in->size = 0;
-	in->allocated = 0;
-
-	/* single threaded, but with known sizes */
-	if (ctx->threads == 1) {
-		/* no pthread_create() needed! */
-		void *p = pt_decompress(w);
-		if (p)
-			return (size_t) p;
-		goto okay;
-	}
-
-	/* multi threaded */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		wt->in.buf = 0;
-		wt->in.size = 0;
-		wt->in.allocated = 0;
-		pthread_create(&wt->pthread, NULL, pt_decompress, wt);
-	}
-
-	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(wt->pthread, &p);
-		if (p)
-			retval_of_thread = p;
-	}
-
- okay:
-	/* clean up the buffers */
-	while (!list_empty(&ctx->writelist_free)) {
-		struct writelist *wl;
-		struct list_head *entry;
-		entry = list_first(&ctx->writelist_free);
-		wl = list_entry(entry, struct writelist, node);
-		free(wl->out.buf);
-		list_del(&wl->node);
-		free(wl);
+		return st_decompress(ctx, rdwr, buf);
 	}
 
-	return (size_t) retval_of_thread;
+	/* known sizes, the frames are decompressed by the workers */
+	return mtpipe_decompress(&ctx->pipe, (mtpipe_fn *) rdwr->fn_read,
+				 rdwr->arg_read, (mtpipe_fn *) rdwr->fn_write,
+				 rdwr->arg_write, buf, 4);
 }
 
 /* returns current uncompressed data size */
@@ -573,7 +285,7 @@ size_t LIZARDMT_GetInsizeDCtx(LIZARDMT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->insize;
+	return mt_atomic_get(&ctx->pipe.insize);
 }
 
 /* returns the current compressed data size */
@@ -582,7 +294,7 @@ size_t LIZARDMT_GetOutsizeDCtx(LIZARDMT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->outsize;
+	return mt_atomic_get(&ctx->pipe.outsize);
 }
 
 /* returns the current compressed frames */
@@ -591,7 +303,66 @@ size_t LIZARDMT_GetFramesDCtx(LIZARDMT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->curframe;
+	return mt_atomic_get(&ctx->pipe.curframe);
+}
+
+/* returns the counters of all workers together */
+void LIZARDMT_GetStatsDCtx(LIZARDMT_DCtx * ctx, mtstat_t * st)
+{
+	if (!ctx) {
+		memset(st, 0, sizeof(*st));
+		return;
+	}
+
+	mtpipe_stats(&ctx->pipe, st);
+}
+
+/* returns the number of workers, up to count of them are copied to st */
+int LIZARDMT_GetWorkerStatsDCtx(LIZARDMT_DCtx * ctx, mtstat_t * st, int count)
+{
+	if (!ctx)
+		return 0;
+
+	return mtpipe_worker_stats(&ctx->pipe, st, count);
+}
+
+/* register a progress callback, see mtprogress_init() */
+void LIZARDMT_setProgressDCtx(LIZARDMT_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes)
+{
+	if (!ctx)
+		return;
+
+	mtprogress_init(&ctx->pipe.progress, fn, arg, ms, bytes);
+}
+
+/* register a trace callback, see mttrace_fn in mtstat.h */
+void LIZARDMT_setTraceDCtx(LIZARDMT_DCtx * ctx, mttrace_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.trace = fn;
+	ctx->pipe.trace_arg = arg;
+}
+
+/* register an output callback, see mtoutput_fn in mtstat.h */
+void LIZARDMT_setOutputDCtx(LIZARDMT_DCtx * ctx, mtoutput_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.output = fn;
+	ctx->pipe.output_arg = arg;
+}
+
+/* run the workers as tasks of ex, or on threads again, when ex is zero */
+void LIZARDMT_setExecutorDCtx(LIZARDMT_DCtx * ctx, const mt_executor * ex)
+{
+	if (!ctx)
+		return;
+
+	mtpipe_executor(&ctx->pipe, ex);
 }
 
 void LIZARDMT_freeDCtx(LIZARDMT_DCtx * ctx)
@@ -601,14 +372,11 @@ void LIZARDMT_freeDCtx(LIZARDMT_DCtx * ctx)
 	if (!ctx)
 		return;
 
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		LizardF_freeDecompressionContext(w->dctx);
-	}
+	for (t = 0; t < ctx->pipe.threads; t++)
+		LizardF_freeDecompressionContext(ctx->dctx[t]);
 
-	pthread_mutex_destroy(&ctx->read_mutex);
-	pthread_mutex_destroy(&ctx->write_mutex);
-	free(ctx->cwork);
+	mtpipe_free(&ctx->pipe);
+	free(ctx->dctx);
 	free(ctx);
 	ctx = 0;
 
@@ -23,6 +23,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>   /* size_t */
+#include "mtstat.h"   /* mtstat_t */
 
 /* current maximum the library will accept */
 #define LZ4MT_THREAD_MAX 128
@@ -31,6 +32,13 @@ extern "C" {
 
 #define LZ4FMT_MAGICNUMBER     0x184D2204U
 #define LZ4FMT_MAGIC_SKIPPABLE 0x184D2A50U
+#define LZ4FMT_MAGIC_LINKED    0x184D2A51U /* skippable too, see 1b) */
+
+/* bytes of the previous input, which a linked frame may refer to */
+#define LZ4FMT_HISTORY (64 * 1024)
+
+/* max. block size of the frames of LZ4MT_p_blocks, BD = 7 */
+#define LZ4FMT_BLOCKSIZE (4 * 1024 * 1024)
 
 /* **************************************
  * Error Handling
@@ -76,11 +84,19 @@ typedef struct {
  * - just write some wrapper on your own
  * - a sample is given in 7-Zip ZS or lz4mt.c
  * - the function should return -1 on error and zero on success
+ * - at compression, fn_read may return 1 instead of zero, when no more
+ *   input is ready and the next read would block, like live streams
  * - the read or written bytes will go to in->size or out->size
  */
 typedef int (fn_read) (void *args, LZ4MT_Buffer * in);
 typedef int (fn_write) (void *args, LZ4MT_Buffer * out);
 
+/**
+ * skipping function, used for listing only
+ * - jump over the next size bytes of the input
+ */
+typedef int (fn_skip) (void *args, size_t size);
+
 typedef struct {
 	fn_read *fn_read;
 	void *arg_read;
@@ -105,6 +121,25 @@ typedef struct LZ4MT_CCtx_s LZ4MT_CCtx;
  */
 LZ4MT_CCtx *LZ4MT_createCCtx(int threads, int level, int inputsize);
 
+/**
+ * 1b) change some setting of the encoder, before 2)
+ * - return zero or an error code
+ *
+ * LZ4MT_p_linked: 1 = each frame uses the last LZ4FMT_HISTORY bytes of
+ *   the input before it as dictionary, the frames get the skippable
+ *   magic LZ4FMT_MAGIC_LINKED and are decompressed in one thread
+ * LZ4MT_p_blocks: 1 = write one standard lz4 frame of independent blocks,
+ *   with block checksums, instead of the skippable frames, the lz4 tool
+ *   reads it, LZ4MT_p_linked is ignored then
+ */
+typedef enum {
+	LZ4MT_p_linked,
+	LZ4MT_p_blocks
+} LZ4MT_cParameter;
+
+size_t LZ4MT_setCCtxParameter(LZ4MT_CCtx * ctx, LZ4MT_cParameter param,
+			      int value);
+
 /**
  * 2) threaded compression
  * - errorcheck via 
@@ -117,6 +152,12 @@ size_t LZ4MT_compressCCtx(LZ4MT_CCtx * ctx, LZ4MT_RdWr_t * rdwr);
 size_t LZ4MT_GetFramesCCtx(LZ4MT_CCtx * ctx);
 size_t LZ4MT_GetInsizeCCtx(LZ4MT_CCtx * ctx);
 size_t LZ4MT_GetOutsizeCCtx(LZ4MT_CCtx * ctx);
+void LZ4MT_GetStatsCCtx(LZ4MT_CCtx * ctx, mtstat_t * st);
+int LZ4MT_GetWorkerStatsCCtx(LZ4MT_CCtx * ctx, mtstat_t * st, int count);
+void LZ4MT_setProgressCCtx(LZ4MT_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void LZ4MT_setTraceCCtx(LZ4MT_CCtx * ctx, mttrace_fn * fn, void *arg);
+void LZ4MT_setExecutorCCtx(LZ4MT_CCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
@@ -145,12 +186,28 @@ LZ4MT_DCtx *LZ4MT_createDCtx(int threads, int inputsize);
  */
 size_t LZ4MT_decompressDCtx(LZ4MT_DCtx * ctx, LZ4MT_RdWr_t * rdwr);
 
+/**
+ * 2b) get the sizes, without decompression
+ * - reads only the frame headers and skips the rest via fn_skip
+ * - frames without content size return an error, the caller should
+ *   rewind the input and use LZ4MT_decompressDCtx() then
+ */
+size_t LZ4MT_listDCtx(LZ4MT_DCtx * ctx, LZ4MT_RdWr_t * rdwr,
+		      fn_skip * fn_skip);
+
 /**
  * 3) get some statistic
  */
 size_t LZ4MT_GetFramesDCtx(LZ4MT_DCtx * ctx);
 size_t LZ4MT_GetInsizeDCtx(LZ4MT_DCtx * ctx);
 size_t LZ4MT_GetOutsizeDCtx(LZ4MT_DCtx * ctx);
+void LZ4MT_GetStatsDCtx(LZ4MT_DCtx * ctx, mtstat_t * st);
+int LZ4MT_GetWorkerStatsDCtx(LZ4MT_DCtx * ctx, mtstat_t * st, int count);
+void LZ4MT_setProgressDCtx(LZ4MT_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void LZ4MT_setTraceDCtx(LZ4MT_DCtx * ctx, mttrace_fn * fn, void *arg);
+void LZ4MT_setOutputDCtx(LZ4MT_DCtx * ctx, mtoutput_fn * fn, void *arg);
+void LZ4MT_setExecutorDCtx(LZ4MT_DCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
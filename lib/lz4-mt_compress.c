@@ -15,11 +15,15 @@
 #include <string.h>
 
 #define LZ4F_DISABLE_OBSOLETE_ENUMS
+#define LZ4F_STATIC_LINKING_ONLY
 #include "lz4frame.h"
+#include "lz4.h"
+#include "lz4hc.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
 
 #include "memmt.h"
-#include "threading.h"
-#include "list.h"
+#include "mtpipe.h"
 #include "lz4-mt.h"
 
 /**
@@ -33,323 +37,367 @@
  *   2) release read mutex and do compression
  *   3) get write mutex and write result
  *   4) begin with step 1 again, until no input
+ * - the workers are run by mtpipe, this file only does the lz4 part
  */
 
-/* worker for compression */
-typedef struct {
-	LZ4MT_CCtx *ctx;
-	LZ4F_preferences_t zpref;
-	pthread_t pthread;
-} cwork_t;
-
-struct writelist;
-struct writelist {
-	size_t frame;
-	LZ4MT_Buffer out;
-	struct list_head node;
-};
-
 struct LZ4MT_CCtx_s {
 
 	/* level: 1..22 */
 	int level;
 
-	/* threads: 1..LZ4MT_THREAD_MAX */
-	int threads;
-
-	/* should be used for read from input */
-	int inputsize;
-
-	/* statistic */
-	size_t insize;
-	size_t outsize;
-	size_t curframe;
-	size_t frames;
+	/* preferences, the same for all workers */
+	LZ4F_preferences_t zpref;
 
-	/* threading */
-	cwork_t *cwork;
+	/* one compression context per worker, reused for each frame */
+	LZ4F_cctx **cctx;
 
-	/* reading input */
-	pthread_mutex_t read_mutex;
-	fn_read *fn_read;
-	void *arg_read;
+	/* LZ4MT_p_linked */
+	int linked;
 
-	/* writing output */
-	pthread_mutex_t write_mutex;
-	fn_write *fn_write;
-	void *arg_write;
+	/* LZ4MT_p_blocks, with the block compression state of each worker */
+	int blocks;
+	void **state;
 
-	/* lists for writing queue */
-	struct list_head writelist_free;
-	struct list_head writelist_busy;
-	struct list_head writelist_done;
+	/* the frame pipeline, see mtpipe.h */
+	mtpipe pipe;
 };
 
 /* **************************************
  * Compression
  ****************************************/
 
-LZ4MT_CCtx *LZ4MT_createCCtx(int threads, int level, int inputsize)
+static const size_t errors[] = MTPIPE_ERRORS(ERROR);
+
+static size_t lz4mt_bound(void *arg, size_t insize)
 {
-	LZ4MT_CCtx *ctx;
-	int t;
+	LZ4MT_CCtx *ctx = (LZ4MT_CCtx *) arg;
 
-	/* allocate ctx */
-	ctx = (LZ4MT_CCtx *) malloc(sizeof(LZ4MT_CCtx));
-	if (!ctx)
-		return 0;
+	/* block size and checksum of each block */
+	if (ctx->blocks)
+		return LZ4_compressBound((int)insize) +
+		    (insize / LZ4FMT_BLOCKSIZE + 1) * 8;
 
-	/* check threads value */
-	if (threads < 1 || threads > LZ4MT_THREAD_MAX)
-		return 0;
+	return LZ4F_compressFrameBound(insize, &ctx->zpref) + 12;
+}
 
-	/* check level */
-	if (level < LZ4MT_LEVEL_MIN || level > LZ4MT_LEVEL_MAX)
-		return 0;
+/* the frame header of LZ4MT_p_blocks: magic, FLG, BD, HC */
+#define LZ4F_FLG_BLOCKS 0x70	/* version 01, independent, block checksum */
+#define LZ4F_BD_BLOCKS  0x70	/* 4 MiB blocks */
+#define LZ4F_HDR_BLOCKS 7
 
-	/* calculate chunksize for one thread */
-	if (inputsize)
-		ctx->inputsize = inputsize;
-	else
-		ctx->inputsize = 1024 * 1024 * 4;
+/* the frame header of LZ4MT_p_linked: magic, FLG, BD, content size, HC */
+#define LZ4F_FLG_LINKED 0x4C	/* version 01, linked, size, content checksum */
+#define LZ4F_BD_LINKED  0x40	/* 64 KiB blocks */
+#define LZ4F_HDR_LINKED 15
+#define LZ4F_BLOCK_LINKED (64 * 1024)
 
-	/* setup ctx */
-	ctx->level = level;
-	ctx->threads = threads;
-	ctx->insize = 0;
-	ctx->outsize = 0;
-	ctx->frames = 0;
-	ctx->curframe = 0;
-
-	pthread_mutex_init(&ctx->read_mutex, NULL);
-	pthread_mutex_init(&ctx->write_mutex, NULL);
-
-	/* free -> busy -> out -> free -> ... */
-	INIT_LIST_HEAD(&ctx->writelist_free);	/* free, can be used */
-	INIT_LIST_HEAD(&ctx->writelist_busy);	/* busy */
-	INIT_LIST_HEAD(&ctx->writelist_done);	/* can be written */
-
-	ctx->cwork = (cwork_t *) malloc(sizeof(cwork_t) * threads);
-	if (!ctx->cwork)
-		goto err_cwork;
-
-	for (t = 0; t < threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		w->ctx = ctx;
-
-		/* setup preferences for that thread */
-		memset(&w->zpref, 0, sizeof(LZ4F_preferences_t));
-		w->zpref.compressionLevel = level;
-		w->zpref.frameInfo.blockMode = LZ4F_blockLinked;
-		w->zpref.frameInfo.contentSize = 1;
-		w->zpref.frameInfo.contentChecksumFlag =
-		    LZ4F_contentChecksumEnabled;
+/**
+ * the block compression state of the worker, allocated and initialized
+ * for the level on first use, reused for all frames
+ */
+static void *lz4mt_state(LZ4MT_CCtx * ctx, int worker)
+{
+	int ss = LZ4_sizeofState(), sshc = LZ4_sizeofStateHC();
 
-	}
+	if (ctx->state[worker])
+		return ctx->state[worker];
 
-	return ctx;
+	ctx->state[worker] = malloc(ss > sshc ? ss : sshc);
+	if (!ctx->state[worker])
+		return 0;
 
- err_cwork:
-	free(ctx);
+	if (ctx->level < 3)
+		LZ4_initStream(ctx->state[worker], ss);
+	else
+		LZ4_initStreamHC(ctx->state[worker], sshc);
 
-	return 0;
+	return ctx->state[worker];
 }
 
 /**
- * mt_error - return mt lib specific error code
+ * LZ4MT_p_blocks: the input becomes independent blocks of one frame, the
+ * frame header and the end mark are written by LZ4MT_compressCCtx()
  */
-static size_t mt_error(int rv)
+static size_t lz4mt_blocks(LZ4MT_CCtx * ctx, int worker, mtpipe_buf * out,
+			   const mtpipe_buf * in)
 {
-	switch (rv) {
-	case -1:
-		return ERROR(read_fail);
-	case -2:
-		return ERROR(canceled);
-	case -3:
+	const char *src = (const char *)in->buf;
+	unsigned char *dst = (unsigned char *)out->buf;
+	size_t pos, size;
+	int csize;
+
+	if (!lz4mt_state(ctx, worker))
 		return ERROR(memory_allocation);
+
+	out->size = 0;
+	for (pos = 0; pos < in->size; pos += size) {
+		unsigned char *blk = dst + out->size;
+
+		size = in->size - pos;
+		if (size > LZ4FMT_BLOCKSIZE)
+			size = LZ4FMT_BLOCKSIZE;
+
+		/* zero, when the block doesn't get smaller */
+		if (ctx->level < 3)
+			csize = LZ4_compress_fast_extState(ctx->state[worker],
+							   src + pos,
+							   (char *)blk + 4,
+							   (int)size,
+							   (int)size - 1, 1);
+		else
+			csize = LZ4_compress_HC_extStateHC(ctx->state[worker],
+							   src + pos,
+							   (char *)blk + 4,
+							   (int)size,
+							   (int)size - 1,
+							   ctx->level);
+		if (csize <= 0) {
+			memcpy(blk + 4, src + pos, size);
+			csize = (int)size;
+			MEM_writeLE32(blk, (U32) csize | 0x80000000U);
+		} else
+			MEM_writeLE32(blk, (U32) csize);
+
+		MEM_writeLE32(blk + 4 + csize, XXH32(blk + 4, csize, 0));
+		out->size += 8 + (size_t)csize;
 	}
 
-	return ERROR(read_fail);
+	return 0;
 }
 
 /**
- * pt_write - queue for compressed output
+ * LZ4MT_p_linked: one standard frame of linked 64 KiB blocks, as
+ * LZ4F_compressFrame() writes it, the history before the frame is loaded
+ * into the stream of the worker as dictionary, returns the frame size
  */
-static size_t pt_write(LZ4MT_CCtx * ctx, struct writelist *wl)
+static size_t lz4mt_linked(LZ4MT_CCtx * ctx, void *state, unsigned char *dst,
+			   const mtpipe_buf * in, const mtpipe_buf * hist)
 {
-	struct list_head *entry;
-
-	/* move the entry to the done list */
-	list_move(&wl->node, &ctx->writelist_done);
-
-	/* the entry isn't the currently needed, return...  */
-	if (wl->frame != ctx->curframe)
-		return 0;
+	const char *src = (const char *)in->buf;
+	size_t pos, size, len;
+	int csize;
+
+	if (ctx->level < 3) {
+		if (hist->size)
+			LZ4_loadDict(state, hist->buf, (int)hist->size);
+		else
+			LZ4_resetStream_fast(state);
+	} else {
+		LZ4_resetStreamHC_fast(state, ctx->level);
+		if (hist->size)
+			LZ4_loadDictHC(state, hist->buf, (int)hist->size);
+	}
 
- again:
-	/* check, what can be written ... */
-	list_for_each(entry, &ctx->writelist_done) {
-		wl = list_entry(entry, struct writelist, node);
-		if (wl->frame == ctx->curframe) {
-			int rv = ctx->fn_write(ctx->arg_write, &wl->out);
-			if (rv != 0)
-				return mt_error(rv);
-			ctx->outsize += wl->out.size;
-			ctx->curframe++;
-			list_move(entry, &ctx->writelist_free);
-			goto again;
-		}
+	MEM_writeLE32(dst, LZ4FMT_MAGICNUMBER);
+	dst[4] = LZ4F_FLG_LINKED;
+	dst[5] = LZ4F_BD_LINKED;
+	MEM_writeLE64(dst + 6, (U64) in->size);
+	dst[14] = (unsigned char)(XXH32(dst + 4, 10, 0) >> 8);
+	len = LZ4F_HDR_LINKED;
+
+	for (pos = 0; pos < in->size; pos += size) {
+		unsigned char *blk = dst + len;
+
+		size = in->size - pos;
+		if (size > LZ4F_BLOCK_LINKED)
+			size = LZ4F_BLOCK_LINKED;
+
+		/* zero, when the block doesn't get smaller */
+		if (ctx->level < 3)
+			csize = LZ4_compress_fast_continue(state, src + pos,
+							   (char *)blk + 4,
+							   (int)size,
+							   (int)size - 1, 1);
+		else
+			csize = LZ4_compress_HC_continue(state, src + pos,
+							 (char *)blk + 4,
+							 (int)size,
+							 (int)size - 1);
+		if (csize <= 0) {
+			memcpy(blk + 4, src + pos, size);
+			csize = (int)size;
+			MEM_writeLE32(blk, (U32) csize | 0x80000000U);
+		} else
+			MEM_writeLE32(blk, (U32) csize);
+
+		len += 4 + (size_t)csize;
 	}
 
-	return 0;
+	/* end mark and content checksum */
+	MEM_writeLE32(dst + len, 0);
+	MEM_writeLE32(dst + len + 4, XXH32(src, in->size, 0));
+
+	return len + 8;
 }
 
-static void *pt_compress(void *arg)
+static size_t lz4mt_compress(void *arg, int worker, mtpipe_buf * out,
+			     const mtpipe_buf * in)
 {
-	cwork_t *w = (cwork_t *) arg;
-	LZ4MT_CCtx *ctx = w->ctx;
+	LZ4MT_CCtx *ctx = (LZ4MT_CCtx *) arg;
+	unsigned char *dst = (unsigned char *)out->buf + 12;
 	size_t result;
-	LZ4MT_Buffer in;
-
-	/* inbuf is constant */
-	in.size = ctx->inputsize;
-	in.buf = malloc(in.size);
-	if (!in.buf)
-		return (void *)ERROR(memory_allocation);
-
-	for (;;) {
-		struct list_head *entry;
-		struct writelist *wl;
-		int rv;
-
-		/* allocate space for new output */
-		pthread_mutex_lock(&ctx->write_mutex);
-		if (!list_empty(&ctx->writelist_free)) {
-			/* take unused entry */
-			entry = list_first(&ctx->writelist_free);
-			wl = list_entry(entry, struct writelist, node);
-			wl->out.size =
-			    LZ4F_compressFrameBound(ctx->inputsize,
-						    &w->zpref) + 12;
-			list_move(entry, &ctx->writelist_busy);
-		} else {
-			/* allocate new one */
-			wl = (struct writelist *)
-			    malloc(sizeof(struct writelist));
-			if (!wl) {
-				pthread_mutex_unlock(&ctx->write_mutex);
-				return (void *)ERROR(memory_allocation);
-			}
-			wl->out.size =
-			    LZ4F_compressFrameBound(ctx->inputsize,
-						    &w->zpref) + 12;;
-			wl->out.buf = malloc(wl->out.size);
-			if (!wl->out.buf) {
-				pthread_mutex_unlock(&ctx->write_mutex);
-				return (void *)ERROR(memory_allocation);
-			}
-			list_add(&wl->node, &ctx->writelist_busy);
-		}
-		pthread_mutex_unlock(&ctx->write_mutex);
-
-		/* read new input */
-		pthread_mutex_lock(&ctx->read_mutex);
-		in.size = ctx->inputsize;
-		rv = ctx->fn_read(ctx->arg_read, &in);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return (void *)mt_error(rv);
-		}
-		
-		/* eof */
-		if (in.size == 0 && ctx->frames > 0) {
-			free(in.buf);
-			pthread_mutex_unlock(&ctx->read_mutex);
-
-			pthread_mutex_lock(&ctx->write_mutex);
-			list_move(&wl->node, &ctx->writelist_free);
-			pthread_mutex_unlock(&ctx->write_mutex);
 
-			goto okay;
-		}
-		ctx->insize += in.size;
-		wl->frame = ctx->frames++;
-		pthread_mutex_unlock(&ctx->read_mutex);
-
-		/* compress whole frame */
-		result =
-		    LZ4F_compressFrame((unsigned char *)wl->out.buf + 12,
-				       wl->out.size - 12, in.buf, in.size,
-				       &w->zpref);
+	if (ctx->blocks)
+		return lz4mt_blocks(ctx, worker, out, in);
+
+	/* linked: the input before this frame is the dictionary */
+	if (ctx->linked) {
+		void *state = lz4mt_state(ctx, worker);
+
+		if (!state)
+			return ERROR(memory_allocation);
+		result = lz4mt_linked(ctx, state, dst, in,
+				      &ctx->pipe.workers[worker].hist);
+	} else {
+		result = LZ4F_compressFrame_usingCDict(ctx->cctx[worker], dst,
+						       out->allocated - 12,
+						       in->buf, in->size, 0,
+						       &ctx->zpref);
 		if (LZ4F_isError(result)) {
-			pthread_mutex_lock(&ctx->write_mutex);
-			list_move(&wl->node, &ctx->writelist_free);
-			pthread_mutex_unlock(&ctx->write_mutex);
 			/* user can lookup that code */
 			lz4mt_errcode = result;
-			return (void *)ERROR(compression_library);
+			return ERROR(compression_library);
 		}
-
-		/* write skippable frame */
-		MEM_writeLE32((unsigned char *)wl->out.buf + 0,
-			      LZ4FMT_MAGIC_SKIPPABLE);
-		MEM_writeLE32((unsigned char *)wl->out.buf + 4, 4);
-		MEM_writeLE32((unsigned char *)wl->out.buf + 8, (U32) result);
-		wl->out.size = result + 12;
-
-		/* write result */
-		pthread_mutex_lock(&ctx->write_mutex);
-		result = pt_write(ctx, wl);
-		pthread_mutex_unlock(&ctx->write_mutex);
-		if (LZ4MT_isError(result))
-			return (void *)result;
 	}
 
- okay:
+	/* write skippable frame */
+	MEM_writeLE32((unsigned char *)out->buf + 0, ctx->linked ?
+		      LZ4FMT_MAGIC_LINKED : LZ4FMT_MAGIC_SKIPPABLE);
+	MEM_writeLE32((unsigned char *)out->buf + 4, 4);
+	MEM_writeLE32((unsigned char *)out->buf + 8, (U32) result);
+	out->size = result + 12;
+
 	return 0;
 }
 
-size_t LZ4MT_compressCCtx(LZ4MT_CCtx * ctx, LZ4MT_RdWr_t * rdwr)
+static const mtpipe_codec lz4mt_codec = {
+	12, LZ4MT_isError, errors, lz4mt_bound, lz4mt_compress, 0
+};
+
+LZ4MT_CCtx *LZ4MT_createCCtx(int threads, int level, int inputsize)
 {
+	LZ4MT_CCtx *ctx;
 	int t;
-	void *retval_of_thread = 0;
 
+	/* check threads value */
+	if (threads < 1 || threads > LZ4MT_THREAD_MAX)
+		return 0;
+
+	/* check level */
+	if (level < LZ4MT_LEVEL_MIN || level > LZ4MT_LEVEL_MAX)
+		return 0;
+
+	/* allocate ctx */
+	ctx = (LZ4MT_CCtx *) malloc(sizeof(LZ4MT_CCtx));
 	if (!ctx)
-		return ERROR(compressionParameter_unsupported);
+		return 0;
 
-	/* init reading and writing functions */
-	ctx->fn_read = rdwr->fn_read;
-	ctx->fn_write = rdwr->fn_write;
-	ctx->arg_read = rdwr->arg_read;
-	ctx->arg_write = rdwr->arg_write;
+	/* calculate chunksize for one thread */
+	if (!inputsize)
+		inputsize = 1024 * 1024 * 4;
 
-	/* start all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		pthread_create(&w->pthread, NULL, pt_compress, w);
-	}
+	/* setup ctx */
+	ctx->level = level;
+	ctx->linked = 0;
+	ctx->blocks = 0;
+	ctx->state = 0;
+	if (mtpipe_init(&ctx->pipe, &lz4mt_codec, ctx, threads, inputsize))
+		goto err_pipe;
+
+	ctx->cctx = (LZ4F_cctx **) calloc(threads, sizeof(LZ4F_cctx *));
+	ctx->state = (void **)calloc(threads, sizeof(void *));
+	if (!ctx->cctx || !ctx->state)
+		goto err_cctx;
+
+	for (t = 0; t < threads; t++)
+		if (LZ4F_isError(LZ4F_createCompressionContext(&ctx->cctx[t],
+							       LZ4F_VERSION)))
+			goto err_cctx;
+
+	/* setup preferences */
+	memset(&ctx->zpref, 0, sizeof(LZ4F_preferences_t));
+	ctx->zpref.compressionLevel = level;
+	ctx->zpref.frameInfo.blockMode = LZ4F_blockLinked;
+	ctx->zpref.frameInfo.contentSize = 1;
+	ctx->zpref.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+	return ctx;
+
+ err_cctx:
+	if (ctx->cctx)
+		for (t = 0; t < threads; t++)
+			LZ4F_freeCompressionContext(ctx->cctx[t]);
+	free(ctx->cctx);
+	free(ctx->state);
+	mtpipe_free(&ctx->pipe);
+ err_pipe:
+	free(ctx);
+
+	return 0;
+}
+
+size_t LZ4MT_setCCtxParameter(LZ4MT_CCtx * ctx, LZ4MT_cParameter param,
+			      int value)
+{
+	if (!ctx)
+		return ERROR(compressionParameter_unsupported);
 
-	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(w->pthread, &p);
-		if (p)
-			retval_of_thread = p;
+	switch (param) {
+	case LZ4MT_p_linked:
+		ctx->linked = value ? 1 : 0;
+		return 0;
+	case LZ4MT_p_blocks:
+		ctx->blocks = value ? 1 : 0;
+		return 0;
 	}
 
-	/* clean up lists */
-	while (!list_empty(&ctx->writelist_free)) {
-		struct writelist *wl;
-		struct list_head *entry;
-		entry = list_first(&ctx->writelist_free);
-		wl = list_entry(entry, struct writelist, node);
-		free(wl->out.buf);
-		list_del(&wl->node);
-		free(wl);
+	return ERROR(compressionParameter_unsupported);
+}
+
+size_t LZ4MT_compressCCtx(LZ4MT_CCtx * ctx, LZ4MT_RdWr_t * rdwr)
+{
+	unsigned char hdr[LZ4F_HDR_BLOCKS + 1];
+	LZ4MT_Buffer b;
+	size_t ret;
+
+	if (!ctx)
+		return ERROR(compressionParameter_unsupported);
+
+	if (!ctx->blocks) {
+		ctx->pipe.history = ctx->linked ? LZ4FMT_HISTORY : 0;
+		return mtpipe_compress(&ctx->pipe,
+				       (mtpipe_fn *) rdwr->fn_read,
+				       rdwr->arg_read,
+				       (mtpipe_fn *) rdwr->fn_write,
+				       rdwr->arg_write);
 	}
 
-	return (size_t) retval_of_thread;
+	/* LZ4MT_p_blocks: the workers write the blocks between these */
+	MEM_writeLE32(hdr, LZ4FMT_MAGICNUMBER);
+	hdr[4] = LZ4F_FLG_BLOCKS;
+	hdr[5] = LZ4F_BD_BLOCKS;
+	hdr[6] = (unsigned char)(XXH32(hdr + 4, 2, 0) >> 8);
+	b.buf = hdr;
+	b.size = LZ4F_HDR_BLOCKS;
+	if (rdwr->fn_write(rdwr->arg_write, &b))
+		return ERROR(write_fail);
+
+	ctx->pipe.history = 0;
+	ret = mtpipe_compress(&ctx->pipe, (mtpipe_fn *) rdwr->fn_read,
+			      rdwr->arg_read, (mtpipe_fn *) rdwr->fn_write,
+			      rdwr->arg_write);
+	if (LZ4MT_isError(ret))
+		return ret;
+
+	/* end mark */
+	MEM_writeLE32(hdr, 0);
+	b.buf = hdr;
+	b.size = 4;
+	if (rdwr->fn_write(rdwr->arg_write, &b))
+		return ERROR(write_fail);
+	mt_atomic_add(&ctx->pipe.outsize, LZ4F_HDR_BLOCKS + 4);
+
+	return 0;
 }
 
 /* returns current uncompressed data size */
@@ -358,7 +406,7 @@ size_t LZ4MT_GetInsizeCCtx(LZ4MT_CCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->insize;
+	return mt_atomic_get(&ctx->pipe.insize);
 }
 
 /* returns the current compressed data size */
@@ -367,7 +415,7 @@ size_t LZ4MT_GetOutsizeCCtx(LZ4MT_CCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->outsize;
+	return mt_atomic_get(&ctx->pipe.outsize);
 }
 
 /* returns the current compressed frames */
@@ -376,17 +424,72 @@ size_t LZ4MT_GetFramesCCtx(LZ4MT_CCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->curframe;
+	return mt_atomic_get(&ctx->pipe.curframe);
+}
+
+/* returns the counters of all workers together */
+void LZ4MT_GetStatsCCtx(LZ4MT_CCtx * ctx, mtstat_t * st)
+{
+	if (!ctx) {
+		memset(st, 0, sizeof(*st));
+		return;
+	}
+
+	mtpipe_stats(&ctx->pipe, st);
+}
+
+/* returns the number of workers, up to count of them are copied to st */
+int LZ4MT_GetWorkerStatsCCtx(LZ4MT_CCtx * ctx, mtstat_t * st, int count)
+{
+	if (!ctx)
+		return 0;
+
+	return mtpipe_worker_stats(&ctx->pipe, st, count);
+}
+
+/* register a progress callback, see mtprogress_init() */
+void LZ4MT_setProgressCCtx(LZ4MT_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes)
+{
+	if (!ctx)
+		return;
+
+	mtprogress_init(&ctx->pipe.progress, fn, arg, ms, bytes);
+}
+
+/* register a trace callback, see mttrace_fn in mtstat.h */
+void LZ4MT_setTraceCCtx(LZ4MT_CCtx * ctx, mttrace_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.trace = fn;
+	ctx->pipe.trace_arg = arg;
+}
+
+/* run the workers as tasks of ex, or on threads again, when ex is zero */
+void LZ4MT_setExecutorCCtx(LZ4MT_CCtx * ctx, const mt_executor * ex)
+{
+	if (!ctx)
+		return;
+
+	mtpipe_executor(&ctx->pipe, ex);
 }
 
 void LZ4MT_freeCCtx(LZ4MT_CCtx * ctx)
 {
+	int t;
+
 	if (!ctx)
 		return;
 
-	pthread_mutex_destroy(&ctx->read_mutex);
-	pthread_mutex_destroy(&ctx->write_mutex);
-	free(ctx->cwork);
+	for (t = 0; t < ctx->pipe.threads; t++) {
+		LZ4F_freeCompressionContext(ctx->cctx[t]);
+		free(ctx->state[t]);
+	}
+	free(ctx->cctx);
+	free(ctx->state);
+	mtpipe_free(&ctx->pipe);
 	free(ctx);
 	ctx = 0;
 
@@ -15,11 +15,14 @@
 #include <string.h>
 
 #define LZ4F_DISABLE_OBSOLETE_ENUMS
+#define LZ4F_STATIC_LINKING_ONLY
 #include "lz4frame.h"
+#include "lz4.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
 
 #include "memmt.h"
-#include "threading.h"
-#include "list.h"
+#include "mtpipe.h"
 #include "lz4-mt.h"
 
 /**
@@ -33,109 +36,240 @@
  *   2) release read mutex and do compression
  *   3) get write mutex and write result
  *   4) begin with step 1 again, until no input
+ * - the workers are run by mtpipe, this file only does the lz4 part
  */
 
-/* worker for compression */
+/**
+ * block parallel decompression of standard lz4 frames
+ *
+ * blk_read() turns the input into units for the pipeline, each with a
+ * skippable frame in front of it: one block of a frame with independent
+ * blocks, a whole frame with linked blocks or the end of a frame.
+ * blk_write() removes the tags of the output again and checks the
+ * content checksum in order.
+ */
 typedef struct {
-	LZ4MT_DCtx *ctx;
-	pthread_t pthread;
-	LZ4MT_Buffer in;
-	LZ4F_decompressionContext_t dctx;
-} cwork_t;
+	int on;			/* the pipeline runs on units of blk_read() */
+	LZ4MT_RdWr_t *rdwr;	/* the read and write functions of the caller */
+	size_t error;		/* of blk_read() or blk_write() */
+
+	/* reader side */
+	unsigned char magic[4];	/* read already by LZ4MT_decompressDCtx() */
+	int havemagic;
+	int inframe;		/* reading the blocks of a frame */
+	unsigned char flg;	/* FLG of that frame */
+	U32 blockmax;		/* and its max. block size */
+	unsigned char unit[12];	/* the unit header and block header */
+	size_t unitsize;
+	size_t pending;		/* size of the unit to read, zero: header */
+	mtpipe_buf frame;	/* a whole frame with linked blocks */
+	size_t insize;
 
-struct writelist;
-struct writelist {
-	size_t frame;
-	LZ4MT_Buffer out;
-	struct list_head node;
-};
+	/* writer side */
+	XXH32_state_t xxh;
+	size_t outsize;
+} blk_t;
+
+/* the unit types, first byte of each unit and of its output */
+#define BLK_BLOCK  'B'		/* one independent block */
+#define BLK_FRAME  'F'		/* a whole frame */
+#define BLK_END    'E'		/* end mark and content checksum */
+#define BLK_DATA   'D'		/* output, without content checksum */
+#define BLK_HASH   'H'		/* output, with content checksum */
+
+/* FLG bits of the lz4 frame header */
+#define LZ4F_FLG_VERSION  0xC0
+#define LZ4F_FLG_INDEP    0x20
+#define LZ4F_FLG_BCHECK   0x10
+#define LZ4F_FLG_CSIZE    0x08
+#define LZ4F_FLG_CCHECK   0x04
+#define LZ4F_FLG_DICTID   0x01
 
 struct LZ4MT_DCtx_s {
 
-	/* threads: 1..LZ4MT_THREAD_MAX */
-	int threads;
+	/* one decompression context per worker */
+	LZ4F_decompressionContext_t *dctx;
 
-	/* should be used for read from input */
-	size_t inputsize;
+	/* block parallel decompression */
+	blk_t blk;
 
-	/* statistic */
-	size_t insize;
-	size_t outsize;
-	size_t curframe;
-	size_t frames;
-
-	/* threading */
-	cwork_t *cwork;
-
-	/* reading input */
-	pthread_mutex_t read_mutex;
-	fn_read *fn_read;
-	void *arg_read;
-
-	/* writing output */
-	pthread_mutex_t write_mutex;
-	fn_write *fn_write;
-	void *arg_write;
-
-	/* lists for writing queue */
-	struct list_head writelist_free;
-	struct list_head writelist_busy;
-	struct list_head writelist_done;
+	/* the frame pipeline, see mtpipe.h, its inputsize is used for
+	 * single stream only */
+	mtpipe pipe;
 };
 
 /* **************************************
  * Decompression
  ****************************************/
 
+static const size_t errors[] = MTPIPE_ERRORS(ERROR);
+
+/* decompress one unit of blk_read() */
+static size_t blk_decompress(LZ4MT_DCtx * ctx, int worker, mtpipe_buf * out,
+			     const mtpipe_buf * in)
+{
+	const unsigned char *src = (const unsigned char *)in->buf;
+	unsigned char *dst;
+	size_t pos, size;
+	U64 csize64;
+	U32 bh, csize;
+	int dsize;
+
+	switch (src[0]) {
+	case BLK_BLOCK:
+		bh = MEM_readLE32(src + 8);
+		csize = bh & 0x7FFFFFFFU;
+		if (mtpipe_reserve(out, 1 + MEM_readLE32(src + 4)))
+			return ERROR(memory_allocation);
+		if ((src[1] & LZ4F_FLG_BCHECK) &&
+		    XXH32(src + 12, csize, 0) != MEM_readLE32(src + 12 + csize))
+			return ERROR(frame_decompress);
+
+		dst = (unsigned char *)out->buf;
+		dst[0] = (src[1] & LZ4F_FLG_CCHECK) ? BLK_HASH : BLK_DATA;
+		if (bh & 0x80000000U) {
+			memcpy(dst + 1, src + 12, csize);
+			dsize = (int)csize;
+		} else {
+			dsize = LZ4_decompress_safe((const char *)src + 12,
+						    (char *)dst + 1, (int)csize,
+						    (int)MEM_readLE32(src + 4));
+			if (dsize < 0)
+				return ERROR(frame_decompress);
+		}
+		out->size = 1 + (size_t)dsize;
+		return 0;
+
+	case BLK_FRAME:
+		/* the frame decoder checks the frame, its content size is
+		 * untrusted, it's only a hint for the output buffer, up to
+		 * one block, which grows with the output */
+		LZ4F_resetDecompressionContext(ctx->dctx[worker]);
+		csize64 = 0;
+		if (src[12] & LZ4F_FLG_CSIZE)
+			csize64 = MEM_readLE64(src + 14);
+		size = LZ4FMT_BLOCKSIZE;
+		if (csize64 && csize64 < size)
+			size = (size_t)csize64;
+		if (mtpipe_reserve(out, 1 + size))
+			return ERROR(memory_allocation);
+
+		out->size = 1;
+		for (pos = 8;;) {
+			size_t srcSize = in->size - pos, dstSize, result;
+
+			if (out->allocated - out->size < 64 * 1024 &&
+			    mtpipe_reserve(out, out->allocated * 2 + 64 * 1024))
+				return ERROR(memory_allocation);
+			dstSize = out->allocated - out->size;
+			result = LZ4F_decompress(ctx->dctx[worker],
+						 (char *)out->buf + out->size,
+						 &dstSize, src + pos, &srcSize,
+						 0);
+			if (LZ4F_isError(result)) {
+				lz4mt_errcode = result;
+				return ERROR(compression_library);
+			}
+			out->size += dstSize;
+			pos += srcSize;
+			if (result == 0)
+				break;
+			if (pos == in->size && dstSize == 0)
+				return ERROR(frame_decompress);
+		}
+		if (csize64 && out->size - 1 != csize64)
+			return ERROR(frame_decompress);
+		((unsigned char *)out->buf)[0] = BLK_DATA;
+		return 0;
+
+	case BLK_END:
+		if (mtpipe_reserve(out, 8))
+			return ERROR(memory_allocation);
+		memcpy(out->buf, src, 8);
+		out->size = 8;
+		return 0;
+	}
+
+	return ERROR(data_error);
+}
+
+static size_t lz4mt_decompress(void *arg, int worker, mtpipe_buf * out,
+			       const mtpipe_buf * in,
+			       const unsigned char *hdr)
+{
+	LZ4MT_DCtx *ctx = (LZ4MT_DCtx *) arg;
+	unsigned char *src = (unsigned char *)in->buf;
+	size_t size = in->size;
+	size_t result;
+
+	(void)hdr;
+	if (ctx->blk.on)
+		return blk_decompress(ctx, worker, out, in);
+	if (size < 6)
+		return ERROR(data_error);
+
+	/* get frame size for output buffer, minimal frames have none */
+	if (src[4] & 0x08)
+		out->size = (size_t) MEM_readLE64(src + 6);
+	else
+		out->size = 1024 * 64;
+	if (mtpipe_reserve(out, out->size))
+		return ERROR(memory_allocation);
+
+	result =
+	    LZ4F_decompress(ctx->dctx[worker], out->buf, &out->size,
+			    in->buf, &size, 0);
+	if (LZ4F_isError(result)) {
+		lz4mt_errcode = result;
+		return ERROR(compression_library);
+	}
+
+	if (result != 0)
+		return ERROR(frame_decompress);
+
+	return 0;
+}
+
+static const mtpipe_codec lz4mt_codec = {
+	12, LZ4MT_isError, errors, 0, 0, lz4mt_decompress
+};
+
 LZ4MT_DCtx *LZ4MT_createDCtx(int threads, int inputsize)
 {
 	LZ4MT_DCtx *ctx;
 	int t;
 
-	/* allocate ctx */
-	ctx = (LZ4MT_DCtx *) malloc(sizeof(LZ4MT_DCtx));
-	if (!ctx)
-		return 0;
-
 	/* check threads value */
 	if (threads < 1 || threads > LZ4MT_THREAD_MAX)
 		return 0;
 
-	/* setup ctx */
-	ctx->threads = threads;
-	ctx->insize = 0;
-	ctx->outsize = 0;
-	ctx->frames = 0;
-	ctx->curframe = 0;
+	/* allocate ctx */
+	ctx = (LZ4MT_DCtx *) malloc(sizeof(LZ4MT_DCtx));
+	if (!ctx)
+		return 0;
 
 	/* will be used for single stream only */
-	if (inputsize)
-		ctx->inputsize = inputsize;
-	else
-		ctx->inputsize = 1024 + 1024 * 4;
-
-	pthread_mutex_init(&ctx->read_mutex, NULL);
-	pthread_mutex_init(&ctx->write_mutex, NULL);
+	if (!inputsize)
+		inputsize = 1024 + 1024 * 4;
 
-	INIT_LIST_HEAD(&ctx->writelist_free);
-	INIT_LIST_HEAD(&ctx->writelist_busy);
-	INIT_LIST_HEAD(&ctx->writelist_done);
+	if (mtpipe_init(&ctx->pipe, &lz4mt_codec, ctx, threads, inputsize))
+		goto err_pipe;
+	ctx->blk.on = 0;
 
-	ctx->cwork = (cwork_t *) malloc(sizeof(cwork_t) * threads);
-	if (!ctx->cwork)
-		goto err_cwork;
+	ctx->dctx = (LZ4F_decompressionContext_t *)
+	    malloc(sizeof(LZ4F_decompressionContext_t) * threads);
+	if (!ctx->dctx)
+		goto err_dctx;
 
-	for (t = 0; t < threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		w->ctx = ctx;
-
-		/* setup thread work */
-		LZ4F_createDecompressionContext(&w->dctx, LZ4F_VERSION);
-	}
+	/* setup thread work */
+	for (t = 0; t < threads; t++)
+		LZ4F_createDecompressionContext(&ctx->dctx[t], LZ4F_VERSION);
 
 	return ctx;
 
- err_cwork:
+ err_dctx:
+	mtpipe_free(&ctx->pipe);
+ err_pipe:
 	free(ctx);
 
 	return 0;
@@ -159,258 +293,66 @@ static size_t mt_error(int rv)
 	return ERROR(read_fail);
 }
 
-/**
- * pt_write - queue for decompressed output
- */
-static size_t pt_write(LZ4MT_DCtx * ctx, struct writelist *wl)
+/* linked frames: append the new output to the history */
+static void st_history(unsigned char *hist, size_t * histsize,
+		       const unsigned char *buf, size_t size)
 {
-	struct list_head *entry;
-
-	/* move the entry to the done list */
-	list_move(&wl->node, &ctx->writelist_done);
- again:
-	/* check, what can be written ... */
-	list_for_each(entry, &ctx->writelist_done) {
-		wl = list_entry(entry, struct writelist, node);
-		if (wl->frame == ctx->curframe) {
-			int rv = ctx->fn_write(ctx->arg_write, &wl->out);
-			if (rv != 0)
-				return mt_error(rv);
-			ctx->outsize += wl->out.size;
-			ctx->curframe++;
-			list_move(entry, &ctx->writelist_free);
-			goto again;
-		}
+	size_t keep;
+
+	if (size >= LZ4FMT_HISTORY) {
+		memcpy(hist, buf + size - LZ4FMT_HISTORY, LZ4FMT_HISTORY);
+		*histsize = LZ4FMT_HISTORY;
+		return;
 	}
 
-	return 0;
+	keep = LZ4FMT_HISTORY - size;
+	if (keep > *histsize)
+		keep = *histsize;
+	memmove(hist, hist + *histsize - keep, keep);
+	memcpy(hist + keep, buf, size);
+	*histsize = keep + size;
 }
 
 /**
- * pt_read - read compressed output
+ * single threaded, for standard lz4 streams and for linked frames, the
+ * frame decoder skips the skippable frames in front of them
  */
-static size_t pt_read(LZ4MT_DCtx * ctx, LZ4MT_Buffer * in, size_t * frame)
-{
-	unsigned char hdrbuf[12];
-	LZ4MT_Buffer hdr;
-	int rv;
-
-	/* read skippable frame (8 or 12 bytes) */
-	pthread_mutex_lock(&ctx->read_mutex);
-
-	/* special case, first 4 bytes already read */
-	if (ctx->frames == 0) {
-		hdr.buf = hdrbuf + 4;
-		hdr.size = 8;
-		rv = ctx->fn_read(ctx->arg_read, &hdr);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		if (hdr.size != 8)
-			goto error_read;
-		hdr.buf = hdrbuf;
-	} else {
-		hdr.buf = hdrbuf;
-		hdr.size = 12;
-		rv = ctx->fn_read(ctx->arg_read, &hdr);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		/* eof reached ? */
-		if (hdr.size == 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			in->size = 0;
-			return 0;
-		}
-		if (hdr.size != 12)
-			goto error_read;
-		if (MEM_readLE32((unsigned char *)hdr.buf + 0) !=
-		    LZ4FMT_MAGIC_SKIPPABLE)
-			goto error_data;
-	}
-
-	/* check header data */
-	if (MEM_readLE32((unsigned char *)hdr.buf + 4) != 4)
-		goto error_data;
-
-	ctx->insize += 12;
-	/* read new inputsize */
-	{
-		size_t toRead = MEM_readLE32((unsigned char *)hdr.buf + 8);
-		if (in->allocated < toRead) {
-			/* need bigger input buffer */
-			if (in->allocated)
-				in->buf = realloc(in->buf, toRead);
-			else
-				in->buf = malloc(toRead);
-			if (!in->buf)
-				goto error_nomem;
-			in->allocated = toRead;
-		}
-
-		in->size = toRead;
-		rv = ctx->fn_read(ctx->arg_read, in);
-		/* generic read failure! */
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		/* needed more bytes! */
-		if (in->size != toRead)
-			goto error_data;
-
-		ctx->insize += in->size;
-	}
-	*frame = ctx->frames++;
-	pthread_mutex_unlock(&ctx->read_mutex);
-
-	/* done, no error */
-	return 0;
-
- error_data:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return ERROR(data_error);
- error_read:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return ERROR(read_fail);
- error_nomem:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return ERROR(memory_allocation);
-}
-
-static void *pt_decompress(void *arg)
+static size_t st_decompress(LZ4MT_DCtx * ctx, LZ4MT_RdWr_t * rdwr,
+			    const void *magic, int linked)
 {
-	cwork_t *w = (cwork_t *) arg;
-	LZ4MT_Buffer *in = &w->in;
-	LZ4MT_DCtx *ctx = w->ctx;
-	size_t result = 0;
-	struct writelist *wl;
-
-	for (;;) {
-		struct list_head *entry;
-		LZ4MT_Buffer *out;
-
-		/* allocate space for new output */
-		pthread_mutex_lock(&ctx->write_mutex);
-		if (!list_empty(&ctx->writelist_free)) {
-			/* take unused entry */
-			entry = list_first(&ctx->writelist_free);
-			wl = list_entry(entry, struct writelist, node);
-			list_move(entry, &ctx->writelist_busy);
-		} else {
-			/* allocate new one */
-			wl = (struct writelist *)
-			    malloc(sizeof(struct writelist));
-			if (!wl) {
-				result = ERROR(memory_allocation);
-				goto error_unlock;
-			}
-			wl->out.buf = 0;
-			wl->out.size = 0;
-			wl->out.allocated = 0;
-			list_add(&wl->node, &ctx->writelist_busy);
-		}
-		pthread_mutex_unlock(&ctx->write_mutex);
-		out = &wl->out;
-
-		/* zero should not happen here! */
-		result = pt_read(ctx, in, &wl->frame);
-		if (LZ4MT_isError(result)) {
-			list_move(&wl->node, &ctx->writelist_free);
-			goto error_lock;
-		}
-
-		if (in->size == 0)
-			break;
-
-		/* mininmal frame */
-		if (in->size < 40 && ctx->frames == 1) {
-			out->size = 1024 * 64;
-		} else {
-			/* get frame size for output buffer */
-			unsigned char *src = (unsigned char *)in->buf + 6;
-			out->size = (size_t) MEM_readLE64(src);
-		}
-
-		if (out->allocated < out->size) {
-			if (out->allocated)
-				out->buf = realloc(out->buf, out->size);
-			else
-				out->buf = malloc(out->size);
-			if (!out->buf) {
-				result = ERROR(memory_allocation);
-				goto error_lock;
-			}
-			out->allocated = out->size;
-		}
-
-		result =
-		    LZ4F_decompress(w->dctx, out->buf, &out->size,
-				    in->buf, &in->size, 0);
-
-		if (LZ4F_isError(result)) {
-			lz4mt_errcode = result;
-			result = ERROR(compression_library);
-			goto error_lock;
-		}
-
-		if (result != 0) {
-			result = ERROR(frame_decompress);
-			goto error_lock;
-		}
-
-		/* write result */
-		pthread_mutex_lock(&ctx->write_mutex);
-		result = pt_write(ctx, wl);
-		if (LZ4MT_isError(result))
-			goto error_unlock;
-		pthread_mutex_unlock(&ctx->write_mutex);
-	}
-
-	/* everything is okay */
-	pthread_mutex_lock(&ctx->write_mutex);
-	list_move(&wl->node, &ctx->writelist_free);
-	pthread_mutex_unlock(&ctx->write_mutex);
-	if (in->allocated)
-		free(in->buf);
-	return 0;
-
- error_lock:
-	pthread_mutex_lock(&ctx->write_mutex);
- error_unlock:
-	list_move(&wl->node, &ctx->writelist_free);
-	pthread_mutex_unlock(&ctx->write_mutex);
-	if (in->allocated)
-		free(in->buf);
-	return (void *)result;
-}
-
-/* single threaded */
-static size_t st_decompress(void *arg)
-{
-	LZ4MT_DCtx *ctx = (LZ4MT_DCtx *) arg;
 	LZ4F_errorCode_t result = 0;
-	cwork_t *w = &ctx->cwork[0];
-	LZ4MT_Buffer Out;
+	size_t inputsize = ctx->pipe.inputsize;
+	LZ4MT_Buffer In, Out;
+	LZ4MT_Buffer *in = &In;
 	LZ4MT_Buffer *out = &Out;
-	LZ4MT_Buffer *in = &w->in;
-	void *magic = in->buf;
+	unsigned char *hist = 0, *dict = 0;
+	size_t histsize = 0, dictsize = 0;
+	size_t ret = 0;
 	int rv;
 
 	/* allocate space for input buffer */
-	in->size = ctx->inputsize;
+	in->size = inputsize;
 	in->buf = malloc(in->size);
 	if (!in->buf)
 		return ERROR(memory_allocation);
 
 	/* allocate space for output buffer */
-	out->size = ctx->inputsize;
+	out->size = inputsize;
 	out->buf = malloc(out->size);
 	if (!out->buf) {
-		free(in->buf);
-		return ERROR(memory_allocation);
+		ret = ERROR(memory_allocation);
+		goto out_in;
+	}
+
+	/* the output so far, copied to dict when a frame begins, because
+	 * the frame decoder refers to it until the frame ends */
+	if (linked) {
+		hist = (unsigned char *)malloc(LZ4FMT_HISTORY * 2);
+		if (!hist) {
+			ret = ERROR(memory_allocation);
+			goto out_out;
+		}
+		dict = hist + LZ4FMT_HISTORY;
 	}
 
 	/* we have read already 4 bytes */
@@ -418,36 +360,47 @@ static size_t st_decompress(void *arg)
 	memcpy(in->buf, magic, in->size);
 
 	/* stats */
-	ctx->insize = 4;
-	ctx->outsize = 0;
+	mt_atomic_set(&ctx->pipe.insize, 4);
+	mt_atomic_set(&ctx->pipe.outsize, 0);
 
 	/* decompress loop */
 	for (;;) {
 		size_t srcPos = 0;
 		for (;;) {
 			size_t srcSize = in->size - srcPos;
-			out->size = ctx->inputsize;
+			out->size = inputsize;
+
+			/* zero means: the next call begins a new frame */
+			if (linked && result == 0) {
+				memcpy(dict, hist, histsize);
+				dictsize = histsize;
+			}
 
-			result = LZ4F_decompress(w->dctx, out->buf, &out->size, (unsigned char *)in->buf + srcPos, &srcSize, NULL);
+			result = LZ4F_decompress_usingDict(ctx->dctx[0],
+				out->buf, &out->size,
+				(unsigned char *)in->buf + srcPos, &srcSize,
+				dict, dictsize, NULL);
 			if (LZ4F_isError(result)) {
-				free(in->buf);
-				free(out->buf);
-				return ERROR(compression_library);
+				ret = ERROR(compression_library);
+				goto out_hist;
 			}
 
 			/* update stats */
 			srcPos += srcSize;
-			ctx->insize += srcSize;
-			ctx->outsize += out->size;
+			mt_atomic_add(&ctx->pipe.insize, srcSize);
+			mt_atomic_add(&ctx->pipe.outsize, out->size);
 
 			/* have some output */
 			if (out->size) {
-				rv = ctx->fn_write(ctx->arg_write, out);
+				if (linked)
+					st_history(hist, &histsize,
+						   out->buf, out->size);
+				rv = rdwr->fn_write(rdwr->arg_write, out);
 				if (rv != 0) {
-					free(in->buf);
-					free(out->buf);
-					return mt_error(rv);
+					ret = mt_error(rv);
+					goto out_hist;
 				}
+				MTPROGRESS(&ctx->pipe, 0);
 			}
 
 			/* consumed all input */
@@ -459,55 +412,397 @@ static size_t st_decompress(void *arg)
 		if (result)
 			in->size = result;
 		else
-			in->size = ctx->inputsize;
+			in->size = inputsize;
 
-		if (in->size > ctx->inputsize)
-			in->size = ctx->inputsize;
+		if (in->size > inputsize)
+			in->size = inputsize;
 
-		rv = ctx->fn_read(ctx->arg_read, in);
-		ctx->insize += in->size;
+		rv = rdwr->fn_read(rdwr->arg_read, in);
+		mt_atomic_add(&ctx->pipe.insize, in->size);
 		if (rv != 0) {
-			free(in->buf);
-			free(out->buf);
-			return mt_error(rv);
+			ret = mt_error(rv);
+			goto out_hist;
 		}
 
-		if (in->size == 0)
+		/* the end of input within a frame */
+		if (in->size == 0) {
+			if (result) {
+				ret = ERROR(data_error);
+				goto out_hist;
+			}
 			break;
+		}
 	}
 
 	/* no error */
+	MTPROGRESS(&ctx->pipe, 1);
+
+ out_hist:
+	free(hist);
+ out_out:
 	free(out->buf);
+ out_in:
 	free(in->buf);
+
+	return ret;
+}
+
+/* read exactly size bytes of the input, returns 1 at the end of input */
+static int blk_get(LZ4MT_DCtx * ctx, void *buf, size_t size)
+{
+	blk_t *blk = &ctx->blk;
+	LZ4MT_Buffer b;
+	int rv;
+
+	b.buf = buf;
+	b.size = size;
+	rv = blk->rdwr->fn_read(blk->rdwr->arg_read, &b);
+	if (rv != 0)
+		return rv;
+	blk->insize += b.size;
+	if (b.size == size)
+		return 0;
+	if (b.size == 0)
+		return 1;
+
+	blk->error = ERROR(data_error);
+	return -1;
+}
+
+/* jump over size bytes of the input */
+static int blk_skip(LZ4MT_DCtx * ctx, size_t size)
+{
+	unsigned char buf[1024];
+	size_t n;
+	int rv;
+
+	while (size) {
+		n = size < sizeof(buf) ? size : sizeof(buf);
+		rv = blk_get(ctx, buf, n);
+		if (rv == 1)
+			ctx->blk.error = ERROR(data_error);
+		if (rv != 0)
+			return -1;
+		size -= n;
+	}
+
+	return 0;
+}
+
+/* append size bytes of the input to the buffered frame */
+static int blk_append(LZ4MT_DCtx * ctx, size_t size)
+{
+	mtpipe_buf *frame = &ctx->blk.frame;
+	int rv;
+
+	if (mtpipe_reserve(frame, frame->size + size) &&
+	    mtpipe_reserve(frame, frame->allocated * 2 + size)) {
+		ctx->blk.error = ERROR(memory_allocation);
+		return -1;
+	}
+
+	rv = blk_get(ctx, (char *)frame->buf + frame->size, size);
+	if (rv == 1)
+		ctx->blk.error = ERROR(data_error);
+	if (rv != 0)
+		return -1;
+	frame->size += size;
+
+	return 0;
+}
+
+/* buffer the rest of a frame with linked blocks, after its header */
+static int blk_frame(LZ4MT_DCtx * ctx)
+{
+	mtpipe_buf *frame = &ctx->blk.frame;
+	unsigned char flg = ctx->blk.flg;
+	U32 bh;
+
+	for (;;) {
+		if (blk_append(ctx, 4))
+			return -1;
+		bh = MEM_readLE32((char *)frame->buf + frame->size - 4);
+		if (bh == 0)
+			break;
+		if ((bh & 0x7FFFFFFFU) > ctx->blk.blockmax) {
+			ctx->blk.error = ERROR(data_error);
+			return -1;
+		}
+		if (blk_append(ctx, (bh & 0x7FFFFFFFU) +
+			       ((flg & LZ4F_FLG_BCHECK) ? 4 : 0)))
+			return -1;
+	}
+
+	if (flg & LZ4F_FLG_CCHECK)
+		return blk_append(ctx, 4);
+
 	return 0;
 }
 
+/**
+ * find the next unit, returns its size or zero at the end of input, the
+ * unit header is put into blk->unit
+ */
+static int blk_next(LZ4MT_DCtx * ctx, size_t * size)
+{
+	blk_t *blk = &ctx->blk;
+	unsigned char hdr[LZ4F_HEADER_SIZE_MAX];
+	size_t hdrsize;
+	U32 bh, csize;
+	int rv;
+
+	for (;;) {
+		if (blk->inframe) {
+			/* next block or end mark */
+			rv = blk_get(ctx, blk->unit + 8, 4);
+			if (rv == 1)
+				blk->error = ERROR(data_error);
+			if (rv != 0)
+				return rv;
+
+			blk->unit[1] = blk->flg;
+			blk->unit[2] = blk->unit[3] = 0;
+			bh = MEM_readLE32(blk->unit + 8);
+			if (bh == 0) {
+				blk->inframe = 0;
+				blk->unit[0] = BLK_END;
+				MEM_writeLE32(blk->unit + 4, 0);
+				if ((blk->flg & LZ4F_FLG_CCHECK) &&
+				    blk_get(ctx, blk->unit + 4, 4) != 0) {
+					blk->error = ERROR(data_error);
+					return -1;
+				}
+				blk->unitsize = 8;
+				*size = 8;
+				return 0;
+			}
+
+			csize = bh & 0x7FFFFFFFU;
+			if (csize > blk->blockmax) {
+				blk->error = ERROR(data_error);
+				return -1;
+			}
+			blk->unit[0] = BLK_BLOCK;
+			MEM_writeLE32(blk->unit + 4, blk->blockmax);
+			blk->unitsize = 12;
+			*size = 12 + csize +
+			    ((blk->flg & LZ4F_FLG_BCHECK) ? 4 : 0);
+			return 0;
+		}
+
+		/* next frame, a skippable frame or the end */
+		if (blk->havemagic) {
+			memcpy(hdr, blk->magic, 4);
+			blk->havemagic = 0;
+		} else {
+			rv = blk_get(ctx, hdr, 4);
+			if (rv == 1) {
+				*size = 0;
+				return 0;
+			}
+			if (rv != 0)
+				return rv;
+		}
+
+		if ((MEM_readLE32(hdr) & 0xFFFFFFF0U) == LZ4FMT_MAGIC_SKIPPABLE) {
+			if (blk_get(ctx, hdr, 4) != 0 ||
+			    blk_skip(ctx, MEM_readLE32(hdr)) != 0) {
+				blk->error = ERROR(data_error);
+				return -1;
+			}
+			continue;
+		}
+
+		/* the frame header: magic, FLG, BD, content size, dictID, HC */
+		if (MEM_readLE32(hdr) != LZ4FMT_MAGICNUMBER ||
+		    blk_get(ctx, hdr + 4, 2) != 0) {
+			blk->error = ERROR(data_error);
+			return -1;
+		}
+		blk->flg = hdr[4];
+		hdrsize = 7 + ((blk->flg & LZ4F_FLG_CSIZE) ? 8 : 0) +
+		    ((blk->flg & LZ4F_FLG_DICTID) ? 4 : 0);
+		if ((blk->flg & LZ4F_FLG_VERSION) != 0x40 ||
+		    ((hdr[5] >> 4) & 7) < 4 ||
+		    blk_get(ctx, hdr + 6, hdrsize - 6) != 0 ||
+		    ((XXH32(hdr + 4, hdrsize - 5, 0) >> 8) & 0xFF) !=
+		    hdr[hdrsize - 1]) {
+			blk->error = ERROR(data_error);
+			return -1;
+		}
+		blk->blockmax = 1U << (8 + 2 * ((hdr[5] >> 4) & 7));
+
+		/* independent blocks, each one is a unit */
+		if ((blk->flg & LZ4F_FLG_INDEP) &&
+		    !(blk->flg & LZ4F_FLG_DICTID)) {
+			blk->inframe = 1;
+			continue;
+		}
+
+		/* linked blocks, the whole frame is one unit */
+		blk->frame.size = 8;
+		if (mtpipe_reserve(&blk->frame, 8 + hdrsize)) {
+			blk->error = ERROR(memory_allocation);
+			return -1;
+		}
+		memcpy((char *)blk->frame.buf + 8, hdr, hdrsize);
+		blk->frame.size += hdrsize;
+		if (blk_frame(ctx))
+			return -1;
+
+		blk->unit[0] = BLK_FRAME;
+		blk->unit[1] = blk->flg;
+		blk->unitsize = 8;
+		*size = blk->frame.size;
+		return 0;
+	}
+}
+
+/**
+ * blk_read - fn_read of the pipeline, first the skippable frame of the
+ * next unit is asked for, then the unit
+ */
+static int blk_read(void *arg, mtpipe_buf * b)
+{
+	LZ4MT_DCtx *ctx = (LZ4MT_DCtx *) arg;
+	blk_t *blk = &ctx->blk;
+	unsigned char *dst = (unsigned char *)b->buf;
+	size_t size;
+	int rv;
+
+	if (blk->pending == 0) {
+		rv = blk_next(ctx, &size);
+		if (rv != 0)
+			return rv;
+		if (size == 0) {
+			b->size = 0;
+			return 0;
+		}
+		MEM_writeLE32(dst + 0, LZ4FMT_MAGIC_SKIPPABLE);
+		MEM_writeLE32(dst + 4, 4);
+		MEM_writeLE32(dst + 8, (U32) size);
+		b->size = 12;
+		blk->pending = size;
+		return 0;
+	}
+
+	/* the unit itself */
+	size = blk->pending;
+	blk->pending = 0;
+	if (blk->unit[0] == BLK_FRAME) {
+		memcpy(blk->frame.buf, blk->unit, 8);
+		memcpy(dst, blk->frame.buf, size);
+		return 0;
+	}
+
+	memcpy(dst, blk->unit, blk->unitsize);
+	if (size > blk->unitsize) {
+		rv = blk_get(ctx, dst + blk->unitsize, size - blk->unitsize);
+		if (rv == 1)
+			blk->error = ERROR(data_error);
+		if (rv != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* blk_write - fn_write of the pipeline, in order */
+static int blk_write(void *arg, mtpipe_buf * b)
+{
+	LZ4MT_DCtx *ctx = (LZ4MT_DCtx *) arg;
+	blk_t *blk = &ctx->blk;
+	unsigned char *src = (unsigned char *)b->buf;
+	LZ4MT_Buffer out;
+
+	switch (src[0]) {
+	case BLK_END:
+		if ((src[1] & LZ4F_FLG_CCHECK) &&
+		    XXH32_digest(&blk->xxh) != MEM_readLE32(src + 4)) {
+			blk->error = ERROR(frame_decompress);
+			return -1;
+		}
+		XXH32_reset(&blk->xxh, 0);
+		return 0;
+	case BLK_HASH:
+		XXH32_update(&blk->xxh, src + 1, b->size - 1);
+		break;
+	}
+
+	if (b->size == 1)
+		return 0;
+
+	out.buf = src + 1;
+	out.size = b->size - 1;
+	out.allocated = out.size;
+	blk->outsize += out.size;
+
+	return blk->rdwr->fn_write(blk->rdwr->arg_write, &out);
+}
+
+/* decompress standard lz4 frames with the workers, buf is the magic */
+static size_t blk_decompress_all(LZ4MT_DCtx * ctx, LZ4MT_RdWr_t * rdwr,
+				 const unsigned char *buf)
+{
+	blk_t *blk = &ctx->blk;
+	mtoutput_fn *output;
+	size_t ret;
+
+	blk->on = 1;
+	blk->rdwr = rdwr;
+	blk->error = 0;
+	memcpy(blk->magic, buf, 4);
+	blk->havemagic = 1;
+	blk->inframe = 0;
+	blk->pending = 0;
+	blk->frame.buf = 0;
+	blk->frame.size = 0;
+	blk->frame.allocated = 0;
+	blk->insize = 4;
+	blk->outsize = 0;
+	XXH32_reset(&blk->xxh, 0);
+
+	/* the units are no frames of the output, see mtoutput_fn */
+	output = ctx->pipe.output;
+	ctx->pipe.output = 0;
+	ret = mtpipe_decompress(&ctx->pipe, blk_read, ctx, blk_write, ctx,
+				blk->magic, 0);
+	ctx->pipe.output = output;
+	blk->on = 0;
+	free(blk->frame.buf);
+	blk->frame.buf = 0;
+
+	/* the counters of the pipeline include the units */
+	mt_atomic_set(&ctx->pipe.insize, blk->insize);
+	mt_atomic_set(&ctx->pipe.outsize, blk->outsize);
+	if (blk->error)
+		return blk->error;
+
+	return ret;
+}
+
 size_t LZ4MT_decompressDCtx(LZ4MT_DCtx * ctx, LZ4MT_RdWr_t * rdwr)
 {
 	unsigned char buf[4];
-	int t, rv;
-	cwork_t *w = &ctx->cwork[0];
-	LZ4MT_Buffer *in = &w->in;
-	void *retval_of_thread = 0;
+	LZ4MT_Buffer in;
+	int rv;
 
 	if (!ctx)
 		return ERROR(compressionParameter_unsupported);
 
-	/* init reading and writing functions */
-	ctx->fn_read = rdwr->fn_read;
-	ctx->fn_write = rdwr->fn_write;
-	ctx->arg_read = rdwr->arg_read;
-	ctx->arg_write = rdwr->arg_write;
-
 	/* check for LZ4FMT_MAGIC_SKIPPABLE */
-	in->buf = buf;
-	in->size = 4;
-	rv = ctx->fn_read(ctx->arg_read, in);
+	in.buf = buf;
+	in.size = 4;
+	rv = rdwr->fn_read(rdwr->arg_read, &in);
 	if (rv != 0)
 		return mt_error(rv);
-	if (in->size != 4)
+	if (in.size != 4)
 		return ERROR(data_error);
 
+	/* linked frames depend on each other */
+	if (MEM_readLE32(buf) == LZ4FMT_MAGIC_LINKED)
+		return st_decompress(ctx, rdwr, buf, 1);
+
 	/* single threaded with unknown sizes */
 	if (MEM_readLE32(buf) != LZ4FMT_MAGIC_SKIPPABLE) {
 
@@ -515,55 +810,81 @@ size_t LZ4MT_decompressDCtx(LZ4MT_DCtx * ctx, LZ4MT_RdWr_t * rdwr)
 		if (MEM_readLE32(buf) != LZ4FMT_MAGICNUMBER)
 			return ERROR(data_error);
 
+		/* the blocks of standard frames go to the workers */
+		if (ctx->pipe.threads > 1)
+			return blk_decompress_all(ctx, rdwr, buf);
+
 		/* decompress single threaded */
-		return st_decompress(ctx);
+		return st_decompress(ctx, rdwr, buf, 0);
 	}
 
-	/* mark unused */
-	in->buf = 0;
-	in->size = 0;
-	in->allocated = 0;
-
-	/* single threaded, but with known sizes */
-	if (ctx->threads == 1) {
-		/* no pthread_create() needed! */
-		void *p = pt_decompress(w);
-		if (p)
-			return (size_t) p;
-		goto okay;
-	}
+	/* known sizes, the frames are decompressed by the workers */
+	return mtpipe_decompress(&ctx->pipe, (mtpipe_fn *) rdwr->fn_read,
+				 rdwr->arg_read, (mtpipe_fn *) rdwr->fn_write,
+				 rdwr->arg_write, buf, 4);
+}
 
-	/* multi threaded */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		wt->in.buf = 0;
-		wt->in.size = 0;
-		wt->in.allocated = 0;
-		pthread_create(&wt->pthread, NULL, pt_decompress, wt);
-	}
+/**
+ * LZ4 frame header: 4 byte magic, FLG, BD and optional 8 byte content size
+ */
+#define LZ4F_HEADER_CSIZE 14
 
-	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(wt->pthread, &p);
-		if (p)
-			retval_of_thread = p;
-	}
+size_t LZ4MT_listDCtx(LZ4MT_DCtx * ctx, LZ4MT_RdWr_t * rdwr,
+		      fn_skip * fn_skip)
+{
+	unsigned char buf[12 + LZ4F_HEADER_CSIZE];
+	LZ4MT_Buffer hdr;
+	size_t toRead;
+	int rv;
+
+	if (!ctx)
+		return ERROR(compressionParameter_unsupported);
+
+	for (;;) {
+		/* 12 byte skippable frame */
+		hdr.buf = buf;
+		hdr.size = 12;
+		rv = rdwr->fn_read(rdwr->arg_read, &hdr);
+		if (rv != 0)
+			return mt_error(rv);
+
+		/* eof reached */
+		if (hdr.size == 0)
+			break;
+
+		if (hdr.size != 12
+		    || (MEM_readLE32(buf + 0) != LZ4FMT_MAGIC_SKIPPABLE
+			&& MEM_readLE32(buf + 0) != LZ4FMT_MAGIC_LINKED)
+		    || MEM_readLE32(buf + 4) != 4)
+			return ERROR(data_error);
+
+		/* header of the lz4 frame */
+		toRead = MEM_readLE32(buf + 8);
+		if (toRead < LZ4F_HEADER_CSIZE)
+			return ERROR(data_error);
+		hdr.buf = buf + 12;
+		hdr.size = LZ4F_HEADER_CSIZE;
+		rv = rdwr->fn_read(rdwr->arg_read, &hdr);
+		if (rv != 0)
+			return mt_error(rv);
+		if (hdr.size != LZ4F_HEADER_CSIZE
+		    || MEM_readLE32(buf + 12) != LZ4FMT_MAGICNUMBER)
+			return ERROR(data_error);
+		if (!(buf[16] & LZ4F_FLG_CSIZE))
+			return ERROR(frame_decompress);
+
+		/* the frame body */
+		rv = fn_skip(rdwr->arg_read, toRead - LZ4F_HEADER_CSIZE);
+		if (rv != 0)
+			return mt_error(rv);
 
- okay:
-	/* clean up the buffers */
-	while (!list_empty(&ctx->writelist_free)) {
-		struct writelist *wl;
-		struct list_head *entry;
-		entry = list_first(&ctx->writelist_free);
-		wl = list_entry(entry, struct writelist, node);
-		free(wl->out.buf);
-		list_del(&wl->node);
-		free(wl);
+		mt_atomic_add(&ctx->pipe.insize, 12 + toRead);
+		mt_atomic_add(&ctx->pipe.outsize, MEM_readLE64(buf + 18));
+		ctx->pipe.frames++;
+		mt_atomic_add(&ctx->pipe.curframe, 1);
 	}
 
-	return (size_t) retval_of_thread;
+	return 0;
 }
 
 /* returns current uncompressed data size */
@@ -572,7 +893,7 @@ size_t LZ4MT_GetInsizeDCtx(LZ4MT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->insize;
+	return mt_atomic_get(&ctx->pipe.insize);
 }
 
 /* returns the current compressed data size */
@@ -581,7 +902,7 @@ size_t LZ4MT_GetOutsizeDCtx(LZ4MT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->outsize;
+	return mt_atomic_get(&ctx->pipe.outsize);
 }
 
 /* returns the current compressed frames */
@@ -590,7 +911,66 @@ size_t LZ4MT_GetFramesDCtx(LZ4MT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->curframe;
+	return mt_atomic_get(&ctx->pipe.curframe);
+}
+
+/* returns the counters of all workers together */
+void LZ4MT_GetStatsDCtx(LZ4MT_DCtx * ctx, mtstat_t * st)
+{
+	if (!ctx) {
+		memset(st, 0, sizeof(*st));
+		return;
+	}
+
+	mtpipe_stats(&ctx->pipe, st);
+}
+
+/* returns the number of workers, up to count of them are copied to st */
+int LZ4MT_GetWorkerStatsDCtx(LZ4MT_DCtx * ctx, mtstat_t * st, int count)
+{
+	if (!ctx)
+		return 0;
+
+	return mtpipe_worker_stats(&ctx->pipe, st, count);
+}
+
+/* register a progress callback, see mtprogress_init() */
+void LZ4MT_setProgressDCtx(LZ4MT_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes)
+{
+	if (!ctx)
+		return;
+
+	mtprogress_init(&ctx->pipe.progress, fn, arg, ms, bytes);
+}
+
+/* register a trace callback, see mttrace_fn in mtstat.h */
+void LZ4MT_setTraceDCtx(LZ4MT_DCtx * ctx, mttrace_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.trace = fn;
+	ctx->pipe.trace_arg = arg;
+}
+
+/* register an output callback, see mtoutput_fn in mtstat.h */
+void LZ4MT_setOutputDCtx(LZ4MT_DCtx * ctx, mtoutput_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.output = fn;
+	ctx->pipe.output_arg = arg;
+}
+
+/* run the workers as tasks of ex, or on threads again, when ex is zero */
+void LZ4MT_setExecutorDCtx(LZ4MT_DCtx * ctx, const mt_executor * ex)
+{
+	if (!ctx)
+		return;
+
+	mtpipe_executor(&ctx->pipe, ex);
 }
 
 void LZ4MT_freeDCtx(LZ4MT_DCtx * ctx)
@@ -600,14 +980,11 @@ void LZ4MT_freeDCtx(LZ4MT_DCtx * ctx)
 	if (!ctx)
 		return;
 
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		LZ4F_freeDecompressionContext(w->dctx);
-	}
+	for (t = 0; t < ctx->pipe.threads; t++)
+		LZ4F_freeDecompressionContext(ctx->dctx[t]);
 
-	pthread_mutex_destroy(&ctx->read_mutex);
-	pthread_mutex_destroy(&ctx->write_mutex);
-	free(ctx->cwork);
+	mtpipe_free(&ctx->pipe);
+	free(ctx->dctx);
 	free(ctx);
 	ctx = 0;
 
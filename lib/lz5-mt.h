@@ -23,6 +23,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>   /* size_t */
+#include "mtstat.h"   /* mtstat_t */
 
 /* current maximum the library will accept */
 #define LZ5MT_THREAD_MAX 128
@@ -76,6 +77,8 @@ typedef struct {
  * - just write some wrapper on your own
  * - a sample is given in 7-Zip ZS or lz5mt.c
  * - the function should return -1 on error and zero on success
+ * - at compression, fn_read may return 1 instead of zero, when no more
+ *   input is ready and the next read would block, like live streams
  * - the read or written bytes will go to in->size or out->size
  */
 typedef int (fn_read) (void *args, LZ5MT_Buffer * in);
@@ -117,6 +120,12 @@ size_t LZ5MT_compressCCtx(LZ5MT_CCtx * ctx, LZ5MT_RdWr_t * rdwr);
 size_t LZ5MT_GetFramesCCtx(LZ5MT_CCtx * ctx);
 size_t LZ5MT_GetInsizeCCtx(LZ5MT_CCtx * ctx);
 size_t LZ5MT_GetOutsizeCCtx(LZ5MT_CCtx * ctx);
+void LZ5MT_GetStatsCCtx(LZ5MT_CCtx * ctx, mtstat_t * st);
+int LZ5MT_GetWorkerStatsCCtx(LZ5MT_CCtx * ctx, mtstat_t * st, int count);
+void LZ5MT_setProgressCCtx(LZ5MT_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void LZ5MT_setTraceCCtx(LZ5MT_CCtx * ctx, mttrace_fn * fn, void *arg);
+void LZ5MT_setExecutorCCtx(LZ5MT_CCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
@@ -151,6 +160,13 @@ size_t LZ5MT_decompressDCtx(LZ5MT_DCtx * ctx, LZ5MT_RdWr_t * rdwr);
 size_t LZ5MT_GetFramesDCtx(LZ5MT_DCtx * ctx);
 size_t LZ5MT_GetInsizeDCtx(LZ5MT_DCtx * ctx);
 size_t LZ5MT_GetOutsizeDCtx(LZ5MT_DCtx * ctx);
+void LZ5MT_GetStatsDCtx(LZ5MT_DCtx * ctx, mtstat_t * st);
+int LZ5MT_GetWorkerStatsDCtx(LZ5MT_DCtx * ctx, mtstat_t * st, int count);
+void LZ5MT_setProgressDCtx(LZ5MT_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void LZ5MT_setTraceDCtx(LZ5MT_DCtx * ctx, mttrace_fn * fn, void *arg);
+void LZ5MT_setOutputDCtx(LZ5MT_DCtx * ctx, mtoutput_fn * fn, void *arg);
+void LZ5MT_setExecutorDCtx(LZ5MT_DCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
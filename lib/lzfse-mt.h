@@ -10,6 +10,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>   /* size_t */
+#include "mtstat.h"   /* mtstat_t */
 
 
 #define LZFSEMT_THREAD_MAX 128
@@ -55,6 +56,8 @@ typedef struct {
  * - just write some wrapper on your own
  * - a sample is given in 7-Zip ZS or bromt.c
  * - the function should return -1 on error and zero on success
+ * - at compression, fn_read may return 1 instead of zero, when no more
+ *   input is ready and the next read would block, like live streams
  * - the read or written bytes will go to in->size or out->size
  */
 typedef int (fnRead) (void *args, LZFSEMT_Buffer * in);
@@ -97,6 +100,12 @@ size_t LZFSEMT_compressCCtx(LZFSEMT_CCtx * ctx, LZFSEMT_RdWr_t * rdwr);
 size_t LZFSEMT_GetFramesCCtx(LZFSEMT_CCtx * ctx);
 size_t LZFSEMT_GetInsizeCCtx(LZFSEMT_CCtx * ctx);
 size_t LZFSEMT_GetOutsizeCCtx(LZFSEMT_CCtx * ctx);
+void LZFSEMT_GetStatsCCtx(LZFSEMT_CCtx * ctx, mtstat_t * st);
+int LZFSEMT_GetWorkerStatsCCtx(LZFSEMT_CCtx * ctx, mtstat_t * st, int count);
+void LZFSEMT_setProgressCCtx(LZFSEMT_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void LZFSEMT_setTraceCCtx(LZFSEMT_CCtx * ctx, mttrace_fn * fn, void *arg);
+void LZFSEMT_setExecutorCCtx(LZFSEMT_CCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
@@ -132,6 +141,13 @@ size_t LZFSEMT_decompressDCtx(LZFSEMT_DCtx * ctx, LZFSEMT_RdWr_t * rdwr);
 size_t LZFSEMT_GetFramesDCtx(LZFSEMT_DCtx * ctx);
 size_t LZFSEMT_GetInsizeDCtx(LZFSEMT_DCtx * ctx);
 size_t LZFSEMT_GetOutsizeDCtx(LZFSEMT_DCtx * ctx);
+void LZFSEMT_GetStatsDCtx(LZFSEMT_DCtx * ctx, mtstat_t * st);
+int LZFSEMT_GetWorkerStatsDCtx(LZFSEMT_DCtx * ctx, mtstat_t * st, int count);
+void LZFSEMT_setProgressDCtx(LZFSEMT_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void LZFSEMT_setTraceDCtx(LZFSEMT_DCtx * ctx, mttrace_fn * fn, void *arg);
+void LZFSEMT_setOutputDCtx(LZFSEMT_DCtx * ctx, mtoutput_fn * fn, void *arg);
+void LZFSEMT_setExecutorDCtx(LZFSEMT_DCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
@@ -0,0 +1,652 @@
+/**
+ * Copyright (c) 2024 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "memmt.h"
+#include "mtpipe.h"
+
+#define ERR(p, name)     ((p)->codec->errors[MTPIPE_##name])
+#define ISERR(p, code)   ((p)->codec->isError(code))
+
+/* error code for a failed fn_read() or fn_write() */
+static size_t mtpipe_rwerror(mtpipe * p, int rv, mtpipe_error fail)
+{
+	switch (rv) {
+	case -2:
+		return ERR(p, canceled);
+	case -3:
+		return ERR(p, memory_allocation);
+	}
+
+	return p->codec->errors[fail];
+}
+
+int mtpipe_init(mtpipe * p, const mtpipe_codec * codec, void *arg,
+		int threads, size_t inputsize)
+{
+	int t;
+
+	p->codec = codec;
+	p->arg = arg;
+	p->threads = threads;
+	p->inputsize = inputsize;
+	p->batch = 1;
+	p->history = 0;
+	p->hist.buf = 0;
+	p->hist.size = 0;
+	p->hist.allocated = 0;
+	p->insize = 0;
+	p->frames = 0;
+	p->outsize = 0;
+	p->curframe = 0;
+	memset(&p->progress, 0, sizeof(p->progress));
+	p->trace = 0;
+	p->output = 0;
+	p->executor.submit = 0;
+	p->fn_cancel = 0;
+	p->prefixsize = 0;
+
+	p->workers = (mtpipe_worker *) malloc(sizeof(mtpipe_worker) * threads);
+	if (!p->workers)
+		return -1;
+
+	for (t = 0; t < threads; t++) {
+		mtpipe_worker *w = &p->workers[t];
+		w->pipe = p;
+		w->in.buf = 0;
+		w->in.size = 0;
+		w->in.allocated = 0;
+		w->hist.buf = 0;
+		w->hist.size = 0;
+		w->hist.allocated = 0;
+		w->batch = 1;
+		memset(&w->stat, 0, sizeof(w->stat));
+	}
+
+	pthread_mutex_init(&p->read_mutex, NULL);
+	pthread_mutex_init(&p->write_mutex, NULL);
+
+	INIT_LIST_HEAD(&p->writelist_free);
+	INIT_LIST_HEAD(&p->writelist_busy);
+	INIT_LIST_HEAD(&p->writelist_done);
+
+	return 0;
+}
+
+void mtpipe_free(mtpipe * p)
+{
+	if (!p->workers)
+		return;
+
+	pthread_mutex_destroy(&p->read_mutex);
+	pthread_mutex_destroy(&p->write_mutex);
+	free(p->workers);
+	p->workers = 0;
+}
+
+int mtpipe_reserve(mtpipe_buf * b, size_t size)
+{
+	void *buf;
+
+	if (b->allocated >= size)
+		return 0;
+
+	buf = realloc(b->buf, size);
+	if (!buf)
+		return -1;
+
+	b->buf = buf;
+	b->allocated = size;
+
+	return 0;
+}
+
+/**
+ * take n output buffers from the free list, or allocate new ones,
+ * returns zero or -1 when out of memory
+ */
+static int mtpipe_getwl(mtpipe * p, mtpipe_worker * w,
+			struct writelist **wl, int n)
+{
+	int i;
+
+	MTSTAT_LOCK(&w->stat, write_wait, &p->write_mutex);
+	for (i = 0; i < n; i++) {
+		if (!list_empty(&p->writelist_free)) {
+			wl[i] = list_entry(list_first(&p->writelist_free),
+					   struct writelist, node);
+			list_move(&wl[i]->node, &p->writelist_busy);
+			continue;
+		}
+		wl[i] = (struct writelist *)malloc(sizeof(struct writelist));
+		if (!wl[i])
+			break;
+		wl[i]->out.buf = 0;
+		wl[i]->out.size = 0;
+		wl[i]->out.allocated = 0;
+		list_add(&wl[i]->node, &p->writelist_busy);
+	}
+	pthread_mutex_unlock(&p->write_mutex);
+
+	if (i == n)
+		return 0;
+
+	/* the ones we got are freed by mtpipe_run() */
+	return -1;
+}
+
+/* give n unused output buffers back */
+static void mtpipe_putwl(mtpipe * p, struct writelist **wl, int n)
+{
+	int i;
+
+	pthread_mutex_lock(&p->write_mutex);
+	for (i = 0; i < n; i++)
+		list_move(&wl[i]->node, &p->writelist_free);
+	pthread_mutex_unlock(&p->write_mutex);
+}
+
+static void mtpipe_freelist(struct list_head *head)
+{
+	while (!list_empty(head)) {
+		struct writelist *wl;
+		wl = list_entry(list_first(head), struct writelist, node);
+		free(wl->out.buf);
+		list_del(&wl->node);
+		free(wl);
+	}
+}
+
+/**
+ * mtpipe_write - queue the output of n consecutive frames, the write
+ * mutex is held
+ *
+ * All queued frames, which are next in order, are written.
+ */
+static size_t mtpipe_write(mtpipe * p, struct writelist **wl, int n)
+{
+	struct list_head *entry;
+	int i;
+
+	/* move the entries to the done list */
+	for (i = 0; i < n; i++)
+		list_move(&wl[i]->node, &p->writelist_done);
+
+	/* the entries aren't the currently needed, return...  */
+	if (wl[0]->frame != p->curframe)
+		return 0;
+
+ again:
+	/* check, what can be written ... */
+	list_for_each(entry, &p->writelist_done) {
+		struct writelist *done;
+		done = list_entry(entry, struct writelist, node);
+		if (done->frame == p->curframe) {
+			int rv = p->fn_write(p->arg_write, &done->out);
+			if (rv != 0)
+				return mtpipe_rwerror(p, rv, MTPIPE_write_fail);
+			mt_atomic_add(&p->outsize, done->out.size);
+			MTTRACE(p, written, MTTRACE_WRITER, done->frame,
+				done->out.size);
+			mt_atomic_add(&p->curframe, 1);
+			MTPROGRESS(p, 0);
+			list_move(entry, &p->writelist_free);
+			goto again;
+		}
+	}
+
+	return 0;
+}
+
+/* queue the output of n frames and write it, when it's next */
+static size_t mtpipe_queue(mtpipe * p, mtpipe_worker * w,
+			   struct writelist **wl, int n)
+{
+	size_t result;
+	int i;
+
+	for (i = 0; i < n; i++)
+		MTTRACE(p, queued, w - p->workers, wl[i]->frame,
+			wl[i]->out.size);
+	MTSTAT_LOCK(&w->stat, write_wait, &p->write_mutex);
+	MTSTAT_TIME(&w->stat, write, result = mtpipe_write(p, wl, n));
+	pthread_mutex_unlock(&p->write_mutex);
+
+	return result;
+}
+
+/**
+ * mtpipe_history - give w the input in front of its frame, then append
+ * the frame to it, called with the read mutex held
+ */
+static void mtpipe_history(mtpipe * p, mtpipe_worker * w)
+{
+	size_t size = w->in.size, keep;
+
+	memcpy(w->hist.buf, p->hist.buf, p->hist.size);
+	w->hist.size = p->hist.size;
+
+	if (size >= p->history) {
+		memcpy(p->hist.buf, (char *)w->in.buf + size - p->history,
+		       p->history);
+		p->hist.size = p->history;
+		return;
+	}
+
+	/* small frame, keep the end of the older input */
+	keep = p->history - size;
+	if (keep > p->hist.size)
+		keep = p->hist.size;
+	memmove(p->hist.buf, (char *)p->hist.buf + p->hist.size - keep, keep);
+	memcpy((char *)p->hist.buf + keep, w->in.buf, size);
+	p->hist.size = keep + size;
+}
+
+/**
+ * mtpipe_batch - the frames of the next batch of w, from the codec time
+ * ns of its last batch with n frames
+ */
+static void mtpipe_batch(mtpipe * p, mtpipe_worker * w,
+			 unsigned long long ns, int n)
+{
+	unsigned long long frame = ns / n + 1;
+	unsigned long long batch = (MTPIPE_BATCH_NS + frame - 1) / frame;
+
+	w->batch = batch < (unsigned long long)p->batch ? (int)batch : p->batch;
+}
+
+static void *pt_compress_frames(void *arg)
+{
+	mtpipe_worker *w = (mtpipe_worker *) arg;
+	mtpipe *p = w->pipe;
+	int id = (int)(w - p->workers);
+	size_t bound = p->codec->bound(p->arg, p->inputsize);
+	MTSTAT_VAR;
+
+	/* inbuf is constant, it's kept for all batches of the worker */
+	if (mtpipe_reserve(&w->in, p->inputsize * p->batch))
+		return (void *)ERR(p, memory_allocation);
+	if (mtpipe_reserve(&w->hist, p->history))
+		return (void *)ERR(p, memory_allocation);
+
+	for (;;) {
+		struct writelist *wl[MTPIPE_BATCH_MAX];
+		size_t insize[MTPIPE_BATCH_MAX];
+		unsigned long long codec;
+		mtpipe_buf in;
+		size_t result;
+		int i, n = w->batch, rv;
+
+		/* allocate space for new output */
+		if (mtpipe_getwl(p, w, wl, n))
+			return (void *)ERR(p, memory_allocation);
+		for (i = 0; i < n; i++)
+			if (mtpipe_reserve(&wl[i]->out, bound)) {
+				mtpipe_putwl(p, wl, n);
+				return (void *)ERR(p, memory_allocation);
+			}
+
+		/* read new input, up to n frames */
+		MTTRACE(p, read_begin, id, 0, 0);
+		MTSTAT_LOCK(&w->stat, read_wait, &p->read_mutex);
+		w->in.size = 0;
+		for (i = 0; i < n; i++) {
+			if (i)
+				MTTRACE(p, read_begin, id, 0, 0);
+			in.buf = (char *)w->in.buf + w->in.size;
+			in.size = p->inputsize;
+			in.allocated = p->inputsize;
+			MTSTAT_TIME(&w->stat, read,
+				    rv = p->fn_read(p->arg_read, &in));
+			if (rv != 0 && rv != MTPIPE_READ_IDLE) {
+				pthread_mutex_unlock(&p->read_mutex);
+				mtpipe_putwl(p, wl, n);
+				return (void *)mtpipe_rwerror(p, rv,
+							      MTPIPE_read_fail);
+			}
+
+			/* eof, empty input still gets one frame */
+			if (in.size == 0 && p->frames > 0) {
+				MTTRACE(p, read_end, id, 0, 0);
+				break;
+			}
+			insize[i] = in.size;
+			w->in.size += in.size;
+			wl[i]->frame = p->frames++;
+			MTTRACE(p, read_end, id, wl[i]->frame, in.size);
+
+			/* eof, a flushed frame or no more input ready, don't
+			 * wait for more */
+			if (in.size < p->inputsize || rv == MTPIPE_READ_IDLE) {
+				i++;
+				break;
+			}
+		}
+		mt_atomic_add(&p->insize, w->in.size);
+		if (p->history && i)
+			mtpipe_history(p, w);
+		pthread_mutex_unlock(&p->read_mutex);
+
+		/* the rest of the output buffers isn't needed */
+		if (i < n)
+			mtpipe_putwl(p, wl + i, n - i);
+		n = i;
+		if (n == 0)
+			return 0;
+
+		/* compress the whole frames */
+		codec = w->stat.codec;
+		in.buf = w->in.buf;
+		for (i = 0; i < n; i++) {
+			in.size = insize[i];
+			in.allocated = insize[i];
+			MTTRACE(p, codec_begin, id, wl[i]->frame, in.size);
+			MTSTAT_BEGIN();
+			result = p->codec->compress(p->arg, id, &wl[i]->out,
+						    &in);
+			MTSTAT_END(&w->stat, codec);
+			if (ISERR(p, result)) {
+				mtpipe_putwl(p, wl, n);
+				return (void *)result;
+			}
+			MTTRACE(p, codec_end, id, wl[i]->frame, in.size);
+			MTSTAT_FRAME(&w->stat, in.size, wl[i]->out.size);
+			in.buf = (char *)in.buf + in.size;
+		}
+		mtpipe_batch(p, w, w->stat.codec - codec, n);
+
+		/* write results */
+		result = mtpipe_queue(p, w, wl, n);
+		if (ISERR(p, result))
+			return (void *)result;
+
+		/* with an executor, each batch is a task of its own */
+		if (mt_task_yield(&w->task))
+			return MT_YIELD;
+	}
+}
+
+/* a failed worker wakes the source of the others, see mtpipe.fn_cancel */
+static void *pt_compress(void *arg)
+{
+	mtpipe_worker *w = (mtpipe_worker *) arg;
+	mtpipe *p = w->pipe;
+	void *result = pt_compress_frames(arg);
+
+	if (result && result != MT_YIELD && p->fn_cancel)
+		p->fn_cancel(p->arg_read);
+
+	return result;
+}
+
+/**
+ * mtpipe_read - read the skippable frame and the frame behind it
+ *
+ * At the end of input, w->in.size is zero.
+ */
+static size_t mtpipe_read(mtpipe * p, mtpipe_worker * w, size_t * frame)
+{
+	size_t hdrsize = p->codec->hdrsize;
+	mtpipe_buf hdr;
+	size_t toRead;
+	int rv;
+
+	MTSTAT_LOCK(&w->stat, read_wait, &p->read_mutex);
+
+	/* special case, first bytes already read */
+	memcpy(w->hdr, p->prefix, p->prefixsize);
+	hdr.buf = w->hdr + p->prefixsize;
+	hdr.size = hdrsize - p->prefixsize;
+	hdr.allocated = hdr.size;
+	MTSTAT_TIME(&w->stat, read, rv = p->fn_read(p->arg_read, &hdr));
+	if (rv != 0) {
+		pthread_mutex_unlock(&p->read_mutex);
+		return mtpipe_rwerror(p, rv, MTPIPE_read_fail);
+	}
+
+	/* eof reached ? */
+	if (hdr.size == 0 && p->prefixsize == 0) {
+		pthread_mutex_unlock(&p->read_mutex);
+		w->in.size = 0;
+		return 0;
+	}
+	if (hdr.size != hdrsize - p->prefixsize)
+		goto error_read;
+	p->prefixsize = 0;
+
+	/* check header data */
+	if (MEM_readLE32(w->hdr + 0) != MTPIPE_MAGIC_SKIPPABLE)
+		goto error_data;
+	if (MEM_readLE32(w->hdr + 4) != hdrsize - 8)
+		goto error_data;
+
+	/* read new inputsize */
+	toRead = MEM_readLE32(w->hdr + 8);
+	if (mtpipe_reserve(&w->in, toRead))
+		goto error_nomem;
+	w->in.size = toRead;
+	MTSTAT_TIME(&w->stat, read, rv = p->fn_read(p->arg_read, &w->in));
+	if (rv != 0) {
+		pthread_mutex_unlock(&p->read_mutex);
+		return mtpipe_rwerror(p, rv, MTPIPE_read_fail);
+	}
+
+	/* needed more bytes! */
+	if (w->in.size != toRead)
+		goto error_data;
+
+	mt_atomic_add(&p->insize, hdrsize + toRead);
+	*frame = p->frames++;
+	pthread_mutex_unlock(&p->read_mutex);
+
+	return 0;
+
+ error_data:
+	pthread_mutex_unlock(&p->read_mutex);
+	return ERR(p, data_error);
+ error_read:
+	pthread_mutex_unlock(&p->read_mutex);
+	return ERR(p, read_fail);
+ error_nomem:
+	pthread_mutex_unlock(&p->read_mutex);
+	return ERR(p, memory_allocation);
+}
+
+static void *pt_decompress(void *arg)
+{
+	mtpipe_worker *w = (mtpipe_worker *) arg;
+	mtpipe *p = w->pipe;
+	int id = (int)(w - p->workers);
+	MTSTAT_VAR;
+
+	for (;;) {
+		struct writelist *wl;
+		size_t result;
+
+		/* allocate space for new output */
+		if (mtpipe_getwl(p, w, &wl, 1))
+			return (void *)ERR(p, memory_allocation);
+
+		/* read new input */
+		MTTRACE(p, read_begin, id, 0, 0);
+		result = mtpipe_read(p, w, &wl->frame);
+		if (ISERR(p, result)) {
+			mtpipe_putwl(p, &wl, 1);
+			return (void *)result;
+		}
+		MTTRACE(p, read_end, id, w->in.size ? wl->frame : 0,
+			w->in.size);
+		if (w->in.size == 0) {
+			mtpipe_putwl(p, &wl, 1);
+			return 0;
+		}
+
+		/* decompress whole frame */
+		MTTRACE(p, codec_begin, id, wl->frame, w->in.size);
+		MTSTAT_BEGIN();
+		result = p->codec->decompress(p->arg, id, &wl->out, &w->in,
+					      w->hdr);
+		MTSTAT_END(&w->stat, codec);
+		if (ISERR(p, result)) {
+			mtpipe_putwl(p, &wl, 1);
+			return (void *)result;
+		}
+		MTTRACE(p, codec_end, id, wl->frame, w->in.size);
+		MTOUTPUT(p, wl->frame, wl->out.buf, wl->out.size);
+
+		/* write result */
+		MTSTAT_FRAME(&w->stat, w->in.size, wl->out.size);
+		result = mtpipe_queue(p, w, &wl, 1);
+		if (ISERR(p, result))
+			return (void *)result;
+
+		/* with an executor, each frame is a task of its own */
+		if (mt_task_yield(&w->task))
+			return MT_YIELD;
+	}
+}
+
+/* start the workers, wait for them and free all buffers */
+static size_t mtpipe_run(mtpipe * p, void *(*fn)(void *))
+{
+	void *result;
+	int t, workers;
+
+	/* init counters */
+	mt_atomic_set(&p->insize, 0);
+	mt_atomic_set(&p->outsize, 0);
+	mt_atomic_set(&p->curframe, 0);
+	p->frames = 0;
+
+	workers = mt_group_workers(&p->executor, p->threads);
+	if (workers == 1 && !p->executor.submit) {
+		/* no pthread_create() needed! */
+		p->workers[0].task.threaded = 1;
+		result = fn(&p->workers[0]);
+	} else {
+		/* as threads or as tasks of the executor */
+		mt_group group;
+
+		mt_group_init(&group, &p->executor);
+		for (t = 0; t < workers; t++) {
+			mtpipe_worker *w = &p->workers[t];
+			mt_group_start(&group, &w->task, fn, w);
+		}
+		result = mt_group_wait(&group);
+	}
+
+	/* the input buffers and all output buffers, after an error some
+	 * of them may still be busy or done */
+	for (t = 0; t < p->threads; t++) {
+		mtpipe_worker *w = &p->workers[t];
+		free(w->in.buf);
+		w->in.buf = 0;
+		w->in.size = 0;
+		w->in.allocated = 0;
+		free(w->hist.buf);
+		w->hist.buf = 0;
+		w->hist.size = 0;
+		w->hist.allocated = 0;
+	}
+	free(p->hist.buf);
+	p->hist.buf = 0;
+	p->hist.size = 0;
+	p->hist.allocated = 0;
+	mtpipe_freelist(&p->writelist_free);
+	mtpipe_freelist(&p->writelist_busy);
+	mtpipe_freelist(&p->writelist_done);
+
+	if (!result)
+		MTPROGRESS(p, 1);
+
+	return (size_t)result;
+}
+
+size_t mtpipe_compress(mtpipe * p, mtpipe_fn * fn_read, void *arg_read,
+		       mtpipe_fn * fn_write, void *arg_write)
+{
+	int t;
+
+	p->fn_read = fn_read;
+	p->arg_read = arg_read;
+	p->fn_write = fn_write;
+	p->arg_write = arg_write;
+	p->prefixsize = 0;
+	if (mtpipe_reserve(&p->hist, p->history))
+		return ERR(p, memory_allocation);
+
+	/* linked frames need the history of each frame, no batches */
+	p->batch = 1;
+	if (!p->history && p->inputsize < MTPIPE_BATCH_BYTES)
+		p->batch = (int)(MTPIPE_BATCH_BYTES / p->inputsize);
+	if (p->batch > MTPIPE_BATCH_MAX)
+		p->batch = MTPIPE_BATCH_MAX;
+	for (t = 0; t < p->threads; t++)
+		p->workers[t].batch = 1;
+
+	return mtpipe_run(p, pt_compress);
+}
+
+size_t mtpipe_decompress(mtpipe * p, mtpipe_fn * fn_read, void *arg_read,
+			 mtpipe_fn * fn_write, void *arg_write,
+			 const void *prefix, size_t prefixsize)
+{
+	if (prefixsize > p->codec->hdrsize)
+		return ERR(p, data_error);
+
+	p->fn_read = fn_read;
+	p->arg_read = arg_read;
+	p->fn_write = fn_write;
+	p->arg_write = arg_write;
+	memcpy(p->prefix, prefix, prefixsize);
+	p->prefixsize = prefixsize;
+
+	return mtpipe_run(p, pt_decompress);
+}
+
+/* the counters of all workers together */
+void mtpipe_stats(mtpipe * p, mtstat_t * st)
+{
+	int t;
+
+	memset(st, 0, sizeof(*st));
+	if (!p->workers)
+		return;
+
+	for (t = 0; t < p->threads; t++)
+		mtstat_add(st, &p->workers[t].stat);
+}
+
+/* returns the number of workers, up to count of them are copied to st */
+int mtpipe_worker_stats(mtpipe * p, mtstat_t * st, int count)
+{
+	int t;
+
+	if (!p->workers)
+		return 0;
+
+	for (t = 0; t < p->threads && t < count; t++)
+		st[t] = p->workers[t].stat;
+
+	return p->threads;
+}
+
+/* run the workers as tasks of ex, or on threads again, when ex is zero */
+void mtpipe_executor(mtpipe * p, const mt_executor * ex)
+{
+	if (ex)
+		p->executor = *ex;
+	else
+		p->executor.submit = 0;
+}
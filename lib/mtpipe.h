@@ -0,0 +1,241 @@
+/**
+ * Copyright (c) 2024 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+#ifndef MTPIPE_H
+#define MTPIPE_H
+
+#include <stddef.h>   /* size_t */
+
+#include "threading.h"
+#include "list.h"
+#include "mtstat.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/**
+ * mtpipe - the frame pipeline of all -mt libraries
+ *
+ * - each worker reads the next frame under the read mutex, runs the
+ *   codec on it and queues the output
+ * - at compression, a worker may read a batch of frames at once and
+ *   queue their output at once, see MTPIPE_BATCH_NS, but it only waits
+ *   for input, which is ready, see MTPIPE_READ_IDLE
+ * - the worker, which finishes the next frame in order, writes all
+ *   queued frames, which follow it
+ * - the output buffers are kept in a free list and reused
+ *
+ * The codec only provides the functions of mtpipe_codec. Each context
+ * of the libraries embeds one mtpipe, its statistic fields are used by
+ * the MTTRACE(), MTOUTPUT() and MTPROGRESS() macros.
+ */
+
+/**
+ * batches at compression: a worker reads so many frames at once, that
+ * the codec needs about MTPIPE_BATCH_NS for them, measured on its last
+ * batch, up to MTPIPE_BATCH_MAX frames and MTPIPE_BATCH_BYTES of input
+ */
+#define MTPIPE_BATCH_NS    250000
+#define MTPIPE_BATCH_MAX   16
+#define MTPIPE_BATCH_BYTES (4*1024*1024)
+
+/* the skippable frame in front of each frame of the -mt formats */
+#define MTPIPE_MAGIC_SKIPPABLE 0x184D2A50U
+#define MTPIPE_HDR_MAX 16
+
+/* same layout as the <codec>_Buffer of the libraries */
+typedef struct {
+	void *buf;		/* ptr to data */
+	size_t size;		/* current filled in buf */
+	size_t allocated;	/* length of buf */
+} mtpipe_buf;
+
+/**
+ * fn_read and fn_write of the libraries, see <codec>-mt.h, at compression
+ * fn_read returns MTPIPE_READ_IDLE instead of zero, when no more input is
+ * ready and the next read may block, so the batch ends with this frame
+ */
+typedef int (mtpipe_fn) (void *args, mtpipe_buf * b);
+#define MTPIPE_READ_IDLE 1
+
+/* errors of the pipeline, the codec maps them to its own codes */
+typedef enum {
+	MTPIPE_memory_allocation,
+	MTPIPE_read_fail,
+	MTPIPE_write_fail,
+	MTPIPE_data_error,
+	MTPIPE_canceled,
+	MTPIPE_errors
+} mtpipe_error;
+
+/* the mapping for the error enums of the libraries, which share these
+ * names: static const size_t errors[] = MTPIPE_ERRORS(ERROR); */
+#define MTPIPE_ERRORS(ERR) { ERR(memory_allocation), ERR(read_fail), \
+	ERR(write_fail), ERR(data_error), ERR(canceled) }
+
+typedef struct {
+	/* size of the skippable frame in front of each frame, 12 or 16 */
+	size_t hdrsize;
+
+	/* <codec>_isError() and the codes for mtpipe_error */
+	unsigned (*isError)(size_t code);
+	const size_t *errors;
+
+	/* max. size of one compressed frame of insize bytes, with header */
+	size_t (*bound)(void *arg, size_t insize);
+
+	/**
+	 * compress in into out, with the skippable frame in front of it,
+	 * out->allocated bytes are available, out may be grown with
+	 * mtpipe_reserve(), sets out->size, returns zero or an error code
+	 */
+	size_t (*compress)(void *arg, int worker, mtpipe_buf * out,
+			   const mtpipe_buf * in);
+
+	/**
+	 * decompress the frame in into out, hdr is the skippable frame in
+	 * front of it, its magic, size and length fields are checked
+	 * already, out must be grown with mtpipe_reserve(), sets out->size,
+	 * returns zero or an error code
+	 */
+	size_t (*decompress)(void *arg, int worker, mtpipe_buf * out,
+			     const mtpipe_buf * in, const unsigned char *hdr);
+} mtpipe_codec;
+
+typedef struct mtpipe_s mtpipe;
+
+/* one worker, on a thread or as task of the executor */
+typedef struct {
+	mtpipe *pipe;
+	mt_task task;
+	mtpipe_buf in;
+	mtpipe_buf hist;	/* input before in, see mtpipe.history */
+	unsigned char hdr[MTPIPE_HDR_MAX];
+	int batch;		/* frames of the next batch */
+	mtstat_t stat;
+} mtpipe_worker;
+
+struct writelist;
+struct writelist {
+	size_t frame;
+	mtpipe_buf out;
+	struct list_head node;
+};
+
+struct mtpipe_s {
+	const mtpipe_codec *codec;
+	void *arg;		/* first argument of the codec functions */
+
+	/* threads: 1..<codec>_THREAD_MAX */
+	int threads;
+
+	/* bytes of input for one frame, at compression */
+	size_t inputsize;
+
+	/* max. frames of one batch, at compression */
+	int batch;
+
+	/**
+	 * linked frames, at compression: the worker gets up to history
+	 * bytes of the input in front of its frame in w->hist, for use as
+	 * dictionary, zero disables it
+	 */
+	size_t history;
+	mtpipe_buf hist;
+
+	/**
+	 * statistic, the reader side (read_mutex) and the writer side
+	 * (write_mutex) are on different cache lines, insize, outsize and
+	 * curframe are updated atomically, so they may be read any time
+	 */
+	char pad_in[MT_CACHELINE];
+	size_t insize;
+	size_t frames;
+	char pad_out[MT_CACHELINE];
+	size_t outsize;
+	size_t curframe;
+	char pad_end[MT_CACHELINE];
+
+	/* progress callback, called by the writer */
+	mtprogress_t progress;
+
+	/* trace callback, called by all workers */
+	mttrace_fn *trace;
+	void *trace_arg;
+
+	/* output callback of each frame, called by all workers */
+	mtoutput_fn *output;
+	void *output_arg;
+
+	/* executor of the caller, threads are used without one */
+	mt_executor executor;
+
+	/* threading */
+	mtpipe_worker *workers;
+
+	/* reading input, prefix holds bytes of the first header, which
+	 * were read already by the format detection */
+	pthread_mutex_t read_mutex;
+	mtpipe_fn *fn_read;
+	void *arg_read;
+	unsigned char prefix[MTPIPE_HDR_MAX];
+	size_t prefixsize;
+
+	/**
+	 * at compression, called with arg_read, when a worker fails, so a
+	 * source, which waits for input, gives the other workers the end
+	 * of input, zero for sources, which never wait
+	 */
+	void (*fn_cancel)(void *arg_read);
+
+	/* writing output */
+	pthread_mutex_t write_mutex;
+	mtpipe_fn *fn_write;
+	void *arg_write;
+
+	/* lists for writing queue: free -> busy -> done -> free -> ... */
+	struct list_head writelist_free;
+	struct list_head writelist_busy;
+	struct list_head writelist_done;
+};
+
+/* setup p for the codec, returns zero or -1 when out of memory */
+extern int mtpipe_init(mtpipe * p, const mtpipe_codec * codec, void *arg,
+		       int threads, size_t inputsize);
+extern void mtpipe_free(mtpipe * p);
+
+/* make room for size bytes in b, returns zero or -1 */
+extern int mtpipe_reserve(mtpipe_buf * b, size_t size);
+
+/* run the pipeline until the input ends, returns zero or an error code */
+extern size_t mtpipe_compress(mtpipe * p, mtpipe_fn * fn_read,
+			      void *arg_read, mtpipe_fn * fn_write,
+			      void *arg_write);
+
+/* the same for decompression, prefix are the first bytes of the input,
+ * which were already read by the caller (up to MTPIPE_HDR_MAX) */
+extern size_t mtpipe_decompress(mtpipe * p, mtpipe_fn * fn_read,
+				void *arg_read, mtpipe_fn * fn_write,
+				void *arg_write, const void *prefix,
+				size_t prefixsize);
+
+/* statistic and callbacks, for the <codec>_Get* and _set* functions */
+extern void mtpipe_stats(mtpipe * p, mtstat_t * st);
+extern int mtpipe_worker_stats(mtpipe * p, mtstat_t * st, int count);
+extern void mtpipe_executor(mtpipe * p, const mt_executor * ex);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif				/* MTPIPE_H */
@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) 2024 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+#include <stddef.h>
+
+#include "mtstat.h"
+
+#ifdef _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+unsigned long long mtstat_now(void)
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+
+	/* split it, the product would overflow after some hours */
+	return (unsigned long long)(now.QuadPart / freq.QuadPart) *
+	    1000000000ULL + (unsigned long long)(now.QuadPart %
+						  freq.QuadPart) *
+	    1000000000ULL / freq.QuadPart;
+}
+
+#else
+
+#include <time.h>
+
+unsigned long long mtstat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
+
+void mtstat_frame(mtstat_t * st, unsigned long long start,
+		  size_t insize, size_t outsize)
+{
+	unsigned long long us = (mtstat_now() - start) / 1000;
+	int i = 0;
+
+	while (us && i < MTSTAT_HIST - 1) {
+		us >>= 1;
+		i++;
+	}
+
+	st->frames++;
+	st->insize += insize;
+	st->outsize += outsize;
+	st->hist[i]++;
+}
+
+void mtstat_add(mtstat_t * sum, const mtstat_t * st)
+{
+	int i;
+
+	sum->frames += st->frames;
+	sum->insize += st->insize;
+	sum->outsize += st->outsize;
+	sum->read += st->read;
+	sum->read_wait += st->read_wait;
+	sum->codec += st->codec;
+	sum->write_wait += st->write_wait;
+	sum->write += st->write;
+	for (i = 0; i < MTSTAT_HIST; i++)
+		sum->hist[i] += st->hist[i];
+}
+
+void mtprogress_init(mtprogress_t * p, mtprogress_fn * fn, void *arg,
+		     unsigned ms, size_t bytes)
+{
+	p->fn = fn;
+	p->arg = arg;
+	p->interval = (unsigned long long)ms * 1000000;
+	p->bytes = bytes;
+	p->last_time = mtstat_now();
+	p->last_bytes = 0;
+}
+
+void mtprogress_tick(mtprogress_t * p, size_t insize, size_t outsize,
+		     size_t frames, int force)
+{
+	if (!p->fn)
+		return;
+
+	if (!force && (p->interval || p->bytes)) {
+		int due = 0;
+
+		if (p->bytes && outsize - p->last_bytes >= p->bytes)
+			due = 1;
+		if (!due && p->interval) {
+			unsigned long long now = mtstat_now();
+			if (now - p->last_time >= p->interval)
+				due = 1;
+		}
+		if (!due)
+			return;
+	}
+
+	if (p->interval)
+		p->last_time = mtstat_now();
+	p->last_bytes = outsize;
+	p->fn(p->arg, insize, outsize, frames);
+}
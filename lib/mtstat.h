@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2024 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+#ifndef MTSTAT_H
+#define MTSTAT_H
+
+#include <stddef.h>   /* size_t */
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* buckets of the frame latency histogram */
+#define MTSTAT_HIST 24
+
+/**
+ * counters of one worker thread
+ *
+ * - all times are in nanoseconds of wall time
+ * - each worker only updates its own counters, so there is no locking;
+ *   read them when the (de)compression is done
+ * - hist[0] counts frames, which took less than 1 us from the start of
+ *   the codec until their output was written, hist[i] the ones which
+ *   took less than 2^i us and the last bucket all the slower ones
+ */
+typedef struct {
+	unsigned long long frames;	/* number of processed frames */
+	unsigned long long insize;	/* bytes of input */
+	unsigned long long outsize;	/* bytes of output */
+	unsigned long long read;	/* in fn_read */
+	unsigned long long read_wait;	/* waiting for the read mutex */
+	unsigned long long codec;	/* in the (de)compression library */
+	unsigned long long write_wait;	/* waiting for the write mutex */
+	unsigned long long write;	/* in pt_write(): ordering + fn_write */
+	unsigned long long hist[MTSTAT_HIST];
+} mtstat_t;
+
+/* monotonic clock in nanoseconds */
+extern unsigned long long mtstat_now(void);
+
+/* count one frame with its sizes and the latency since start */
+extern void mtstat_frame(mtstat_t * st, unsigned long long start,
+			 size_t insize, size_t outsize);
+
+/* add the counters of st to sum */
+extern void mtstat_add(mtstat_t * sum, const mtstat_t * st);
+
+/**
+ * progress callback
+ *
+ * It is called by the writer thread, while it holds the write mutex,
+ * so it should return fast. The values are the bytes read and written
+ * and the number of written frames so far.
+ */
+typedef void (mtprogress_fn)(void *arg, size_t insize, size_t outsize,
+			     size_t frames);
+
+typedef struct {
+	mtprogress_fn *fn;
+	void *arg;
+	unsigned long long interval;	/* ns between two calls, or 0 */
+	size_t bytes;			/* output bytes between two calls */
+	unsigned long long last_time;
+	size_t last_bytes;
+} mtprogress_t;
+
+/* register fn, it is called at most every ms milliseconds or bytes of
+ * output, whatever comes first, zero for both means after each frame */
+extern void mtprogress_init(mtprogress_t * p, mtprogress_fn * fn, void *arg,
+			    unsigned ms, size_t bytes);
+
+/* call the callback, when it is due or when force is set */
+extern void mtprogress_tick(mtprogress_t * p, size_t insize, size_t outsize,
+			    size_t frames, int force);
+
+/* for contexts with insize, outsize and curframe as atomic counters */
+#define MTPROGRESS(ctx, force) do { \
+	if ((ctx)->progress.fn) \
+		mtprogress_tick(&(ctx)->progress, \
+				mt_atomic_get(&(ctx)->insize), \
+				mt_atomic_get(&(ctx)->outsize), \
+				mt_atomic_get(&(ctx)->curframe), force); \
+} while (0)
+
+/**
+ * frame lifecycle events
+ *
+ * Each event is a USDT probe zstdmt:<event> with the arguments worker,
+ * frame and size, when <sys/sdt.h> is available (define MT_NO_USDT to
+ * leave them out). It is also passed to the trace callback of a context,
+ * when one is set. The callback is called by all workers in parallel.
+ *
+ * - read_begin: before waiting for the read mutex, frame is not known yet
+ * - read_end: the input of the frame is read, size is the input size
+ * - codec_begin, codec_end: around the (de)compression, size is the input
+ * - queued: the output is done and waits for writing, size is the output
+ * - written: the output is written, in order, worker is MTTRACE_WRITER
+ */
+typedef enum {
+	MTTRACE_read_begin,
+	MTTRACE_read_end,
+	MTTRACE_codec_begin,
+	MTTRACE_codec_end,
+	MTTRACE_queued,
+	MTTRACE_written
+} mttrace_event;
+
+#define MTTRACE_WRITER -1
+
+/* ns is the time of mtstat_now() */
+typedef void (mttrace_fn)(void *arg, mttrace_event event, int worker,
+			  size_t frame, size_t size, unsigned long long ns);
+
+#if !defined(MT_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MTTRACE_PROBE(event, worker, frame, size) \
+	DTRACE_PROBE3(zstdmt, event, worker, frame, size)
+#endif
+#endif
+
+#ifndef MTTRACE_PROBE
+#define MTTRACE_PROBE(event, worker, frame, size) do { } while (0)
+#endif
+
+/* for contexts with trace and trace_arg, worker is the index in cwork */
+#define MTTRACE(ctx, event, worker, frame, size) do { \
+	MTTRACE_PROBE(event, (int)(worker), (size_t)(frame), (size_t)(size)); \
+	if ((ctx)->trace) \
+		(ctx)->trace((ctx)->trace_arg, MTTRACE_##event, \
+			     (int)(worker), frame, size, mtstat_now()); \
+} while (0)
+
+/**
+ * output of each frame, at decompression
+ *
+ * The worker of each frame calls it with the output, before the frame is
+ * queued for writing, so the calls run in parallel and not in order.
+ * frame counts from zero, the frames are written in that order, each one
+ * with one call of fn_write. Paths without frames, like one thread or
+ * linked frames, do not call it.
+ */
+typedef void (mtoutput_fn)(void *arg, size_t frame, const void *buf,
+			   size_t size);
+
+/* for contexts with output and output_arg */
+#define MTOUTPUT(ctx, frame, buf, size) do { \
+	if ((ctx)->output) \
+		(ctx)->output((ctx)->output_arg, frame, buf, size); \
+} while (0)
+
+/**
+ * executor of the caller, used instead of one thread per worker
+ *
+ * - submit() must run fn(arg) later on some thread of the pool and
+ *   return zero, when the task was accepted
+ * - the workers become tasks, which handle one frame each (one batch
+ *   at compression, see mtpipe.h) and then submit themselves again, so
+ *   they never block a pool thread for longer than that and the read
+ *   and write waits
+ * - concurrency is the number of workers, which should run at the same
+ *   time, zero means the threads of the context
+ */
+typedef void (mt_task_fn)(void *arg);
+
+typedef struct {
+	int (*submit)(void *pool, mt_task_fn * fn, void *arg);
+	void *pool;
+	int concurrency;
+} mt_executor;
+
+/* run some statement and add the used time to the given field */
+#define MTSTAT_TIME(st, field, ...) do { \
+	unsigned long long mtstat_t0 = mtstat_now(); \
+	__VA_ARGS__; \
+	(st)->field += mtstat_now() - mtstat_t0; \
+} while (0)
+
+#define MTSTAT_LOCK(st, field, mutex) \
+	MTSTAT_TIME(st, field, pthread_mutex_lock(mutex))
+
+/* the same for bigger blocks, MTSTAT_VAR must be declared before */
+#define MTSTAT_VAR            unsigned long long mtstat_t0 = 0
+#define MTSTAT_BEGIN()        mtstat_t0 = mtstat_now()
+#define MTSTAT_END(st, field) (st)->field += mtstat_now() - mtstat_t0
+
+/* one frame is done, its latency starts at MTSTAT_BEGIN() */
+#define MTSTAT_FRAME(st, insize, outsize) \
+	mtstat_frame(st, mtstat_t0, insize, outsize)
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif				/* MTSTAT_H */
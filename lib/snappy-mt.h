@@ -10,12 +10,22 @@ extern "C" {
 #endif
 
 #include <stddef.h>   /* size_t */
+#include "mtstat.h"   /* mtstat_t */
 
 #define SNAPPY_OK 0
 #define SNAPPYMT_THREAD_MAX 128
 #define SNAPPYMT_MAGICNUMBER 0x5053 // SP
 #define SNAPPYMT_MAGIC_SKIPPABLE 0x184D2A50U  // MT magic number
 
+/* the official snappy framing format, chunks of up to 64 KiB */
+#define SNAPPYMT_FRAMED_CHUNK (64*1024)
+#define SNAPPYMT_FRAMED_ID "\xff\x06\x00\x00sNaPpY"
+#define SNAPPYMT_FRAMED_IDSIZE 10
+#define SNAPPYMT_CHUNK_COMPRESSED   0x00
+#define SNAPPYMT_CHUNK_UNCOMPRESSED 0x01
+#define SNAPPYMT_CHUNK_PADDING      0xfe
+#define SNAPPYMT_CHUNK_STREAM_ID    0xff
+
 /* **************************************
  * Error Handling
  ****************************************/
@@ -55,6 +65,8 @@ typedef struct {
  * - just write some wrapper on your own
  * - a sample is given in 7-Zip ZS or bromt.c
  * - the function should return -1 on error and zero on success
+ * - at compression, fn_read may return 1 instead of zero, when no more
+ *   input is ready and the next read would block, like live streams
  * - the read or written bytes will go to in->size or out->size
  */
 typedef int (fnRead) (void *args, SNAPPYMT_Buffer * in);
@@ -85,6 +97,21 @@ typedef struct SNAPPYMT_CCtx_s SNAPPYMT_CCtx;
 SNAPPYMT_CCtx *SNAPPYMT_createCCtx(int threads, int level,/*Not use*/ 
                                    int inputsize);
 
+/**
+ * 1b) change some advanced setting of the encoder, before 2)
+ * - return zero or an error code
+ *
+ * SNAPPYMT_p_framed: 1 = write the official snappy framing format, with
+ *   a masked crc32c of each 64 KiB chunk, the standard snappy tools can
+ *   read it, SNAPPYMT_decompressDCtx() reads both formats
+ */
+typedef enum {
+	SNAPPYMT_p_framed
+} SNAPPYMT_cParameter;
+
+size_t SNAPPYMT_setCCtxParameter(SNAPPYMT_CCtx * ctx,
+				 SNAPPYMT_cParameter param, int value);
+
 /**
  * 2) threaded compression
  * - errorcheck via 
@@ -97,6 +124,12 @@ size_t SNAPPYMT_compressCCtx(SNAPPYMT_CCtx * ctx, SNAPPYMT_RdWr_t * rdwr);
 size_t SNAPPYMT_GetFramesCCtx(SNAPPYMT_CCtx * ctx);
 size_t SNAPPYMT_GetInsizeCCtx(SNAPPYMT_CCtx * ctx);
 size_t SNAPPYMT_GetOutsizeCCtx(SNAPPYMT_CCtx * ctx);
+void SNAPPYMT_GetStatsCCtx(SNAPPYMT_CCtx * ctx, mtstat_t * st);
+int SNAPPYMT_GetWorkerStatsCCtx(SNAPPYMT_CCtx * ctx, mtstat_t * st, int count);
+void SNAPPYMT_setProgressCCtx(SNAPPYMT_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void SNAPPYMT_setTraceCCtx(SNAPPYMT_CCtx * ctx, mttrace_fn * fn, void *arg);
+void SNAPPYMT_setExecutorCCtx(SNAPPYMT_CCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
@@ -132,6 +165,13 @@ size_t SNAPPYMT_decompressDCtx(SNAPPYMT_DCtx * ctx, SNAPPYMT_RdWr_t * rdwr);
 size_t SNAPPYMT_GetFramesDCtx(SNAPPYMT_DCtx * ctx);
 size_t SNAPPYMT_GetInsizeDCtx(SNAPPYMT_DCtx * ctx);
 size_t SNAPPYMT_GetOutsizeDCtx(SNAPPYMT_DCtx * ctx);
+void SNAPPYMT_GetStatsDCtx(SNAPPYMT_DCtx * ctx, mtstat_t * st);
+int SNAPPYMT_GetWorkerStatsDCtx(SNAPPYMT_DCtx * ctx, mtstat_t * st, int count);
+void SNAPPYMT_setProgressDCtx(SNAPPYMT_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void SNAPPYMT_setTraceDCtx(SNAPPYMT_DCtx * ctx, mttrace_fn * fn, void *arg);
+void SNAPPYMT_setOutputDCtx(SNAPPYMT_DCtx * ctx, mtoutput_fn * fn, void *arg);
+void SNAPPYMT_setExecutorDCtx(SNAPPYMT_DCtx * ctx, const mt_executor * ex);
 
 /**
  * 4) free cctx
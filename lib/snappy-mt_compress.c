@@ -2,8 +2,8 @@
 #include "snappy-mt.h"
 
 #include "memmt.h"
-#include "threading.h"
-#include "list.h"
+#include "mtpipe.h"
+#include "crc32c.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,71 +22,138 @@
  *   2) release read mutex and do compression
  *   3) get write mutex and write result
  *   4) begin with step 1 again, until no input
+ * - the workers are run by mtpipe, this file only does the snappy part
  */
 
-typedef struct {
-	SNAPPYMT_CCtx *ctx;
-	struct snappy_env zpref;
-	pthread_t pthread;
-} cwork_t;
-
-struct writelist {
-	size_t frame;
-	SNAPPYMT_Buffer out;
-	struct list_head node;
-};
-
-
 struct SNAPPYMT_CCtx_s {
 
 	/* levels: 1..SNAPPYMT NOT USE  DELETE level maybe later*/
 	int level;
 
-	/* threads: 1..SNAPPYMT_THREAD_MAX */
-	int threads;
+	/* SNAPPYMT_p_framed */
+	int framed;
 
-	/* should be used for read from input */
-	int inputsize;
+	/* the frame pipeline, see mtpipe.h */
+	mtpipe pipe;
+};
 
-	/* statistic */
-	size_t insize;
-	size_t outsize;
-	size_t curframe;
-	size_t frames;
+/* **************************************
+ * Compression
+ ****************************************/
 
-	/* threading */
-	cwork_t *cwork;
+static const size_t errors[] = MTPIPE_ERRORS(MT_ERROR);
 
-	/* reading input */
-	pthread_mutex_t read_mutex;
-	fnRead *fn_read;
-	void *arg_read;
+static size_t snappymt_bound(void *arg, size_t insize)
+{
+	SNAPPYMT_CCtx *ctx = (SNAPPYMT_CCtx *) arg;
 
-	/* writing output */
-	pthread_mutex_t write_mutex;
-	fnWrite *fn_write;
-	void *arg_write;
+	/* chunk header and crc of each chunk */
+	if (ctx->framed)
+		return (insize / SNAPPYMT_FRAMED_CHUNK + 1) *
+		    (snappy_max_compressed_length(SNAPPYMT_FRAMED_CHUNK) + 8);
 
-	/* lists for writing queue */
-	struct list_head writelist_free;
-	struct list_head writelist_busy;
-	struct list_head writelist_done;
-};
+	return snappy_max_compressed_length(insize) + 16;
+}
 
-/* **************************************
- * Compression
- ****************************************/
+/**
+ * SNAPPYMT_p_framed: the input becomes chunks of the snappy framing
+ * format, the stream identifier is written by SNAPPYMT_compressCCtx()
+ */
+static size_t snappymt_framed(struct snappy_env *env, mtpipe_buf * out,
+			      const mtpipe_buf * in)
+{
+	const char *src = (const char *)in->buf;
+	unsigned char *dst = (unsigned char *)out->buf;
+	size_t pos, size, csize;
+	unsigned int crc;
+
+	out->size = 0;
+	for (pos = 0; pos < in->size; pos += size) {
+		unsigned char *chunk = dst + out->size;
+
+		size = in->size - pos;
+		if (size > SNAPPYMT_FRAMED_CHUNK)
+			size = SNAPPYMT_FRAMED_CHUNK;
+
+		/* the crc is over the uncompressed data */
+		crc = mt_crc32c(src + pos, size, 0);
+		if (snappy_compress(env, src + pos, size, (char *)chunk + 8,
+				    &csize) != SNAPPY_OK)
+			return MT_ERROR(frame_compress);
+
+		/* store it, when it doesn't get 1/8 smaller */
+		if (csize >= size - size / 8) {
+			memcpy(chunk + 8, src + pos, size);
+			csize = size;
+			chunk[0] = SNAPPYMT_CHUNK_UNCOMPRESSED;
+		} else
+			chunk[0] = SNAPPYMT_CHUNK_COMPRESSED;
+
+		chunk[1] = (unsigned char)(csize + 4);
+		chunk[2] = (unsigned char)((csize + 4) >> 8);
+		chunk[3] = (unsigned char)((csize + 4) >> 16);
+		MEM_writeLE32(chunk + 4, MT_CRC32C_MASK(crc));
+		out->size += 8 + csize;
+	}
+
+	return 0;
+}
+
+static size_t snappymt_compress(void *arg, int worker, mtpipe_buf * out,
+				const mtpipe_buf * in)
+{
+	SNAPPYMT_CCtx *ctx = (SNAPPYMT_CCtx *) arg;
+	size_t inputsize = ctx->pipe.inputsize;
+	const char *ibuf = (char *)(in->buf);
+	char *obuf = (char *)(out->buf) + 16;
+	struct snappy_env env;
+	U16 hintsize;
+	int rv;
+
+	(void)worker;
+	out->size = out->allocated - 16;
+	rv = snappy_init_env(&env);
+	if (rv != SNAPPY_OK)
+		return MT_ERROR(memory_allocation);
+	if (ctx->framed) {
+		size_t ret = snappymt_framed(&env, out, in);
+		snappy_free_env(&env);
+		return ret;
+	}
+	rv = snappy_compress(&env, ibuf, in->size, obuf, &out->size);
+	snappy_free_env(&env);
+	if (rv != SNAPPY_OK)
+		return MT_ERROR(frame_compress);
+
+	/* write skippable frame */
+	MEM_writeLE32((unsigned char *)out->buf + 0, SNAPPYMT_MAGIC_SKIPPABLE);
+	MEM_writeLE32((unsigned char *)out->buf + 4, 8);
+	MEM_writeLE32((unsigned char *)out->buf + 8, (U32) out->size);
+	/* SP */
+	MEM_writeLE16((unsigned char *)out->buf + 12,
+		      (U16) SNAPPYMT_MAGICNUMBER);
+
+	/* number of 64KB blocks needed for decompression */
+	if (inputsize > in->size) {
+		hintsize = (U16)(in->size >> 16);
+		hintsize += 1;
+	} else
+		hintsize = (U16)(inputsize >> 16);
+	MEM_writeLE16((unsigned char *)out->buf + 14, hintsize);
+
+	out->size += 16;
+
+	return 0;
+}
+
+static const mtpipe_codec snappymt_codec = {
+	16, SNAPPYMT_isError, errors, snappymt_bound, snappymt_compress, 0
+};
 
 SNAPPYMT_CCtx *SNAPPYMT_createCCtx(int threads, __attribute__((unused)) int level,/*Not use*/ 
 								   int inputsize)
 {
 	SNAPPYMT_CCtx *ctx;
-	int t;
-
-	/* allocate ctx */
-	ctx = (SNAPPYMT_CCtx *) malloc(sizeof(SNAPPYMT_CCtx));
-	if (!ctx)
-		return 0;
 
 	/* check threads value */
 	if (threads < 1 || threads > SNAPPYMT_THREAD_MAX)
@@ -95,291 +162,152 @@ SNAPPYMT_CCtx *SNAPPYMT_createCCtx(int threads, __attribute__((unused)) int leve
 	/* check level */
 	/* None level */
 
+	/* allocate ctx */
+	ctx = (SNAPPYMT_CCtx *) malloc(sizeof(SNAPPYMT_CCtx));
+	if (!ctx)
+		return 0;
+
 	/* calculate chunksize for one thread */
-	if (inputsize)
-		ctx->inputsize = inputsize;
-	else
-		ctx->inputsize = SNAPPY_IN_ALLOC_SIZE;  /* 64K frame */
+	if (!inputsize)
+		inputsize = SNAPPY_IN_ALLOC_SIZE;  /* 64K frame */
 
 	/* setup ctx */
 	ctx->level = 0; 
-	ctx->threads = threads;
-	ctx->insize = 0;
-	ctx->outsize = 0;
-	ctx->frames = 0;
-	ctx->curframe = 0;
-
-	pthread_mutex_init(&ctx->read_mutex, NULL);
-	pthread_mutex_init(&ctx->write_mutex, NULL);
-
-	/* free -> busy -> out -> free -> ... */
-	INIT_LIST_HEAD(&ctx->writelist_free);	/* free, can be used */
-	INIT_LIST_HEAD(&ctx->writelist_busy);	/* busy */
-	INIT_LIST_HEAD(&ctx->writelist_done);	/* can be written */
-
-	ctx->cwork = (cwork_t *) malloc(sizeof(cwork_t) * threads);
-	if (!ctx->cwork)
-		goto err_cwork;
-
-	for (t = 0; t < threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		w->ctx = ctx;
-
-	}
+	ctx->framed = 0;
+	if (mtpipe_init(&ctx->pipe, &snappymt_codec, ctx, threads, inputsize))
+		goto err_pipe;
 
 	return ctx;
 
- err_cwork:
+ err_pipe:
 	free(ctx);
 
 	return NULL;
 }
 
-/**
- * mt_error - return mt lib specific error code read write ERROR
- */
-static size_t mt_error(int rv)
+size_t SNAPPYMT_setCCtxParameter(SNAPPYMT_CCtx * ctx,
+				 SNAPPYMT_cParameter param, int value)
 {
-	switch (rv) {
-	case -1:
-		return MT_ERROR(read_fail);
-	case -2:
-		return MT_ERROR(canceled);
-	case -3:
-		return MT_ERROR(memory_allocation);
+	if (!ctx)
+		return MT_ERROR(compressionParameter_unsupported);
+
+	switch (param) {
+	case SNAPPYMT_p_framed:
+		ctx->framed = value ? 1 : 0;
+		return 0;
 	}
 
-	return MT_ERROR(read_fail);
+	return MT_ERROR(compressionParameter_unsupported);
 }
 
-/**
- * pt_write - queue for compressed output
- */
-static size_t pt_write(SNAPPYMT_CCtx *ctx, struct writelist *wl)
+size_t SNAPPYMT_compressCCtx(SNAPPYMT_CCtx * ctx, SNAPPYMT_RdWr_t * rdwr)
 {
-	struct list_head *entry;
-
-	/* move the entry to the done list */
-	list_move(&wl->node, &ctx->writelist_done);
+	unsigned char id[SNAPPYMT_FRAMED_IDSIZE];
+	SNAPPYMT_Buffer b;
+	size_t ret;
 
-	/* the entry isn't the currently needed, return...  */
-	if (wl->frame != ctx->curframe)
-		return 0;
+	if (!ctx)
+		return MT_ERROR(compressionParameter_unsupported);
 
- again:
-	/* check, what can be written ... */
-	list_for_each(entry, &ctx->writelist_done) {
-		wl = list_entry(entry, struct writelist, node);
-		if (wl->frame == ctx->curframe) {
-			int rv = ctx->fn_write(ctx->arg_write, &wl->out);
-			if (rv != 0)
-				return mt_error(rv);
-			ctx->outsize += wl->out.size;
-			ctx->curframe++;
-			list_move(entry, &ctx->writelist_free);
-			goto again;
-		}
-	}
+	if (!ctx->framed)
+		return mtpipe_compress(&ctx->pipe,
+				       (mtpipe_fn *) rdwr->fn_read,
+				       rdwr->arg_read,
+				       (mtpipe_fn *) rdwr->fn_write,
+				       rdwr->arg_write);
+
+	/* SNAPPYMT_p_framed: the workers write the chunks after it */
+	memcpy(id, SNAPPYMT_FRAMED_ID, SNAPPYMT_FRAMED_IDSIZE);
+	b.buf = id;
+	b.size = SNAPPYMT_FRAMED_IDSIZE;
+	if (rdwr->fn_write(rdwr->arg_write, &b))
+		return MT_ERROR(write_fail);
+
+	mt_crc32c_init();
+	ret = mtpipe_compress(&ctx->pipe, (mtpipe_fn *) rdwr->fn_read,
+			      rdwr->arg_read, (mtpipe_fn *) rdwr->fn_write,
+			      rdwr->arg_write);
+	if (SNAPPYMT_isError(ret))
+		return ret;
+	mt_atomic_add(&ctx->pipe.outsize, SNAPPYMT_FRAMED_IDSIZE);
 
 	return 0;
 }
 
-static void *pt_compress(void *arg)
+/* returns current uncompressed data size */
+size_t SNAPPYMT_GetInsizeCCtx(SNAPPYMT_CCtx * ctx)
 {
-	cwork_t *w = (cwork_t *) arg;
-	SNAPPYMT_CCtx *ctx = w->ctx;
-	size_t result;
-	SNAPPYMT_Buffer in;
-
-	/* inbuf is constant */
-	in.size = ctx->inputsize;
-	in.buf = malloc(in.size);
-	if (!in.buf)
-		return (void *)MT_ERROR(memory_allocation);
-
-	for (;;) {
-		struct list_head *entry;
-		struct writelist *wl;
-		int rv;
-
-		/* allocate space for new output */
-		pthread_mutex_lock(&ctx->write_mutex);
-		if (!list_empty(&ctx->writelist_free)) {
-			/* take unused entry */
-			entry = list_first(&ctx->writelist_free);
-			wl = list_entry(entry, struct writelist, node);
-			wl->out.size =
-			    snappy_max_compressed_length((size_t)(ctx->inputsize)) + 16;
-			list_move(entry, &ctx->writelist_busy);
-		} else {
-			/* allocate new one */
-			wl = (struct writelist *)
-			    malloc(sizeof(struct writelist));
-			if (!wl) {
-				pthread_mutex_unlock(&ctx->write_mutex);
-				return (void *)MT_ERROR(memory_allocation);
-			}
-			wl->out.size =
-			    snappy_max_compressed_length((size_t)(ctx->inputsize)) + 16;
-			wl->out.buf = malloc(wl->out.size);
-			if (!wl->out.buf) {
-				pthread_mutex_unlock(&ctx->write_mutex);
-				return (void *)MT_ERROR(memory_allocation);
-			}
-			list_add(&wl->node, &ctx->writelist_busy);
-		}
-		pthread_mutex_unlock(&ctx->write_mutex);
-
-		/* read new input */
-		pthread_mutex_lock(&ctx->read_mutex);
-		in.size = ctx->inputsize;
-		rv = ctx->fn_read(ctx->arg_read, &in);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return (void *)mt_error(rv);
-		}
-
-		/* eof */
-		if (in.size == 0 && ctx->frames > 0) {
-			free(in.buf);
-			pthread_mutex_unlock(&ctx->read_mutex);
-
-			pthread_mutex_lock(&ctx->write_mutex);
-			list_move(&wl->node, &ctx->writelist_free);
-			pthread_mutex_unlock(&ctx->write_mutex);
-
-			goto okay;
-		}
-		ctx->insize += in.size;
-		wl->frame = ctx->frames++;
-		pthread_mutex_unlock(&ctx->read_mutex);
-
-		/* compress whole frame */
-		{
-			const char *ibuf = (char *)(in.buf);
-			char *obuf = (char *)(wl->out.buf) + 16;
-			wl->out.size -= 16;
-
-
-			struct snappy_env env;
-			snappy_init_env(&env);
-			rv = snappy_compress(&(env), ibuf, in.size, obuf, &wl->out.size);
-
-			/* printf("snappy_compress() rv=%d in=%zu out=%zu\n", rv, in.size, wl->out.size); */
-
-			if (rv != SNAPPY_OK) {
-				pthread_mutex_lock(&ctx->write_mutex);
-				list_move(&wl->node, &ctx->writelist_free);
-				pthread_mutex_unlock(&ctx->write_mutex);
-				return (void *)MT_ERROR(frame_compress);
-			}
-			snappy_free_env(&(env));
-		}
-
-		/* write skippable frame */
-		MEM_writeLE32((unsigned char *)wl->out.buf + 0,
-			      SNAPPYMT_MAGIC_SKIPPABLE);
-		MEM_writeLE32((unsigned char *)wl->out.buf + 4, 8);
-		MEM_writeLE32((unsigned char *)wl->out.buf + 8,
-			      (U32) wl->out.size);
-		/* BR */
-		MEM_writeLE16((unsigned char *)wl->out.buf + 12,
-			      (U16) SNAPPYMT_MAGICNUMBER);
-
-		/* number of 64KB blocks needed for decompression */
-		{
-		U16 hintsize;
-		if (ctx->inputsize > (int)in.size) {
-			hintsize = (U16)(in.size >> 16);
-			hintsize += 1;
-		} else
-			hintsize = ctx->inputsize >> 16;
-		MEM_writeLE16((unsigned char *)wl->out.buf + 14,
-			      hintsize);
-		}
-
-		wl->out.size += 16;
-
-		/* write result */
-		pthread_mutex_lock(&ctx->write_mutex);
-		result = pt_write(ctx, wl);
-		pthread_mutex_unlock(&ctx->write_mutex);
-		if (SNAPPYMT_isError(result))
-			return (void *)result;
-	}
+	if (!ctx)
+		return 0;
 
- okay:
-	return 0;
+	return mt_atomic_get(&ctx->pipe.insize);
 }
 
-size_t SNAPPYMT_compressCCtx(SNAPPYMT_CCtx *ctx, SNAPPYMT_RdWr_t *rdwr)
+/* returns the current compressed data size */
+size_t SNAPPYMT_GetOutsizeCCtx(SNAPPYMT_CCtx * ctx)
 {
-	int t;
-	void *retval_of_thread = 0;
-
 	if (!ctx)
-		return MT_ERROR(compressionParameter_unsupported);
+		return 0;
 
-	/* init reading and writing functions */
-	ctx->fn_read = rdwr->fn_read;
-	ctx->fn_write = rdwr->fn_write;
-	ctx->arg_read = rdwr->arg_read;
-	ctx->arg_write = rdwr->arg_write;
+	return mt_atomic_get(&ctx->pipe.outsize);
+}
 
-	/* start all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		pthread_create(&w->pthread, NULL, pt_compress, w);
-	}
+/* returns the current compressed frames */
+size_t SNAPPYMT_GetFramesCCtx(SNAPPYMT_CCtx * ctx)
+{
+	if (!ctx)
+		return 0;
 
-	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(w->pthread, &p);
-		if (p)
-			retval_of_thread = p;
-	}
+	return mt_atomic_get(&ctx->pipe.curframe);
+}
 
-	/* clean up lists */
-	while (!list_empty(&ctx->writelist_free)) {
-		struct writelist *wl;
-		struct list_head *entry;
-		entry = list_first(&ctx->writelist_free);
-		wl = list_entry(entry, struct writelist, node);
-		free(wl->out.buf);
-		list_del(&wl->node);
-		free(wl);
+/* returns the counters of all workers together */
+void SNAPPYMT_GetStatsCCtx(SNAPPYMT_CCtx * ctx, mtstat_t * st)
+{
+	if (!ctx) {
+		memset(st, 0, sizeof(*st));
+		return;
 	}
 
-	return (size_t) retval_of_thread;
+	mtpipe_stats(&ctx->pipe, st);
 }
 
-/* returns current uncompressed data size */
-size_t SNAPPYMT_GetInsizeCCtx(SNAPPYMT_CCtx * ctx)
+/* returns the number of workers, up to count of them are copied to st */
+int SNAPPYMT_GetWorkerStatsCCtx(SNAPPYMT_CCtx * ctx, mtstat_t * st, int count)
 {
 	if (!ctx)
 		return 0;
 
-	return ctx->insize;
+	return mtpipe_worker_stats(&ctx->pipe, st, count);
 }
 
-/* returns the current compressed data size */
-size_t SNAPPYMT_GetOutsizeCCtx(SNAPPYMT_CCtx * ctx)
+/* register a progress callback, see mtprogress_init() */
+void SNAPPYMT_setProgressCCtx(SNAPPYMT_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes)
 {
 	if (!ctx)
-		return 0;
+		return;
 
-	return ctx->outsize;
+	mtprogress_init(&ctx->pipe.progress, fn, arg, ms, bytes);
 }
 
-/* returns the current compressed frames */
-size_t SNAPPYMT_GetFramesCCtx(SNAPPYMT_CCtx * ctx)
+/* register a trace callback, see mttrace_fn in mtstat.h */
+void SNAPPYMT_setTraceCCtx(SNAPPYMT_CCtx * ctx, mttrace_fn * fn, void *arg)
 {
 	if (!ctx)
-		return 0;
+		return;
+
+	ctx->pipe.trace = fn;
+	ctx->pipe.trace_arg = arg;
+}
+
+/* run the workers as tasks of ex, or on threads again, when ex is zero */
+void SNAPPYMT_setExecutorCCtx(SNAPPYMT_CCtx * ctx, const mt_executor * ex)
+{
+	if (!ctx)
+		return;
 
-	return ctx->curframe;
+	mtpipe_executor(&ctx->pipe, ex);
 }
 
 void SNAPPYMT_freeCCtx(SNAPPYMT_CCtx * ctx)
@@ -387,9 +315,7 @@ void SNAPPYMT_freeCCtx(SNAPPYMT_CCtx * ctx)
 	if (!ctx)
 		return;
 
-	pthread_mutex_destroy(&ctx->read_mutex);
-	pthread_mutex_destroy(&ctx->write_mutex);
-	free(ctx->cwork);
+	mtpipe_free(&ctx->pipe);
 	free(ctx);
 	ctx = 0;
 
@@ -2,8 +2,8 @@
 #include "snappy-mt.h"
 
 #include "memmt.h"
-#include "threading.h"
-#include "list.h"
+#include "mtpipe.h"
+#include "crc32c.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,109 +22,128 @@
  *   2) release read mutex and do compression
  *   3) get write mutex and write result
  *   4) begin with step 1 again, until no input
+ * - the workers are run by mtpipe, this file only does the snappy part
  */
 
-/* worker for compression */
+/**
+ * parallel decompression of the snappy framing format
+ *
+ * fr_read() gives each compressed or uncompressed chunk to the pipeline,
+ * with a skippable frame in front of it, the chunk type is in place of
+ * the "SP" magic. The workers decompress the chunks and check their crc.
+ */
 typedef struct {
-	SNAPPYMT_DCtx *ctx;
-	pthread_t pthread;
-	SNAPPYMT_Buffer in;
-} cwork_t;
-
-struct writelist {
-	size_t frame;
-	SNAPPYMT_Buffer out;
-	struct list_head node;
-};
+	int on;			/* the pipeline runs on chunks of fr_read() */
+	SNAPPYMT_RdWr_t *rdwr;	/* the read and write functions of the caller */
+	size_t error;		/* of fr_read() */
+	int inchunk;		/* the chunk itself is read next */
+	size_t insize;
+} fr_t;
 
 struct SNAPPYMT_DCtx_s {
 
-	/* threads: 1..SNAPPYMT_THREAD_MAX */
-	int threads;
-
-	/* should be used for read from input */
-	size_t inputsize;
+	/* the snappy framing format */
+	fr_t fr;
 
-	/* statistic */
-	size_t insize;
-	size_t outsize;
-	size_t curframe;
-	size_t frames;
-
-	/* threading */
-	cwork_t *cwork;
-
-	/* reading input */
-	pthread_mutex_t read_mutex;
-	fnRead *fn_read;
-	void *arg_read;
-
-	/* writing output */
-	pthread_mutex_t write_mutex;
-	fnWrite *fn_write;
-	void *arg_write;
-
-	/* lists for writing queue */
-	struct list_head writelist_free;
-	struct list_head writelist_busy;
-	struct list_head writelist_done;
+	/* the frame pipeline, see mtpipe.h */
+	mtpipe pipe;
 };
 
 /* **************************************
  * Decompression
  ****************************************/
 
+static const size_t errors[] = MTPIPE_ERRORS(MT_ERROR);
+
+/* decompress one chunk of fr_read(), crc and data */
+static size_t fr_decompress(mtpipe_buf * out, const mtpipe_buf * in,
+			    const unsigned char *hdr)
+{
+	const char *src = (const char *)in->buf + 4;
+	size_t size = in->size - 4;
+
+	if (hdr[12] == SNAPPYMT_CHUNK_UNCOMPRESSED) {
+		out->size = size;
+		if (mtpipe_reserve(out, out->size))
+			return MT_ERROR(memory_allocation);
+		memcpy(out->buf, src, size);
+	} else {
+		if (!snappy_uncompressed_length(src, size, &out->size) ||
+		    out->size > SNAPPYMT_FRAMED_CHUNK)
+			return MT_ERROR(data_error);
+		if (mtpipe_reserve(out, out->size))
+			return MT_ERROR(memory_allocation);
+		if (snappy_uncompress(src, size, (char *)out->buf) !=
+		    SNAPPY_OK)
+			return MT_ERROR(frame_decompress);
+	}
+
+	if (MT_CRC32C_MASK(mt_crc32c(out->buf, out->size, 0)) !=
+	    MEM_readLE32(in->buf))
+		return MT_ERROR(frame_decompress);
+
+	return 0;
+}
+
+static size_t snappymt_decompress(void *arg, int worker, mtpipe_buf * out,
+				  const mtpipe_buf * in,
+				  const unsigned char *hdr)
+{
+	SNAPPYMT_DCtx *ctx = (SNAPPYMT_DCtx *) arg;
+	int rv;
+
+	(void)worker;
+	if (ctx->fr.on)
+		return fr_decompress(out, in, hdr);
+
+	if (MEM_readLE16(hdr + 12) != SNAPPYMT_MAGICNUMBER)
+		return MT_ERROR(data_error);
+
+	/* get uncompressed size for output buffer */
+	if (!snappy_uncompressed_length((char *)in->buf, in->size, &out->size))
+		return MT_ERROR(data_error);
+	if (mtpipe_reserve(out, out->size))
+		return MT_ERROR(memory_allocation);
+
+	rv = snappy_uncompress((char *)(in->buf), in->size,
+			       (char *)(out->buf));
+	if (rv != SNAPPY_OK)
+		return MT_ERROR(frame_decompress);
+
+	return 0;
+}
+
+static const mtpipe_codec snappymt_codec = {
+	16, SNAPPYMT_isError, errors, 0, 0, snappymt_decompress
+};
+
 SNAPPYMT_DCtx *SNAPPYMT_createDCtx(int threads, int inputsize)
 {
 	SNAPPYMT_DCtx *ctx;
-	int t;
-
-	/* allocate ctx */
-	ctx = (SNAPPYMT_DCtx *) malloc(sizeof(SNAPPYMT_DCtx));
-	if (!ctx)
-		return 0;
 
 	/* check threads value */
 	if (threads < 1 || threads > SNAPPYMT_THREAD_MAX)
 		return 0;
 
-	/* setup ctx */
-	ctx->threads = threads;
-	ctx->insize = 0;
-	ctx->outsize = 0;
-	ctx->frames = 0;
-	ctx->curframe = 0;
+	/* allocate ctx */
+	ctx = (SNAPPYMT_DCtx *) malloc(sizeof(SNAPPYMT_DCtx));
+	if (!ctx)
+		return 0;
 
 	/* will be used for single stream only */
-	if (inputsize)
-		ctx->inputsize = inputsize;
-	else
-		ctx->inputsize = 1024 * 64;	/* 64K buffer */
-
-	pthread_mutex_init(&ctx->read_mutex, NULL);
-	pthread_mutex_init(&ctx->write_mutex, NULL);
+	if (!inputsize)
+		inputsize = 1024 * 64;	/* 64K buffer */
 
-	INIT_LIST_HEAD(&ctx->writelist_free);
-	INIT_LIST_HEAD(&ctx->writelist_busy);
-	INIT_LIST_HEAD(&ctx->writelist_done);
+	ctx->fr.on = 0;
+	mt_crc32c_init();
 
-	ctx->cwork = (cwork_t *) malloc(sizeof(cwork_t) * threads);
-	if (!ctx->cwork)
-		goto err_cwork;
-
-	for (t = 0; t < threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-        w->in.allocated = 0;
-        w->in.buf = NULL;
-        w->in.size = 0;
-		w->ctx = ctx;
-	}
+	if (mtpipe_init(&ctx->pipe, &snappymt_codec, ctx, threads, inputsize))
+		goto err_pipe;
 
 	return ctx;
 
- err_cwork:
+ err_pipe:
 	free(ctx);
-    ctx = NULL;
 
 	return 0;
 }
@@ -147,325 +166,179 @@ static size_t mt_error(int rv)
 	return MT_ERROR(read_fail);
 }
 
-/**
- * pt_write - queue for decompressed output
- */
-static size_t pt_write(SNAPPYMT_DCtx * ctx, struct writelist *wl)
+/* read exactly size bytes of the input, returns 1 at the end of input */
+static int fr_get(SNAPPYMT_DCtx * ctx, void *buf, size_t size)
 {
-	struct list_head *entry;
-
-	/* move the entry to the done list */
-	list_move(&wl->node, &ctx->writelist_done);
+	fr_t *fr = &ctx->fr;
+	SNAPPYMT_Buffer b;
+	int rv;
 
-    /* the entry isn't the currently needed, return...  */
-    if (wl->frame != ctx->curframe)
+	b.buf = buf;
+	b.size = size;
+	rv = fr->rdwr->fn_read(fr->rdwr->arg_read, &b);
+	if (rv != 0)
+		return rv;
+	fr->insize += b.size;
+	if (b.size == size)
 		return 0;
+	if (b.size == 0)
+		return 1;
 
- again:
-	/* check, what can be written ... */
-	list_for_each(entry, &ctx->writelist_done) {
-		wl = list_entry(entry, struct writelist, node);
-		if (wl->frame == ctx->curframe) {
-			int rv = ctx->fn_write(ctx->arg_write, &wl->out);
-			if (rv != 0)
-				return mt_error(rv);
-			ctx->outsize += wl->out.size;
-			ctx->curframe++;
-			list_move(entry, &ctx->writelist_free);
-			goto again;
-		}
-	}
-
-	return 0;
+	fr->error = MT_ERROR(data_error);
+	return -1;
 }
 
+/* the max. size of a chunk with data, crc included */
+#define FR_CHUNK_MAX(type) (4 + ((type) == SNAPPYMT_CHUNK_COMPRESSED ? \
+	snappy_max_compressed_length(SNAPPYMT_FRAMED_CHUNK) : \
+	SNAPPYMT_FRAMED_CHUNK))
+
 /**
- * pt_read - read compressed output Verify header information
+ * fr_read - fn_read of the pipeline, it reads the chunk headers and
+ * skips the stream identifiers and the skippable chunks
  */
-static size_t pt_read(SNAPPYMT_DCtx *ctx, SNAPPYMT_Buffer *in, size_t *frame, 
-                      size_t *uncompressed)
+static int fr_read(void *arg, mtpipe_buf * b)
 {
-	unsigned char hdrbuf[16];
-	SNAPPYMT_Buffer hdr;
+	SNAPPYMT_DCtx *ctx = (SNAPPYMT_DCtx *) arg;
+	fr_t *fr = &ctx->fr;
+	unsigned char *dst = (unsigned char *)b->buf;
+	unsigned char hdr[SNAPPYMT_FRAMED_IDSIZE];
+	size_t size;
 	int rv;
 
-	/* read skippable frame (12 or 16 bytes) */
-	pthread_mutex_lock(&ctx->read_mutex);
-
-	/* special case, first 4 bytes already read */
-	if (ctx->frames == 0) {
-		hdr.buf = hdrbuf + 4;
-		hdr.size = 12;
-		rv = ctx->fn_read(ctx->arg_read, &hdr);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		if (hdr.size != 12)
-			goto error_read;
-		hdr.buf = hdrbuf;
-	} else {
-		hdr.buf = hdrbuf;
-		hdr.size = 16;
-		rv = ctx->fn_read(ctx->arg_read, &hdr);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
-		}
-		/* eof reached ? */
-		if (hdr.size == 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			in->size = 0;
-			return 0;
-		}
-		if (hdr.size != 16)
-			goto error_read;
-		if (MEM_readLE32((unsigned char *)hdr.buf + 0) !=
-		    SNAPPYMT_MAGIC_SKIPPABLE)
-			goto error_data;
+	/* the chunk itself */
+	if (fr->inchunk) {
+		fr->inchunk = 0;
+		rv = fr_get(ctx, b->buf, b->size);
+		if (rv == 1)
+			fr->error = MT_ERROR(data_error);
+		return rv == 1 ? -1 : rv;
 	}
 
-	/* check header data */
-	if (MEM_readLE32((unsigned char *)hdr.buf + 4) != 8)
-		goto error_data;
-	if (MEM_readLE16((unsigned char *)hdr.buf + 12) != SNAPPYMT_MAGICNUMBER)
-		goto error_data;
-
-	// /* get uncompressed size for output buffer */
-	// {
-	// 	U16 hintsize = MEM_readLE16((unsigned char *)hdr.buf + 14);
-	// 	*uncompressed = hintsize << 16;
-	// }
-
-	ctx->insize += 16;
-	/* read new inputsize */
-	{
-		size_t toRead = MEM_readLE32((unsigned char *)hdr.buf + 8);
-		if (in->allocated < toRead) {
-			/* need bigger input buffer */
-			if (in->allocated)
-				in->buf = realloc(in->buf, toRead);
-			else
-				in->buf = malloc(toRead);
-			if (!in->buf)
-				goto error_nomem;
-			in->allocated = toRead;
+	for (;;) {
+		rv = fr_get(ctx, hdr, 4);
+		if (rv == 1) {
+			b->size = 0;
+			return 0;
 		}
-
-		in->size = toRead;
-		rv = ctx->fn_read(ctx->arg_read, in);
-		/* generic read failure! */
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			return mt_error(rv);
+		if (rv != 0)
+			return rv;
+		size = hdr[1] | hdr[2] << 8 | (size_t)hdr[3] << 16;
+
+		switch (hdr[0]) {
+		case SNAPPYMT_CHUNK_COMPRESSED:
+		case SNAPPYMT_CHUNK_UNCOMPRESSED:
+			if (size < 4 || size > FR_CHUNK_MAX(hdr[0]))
+				goto error_data;
+			MEM_writeLE32(dst + 0, SNAPPYMT_MAGIC_SKIPPABLE);
+			MEM_writeLE32(dst + 4, 8);
+			MEM_writeLE32(dst + 8, (U32) size);
+			MEM_writeLE16(dst + 12, hdr[0]);
+			MEM_writeLE16(dst + 14, 1);
+			b->size = 16;
+			fr->inchunk = 1;
+			return 0;
+		case SNAPPYMT_CHUNK_STREAM_ID:
+			/* also in front of each concatenated stream */
+			if (size != SNAPPYMT_FRAMED_IDSIZE - 4)
+				goto error_data;
+			rv = fr_get(ctx, hdr + 4, size);
+			if (rv != 0 && rv != 1)
+				return rv;
+			if (rv == 1 || memcmp(hdr, SNAPPYMT_FRAMED_ID,
+					      SNAPPYMT_FRAMED_IDSIZE))
+				goto error_data;
+			break;
+		default:
+			/* reserved unskippable chunks */
+			if (hdr[0] < 0x80)
+				goto error_data;
+
+			/* padding and reserved skippable chunks */
+			while (size) {
+				size_t n = size < sizeof(hdr) ? size : sizeof(hdr);
+				rv = fr_get(ctx, hdr, n);
+				if (rv == 1)
+					goto error_data;
+				if (rv != 0)
+					return rv;
+				size -= n;
+			}
 		}
-        // size_t output_length = 0;
-        // if(snappy_validate_compressed_buffer((char *)in->buf, in->size) 
-        //     != SNAPPY_OK){
-        //         return MT_ERROR(data_error);
-        // }
-        snappy_uncompressed_length((char *)in->buf, in->size, uncompressed);
-        //*uncompressed = output_length;
-		/* needed more bytes! */
-		if (in->size != toRead)
-			goto error_data;
-
-		ctx->insize += in->size;
 	}
-	*frame = ctx->frames++;
-	pthread_mutex_unlock(&ctx->read_mutex);
-
-	/* done, no error */
-	return 0;
 
  error_data:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return MT_ERROR(data_error);
- error_read:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return MT_ERROR(read_fail);
- error_nomem:
-	pthread_mutex_unlock(&ctx->read_mutex);
-	return MT_ERROR(memory_allocation);
+	fr->error = MT_ERROR(data_error);
+	return -1;
 }
 
-static void *pt_decompress(void *arg)
+/* decompress the snappy framing format with the workers */
+static size_t fr_decompress_all(SNAPPYMT_DCtx * ctx, SNAPPYMT_RdWr_t * rdwr,
+				const unsigned char *buf)
 {
-	cwork_t *w = (cwork_t *) arg;
-	SNAPPYMT_Buffer *in = &w->in;
-	SNAPPYMT_DCtx *ctx = w->ctx;
-	size_t result = 0;
-	struct writelist *wl;
-
-	for (;;) {
-		struct list_head *entry;
-		SNAPPYMT_Buffer *out;
-		int rv;
-
-		/* allocate space for new output */
-		pthread_mutex_lock(&ctx->write_mutex);
-		if (!list_empty(&ctx->writelist_free)) {
-			/* take unused entry */
-			entry = list_first(&ctx->writelist_free);
-			wl = list_entry(entry, struct writelist, node);
-			list_move(entry, &ctx->writelist_busy);
-		} else {
-			/* allocate new one */
-			wl = (struct writelist *)
-			    malloc(sizeof(struct writelist));
-			if (!wl) {
-				result = MT_ERROR(memory_allocation);
-				goto error_unlock;
-			}
-			wl->out.buf = 0;
-			wl->out.size = 0;
-			wl->out.allocated = 0;
-			list_add(&wl->node, &ctx->writelist_busy);
-		}
-		pthread_mutex_unlock(&ctx->write_mutex);
-		out = &wl->out;
-
-		/* zero should not happen here! */
-		result = pt_read(ctx, in, &wl->frame, &(wl->out.size));
-		if (SNAPPYMT_isError(result)) {
-			list_move(&wl->node, &ctx->writelist_free);
-			goto error_lock;
-		}
-
-		if (in->size == 0)
-			break;
-
-		if (out->allocated < out->size) {
-			if (out->allocated)
-				out->buf = realloc(out->buf, out->size);
-			else
-				out->buf = malloc(out->size);
-			if (!out->buf) {
-				result = MT_ERROR(memory_allocation);
-				goto error_lock;
-			}
-			out->allocated = out->size;
-		}
-
-		rv = snappy_uncompress((char *)(in->buf), in->size, (char *)(out->buf));
-
-		if (rv != SNAPPY_OK) {
-			result = MT_ERROR(frame_decompress);
-			goto error_lock;
-		}
+	fr_t *fr = &ctx->fr;
+	unsigned char id[SNAPPYMT_FRAMED_IDSIZE];
+	size_t ret;
+	int rv;
 
-		/* write result */
-		pthread_mutex_lock(&ctx->write_mutex);
-		result = pt_write(ctx, wl);
-		if (SNAPPYMT_isError(result))
-			goto error_unlock;
-		pthread_mutex_unlock(&ctx->write_mutex);
-	}
+	fr->on = 1;
+	fr->rdwr = rdwr;
+	fr->error = 0;
+	fr->inchunk = 0;
+	fr->insize = 4;
+
+	/* the rest of the stream identifier */
+	memcpy(id, buf, 4);
+	rv = fr_get(ctx, id + 4, SNAPPYMT_FRAMED_IDSIZE - 4);
+	if (rv == 1 || (rv == 0 &&
+			memcmp(id, SNAPPYMT_FRAMED_ID, SNAPPYMT_FRAMED_IDSIZE)))
+		ret = MT_ERROR(data_error);
+	else if (rv != 0)
+		ret = mt_error(rv);
+	else
+		ret = mtpipe_decompress(&ctx->pipe, fr_read, ctx,
+					(mtpipe_fn *) rdwr->fn_write,
+					rdwr->arg_write, buf, 0);
+	fr->on = 0;
 
-	/* everything is okay */
-	pthread_mutex_lock(&ctx->write_mutex);
-	list_move(&wl->node, &ctx->writelist_free);
-	pthread_mutex_unlock(&ctx->write_mutex);
-	if (in->allocated)
-		free(in->buf);
-        in->buf = NULL;
-        in->allocated = 0;
-        in->size = 0;
-	return 0;
+	/* the counters of the pipeline include the skippable frames */
+	mt_atomic_set(&ctx->pipe.insize, fr->insize);
+	if (fr->error)
+		return fr->error;
 
- error_lock:
-	pthread_mutex_lock(&ctx->write_mutex);
- error_unlock:
-	list_move(&wl->node, &ctx->writelist_free);
-	pthread_mutex_unlock(&ctx->write_mutex);
-	if (in->allocated)
-		free(in->buf);
-        in->buf = NULL;
-        in->allocated = 0;
-        in->size = 0;
-	return (void *)result;
+	return ret;
 }
 
 size_t SNAPPYMT_decompressDCtx(SNAPPYMT_DCtx * ctx, SNAPPYMT_RdWr_t * rdwr)
 {
-	unsigned char buf[4]; // first frame SNAPPYMT_MAGIC_SKIPPABLE
-	int t, rv;
-	cwork_t *w = &ctx->cwork[0];
-	SNAPPYMT_Buffer *in = &w->in;
-	void *retval_of_thread = 0;
+	unsigned char buf[4];
+	SNAPPYMT_Buffer in;
+	int rv;
 
 	if (!ctx)
 		return MT_ERROR(compressionParameter_unsupported);
 
-	/* init reading and writing functions */
-	ctx->fn_read = rdwr->fn_read;
-	ctx->fn_write = rdwr->fn_write;
-	ctx->arg_read = rdwr->arg_read;
-	ctx->arg_write = rdwr->arg_write;
-
-	/* check for SNAPPYMT_MAGIC_SKIPPABLE  read the first frame
-										   SNAPPYMT_MAGIC_SKIPPABLE*/
-	in->buf = buf;
-	in->size = 4;
-	rv = ctx->fn_read(ctx->arg_read, in);
+	/* check for SNAPPYMT_MAGIC_SKIPPABLE */
+	in.buf = buf;
+	in.size = 4;
+	rv = rdwr->fn_read(rdwr->arg_read, &in);
 	if (rv != 0)
 		return mt_error(rv);
-	if (in->size != 4)
+	if (in.size != 4)
 		return MT_ERROR(data_error);
 
+	/* the official snappy framing format */
+	if (!memcmp(buf, SNAPPYMT_FRAMED_ID, 4))
+		return fr_decompress_all(ctx, rdwr, buf);
+
 	/* single threaded with unknown sizes */
 	if (MEM_readLE32(buf) != SNAPPYMT_MAGIC_SKIPPABLE)
 		return MT_ERROR(data_error);
 
-	/* mark unused */
-	in->buf = 0;
-	in->size = 0;
-	in->allocated = 0;
-
-	/* single threaded, but with known sizes */
-	if (ctx->threads == 1) {
-		/* no pthread_create() needed! */
-		void *p = pt_decompress(w);
-		if (p)
-			return (size_t) p;
-		goto okay;
-	}
-
-	/* multi threaded */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		wt->in.buf = 0;
-		wt->in.size = 0;
-		wt->in.allocated = 0;
-		pthread_create(&wt->pthread, NULL, pt_decompress, wt);
-	}
-
-	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(wt->pthread, &p);
-		if (p)
-			retval_of_thread = p;
-	}
-
- okay:
-	/* clean up the buffers */
-	while (!list_empty(&ctx->writelist_free)) {
-		struct writelist *wl;
-		struct list_head *entry;
-		entry = list_first(&ctx->writelist_free);
-		wl = list_entry(entry, struct writelist, node);
-		free(wl->out.buf);
-        wl->out.buf = NULL;
-        wl->out.allocated = 0;
-        wl->out.size = 0;
-		list_del(&wl->node);
-		free(wl);
-        wl = NULL;
-	}
-
-	return (size_t) retval_of_thread;
+	/* known sizes, the frames are decompressed by the workers */
+	return mtpipe_decompress(&ctx->pipe, (mtpipe_fn *) rdwr->fn_read,
+				 rdwr->arg_read, (mtpipe_fn *) rdwr->fn_write,
+				 rdwr->arg_write, buf, 4);
 }
 
 /* returns current uncompressed data size */
@@ -474,7 +347,7 @@ size_t SNAPPYMT_GetInsizeDCtx(SNAPPYMT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->insize;
+	return mt_atomic_get(&ctx->pipe.insize);
 }
 
 /* returns the current compressed data size */
@@ -483,7 +356,7 @@ size_t SNAPPYMT_GetOutsizeDCtx(SNAPPYMT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->outsize;
+	return mt_atomic_get(&ctx->pipe.outsize);
 }
 
 /* returns the current compressed frames */
@@ -492,7 +365,66 @@ size_t SNAPPYMT_GetFramesDCtx(SNAPPYMT_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->curframe;
+	return mt_atomic_get(&ctx->pipe.curframe);
+}
+
+/* returns the counters of all workers together */
+void SNAPPYMT_GetStatsDCtx(SNAPPYMT_DCtx * ctx, mtstat_t * st)
+{
+	if (!ctx) {
+		memset(st, 0, sizeof(*st));
+		return;
+	}
+
+	mtpipe_stats(&ctx->pipe, st);
+}
+
+/* returns the number of workers, up to count of them are copied to st */
+int SNAPPYMT_GetWorkerStatsDCtx(SNAPPYMT_DCtx * ctx, mtstat_t * st, int count)
+{
+	if (!ctx)
+		return 0;
+
+	return mtpipe_worker_stats(&ctx->pipe, st, count);
+}
+
+/* register a progress callback, see mtprogress_init() */
+void SNAPPYMT_setProgressDCtx(SNAPPYMT_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes)
+{
+	if (!ctx)
+		return;
+
+	mtprogress_init(&ctx->pipe.progress, fn, arg, ms, bytes);
+}
+
+/* register a trace callback, see mttrace_fn in mtstat.h */
+void SNAPPYMT_setTraceDCtx(SNAPPYMT_DCtx * ctx, mttrace_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.trace = fn;
+	ctx->pipe.trace_arg = arg;
+}
+
+/* register an output callback, see mtoutput_fn in mtstat.h */
+void SNAPPYMT_setOutputDCtx(SNAPPYMT_DCtx * ctx, mtoutput_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.output = fn;
+	ctx->pipe.output_arg = arg;
+}
+
+/* run the workers as tasks of ex, or on threads again, when ex is zero */
+void SNAPPYMT_setExecutorDCtx(SNAPPYMT_DCtx * ctx, const mt_executor * ex)
+{
+	if (!ctx)
+		return;
+
+	mtpipe_executor(&ctx->pipe, ex);
 }
 
 void SNAPPYMT_freeDCtx(SNAPPYMT_DCtx * ctx)
@@ -500,12 +432,8 @@ void SNAPPYMT_freeDCtx(SNAPPYMT_DCtx * ctx)
 	if (!ctx)
 		return;
 
-	pthread_mutex_destroy(&ctx->read_mutex);
-	pthread_mutex_destroy(&ctx->write_mutex);
-	free(ctx->cwork);
-    ctx->cwork = NULL;
+	mtpipe_free(&ctx->pipe);
 	free(ctx);
-    ctx = NULL;
 	ctx = 0;
 
 	return;
@@ -12,9 +12,14 @@
  */
 
 /**
- * This file will hold wrapper for systems, which do not support Pthreads
+ * This file holds the wrapper for systems, which do not support Pthreads
+ * and the worker groups, which run on threads or on an executor
  */
 
+#include <stddef.h>
+
+#include "threading.h"
+
 #ifdef _WIN32
 
 /**
@@ -22,8 +27,6 @@
  * http://www.cse.wustl.edu/~schmidt/win32-cv-1.html
  */
 
-#include "threading.h"
-
 #include <process.h>
 #include <errno.h>
 
@@ -72,3 +75,117 @@ int _pthread_join(pthread_t * thread, void **value_ptr)
 }
 
 #endif
+
+/* **************************************
+ * Worker Groups
+ ****************************************/
+
+/* its address can not be an error code of the workers */
+char mt_yield_tag;
+
+int mt_group_workers(const mt_executor * ex, int threads)
+{
+	if (ex && ex->submit && ex->concurrency > 0
+	    && ex->concurrency < threads)
+		return ex->concurrency;
+
+	return threads;
+}
+
+void mt_group_init(mt_group * g, const mt_executor * ex)
+{
+	if (ex)
+		g->ex = *ex;
+	else
+		g->ex.submit = 0;
+	g->running = 0;
+	g->result = 0;
+	g->threads = 0;
+	pthread_mutex_init(&g->mutex, NULL);
+	pthread_cond_init(&g->cond, NULL);
+}
+
+/* a worker has finished, remember its error */
+static void mt_group_done(mt_group * g, void *result)
+{
+	pthread_mutex_lock(&g->mutex);
+	if (result && !g->result)
+		g->result = result;
+	g->running--;
+	pthread_cond_broadcast(&g->cond);
+	pthread_mutex_unlock(&g->mutex);
+}
+
+static void mt_task_run(void *arg)
+{
+	mt_task *t = (mt_task *) arg;
+	mt_group *g = t->group;
+	void *result = t->fn(t->arg);
+
+	/* t belongs to the next task already */
+	if (result == MT_YIELD)
+		return;
+
+	mt_group_done(g, result);
+}
+
+static void *mt_task_thread(void *arg)
+{
+	mt_task *t = (mt_task *) arg;
+
+	mt_group_done(t->group, t->fn(t->arg));
+
+	return 0;
+}
+
+void mt_group_start(mt_group * g, mt_task * t, void *(*fn)(void *),
+		    void *arg)
+{
+	t->group = g;
+	t->fn = fn;
+	t->arg = arg;
+	t->threaded = 0;
+
+	pthread_mutex_lock(&g->mutex);
+	g->running++;
+	pthread_mutex_unlock(&g->mutex);
+
+	if (g->ex.submit && g->ex.submit(g->ex.pool, mt_task_run, t) == 0)
+		return;
+
+	/* no executor, or it refused the task */
+	t->threaded = 1;
+	pthread_mutex_lock(&g->mutex);
+	t->next = g->threads;
+	g->threads = t;
+	pthread_mutex_unlock(&g->mutex);
+	pthread_create(&t->pthread, NULL, mt_task_thread, t);
+}
+
+int mt_task_yield(mt_task * t)
+{
+	mt_group *g = t->group;
+
+	if (t->threaded)
+		return 0;
+
+	return g->ex.submit(g->ex.pool, mt_task_run, t) == 0;
+}
+
+void *mt_group_wait(mt_group * g)
+{
+	mt_task *t;
+
+	pthread_mutex_lock(&g->mutex);
+	while (g->running)
+		pthread_cond_wait(&g->cond, &g->mutex);
+	pthread_mutex_unlock(&g->mutex);
+
+	for (t = g->threads; t; t = t->next)
+		pthread_join(t->pthread, NULL);
+
+	pthread_cond_destroy(&g->cond);
+	pthread_mutex_destroy(&g->mutex);
+
+	return g->result;
+}
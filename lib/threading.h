@@ -37,6 +37,14 @@ extern "C" {
 #define pthread_mutex_lock        EnterCriticalSection
 #define pthread_mutex_unlock      LeaveCriticalSection
 
+/* condition variables, Vista and newer */
+#define pthread_cond_t CONDITION_VARIABLE
+#define pthread_cond_init(a,b)    InitializeConditionVariable((a))
+#define pthread_cond_destroy(a)   do { } while (0)
+#define pthread_cond_wait(a,b)    SleepConditionVariableCS((a),(b),INFINITE)
+#define pthread_cond_signal       WakeConditionVariable
+#define pthread_cond_broadcast    WakeAllConditionVariable
+
 /* pthread_create() and pthread_join() */
 typedef struct {
 	HANDLE handle;
@@ -61,6 +69,82 @@ extern int _pthread_join(pthread_t * thread, void **value_ptr);
 
 #endif /* POSIX Systems */
 
+#include "mtstat.h"   /* mt_executor */
+
+/**
+ * atomic size_t counters for statistics
+ *
+ * The writers of a counter are still serialized by some mutex, but any
+ * other thread may read it at any time without taking that mutex.
+ */
+#if defined(_WIN64)
+#define mt_atomic_add(p, v) \
+	InterlockedExchangeAdd64((LONG64 volatile *)(p), (LONG64)(v))
+#define mt_atomic_set(p, v) \
+	InterlockedExchange64((LONG64 volatile *)(p), (LONG64)(v))
+#define mt_atomic_get(p) \
+	((size_t)InterlockedCompareExchange64((LONG64 volatile *)(p), 0, 0))
+#elif defined(_WIN32)
+#define mt_atomic_add(p, v) \
+	InterlockedExchangeAdd((LONG volatile *)(p), (LONG)(v))
+#define mt_atomic_set(p, v) \
+	InterlockedExchange((LONG volatile *)(p), (LONG)(v))
+#define mt_atomic_get(p) \
+	((size_t)InterlockedCompareExchange((LONG volatile *)(p), 0, 0))
+#else
+#define mt_atomic_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define mt_atomic_set(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define mt_atomic_get(p)    __atomic_load_n((p), __ATOMIC_RELAXED)
+#endif
+
+/* padding between fields, which are written by different threads */
+#define MT_CACHELINE 64
+
+/* returned by a worker, which has submitted itself again */
+extern char mt_yield_tag;
+#define MT_YIELD ((void *)&mt_yield_tag)
+
+typedef struct mt_group_s mt_group;
+typedef struct mt_task_s mt_task;
+
+/* one worker, it runs fn(arg) on a thread or as tasks of an executor */
+struct mt_task_s {
+	mt_group *group;
+	void *(*fn)(void *);
+	void *arg;
+	int threaded;		/* runs on a thread of its own */
+	pthread_t pthread;
+	mt_task *next;		/* threads, which must be joined */
+};
+
+/* all workers of one (de)compression run */
+struct mt_group_s {
+	mt_executor ex;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int running;
+	void *result;		/* first error of a worker */
+	mt_task *threads;
+};
+
+/* number of workers to start, for a context with the given threads */
+extern int mt_group_workers(const mt_executor * ex, int threads);
+
+/* ex may be zero or have no submit function, then threads are used */
+extern void mt_group_init(mt_group * g, const mt_executor * ex);
+extern void mt_group_start(mt_group * g, mt_task * t,
+			   void *(*fn)(void *), void *arg);
+
+/**
+ * call at the end of each frame: returns 1, when the worker was
+ * submitted again and must return MT_YIELD now, without touching any
+ * of its state, 0 when it should just go on with the next frame
+ */
+extern int mt_task_yield(mt_task * t);
+
+/* wait for all workers, returns the first error or zero */
+extern void *mt_group_wait(mt_group * g);
+
 #if defined (__cplusplus)
 }
 #endif
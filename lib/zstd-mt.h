@@ -23,6 +23,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>   /* size_t */
+#include "mtstat.h"   /* mtstat_t */
 
 #define ZSTDCB_THREAD_MAX 128
 #define ZSTDCB_LEVEL_MIN    1
@@ -81,10 +82,19 @@ typedef struct {
  * -1 = generic read/write error
  * -2 = user abort
  * -3 = memory
+ *  1 = success, at compression only: no more input is ready and the
+ *      next fn_read would block, like live streams
  */
 typedef int (fn_read) (void *args, ZSTDCB_Buffer * in);
 typedef int (fn_write) (void *args, ZSTDCB_Buffer * out);
 
+/**
+ * skipping function, used for listing only
+ * - jump over the next size bytes of the input
+ * - same error definitions as above
+ */
+typedef int (fn_skip) (void *args, size_t size);
+
 typedef struct {
 	fn_read *fn_read;
 	void *arg_read;
@@ -114,6 +124,42 @@ typedef struct ZSTDCB_CCtx_s ZSTDCB_CCtx;
  */
 ZSTDCB_CCtx *ZSTDCB_createCCtx(int threads, int level, int inputsize);
 
+/**
+ * ZSTDCB_setCCtxParameter() - change some advanced setting of the context
+ *
+ * ZSTDCB_p_checksum: 0 = no checksum (default)
+ *                    1 = each zstd frame gets a content checksum, it's
+ *                        computed by the compressing worker and checked
+ *                        by the decompressing worker of that frame
+ *
+ * @ctx: context, which needs to be created with ZSTDCB_createCCtx()
+ * @param: the parameter, which should be changed
+ * @value: the new value
+ * @return: zero on success, or error code
+ */
+typedef enum {
+	ZSTDCB_p_checksum
+} ZSTDCB_cParameter;
+
+size_t ZSTDCB_setCCtxParameter(ZSTDCB_CCtx * ctx, ZSTDCB_cParameter param,
+			       int value);
+
+/**
+ * ZSTDCB_setSrcSize() - the expected size of the input, when it's known
+ *
+ * When the input has fewer frames than threads, the threads without a
+ * frame of their own help in the frames of the others, with the workers
+ * of libzstd (ZSTD_c_nbWorkers). The output format is the same. With an
+ * unknown size, this is only done when the first frame is the whole
+ * input. It needs libzstd with ZSTD_MULTITHREAD and is not done with an
+ * executor.
+ *
+ * @ctx: context, which needs to be created with ZSTDCB_createCCtx()
+ * @size: the size of the next input, zero for unknown (default)
+ * @return: zero on success, or error code
+ */
+size_t ZSTDCB_setSrcSize(ZSTDCB_CCtx * ctx, unsigned long long size);
+
 /**
  * ZSTDCB_compressDCtx() - threaded compression for zstd
  *
@@ -130,9 +176,16 @@ size_t ZSTDCB_compressCCtx(ZSTDCB_CCtx * ctx, ZSTDCB_RdWr_t * rdwr);
  * ZSTDCB_GetFramesCCtx() - number of written frames
  * ZSTDCB_GetInsizeCCtx() - read bytes of input
  * ZSTDCB_GetOutsizeCCtx() - written bytes of output
+ * ZSTDCB_GetStatsCCtx() - counters of all workers together
+ * ZSTDCB_GetWorkerStatsCCtx() - counters of each worker
+ * ZSTDCB_setProgressCCtx() - progress callback, see mtstat.h
+ * ZSTDCB_setTraceCCtx() - callback for the frame events, see mtstat.h
+ * ZSTDCB_setExecutorCCtx() - run the workers on a pool, see mtstat.h
  *
- * These three functions will return some statistical data of the
- * compression context ctx.
+ * These functions will return some statistical data of the
+ * compression context ctx. The worker counters (see mtstat.h) are
+ * always collected, GetWorkerStats copies up to count of them into
+ * the st array and returns the number of workers.
  *
  * @ctx: context, which should be examined
  * @return: the request value, or zero on error
@@ -140,6 +193,12 @@ size_t ZSTDCB_compressCCtx(ZSTDCB_CCtx * ctx, ZSTDCB_RdWr_t * rdwr);
 size_t ZSTDCB_GetFramesCCtx(ZSTDCB_CCtx * ctx);
 size_t ZSTDCB_GetInsizeCCtx(ZSTDCB_CCtx * ctx);
 size_t ZSTDCB_GetOutsizeCCtx(ZSTDCB_CCtx * ctx);
+void ZSTDCB_GetStatsCCtx(ZSTDCB_CCtx * ctx, mtstat_t * st);
+int ZSTDCB_GetWorkerStatsCCtx(ZSTDCB_CCtx * ctx, mtstat_t * st, int count);
+void ZSTDCB_setProgressCCtx(ZSTDCB_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void ZSTDCB_setTraceCCtx(ZSTDCB_CCtx * ctx, mttrace_fn * fn, void *arg);
+void ZSTDCB_setExecutorCCtx(ZSTDCB_CCtx * ctx, const mt_executor * ex);
 
 /**
  * ZSTDCB_freeCCtx() - free compression context
@@ -151,6 +210,68 @@ size_t ZSTDCB_GetOutsizeCCtx(ZSTDCB_CCtx * ctx);
  */
 void ZSTDCB_freeCCtx(ZSTDCB_CCtx * ctx);
 
+/* **************************************
+ * Streaming Compression
+ ****************************************/
+
+typedef struct ZSTDCB_CStream_s ZSTDCB_CStream;
+
+/**
+ * ZSTDCB_createCStream() - allocate new push style compression stream
+ *
+ * For callers, which get their input in pieces, like event loops. The
+ * data is collected into chunks of inputsize bytes, each full chunk is
+ * compressed by the next free worker. The output is the same as the one
+ * of ZSTDCB_compressCCtx() and is passed to fn in order, it's called by
+ * the worker threads.
+ *
+ * @threads, @level, @inputsize: see ZSTDCB_createCCtx()
+ * @inflight: number of chunks, which may wait for a worker, before
+ *            push blocks (0 = threads)
+ * @fn, @arg: output function and its argument
+ * @return: the stream on success, zero on error
+ */
+ZSTDCB_CStream *ZSTDCB_createCStream(int threads, int level, int inputsize,
+				     int inflight, fn_write * fn, void *arg);
+
+/**
+ * ZSTDCB_pushCStream() - add some input
+ *
+ * Copies the data into the current chunk. It only blocks, when all
+ * inflight chunks are still waiting for a worker.
+ *
+ * @return: zero on success, or error code
+ */
+size_t ZSTDCB_pushCStream(ZSTDCB_CStream * cs, const void *src, size_t len);
+
+/**
+ * ZSTDCB_flushCStream() - compress the current chunk, even when it is
+ * not full, and wait until all output up to here was passed to fn
+ *
+ * @return: zero on success, or error code
+ */
+size_t ZSTDCB_flushCStream(ZSTDCB_CStream * cs);
+
+/**
+ * ZSTDCB_endCStream() - flush and finish the stream, no push afterwards
+ *
+ * @return: zero on success, or error code
+ */
+size_t ZSTDCB_endCStream(ZSTDCB_CStream * cs);
+
+/**
+ * ZSTDCB_getCCtxCStream() - the compression context of the stream
+ *
+ * It may be used for the statistic functions any time. Parameters,
+ * progress and trace callbacks may only be set before the first push.
+ */
+ZSTDCB_CCtx *ZSTDCB_getCCtxCStream(ZSTDCB_CStream * cs);
+
+/**
+ * ZSTDCB_freeCStream() - end the stream, when needed, and free it
+ */
+void ZSTDCB_freeCStream(ZSTDCB_CStream * cs);
+
 /* **************************************
  * Decompression
  ****************************************/
@@ -179,13 +300,53 @@ ZSTDCB_DCtx *ZSTDCB_createDCtx(int threads, int inputsize);
  */
 size_t ZSTDCB_decompressDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr);
 
+/**
+ * ZSTDCB_testDCtx() - threaded verification of zstd data
+ *
+ * Like ZSTDCB_decompressDCtx(), but the decompressed data is thrown away
+ * within the workers. There is no ordering of frames and rdwr->fn_write
+ * is never called, so it may be NULL.
+ *
+ * @ctx: context, which needs to be created with ZSTDCB_createDCtx()
+ * @rdwr: callback structure, only the reading part is used
+ * @return: zero on success, or error code
+ */
+size_t ZSTDCB_testDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr);
+
+/**
+ * ZSTDCB_listDCtx() - get the sizes of zstd data, without decompression
+ *
+ * Only the skippable and zstd frame headers are read, the frame bodies
+ * are skipped via fn_skip. The result can be queried afterwards with the
+ * statistic functions below.
+ *
+ * Streams without skippable frames or with frames, which don't carry
+ * the content size, return an error. The caller should then rewind the
+ * input and use ZSTDCB_decompressDCtx() instead.
+ *
+ * @ctx: context, which needs to be created with ZSTDCB_createDCtx()
+ * @rdwr: callback structure, only the reading part is used
+ * @fn_skip: function for skipping input
+ * @return: zero on success, or error code
+ */
+size_t ZSTDCB_listDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr,
+		       fn_skip * fn_skip);
+
 /**
  * ZSTDCB_GetFramesDCtx() - number of read frames
  * ZSTDCB_GetInsizeDCtx() - read bytes of input
  * ZSTDCB_GetOutsizeDCtx() - written bytes of output
+ * ZSTDCB_GetStatsDCtx() - counters of all workers together
+ * ZSTDCB_GetWorkerStatsDCtx() - counters of each worker
+ * ZSTDCB_setProgressDCtx() - progress callback, see mtstat.h
+ * ZSTDCB_setTraceDCtx() - callback for the frame events, see mtstat.h
+ * ZSTDCB_setOutputDCtx() - output of each frame, see mtstat.h
+ * ZSTDCB_setExecutorDCtx() - run the workers on a pool, see mtstat.h
  *
- * These three functions will return some statistical data of the
- * decompression context ctx.
+ * These functions will return some statistical data of the
+ * decompression context ctx. The worker counters (see mtstat.h) are
+ * always collected, GetWorkerStats copies up to count of them into
+ * the st array and returns the number of workers.
  *
  * @ctx: context, which should be examined
  * @return: the request value, or zero on error
@@ -193,6 +354,13 @@ size_t ZSTDCB_decompressDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr);
 size_t ZSTDCB_GetFramesDCtx(ZSTDCB_DCtx * ctx);
 size_t ZSTDCB_GetInsizeDCtx(ZSTDCB_DCtx * ctx);
 size_t ZSTDCB_GetOutsizeDCtx(ZSTDCB_DCtx * ctx);
+void ZSTDCB_GetStatsDCtx(ZSTDCB_DCtx * ctx, mtstat_t * st);
+int ZSTDCB_GetWorkerStatsDCtx(ZSTDCB_DCtx * ctx, mtstat_t * st, int count);
+void ZSTDCB_setProgressDCtx(ZSTDCB_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes);
+void ZSTDCB_setTraceDCtx(ZSTDCB_DCtx * ctx, mttrace_fn * fn, void *arg);
+void ZSTDCB_setOutputDCtx(ZSTDCB_DCtx * ctx, mtoutput_fn * fn, void *arg);
+void ZSTDCB_setExecutorDCtx(ZSTDCB_DCtx * ctx, const mt_executor * ex);
 
 /**
  * ZSTDCB_freeDCtx() - free decompression context
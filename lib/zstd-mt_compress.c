@@ -13,13 +13,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define ZSTD_STATIC_LINKING_ONLY
 #include "zstd.h"
 
 #include "memmt.h"
-#include "threading.h"
-#include "list.h"
+#include "mtpipe.h"
 #include "zstd-mt.h"
 
 /**
@@ -32,90 +32,138 @@
  *   2) release read mutex and do compression
  *   3) get write mutex and write result
  *   4) begin with step 1 again, until no input
+ * - the workers are run by mtpipe, this file only does the zstd part
  */
 
-/* worker for compression */
-typedef struct {
-	ZSTDCB_CCtx *ctx;
-	pthread_t pthread;
-} cwork_t;
-
-struct writelist;
-struct writelist {
-	size_t frame;
-	ZSTDCB_Buffer out;
-	struct list_head node;
-};
-
 struct ZSTDCB_CCtx_s {
 
 	/* level: 1..ZSTDCB_LEVEL_MAX */
 	int level;
 
-	/* threads: 1..ZSTDCB_THREAD_MAX */
-	int threads;
-
-	/* buffersize for reading input */
-	int inputsize;
+	/* content checksum for each frame */
+	int checksum;
 
-	/* statistic */
-	size_t insize;
-	size_t outsize;
-	size_t curframe;
-	size_t frames;
+	/* one zstd context per worker */
+	ZSTD_CCtx **zctx;
 
-	/* threading */
-	cwork_t *cwork;
+	/* ZSTDCB_setSrcSize(), the ZSTD_c_nbWorkers of each zctx and if
+	 * libzstd supports them */
+	unsigned long long srcsize;
+	int *nbworkers;
+	int hybrid;
 
-	/* reading input */
-	pthread_mutex_t read_mutex;
-	fn_read *fn_read;
-	void *arg_read;
-
-	/* writing output */
-	pthread_mutex_t write_mutex;
-	fn_write *fn_write;
-	void *arg_write;
-
-	/* error handling */
-	pthread_mutex_t error_mutex;
-	size_t zstdmt_errcode;
-
-	/* lists for writing queue */
-	struct list_head writelist_free;
-	struct list_head writelist_busy;
-	struct list_head writelist_done;
+	/* the frame pipeline, see mtpipe.h */
+	mtpipe pipe;
 };
 
 /* **************************************
  * Compression
  ****************************************/
 
+static const size_t errors[] = MTPIPE_ERRORS(ZSTDCB_ERROR);
+
+static size_t zstdmt_bound(void *arg, size_t insize)
+{
+	(void)arg;
+	return ZSTD_compressBound(insize) + 12;
+}
+
+/* the smallest job of the workers of libzstd, they are not worth it below */
+#define ZSTDMT_JOB_MIN (1024*1024)
+
+/**
+ * zstdmt_nbworkers - the workers of libzstd for the frame in, zero for
+ * none, it's more than one, when the input has fewer frames than threads
+ */
+static int zstdmt_nbworkers(ZSTDCB_CCtx * ctx, const mtpipe_buf * in)
+{
+	mtpipe *p = &ctx->pipe;
+	size_t frames, n;
+
+	if (!ctx->hybrid)
+		return 0;
+
+	if (ctx->srcsize) {
+		/* the threads, which get no frame of their own */
+		frames = (size_t)((ctx->srcsize + p->inputsize - 1) /
+				  p->inputsize);
+		n = frames < (size_t)p->threads ? p->threads / frames : 1;
+	} else if (in->size < p->inputsize &&
+		   mt_atomic_get(&p->insize) == in->size) {
+		/* the first frame ended early, it's all of the input */
+		n = p->threads;
+	} else
+		n = 1;
+
+	if (n > in->size / ZSTDMT_JOB_MIN)
+		n = in->size / ZSTDMT_JOB_MIN;
+
+	return n < 2 ? 0 : (int)n;
+}
+
+static size_t zstdmt_compress(void *arg, int worker, mtpipe_buf * out,
+			      const mtpipe_buf * in)
+{
+	ZSTDCB_CCtx *ctx = (ZSTDCB_CCtx *) arg;
+	ZSTD_CCtx *zctx = ctx->zctx[worker];
+	unsigned char *outbuf = out->buf;
+	int nbworkers = zstdmt_nbworkers(ctx, in);
+	size_t result = 0;
+
+	/* the jobs of libzstd split the frame between its workers */
+	if (nbworkers != ctx->nbworkers[worker]) {
+		result = ZSTD_CCtx_setParameter(zctx, ZSTD_c_nbWorkers,
+						nbworkers);
+		ctx->nbworkers[worker] = nbworkers;
+	}
+	if (nbworkers && !ZSTD_isError(result))
+		result = ZSTD_CCtx_setParameter(zctx, ZSTD_c_jobSize,
+						(int)(in->size / nbworkers + 1));
+	if (ZSTD_isError(result)) {
+		zstdmt_errcode = result;
+		return ZSTDCB_ERROR(compression_library);
+	}
+
+	result = ZSTD_compress2(zctx, outbuf + 12,
+				out->allocated - 12, in->buf, in->size);
+	if (ZSTD_isError(result)) {
+		zstdmt_errcode = result;
+		return ZSTDCB_ERROR(compression_library);
+	}
+
+	/* write skippable frame */
+	MEM_writeLE32(outbuf + 0, ZSTDCB_MAGIC_SKIPPABLE);
+	MEM_writeLE32(outbuf + 4, 4);
+	MEM_writeLE32(outbuf + 8, (U32) result);
+	out->size = result + 12;
+
+	return 0;
+}
+
+static const mtpipe_codec zstdmt_codec = {
+	12, ZSTDCB_isError, errors, zstdmt_bound, zstdmt_compress, 0
+};
+
 ZSTDCB_CCtx *ZSTDCB_createCCtx(int threads, int level, int inputsize)
 {
 	ZSTDCB_CCtx *ctx;
 	int t;
 
-	/* allocate ctx */
-	ctx = (ZSTDCB_CCtx *) malloc(sizeof(ZSTDCB_CCtx));
-	if (!ctx)
-		return 0;
-
 	/* check threads value */
 	if (threads < 1 || threads > ZSTDCB_THREAD_MAX)
-		goto err_ctx;
+		return 0;
 
 	/* check level */
 	if (level < ZSTDCB_LEVEL_MIN || level > ZSTDCB_LEVEL_MAX)
-		goto err_ctx;
-
-
+		return 0;
 
+	/* allocate ctx */
+	ctx = (ZSTDCB_CCtx *) malloc(sizeof(ZSTDCB_CCtx));
+	if (!ctx)
+		return 0;
 
 	/* calculate chunksize for one thread */
-	if (inputsize)
-		ctx->inputsize = inputsize;
-	else {
+	if (!inputsize) {
 		const int windowLog[] = {
 			19, 19, 20, 20, 20, /*  1 -  5 */
 			21, 21, 21, 21, 21, /*  6 - 10 */
@@ -123,272 +171,111 @@ ZSTDCB_CCtx *ZSTDCB_createCCtx(int threads, int level, int inputsize)
 			23, 23, 23, 23, 25, /* 16 - 20 */
 			26, 27
 		};
-		ctx->inputsize = 1 << (windowLog[level] + 1);
+		inputsize = 1 << (windowLog[level] + 1);
 	}
 
 	/* setup ctx */
 	ctx->level = level;
-	ctx->threads = threads;
-
-	pthread_mutex_init(&ctx->read_mutex, NULL);
-	pthread_mutex_init(&ctx->write_mutex, NULL);
-	pthread_mutex_init(&ctx->error_mutex, NULL);
+	ctx->checksum = 0;
+	ctx->srcsize = 0;
+	if (mtpipe_init(&ctx->pipe, &zstdmt_codec, ctx, threads, inputsize))
+		goto err_ctx;
 
-	INIT_LIST_HEAD(&ctx->writelist_free);
-	INIT_LIST_HEAD(&ctx->writelist_busy);
-	INIT_LIST_HEAD(&ctx->writelist_done);
+	ctx->nbworkers = (int *)calloc(threads, sizeof(int));
+	if (!ctx->nbworkers)
+		goto err_pipe;
 
-	ctx->cwork = (cwork_t *) malloc(sizeof(cwork_t) * threads);
-	if (!ctx->cwork)
-		goto err_ctx;
+	ctx->zctx = (ZSTD_CCtx **) malloc(sizeof(ZSTD_CCtx *) * threads);
+	if (!ctx->zctx)
+		goto err_nbworkers;
 
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		w->ctx = ctx;
+	for (t = 0; t < threads; t++) {
+		ctx->zctx[t] = ZSTD_createCCtx();
+		if (!ctx->zctx[t])
+			goto err_zctx;
 	}
 
 	return ctx;
 
+ err_zctx:
+	while (t--)
+		ZSTD_freeCCtx(ctx->zctx[t]);
+	free(ctx->zctx);
+ err_nbworkers:
+	free(ctx->nbworkers);
+ err_pipe:
+	mtpipe_free(&ctx->pipe);
  err_ctx:
 	free(ctx);
 	return 0;
 }
 
-/**
- * mt_error - return mt lib specific error code
- */
-static size_t mt_error(int rv)
-{
-	switch (rv) {
-	case -1:
-		return ZSTDCB_ERROR(read_fail);
-	case -2:
-		return ZSTDCB_ERROR(canceled);
-	case -3:
-		return ZSTDCB_ERROR(memory_allocation);
-	}
-
-	return ZSTDCB_ERROR(read_fail);
-}
-
-/**
- * pt_write - queue for compressed output
- */
-static size_t pt_write(ZSTDCB_CCtx * ctx, struct writelist *wl)
+size_t ZSTDCB_setCCtxParameter(ZSTDCB_CCtx * ctx, ZSTDCB_cParameter param,
+			       int value)
 {
-	struct list_head *entry;
-	int rv;
-
-	/* move the entry to the done list */
-	list_move(&wl->node, &ctx->writelist_done);
+	if (!ctx)
+		return ZSTDCB_ERROR(init_missing);
 
-	/* the entry isn't the currently needed, return...  */
-	if (wl->frame != ctx->curframe)
+	switch (param) {
+	case ZSTDCB_p_checksum:
+		ctx->checksum = value ? 1 : 0;
 		return 0;
-
- again:
-	/* check, what can be written ... */
-	list_for_each(entry, &ctx->writelist_done) {
-		wl = list_entry(entry, struct writelist, node);
-		if (wl->frame == ctx->curframe) {
-			rv = ctx->fn_write(ctx->arg_write, &wl->out);
-			if (rv != 0)
-				return mt_error(rv);
-			ctx->outsize += wl->out.size;
-			ctx->curframe++;
-			list_move(entry, &ctx->writelist_free);
-			goto again;
-		}
 	}
 
-	return 0;
+	return ZSTDCB_ERROR(compressionParameter_unsupported);
 }
 
-/* parallel compression worker */
-static void *pt_compress(void *arg)
+size_t ZSTDCB_setSrcSize(ZSTDCB_CCtx * ctx, unsigned long long size)
 {
-	cwork_t *w = (cwork_t *) arg;
-	ZSTDCB_CCtx *ctx = w->ctx;
-	struct writelist *wl;
-	size_t result;
-	ZSTDCB_Buffer in;
-
-	/* inbuf is constant */
-	in.size = ctx->inputsize;
-	in.buf = malloc(in.size);
-	if (!in.buf)
-		return (void *)ZSTDCB_ERROR(memory_allocation);
-
-	for (;;) {
-		struct list_head *entry;
-		ZSTDCB_Buffer *out;
-		int rv;
-
-		/* allocate space for new output */
-		pthread_mutex_lock(&ctx->write_mutex);
-		if (!list_empty(&ctx->writelist_free)) {
-			/* take unused entry */
-			entry = list_first(&ctx->writelist_free);
-			wl = list_entry(entry, struct writelist, node);
-			wl->out.size = ZSTD_compressBound(ctx->inputsize) + 12;
-			list_move(entry, &ctx->writelist_busy);
-		} else {
-			/* allocate new one */
-			wl = (struct writelist *)
-			    malloc(sizeof(struct writelist));
-			if (!wl) {
-				pthread_mutex_unlock(&ctx->write_mutex);
-				free(in.buf);
-				return (void *)ZSTDCB_ERROR(memory_allocation);
-			}
-			wl->out.size = ZSTD_compressBound(ctx->inputsize) + 12;;
-			wl->out.buf = malloc(wl->out.size);
-			if (!wl->out.buf) {
-				pthread_mutex_unlock(&ctx->write_mutex);
-				free(in.buf);
-				return (void *)ZSTDCB_ERROR(memory_allocation);
-			}
-			list_add(&wl->node, &ctx->writelist_busy);
-		}
-		pthread_mutex_unlock(&ctx->write_mutex);
-		out = &wl->out;
-
-		/* read new input */
-		pthread_mutex_lock(&ctx->read_mutex);
-		in.size = ctx->inputsize;
-		rv = ctx->fn_read(ctx->arg_read, &in);
-		if (rv != 0) {
-			pthread_mutex_unlock(&ctx->read_mutex);
-			result = mt_error(rv);
-			goto error;
-		}
-
-		/* eof */
-		if (in.size == 0 && ctx->frames > 0) {
-			free(in.buf);
-			pthread_mutex_unlock(&ctx->read_mutex);
-
-			pthread_mutex_lock(&ctx->write_mutex);
-			list_move(&wl->node, &ctx->writelist_free);
-			pthread_mutex_unlock(&ctx->write_mutex);
-
-			goto okay;
-		}
-		ctx->insize += in.size;
-		wl->frame = ctx->frames++;
-		pthread_mutex_unlock(&ctx->read_mutex);
-
-		/* compress whole frame */
-		{
-			unsigned char *outbuf = out->buf;
-			result =
-			    ZSTD_compress(outbuf + 12, out->size - 12, in.buf,
-					  in.size, ctx->level);
-			if (ZSTD_isError(result)) {
-				zstdmt_errcode = result;
-				result = ZSTDCB_ERROR(compression_library);
-				goto error;
-			}
-		}
-
-		/* write skippable frame */
-		{
-			unsigned char *outbuf = out->buf;
-
-			MEM_writeLE32(outbuf + 0, ZSTDCB_MAGIC_SKIPPABLE);
-			MEM_writeLE32(outbuf + 4, 4);
-			MEM_writeLE32(outbuf + 8, (U32) result);
-			out->size = result + 12;
-		}
+	if (!ctx)
+		return ZSTDCB_ERROR(init_missing);
 
-		/* write result */
-		pthread_mutex_lock(&ctx->write_mutex);
-		result = pt_write(ctx, wl);
-		pthread_mutex_unlock(&ctx->write_mutex);
-		if (ZSTDCB_isError(result))
-			goto error;
-	}
+	ctx->srcsize = size;
 
- okay:
 	return 0;
- error:
-	pthread_mutex_lock(&ctx->write_mutex);
-	list_move(&wl->node, &ctx->writelist_free);
-	pthread_mutex_unlock(&ctx->write_mutex);
-	return (void *)result;
 }
 
 /* compress data, until input ends */
 size_t ZSTDCB_compressCCtx(ZSTDCB_CCtx * ctx, ZSTDCB_RdWr_t * rdwr)
 {
+	size_t result;
 	int t;
-	void *retval_of_thread = 0;
 
 	if (!ctx)
 		return ZSTDCB_ERROR(init_missing);
 
-	/* setup reading and writing functions */
-	ctx->fn_read = rdwr->fn_read;
-	ctx->fn_write = rdwr->fn_write;
-	ctx->arg_read = rdwr->arg_read;
-	ctx->arg_write = rdwr->arg_write;
-
-	/* init counter and error codes */
-	ctx->insize = 0;
-	ctx->outsize = 0;
-	ctx->frames = 0;
-	ctx->curframe = 0;
-	ctx->zstdmt_errcode = 0;
-
-	/* start all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		pthread_create(&w->pthread, NULL, pt_compress, w);
-	}
-
-	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(w->pthread, &p);
-		if (p)
-			retval_of_thread = p;
-	}
-
-	/* clean up the free list */
-	while (!list_empty(&ctx->writelist_free)) {
-		struct writelist *wl;
-		struct list_head *entry;
-		entry = list_first(&ctx->writelist_free);
-		wl = list_entry(entry, struct writelist, node);
-		free(wl->out.buf);
-		list_del(&wl->node);
-		free(wl);
+	/* the workers of libzstd need ZSTD_MULTITHREAD, threads of our
+	 * own and no executor */
+	ctx->hybrid = ctx->pipe.threads > 1 && !ctx->pipe.executor.submit &&
+	    ZSTD_cParam_getBounds(ZSTD_c_nbWorkers).upperBound > 0;
+
+	/* setup the zstd contexts of the workers */
+	for (t = 0; t < ctx->pipe.threads; t++) {
+		size_t rv;
+
+		ZSTD_CCtx_reset(ctx->zctx[t], ZSTD_reset_session_and_parameters);
+		ctx->nbworkers[t] = 0;
+		rv = ZSTD_CCtx_setParameter(ctx->zctx[t],
+					    ZSTD_c_compressionLevel,
+					    ctx->level);
+		if (!ZSTD_isError(rv))
+			rv = ZSTD_CCtx_setParameter(ctx->zctx[t],
+						    ZSTD_c_checksumFlag,
+						    ctx->checksum);
+		if (ZSTD_isError(rv)) {
+			zstdmt_errcode = rv;
+			return ZSTDCB_ERROR(compression_library);
+		}
 	}
 
-	/* on error, these two lists may have some entries */
-	if (retval_of_thread) {
-		struct writelist *wl;
-		struct list_head *entry;
-
-		while (!list_empty(&ctx->writelist_busy)) {
-			entry = list_first(&ctx->writelist_busy);
-			wl = list_entry(entry, struct writelist, node);
-			free(wl->out.buf);
-			list_del(&wl->node);
-			free(wl);
-		}
+	result = mtpipe_compress(&ctx->pipe, (mtpipe_fn *) rdwr->fn_read,
+				 rdwr->arg_read, (mtpipe_fn *) rdwr->fn_write,
+				 rdwr->arg_write);
 
-		while (!list_empty(&ctx->writelist_done)) {
-			entry = list_first(&ctx->writelist_done);
-			wl = list_entry(entry, struct writelist, node);
-			free(wl->out.buf);
-			list_del(&wl->node);
-			free(wl);
-		}
-	}
+	/* ZSTDCB_setSrcSize() is for one input only */
+	ctx->srcsize = 0;
 
-	return (size_t) retval_of_thread;
+	return result;
 }
 
 /* returns current uncompressed data size */
@@ -397,8 +284,7 @@ size_t ZSTDCB_GetInsizeCCtx(ZSTDCB_CCtx * ctx)
 	if (!ctx)
 		return ZSTDCB_ERROR(init_missing);
 
-	/* no mutex needed here */
-	return ctx->insize;
+	return mt_atomic_get(&ctx->pipe.insize);
 }
 
 /* returns the current compressed data size */
@@ -407,8 +293,7 @@ size_t ZSTDCB_GetOutsizeCCtx(ZSTDCB_CCtx * ctx)
 	if (!ctx)
 		return ZSTDCB_ERROR(init_missing);
 
-	/* no mutex needed here */
-	return ctx->outsize;
+	return mt_atomic_get(&ctx->pipe.outsize);
 }
 
 /* returns the current compressed data frame count */
@@ -417,19 +302,406 @@ size_t ZSTDCB_GetFramesCCtx(ZSTDCB_CCtx * ctx)
 	if (!ctx)
 		return ZSTDCB_ERROR(init_missing);
 
-	/* no mutex needed here */
-	return ctx->curframe;
+	return mt_atomic_get(&ctx->pipe.curframe);
+}
+
+/* returns the counters of all workers together */
+void ZSTDCB_GetStatsCCtx(ZSTDCB_CCtx * ctx, mtstat_t * st)
+{
+	if (!ctx) {
+		memset(st, 0, sizeof(*st));
+		return;
+	}
+
+	mtpipe_stats(&ctx->pipe, st);
+}
+
+/* returns the number of workers, up to count of them are copied to st */
+int ZSTDCB_GetWorkerStatsCCtx(ZSTDCB_CCtx * ctx, mtstat_t * st, int count)
+{
+	if (!ctx)
+		return 0;
+
+	return mtpipe_worker_stats(&ctx->pipe, st, count);
+}
+
+/* register a progress callback, see mtprogress_init() */
+void ZSTDCB_setProgressCCtx(ZSTDCB_CCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes)
+{
+	if (!ctx)
+		return;
+
+	mtprogress_init(&ctx->pipe.progress, fn, arg, ms, bytes);
+}
+
+/* register a trace callback, see mttrace_fn in mtstat.h */
+void ZSTDCB_setTraceCCtx(ZSTDCB_CCtx * ctx, mttrace_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->pipe.trace = fn;
+	ctx->pipe.trace_arg = arg;
+}
+
+/* run the workers as tasks of ex, or on threads again, when ex is zero */
+void ZSTDCB_setExecutorCCtx(ZSTDCB_CCtx * ctx, const mt_executor * ex)
+{
+	if (!ctx)
+		return;
+
+	mtpipe_executor(&ctx->pipe, ex);
 }
 
 /* free all allocated buffers and structures */
 void ZSTDCB_freeCCtx(ZSTDCB_CCtx * ctx)
 {
+	int t;
+
 	if (!ctx)
 		return;
 
-	free(ctx->cwork);
+	for (t = 0; t < ctx->pipe.threads; t++)
+		ZSTD_freeCCtx(ctx->zctx[t]);
+	mtpipe_free(&ctx->pipe);
+	free(ctx->zctx);
+	free(ctx->nbworkers);
 	free(ctx);
 	ctx = 0;
 
 	return;
 }
+
+/* **************************************
+ * Streaming Compression
+ ****************************************/
+
+/**
+ * push style compression
+ *
+ * - ZSTDCB_compressCCtx() runs in a thread of its own and its fn_read
+ *   takes the chunks, which were filled by ZSTDCB_pushCStream()
+ * - there is a ring of inflight chunks, push only blocks, when all of
+ *   them are waiting for a worker
+ * - the output is passed to fn_write by the workers, in order
+ */
+struct ZSTDCB_CStream_s {
+	ZSTDCB_CCtx *cctx;
+	pthread_t pthread;
+	size_t result;
+
+	/* output of the caller */
+	fn_write *fn_write;
+	void *arg_write;
+
+	/* everything below is protected by mutex */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/* chunks [head, head + ready) wait for the workers */
+	ZSTDCB_Buffer *chunk;
+	int inflight;
+	int head;
+	int ready;
+
+	/* bytes in the chunk at head + ready, which is filled by push */
+	size_t fill;
+
+	/* frames given to the workers and frames written */
+	size_t queued;
+	size_t written;
+
+	int started;		/* the compression thread is running */
+	int ending;		/* no more input, set by end */
+	int failed;		/* fn_write returned an error */
+	int canceled;		/* a worker failed, see cs_cancel() */
+	int done;		/* ZSTDCB_compressCCtx() has returned */
+};
+
+/**
+ * fn_read of the compression thread, waits for the next chunk, a worker
+ * must not wait for more chunks than are ready, so it gets
+ * MTPIPE_READ_IDLE with the last one
+ */
+static int cs_read(void *arg, ZSTDCB_Buffer * in)
+{
+	ZSTDCB_CStream *cs = (ZSTDCB_CStream *) arg;
+	ZSTDCB_Buffer *c;
+	int rv;
+
+	pthread_mutex_lock(&cs->mutex);
+	while (!cs->ready && !cs->ending && !cs->failed && !cs->canceled)
+		pthread_cond_wait(&cs->cond, &cs->mutex);
+	if (!cs->ready || cs->canceled) {
+		pthread_mutex_unlock(&cs->mutex);
+		in->size = 0;
+		return 0;
+	}
+	c = &cs->chunk[cs->head];
+	pthread_mutex_unlock(&cs->mutex);
+
+	/* push never touches a ready chunk, so copy it without the lock */
+	memcpy(in->buf, c->buf, c->size);
+	in->size = c->size;
+
+	pthread_mutex_lock(&cs->mutex);
+	cs->head = (cs->head + 1) % cs->inflight;
+	cs->ready--;
+	rv = cs->ready || cs->ending ? 0 : MTPIPE_READ_IDLE;
+	pthread_cond_broadcast(&cs->cond);
+	pthread_mutex_unlock(&cs->mutex);
+
+	return rv;
+}
+
+/* fn_write of the workers, counts the written frames for flush */
+static int cs_write(void *arg, ZSTDCB_Buffer * out)
+{
+	ZSTDCB_CStream *cs = (ZSTDCB_CStream *) arg;
+	int rv = cs->fn_write(cs->arg_write, out);
+
+	pthread_mutex_lock(&cs->mutex);
+	if (rv)
+		cs->failed = 1;
+	else
+		cs->written++;
+	pthread_cond_broadcast(&cs->cond);
+	pthread_mutex_unlock(&cs->mutex);
+
+	return rv;
+}
+
+/**
+ * fn_cancel of the pipeline, a worker failed: the others get the end of
+ * input, so ZSTDCB_compressCCtx() returns the error to flush and end
+ */
+static void cs_cancel(void *arg)
+{
+	ZSTDCB_CStream *cs = (ZSTDCB_CStream *) arg;
+
+	pthread_mutex_lock(&cs->mutex);
+	cs->canceled = 1;
+	pthread_cond_broadcast(&cs->cond);
+	pthread_mutex_unlock(&cs->mutex);
+}
+
+static void *pt_stream(void *arg)
+{
+	ZSTDCB_CStream *cs = (ZSTDCB_CStream *) arg;
+	ZSTDCB_RdWr_t rdwr;
+	size_t result;
+
+	rdwr.fn_read = cs_read;
+	rdwr.arg_read = cs;
+	rdwr.fn_write = cs_write;
+	rdwr.arg_write = cs;
+	cs->cctx->pipe.fn_cancel = cs_cancel;
+	result = ZSTDCB_compressCCtx(cs->cctx, &rdwr);
+	cs->cctx->pipe.fn_cancel = 0;
+
+	pthread_mutex_lock(&cs->mutex);
+	cs->result = result;
+	cs->done = 1;
+	pthread_cond_broadcast(&cs->cond);
+	pthread_mutex_unlock(&cs->mutex);
+
+	return 0;
+}
+
+/* the error of a failed stream, called with the mutex held */
+static size_t cs_error(ZSTDCB_CStream * cs)
+{
+	if (cs->done && ZSTDCB_isError(cs->result))
+		return cs->result;
+	if (cs->failed)
+		return ZSTDCB_ERROR(write_fail);
+	return ZSTDCB_ERROR(canceled);
+}
+
+/* start the compression thread on first use, mutex is held */
+static void cs_start(ZSTDCB_CStream * cs)
+{
+	if (cs->started)
+		return;
+
+	cs->started = 1;
+	pthread_create(&cs->pthread, NULL, pt_stream, cs);
+}
+
+/* give the partly filled chunk to the workers, mutex is held */
+static void cs_dispatch(ZSTDCB_CStream * cs)
+{
+	ZSTDCB_Buffer *c = &cs->chunk[(cs->head + cs->ready) % cs->inflight];
+
+	c->size = cs->fill;
+	cs->fill = 0;
+	cs->ready++;
+	cs->queued++;
+	pthread_cond_broadcast(&cs->cond);
+}
+
+ZSTDCB_CStream *ZSTDCB_createCStream(int threads, int level, int inputsize,
+				     int inflight, fn_write * fn, void *arg)
+{
+	ZSTDCB_CStream *cs;
+	int i;
+
+	if (!fn)
+		return 0;
+
+	cs = (ZSTDCB_CStream *) malloc(sizeof(ZSTDCB_CStream));
+	if (!cs)
+		return 0;
+	memset(cs, 0, sizeof(*cs));
+
+	cs->cctx = ZSTDCB_createCCtx(threads, level, inputsize);
+	if (!cs->cctx)
+		goto err_cs;
+
+	cs->inflight = inflight > 0 ? inflight : threads;
+	cs->chunk = (ZSTDCB_Buffer *) malloc(sizeof(ZSTDCB_Buffer) *
+					     cs->inflight);
+	if (!cs->chunk)
+		goto err_cctx;
+	for (i = 0; i < cs->inflight; i++) {
+		cs->chunk[i].allocated = cs->cctx->pipe.inputsize;
+		cs->chunk[i].size = 0;
+		cs->chunk[i].buf = malloc(cs->chunk[i].allocated);
+		if (!cs->chunk[i].buf)
+			goto err_chunk;
+	}
+
+	cs->fn_write = fn;
+	cs->arg_write = arg;
+	pthread_mutex_init(&cs->mutex, 0);
+	pthread_cond_init(&cs->cond, 0);
+
+	return cs;
+
+ err_chunk:
+	while (i--)
+		free(cs->chunk[i].buf);
+	free(cs->chunk);
+ err_cctx:
+	ZSTDCB_freeCCtx(cs->cctx);
+ err_cs:
+	free(cs);
+
+	return 0;
+}
+
+size_t ZSTDCB_pushCStream(ZSTDCB_CStream * cs, const void *src, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)src;
+
+	if (!cs)
+		return ZSTDCB_ERROR(init_missing);
+
+	pthread_mutex_lock(&cs->mutex);
+	cs_start(cs);
+	while (len) {
+		ZSTDCB_Buffer *c;
+		size_t n;
+
+		/* all chunks are in flight, wait for a worker */
+		while (cs->ready == cs->inflight && !cs->failed && !cs->done)
+			pthread_cond_wait(&cs->cond, &cs->mutex);
+		if (cs->failed || cs->done || cs->ending) {
+			size_t rv = cs_error(cs);
+			pthread_mutex_unlock(&cs->mutex);
+			return rv;
+		}
+
+		/* only push touches the chunk, which is filled */
+		c = &cs->chunk[(cs->head + cs->ready) % cs->inflight];
+		n = c->allocated - cs->fill;
+		if (n > len)
+			n = len;
+		pthread_mutex_unlock(&cs->mutex);
+		memcpy((unsigned char *)c->buf + cs->fill, p, n);
+		pthread_mutex_lock(&cs->mutex);
+
+		cs->fill += n;
+		p += n;
+		len -= n;
+		if (cs->fill == c->allocated)
+			cs_dispatch(cs);
+	}
+	pthread_mutex_unlock(&cs->mutex);
+
+	return 0;
+}
+
+size_t ZSTDCB_flushCStream(ZSTDCB_CStream * cs)
+{
+	size_t rv = 0;
+
+	if (!cs)
+		return ZSTDCB_ERROR(init_missing);
+
+	pthread_mutex_lock(&cs->mutex);
+	cs_start(cs);
+	while (cs->fill && cs->ready == cs->inflight && !cs->failed &&
+	       !cs->done)
+		pthread_cond_wait(&cs->cond, &cs->mutex);
+	if (cs->fill && !cs->failed && !cs->done)
+		cs_dispatch(cs);
+	while (cs->written < cs->queued && !cs->failed && !cs->done)
+		pthread_cond_wait(&cs->cond, &cs->mutex);
+	if (cs->failed || cs->written < cs->queued)
+		rv = cs_error(cs);
+	pthread_mutex_unlock(&cs->mutex);
+
+	return rv;
+}
+
+size_t ZSTDCB_endCStream(ZSTDCB_CStream * cs)
+{
+	size_t rv;
+
+	if (!cs)
+		return ZSTDCB_ERROR(init_missing);
+
+	rv = ZSTDCB_flushCStream(cs);
+
+	pthread_mutex_lock(&cs->mutex);
+	if (cs->ending) {
+		pthread_mutex_unlock(&cs->mutex);
+		return ZSTDCB_ERROR(canceled);
+	}
+	cs->ending = 1;
+	pthread_cond_broadcast(&cs->cond);
+	pthread_mutex_unlock(&cs->mutex);
+
+	pthread_join(cs->pthread, 0);
+	if (!ZSTDCB_isError(rv) && ZSTDCB_isError(cs->result))
+		rv = cs->result;
+
+	return rv;
+}
+
+ZSTDCB_CCtx *ZSTDCB_getCCtxCStream(ZSTDCB_CStream * cs)
+{
+	return cs ? cs->cctx : 0;
+}
+
+void ZSTDCB_freeCStream(ZSTDCB_CStream * cs)
+{
+	int i;
+
+	if (!cs)
+		return;
+
+	/* the compression thread must be gone */
+	if (cs->started && !cs->ending)
+		ZSTDCB_endCStream(cs);
+
+	for (i = 0; i < cs->inflight; i++)
+		free(cs->chunk[i].buf);
+	free(cs->chunk);
+	pthread_cond_destroy(&cs->cond);
+	pthread_mutex_destroy(&cs->mutex);
+	ZSTDCB_freeCCtx(cs->cctx);
+	free(cs);
+}
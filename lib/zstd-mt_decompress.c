@@ -20,6 +20,7 @@
 #include "memmt.h"
 #include "threading.h"
 #include "list.h"
+#include "mtstat.h"
 #include "zstd-mt.h"
 
 /**
@@ -46,9 +47,11 @@ extern size_t zstdmt_errcode;
 /* worker for compression */
 typedef struct {
 	ZSTDCB_DCtx *ctx;
-	pthread_t pthread;
+	mt_task task;
 	ZSTDCB_Buffer in;
 	ZSTD_DStream *dctx;
+	ZSTDCB_Buffer scratch;	/* output of pt_test(), is not kept */
+	mtstat_t stat;
 } cwork_t;
 
 struct writelist;
@@ -70,11 +73,36 @@ struct ZSTDCB_DCtx_s {
 	/* buffersize used for output */
 	size_t outputsize;
 
-	/* statistic */
+	/* only verify the input, nothing is written */
+	int testonly;
+
+	/**
+	 * statistic, the reader side (read_mutex) and the writer side
+	 * (write_mutex) are on different cache lines, insize, outsize and
+	 * curframe are updated atomically, so they may be read any time
+	 */
+	char pad_in[MT_CACHELINE];
 	size_t insize;
+	size_t frames;
+	char pad_out[MT_CACHELINE];
 	size_t outsize;
 	size_t curframe;
-	size_t frames;
+	char pad_end[MT_CACHELINE];
+
+	/* progress callback, called by the writer, or at testing by the
+	 * workers under the write mutex */
+	mtprogress_t progress;
+
+	/* trace callback, called by all workers */
+	mttrace_fn *trace;
+	void *trace_arg;
+
+	/* output callback of each frame, called by all workers */
+	mtoutput_fn *output;
+	void *output_arg;
+
+	/* executor of the caller, threads are used without one */
+	mt_executor executor;
 
 	/* threading */
 	cwork_t *cwork;
@@ -110,6 +138,10 @@ ZSTDCB_DCtx *ZSTDCB_createDCtx(int threads, int inputsize)
 	ctx = (ZSTDCB_DCtx *) malloc(sizeof(ZSTDCB_DCtx));
 	if (!ctx)
 		return 0;
+	memset(&ctx->progress, 0, sizeof(ctx->progress));
+	ctx->trace = 0;
+	ctx->output = 0;
+	ctx->executor.submit = 0;
 
 	/* check threads value */
 	if (threads < 1 || threads > ZSTDCB_THREAD_MAX)
@@ -122,6 +154,7 @@ ZSTDCB_DCtx *ZSTDCB_createDCtx(int threads, int inputsize)
 	ctx->outsize = 0;
 	ctx->frames = 0;
 	ctx->curframe = 0;
+	ctx->testonly = 0;
 
 	/* will be used for single stream only */
 	if (inputsize)
@@ -193,8 +226,11 @@ static size_t pt_write(ZSTDCB_DCtx * ctx, struct writelist *wl)
 			int rv = ctx->fn_write(ctx->arg_write, &wl->out);
 			if (rv != 0)
 				return mt_error(rv);
-			ctx->outsize += wl->out.size;
-			ctx->curframe++;
+			mt_atomic_add(&ctx->outsize, wl->out.size);
+			MTTRACE(ctx, written, MTTRACE_WRITER, wl->frame,
+				wl->out.size);
+			mt_atomic_add(&ctx->curframe, 1);
+			MTPROGRESS(ctx, 0);
 			list_move(entry, &ctx->writelist_free);
 			goto again;
 		}
@@ -206,21 +242,22 @@ static size_t pt_write(ZSTDCB_DCtx * ctx, struct writelist *wl)
 /**
  * pt_read - read compressed input
  */
-static size_t pt_read(ZSTDCB_DCtx * ctx, ZSTDCB_Buffer * in, size_t * frame)
+static size_t pt_read(ZSTDCB_DCtx * ctx, mtstat_t * st,
+		      ZSTDCB_Buffer * in, size_t * frame)
 {
 	unsigned char hdrbuf[12];
 	ZSTDCB_Buffer hdr;
 	size_t toRead;
 	int rv;
 
-	pthread_mutex_lock(&ctx->read_mutex);
+	MTSTAT_LOCK(st, read_wait, &ctx->read_mutex);
 
 	/* special case, some bytes were read by magic check */
 	if (unlikely(ctx->frames == 0)) {
 		/* the magic check reads exactly 16 bytes! */
 		if (unlikely(in->size != 16))
 			goto error_data;
-		ctx->insize += 16;
+		mt_atomic_add(&ctx->insize, 16);
 
 		/**
 		 * zstdmt mode, with zstd magic prefix
@@ -232,7 +269,8 @@ static size_t pt_read(ZSTDCB_DCtx * ctx, ZSTDCB_Buffer * in, size_t * frame)
 			memcpy(hdrbuf, in->buf, 7);
 			hdr.buf = hdrbuf + 7;
 			hdr.size = 5;
-			rv = ctx->fn_read(ctx->arg_read, &hdr);
+			MTSTAT_TIME(st, read,
+				    rv = ctx->fn_read(ctx->arg_read, &hdr));
 			if (rv != 0) {
 				pthread_mutex_unlock(&ctx->read_mutex);
 				return mt_error(rv);
@@ -240,7 +278,7 @@ static size_t pt_read(ZSTDCB_DCtx * ctx, ZSTDCB_Buffer * in, size_t * frame)
 			if (hdr.size != 5)
 				goto error_data;
 			hdr.buf = hdrbuf;
-			ctx->insize += 16 + 5;
+			mt_atomic_add(&ctx->insize, 16 + 5);
 
 			/* read data */
 			toRead = MEM_readLE32((unsigned char *)hdr.buf + 8);
@@ -249,14 +287,15 @@ static size_t pt_read(ZSTDCB_DCtx * ctx, ZSTDCB_Buffer * in, size_t * frame)
 			if (!in->buf)
 				goto error_nomem;
 			in->allocated = in->size;
-			rv = ctx->fn_read(ctx->arg_read, in);
+			MTSTAT_TIME(st, read,
+				    rv = ctx->fn_read(ctx->arg_read, in));
 			if (rv != 0) {
 				pthread_mutex_unlock(&ctx->read_mutex);
 				return mt_error(rv);
 			}
 			if (in->size != toRead)
 				goto error_data;
-			ctx->insize += in->size;
+			mt_atomic_add(&ctx->insize, in->size);
 			*frame = ctx->frames++;
 			pthread_mutex_unlock(&ctx->read_mutex);
 			return 0;	/* done! */
@@ -281,14 +320,15 @@ static size_t pt_read(ZSTDCB_DCtx * ctx, ZSTDCB_Buffer * in, size_t * frame)
 			/* 12 byte skippable, so 4 bytes data done */
 			in->buf = start + 4;
 			in->size = toRead - 4;
-			rv = ctx->fn_read(ctx->arg_read, in);
+			MTSTAT_TIME(st, read,
+				    rv = ctx->fn_read(ctx->arg_read, in));
 			if (rv != 0) {
 				pthread_mutex_unlock(&ctx->read_mutex);
 				return mt_error(rv);
 			}
 			if (in->size != toRead - 4)
 				goto error_data;
-			ctx->insize += in->size;
+			mt_atomic_add(&ctx->insize, in->size);
 			in->buf = start;	/* restore inbuf */
 			in->size += 4;
 			*frame = ctx->frames++;
@@ -305,7 +345,8 @@ static size_t pt_read(ZSTDCB_DCtx * ctx, ZSTDCB_Buffer * in, size_t * frame)
 	 */
 	hdr.buf = hdrbuf;
 	hdr.size = 12;
-	rv = ctx->fn_read(ctx->arg_read, &hdr);
+	MTSTAT_TIME(st, read,
+		    rv = ctx->fn_read(ctx->arg_read, &hdr));
 	if (rv != 0) {
 		pthread_mutex_unlock(&ctx->read_mutex);
 		return mt_error(rv);
@@ -323,7 +364,7 @@ static size_t pt_read(ZSTDCB_DCtx * ctx, ZSTDCB_Buffer * in, size_t * frame)
 		goto error_read;
 	if (unlikely(!IsZstd_Skippable(hdr.buf)))
 		goto error_data;
-	ctx->insize += 12;
+	mt_atomic_add(&ctx->insize, 12);
 
 	/* read new input (size should be _toRead_ bytes */
 	toRead = MEM_readLE32((unsigned char *)hdr.buf + 8);
@@ -340,7 +381,8 @@ static size_t pt_read(ZSTDCB_DCtx * ctx, ZSTDCB_Buffer * in, size_t * frame)
 		}
 
 		in->size = toRead;
-		rv = ctx->fn_read(ctx->arg_read, in);
+		MTSTAT_TIME(st, read,
+			    rv = ctx->fn_read(ctx->arg_read, in));
 		if (rv != 0) {
 			pthread_mutex_unlock(&ctx->read_mutex);
 			return mt_error(rv);
@@ -349,7 +391,7 @@ static size_t pt_read(ZSTDCB_DCtx * ctx, ZSTDCB_Buffer * in, size_t * frame)
 		if (in->size != toRead)
 			goto error_data;
 
-		ctx->insize += in->size;
+		mt_atomic_add(&ctx->insize, in->size);
 	}
 	*frame = ctx->frames++;
 	pthread_mutex_unlock(&ctx->read_mutex);
@@ -376,6 +418,7 @@ static void *pt_decompress(void *arg)
 	struct writelist *wl;
 	size_t result = 0;
 	ZSTDCB_Buffer collect;
+	MTSTAT_VAR;
 
 	/* init dstream stream */
 	result = ZSTD_initDStream(w->dctx);
@@ -393,7 +436,7 @@ static void *pt_decompress(void *arg)
 		ZSTD_outBuffer zOut;
 
 		/* select or allocate space for new output */
-		pthread_mutex_lock(&ctx->write_mutex);
+		MTSTAT_LOCK(&w->stat, write_wait, &ctx->write_mutex);
 		if (!list_empty(&ctx->writelist_free)) {
 			/* take unused entry */
 			struct list_head *entry;
@@ -432,13 +475,18 @@ static void *pt_decompress(void *arg)
 		}
 
 		/* zero should not happen here! */
-		result = pt_read(ctx, in, &wl->frame);
+		MTTRACE(ctx, read_begin, w - ctx->cwork, 0, 0);
+		result = pt_read(ctx, &w->stat, in, &wl->frame);
+		MTTRACE(ctx, read_end, w - ctx->cwork,
+			in->size ? wl->frame : 0, in->size);
 		if (in->size == 0)
 			break;
 		if (ZSTDCB_isError(result)) {
 			goto error_lock;
 		}
 
+		MTTRACE(ctx, codec_begin, w - ctx->cwork, wl->frame, in->size);
+		MTSTAT_BEGIN();
 		zIn.size = in->allocated;
 		zIn.src = in->buf;
 		zIn.pos = 0;
@@ -453,7 +501,9 @@ static void *pt_decompress(void *arg)
 			dprintf
 			    ("ZSTD_decompressStream() zIn.size=%zu zIn.pos=%zu zOut.size=%zu zOut.pos=%zu\n",
 			     zIn.size, zIn.pos, zOut.size, zOut.pos);
-			result = ZSTD_decompressStream(w->dctx, &zOut, &zIn);
+			MTSTAT_TIME(&w->stat, codec,
+				    result = ZSTD_decompressStream(w->dctx, &zOut,
+								   &zIn));
 			dprintf
 			    ("ZSTD_decompressStream(), ret=%zu zIn.size=%zu zIn.pos=%zu zOut.size=%zu zOut.pos=%zu\n",
 			     result, zIn.size, zIn.pos, zOut.size, zOut.pos);
@@ -486,9 +536,16 @@ static void *pt_decompress(void *arg)
 				} else {
 					out->size = zOut.pos;
 				}
+				MTTRACE(ctx, codec_end, w - ctx->cwork, wl->frame,
+					in->size);
+				MTOUTPUT(ctx, wl->frame, out->buf, out->size);
+
 				/* write result */
-				pthread_mutex_lock(&ctx->write_mutex);
-				result = pt_write(ctx, wl);
+				MTTRACE(ctx, queued, w - ctx->cwork, wl->frame,
+					wl->out.size);
+				MTSTAT_LOCK(&w->stat, write_wait, &ctx->write_mutex);
+				MTSTAT_TIME(&w->stat, write, result = pt_write(ctx, wl));
+				MTSTAT_FRAME(&w->stat, in->size, out->size);
 				if (ZSTDCB_isError(result))
 					goto error_unlock;
 				pthread_mutex_unlock(&ctx->write_mutex);
@@ -524,6 +581,10 @@ static void *pt_decompress(void *arg)
 			if (zIn.pos == zIn.size)
 				break;	/* should fail... */
 		}		/* decompress loop */
+
+		/* with an executor, each frame is a task of its own */
+		if (mt_task_yield(&w->task))
+			return MT_YIELD;
 	}			/* read input loop */
 
 	/* everything is okay */
@@ -548,6 +609,97 @@ static void *pt_decompress(void *arg)
 	return (void *)result;
 }
 
+/**
+ * pt_test - verify frames without producing any output
+ *
+ * Each frame is decoded into a small per thread scratch buffer, which
+ * is overwritten again and again. There is no ordering and no writer,
+ * so the threads only compete for the read mutex.
+ */
+static void *pt_test(void *arg)
+{
+	cwork_t *w = (cwork_t *) arg;
+	ZSTDCB_Buffer *in = &w->in;
+	ZSTDCB_DCtx *ctx = w->ctx;
+	size_t result, frame, outsize;
+	MTSTAT_VAR;
+
+	result = ZSTD_initDStream(w->dctx);
+	if (ZSTD_isError(result))
+		goto error_clib;
+
+	for (;;) {
+		ZSTD_inBuffer zIn;
+		ZSTD_outBuffer zOut;
+
+		MTTRACE(ctx, read_begin, w - ctx->cwork, 0, 0);
+		result = pt_read(ctx, &w->stat, in, &frame);
+		if (ZSTDCB_isError(result))
+			goto error;
+		MTTRACE(ctx, read_end, w - ctx->cwork,
+			in->size ? frame : 0, in->size);
+		if (in->size == 0)
+			break;
+
+		result = ZSTD_DCtx_reset(w->dctx, ZSTD_reset_session_only);
+		if (ZSTD_isError(result))
+			goto error_clib;
+
+		MTTRACE(ctx, codec_begin, w - ctx->cwork, frame, in->size);
+		MTSTAT_BEGIN();
+		zIn.src = in->buf;
+		zIn.size = in->size;
+		zIn.pos = 0;
+		outsize = 0;
+		do {
+			zOut.dst = w->scratch.buf;
+			zOut.size = w->scratch.allocated;
+			zOut.pos = 0;
+			MTSTAT_TIME(&w->stat, codec,
+				    result = ZSTD_decompressStream(w->dctx, &zOut,
+								   &zIn));
+			if (ZSTD_isError(result))
+				goto error_clib;
+			outsize += zOut.pos;
+		} while (result != 0 &&
+			 (zIn.pos < zIn.size || zOut.pos == zOut.size));
+
+		/* frame is truncated */
+		if (result != 0) {
+			result = ZSTDCB_ERROR(data_error);
+			goto error;
+		}
+		MTTRACE(ctx, codec_end, w - ctx->cwork, frame, in->size);
+		MTSTAT_FRAME(&w->stat, in->size, outsize);
+
+		/* without writer, the progress is serialized here */
+		mt_atomic_add(&ctx->outsize, outsize);
+		mt_atomic_add(&ctx->curframe, 1);
+		if (ctx->progress.fn) {
+			pthread_mutex_lock(&ctx->write_mutex);
+			MTPROGRESS(ctx, 0);
+			pthread_mutex_unlock(&ctx->write_mutex);
+		}
+
+		/* with an executor, each frame is a task of its own */
+		if (mt_task_yield(&w->task))
+			return MT_YIELD;
+	}
+
+	result = 0;
+	goto out;
+
+ error_clib:
+	zstdmt_errcode = result;
+	result = ZSTDCB_ERROR(compression_library);
+	/* fall through */
+ error:
+ out:
+	if (in->allocated)
+		free(in->buf);
+	return (void *)result;
+}
+
 /* single threaded */
 static size_t st_decompress(void *arg)
 {
@@ -598,7 +750,8 @@ static size_t st_decompress(void *arg)
 		in->size = in->allocated - magic->size;
 
 		/* read more bytes, to fill buffer */
-		rv = ctx->fn_read(ctx->arg_read, in);
+		MTSTAT_TIME(&w->stat, read,
+			    rv = ctx->fn_read(ctx->arg_read, in));
 		if (rv != 0) {
 			result = mt_error(rv);
 			goto error;
@@ -607,7 +760,8 @@ static size_t st_decompress(void *arg)
 		/* ready, first buffer complete */
 		in->buf = buf;
 		in->size += magic->size;
-		ctx->insize += in->size;
+		mt_atomic_add(&ctx->insize, in->size);
+		w->stat.insize += in->size;
 	}
 
 	zIn.src = in->buf;
@@ -622,21 +776,25 @@ static size_t st_decompress(void *arg)
 			zOut.size = out->allocated;
 			zOut.pos = 0;
 
-			result = ZSTD_decompressStream(w->dctx, &zOut, &zIn);
+			MTSTAT_TIME(&w->stat, codec, result =
+				    ZSTD_decompressStream(w->dctx, &zOut, &zIn));
 			if (ZSTD_isError(result))
 				goto error_clib;
 
-			if (zOut.pos) {
+			if (zOut.pos && !ctx->testonly) {
 				ZSTDCB_Buffer wb;
 				wb.size = zOut.pos;
 				wb.buf = zOut.dst;
-				rv = ctx->fn_write(ctx->arg_write, &wb);
+				MTSTAT_TIME(&w->stat, write, rv =
+					    ctx->fn_write(ctx->arg_write, &wb));
 				if (rv != 0) {
 					result = mt_error(rv);
 					goto error;
 				}
-				ctx->outsize += zOut.pos;
 			}
+			mt_atomic_add(&ctx->outsize, zOut.pos);
+			MTPROGRESS(ctx, 0);
+			w->stat.outsize += zOut.pos;
 
 			/* one more round */
 			if ((zIn.pos == zIn.size) && (result == 1) && zOut.pos)
@@ -648,6 +806,7 @@ static size_t st_decompress(void *arg)
 
 			/* end of frame */
 			if (result == 0) {
+				w->stat.frames++;
 				result = ZSTD_resetDStream(w->dctx);
 				if (ZSTD_isError(result))
 					goto error_clib;
@@ -656,7 +815,8 @@ static size_t st_decompress(void *arg)
 
 		/* read next input */
 		in->size = in->allocated;
-		rv = ctx->fn_read(ctx->arg_read, in);
+		MTSTAT_TIME(&w->stat, read,
+			    rv = ctx->fn_read(ctx->arg_read, in));
 		if (rv != 0) {
 			result = mt_error(rv);
 			goto error;
@@ -664,7 +824,8 @@ static size_t st_decompress(void *arg)
 
 		if (in->size == 0)
 			goto okay;
-		ctx->insize += in->size;
+		mt_atomic_add(&ctx->insize, in->size);
+		w->stat.insize += in->size;
 
 		zIn.size = in->size;
 		zIn.pos = 0;
@@ -683,6 +844,7 @@ static size_t st_decompress(void *arg)
 	/* no error */
 	free(out->buf);
 	free(in->buf);
+	MTPROGRESS(ctx, 1);
 	return 0;
 }
 
@@ -690,13 +852,30 @@ static size_t st_decompress(void *arg)
 #define TYPE_SINGLE_THREAD 1
 #define TYPE_MULTI_THREAD  2
 
-size_t ZSTDCB_decompressDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr)
+/* free the workers of the last run, a context may be used again */
+static void free_workers(ZSTDCB_DCtx * ctx)
+{
+	int t;
+
+	for (t = 0; ctx->cwork && t < ctx->threads; t++) {
+		cwork_t *w = &ctx->cwork[t];
+		ZSTD_freeDStream(w->dctx);
+		free(w->scratch.buf);
+	}
+
+	free(ctx->cwork);
+	ctx->cwork = 0;
+	ctx->threads = 0;
+}
+
+static size_t mt_decompress(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr)
 {
 	unsigned char buf[16];
 	ZSTDCB_Buffer In;
 	ZSTDCB_Buffer *in = &In;
 	cwork_t *w;
-	int t, rv, type = TYPE_UNKNOWN;
+	mt_group group;
+	int t, rv, workers, type = TYPE_UNKNOWN;
 	void *retval_of_thread = 0;
 
 	if (!ctx)
@@ -708,6 +887,13 @@ size_t ZSTDCB_decompressDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr)
 	ctx->arg_read = rdwr->arg_read;
 	ctx->arg_write = rdwr->arg_write;
 
+	/* init counters */
+	free_workers(ctx);
+	mt_atomic_set(&ctx->insize, 0);
+	mt_atomic_set(&ctx->outsize, 0);
+	mt_atomic_set(&ctx->curframe, 0);
+	ctx->frames = 0;
+
 	/**
 	 * possible valid magic's for us, we need 16 bytes, for checking
 	 *
@@ -773,6 +959,8 @@ size_t ZSTDCB_decompressDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr)
 		w->in.size = in->size;
 		w->in.allocated = 0;
 		w->ctx = ctx;
+		w->scratch.buf = 0;
+		memset(&w->stat, 0, sizeof(w->stat));
 		w->dctx = ZSTD_createDStream();
 		if (!w->dctx)
 			return ZSTDCB_ERROR(memory_allocation);
@@ -794,9 +982,25 @@ size_t ZSTDCB_decompressDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr)
 		w->in.size = in->size;
 		w->in.allocated = 0;
 		w->ctx = ctx;
+		memset(&w->stat, 0, sizeof(w->stat));
+		w->scratch.buf = 0;
+		w->scratch.size = 0;
+		w->scratch.allocated = 0;
 		w->dctx = ZSTD_createDStream();
-		if (!w->dctx)
+		if (!w->dctx) {
+			ctx->threads = t + 1;
 			return ZSTDCB_ERROR(memory_allocation);
+		}
+
+		/* testing writes nothing, one buffer for all frames */
+		if (ctx->testonly) {
+			w->scratch.allocated = ZSTD_DStreamOutSize();
+			w->scratch.buf = malloc(w->scratch.allocated);
+			if (!w->scratch.buf) {
+				ctx->threads = t + 1;
+				return ZSTDCB_ERROR(memory_allocation);
+			}
+		}
 	}
 
 	/* real multi threaded, init pthread's */
@@ -808,20 +1012,17 @@ size_t ZSTDCB_decompressDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr)
 	INIT_LIST_HEAD(&ctx->writelist_busy);
 	INIT_LIST_HEAD(&ctx->writelist_done);
 
-	/* multi threaded */
-	for (t = 0; t < ctx->threads; t++) {
+	/* multi threaded, as threads or as tasks of the executor */
+	mt_group_init(&group, &ctx->executor);
+	workers = mt_group_workers(&ctx->executor, ctx->threads);
+	for (t = 0; t < workers; t++) {
 		cwork_t *wt = &ctx->cwork[t];
-		pthread_create(&wt->pthread, NULL, pt_decompress, wt);
+		mt_group_start(&group, &wt->task,
+			       ctx->testonly ? pt_test : pt_decompress, wt);
 	}
 
 	/* wait for all workers */
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *wt = &ctx->cwork[t];
-		void *p = 0;
-		pthread_join(wt->pthread, &p);
-		if (p)
-			retval_of_thread = p;
-	}
+	retval_of_thread = mt_group_wait(&group);
 
 	/* clean up pthread stuff */
 	pthread_mutex_destroy(&ctx->read_mutex);
@@ -839,16 +1040,98 @@ size_t ZSTDCB_decompressDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr)
 		free(wl);
 	}
 
+	if (!retval_of_thread)
+		MTPROGRESS(ctx, 1);
+
 	return (size_t) retval_of_thread;
 }
 
+size_t ZSTDCB_decompressDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr)
+{
+	if (!ctx)
+		return ZSTDCB_ERROR(compressionParameter_unsupported);
+
+	ctx->testonly = 0;
+	return mt_decompress(ctx, rdwr);
+}
+
+size_t ZSTDCB_testDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr)
+{
+	if (!ctx)
+		return ZSTDCB_ERROR(compressionParameter_unsupported);
+
+	ctx->testonly = 1;
+	return mt_decompress(ctx, rdwr);
+}
+
+size_t ZSTDCB_listDCtx(ZSTDCB_DCtx * ctx, ZSTDCB_RdWr_t * rdwr,
+		       fn_skip * fn_skip)
+{
+	unsigned char buf[12 + ZSTD_FRAMEHEADERSIZE_MAX];
+	unsigned long long csize;
+	ZSTDCB_Buffer hdr;
+	size_t toRead, len;
+	int rv;
+
+	if (!ctx)
+		return ZSTDCB_ERROR(compressionParameter_unsupported);
+
+	for (;;) {
+		/* 12 byte skippable frame */
+		hdr.buf = buf;
+		hdr.size = 12;
+		rv = rdwr->fn_read(rdwr->arg_read, &hdr);
+		if (rv != 0)
+			return mt_error(rv);
+
+		/* eof reached */
+		if (hdr.size == 0)
+			break;
+
+		if (hdr.size != 12 || !IsZstd_Skippable(buf)
+		    || MEM_readLE32(buf + 4) != 4)
+			return ZSTDCB_ERROR(data_error);
+
+		/* header of the zstd frame */
+		toRead = MEM_readLE32(buf + 8);
+		len = toRead;
+		if (len > ZSTD_FRAMEHEADERSIZE_MAX)
+			len = ZSTD_FRAMEHEADERSIZE_MAX;
+		hdr.buf = buf + 12;
+		hdr.size = len;
+		rv = rdwr->fn_read(rdwr->arg_read, &hdr);
+		if (rv != 0)
+			return mt_error(rv);
+		if (hdr.size != len)
+			return ZSTDCB_ERROR(data_error);
+
+		csize = ZSTD_getFrameContentSize(buf + 12, len);
+		if (csize == ZSTD_CONTENTSIZE_ERROR)
+			return ZSTDCB_ERROR(data_error);
+		if (csize == ZSTD_CONTENTSIZE_UNKNOWN)
+			return ZSTDCB_ERROR(frame_decompress);
+
+		/* the frame body */
+		rv = fn_skip(rdwr->arg_read, toRead - len);
+		if (rv != 0)
+			return mt_error(rv);
+
+		mt_atomic_add(&ctx->insize, 12 + toRead);
+		mt_atomic_add(&ctx->outsize, csize);
+		ctx->frames++;
+		mt_atomic_add(&ctx->curframe, 1);
+	}
+
+	return 0;
+}
+
 /* returns current uncompressed data size */
 size_t ZSTDCB_GetInsizeDCtx(ZSTDCB_DCtx * ctx)
 {
 	if (!ctx)
 		return 0;
 
-	return ctx->insize;
+	return mt_atomic_get(&ctx->insize);
 }
 
 /* returns the current compressed data size */
@@ -857,7 +1140,7 @@ size_t ZSTDCB_GetOutsizeDCtx(ZSTDCB_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->outsize;
+	return mt_atomic_get(&ctx->outsize);
 }
 
 /* returns the current compressed frames */
@@ -866,24 +1149,84 @@ size_t ZSTDCB_GetFramesDCtx(ZSTDCB_DCtx * ctx)
 	if (!ctx)
 		return 0;
 
-	return ctx->curframe;
+	return mt_atomic_get(&ctx->curframe);
 }
 
-void ZSTDCB_freeDCtx(ZSTDCB_DCtx * ctx)
+/* returns the counters of all workers together */
+void ZSTDCB_GetStatsDCtx(ZSTDCB_DCtx * ctx, mtstat_t * st)
+{
+	int t;
+
+	memset(st, 0, sizeof(*st));
+	if (!ctx || !ctx->cwork)
+		return;
+
+	for (t = 0; t < ctx->threads; t++)
+		mtstat_add(st, &ctx->cwork[t].stat);
+}
+
+/* returns the number of workers, up to count of them are copied to st */
+int ZSTDCB_GetWorkerStatsDCtx(ZSTDCB_DCtx * ctx, mtstat_t * st, int count)
 {
 	int t;
 
+	if (!ctx || !ctx->cwork)
+		return 0;
+
+	for (t = 0; t < ctx->threads && t < count; t++)
+		st[t] = ctx->cwork[t].stat;
+
+	return ctx->threads;
+}
+
+/* register a progress callback, see mtprogress_init() */
+void ZSTDCB_setProgressDCtx(ZSTDCB_DCtx * ctx, mtprogress_fn * fn,
+			void *arg, unsigned ms, size_t bytes)
+{
 	if (!ctx)
 		return;
 
-	for (t = 0; t < ctx->threads; t++) {
-		cwork_t *w = &ctx->cwork[t];
-		ZSTD_freeDStream(w->dctx);
-	}
+	mtprogress_init(&ctx->progress, fn, arg, ms, bytes);
+}
+
+/* register a trace callback, see mttrace_fn in mtstat.h */
+void ZSTDCB_setTraceDCtx(ZSTDCB_DCtx * ctx, mttrace_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->trace = fn;
+	ctx->trace_arg = arg;
+}
+
+/* register an output callback, see mtoutput_fn in mtstat.h */
+void ZSTDCB_setOutputDCtx(ZSTDCB_DCtx * ctx, mtoutput_fn * fn, void *arg)
+{
+	if (!ctx)
+		return;
+
+	ctx->output = fn;
+	ctx->output_arg = arg;
+}
+
+/* run the workers as tasks of ex, or on threads again, when ex is zero */
+void ZSTDCB_setExecutorDCtx(ZSTDCB_DCtx * ctx, const mt_executor * ex)
+{
+	if (!ctx)
+		return;
+
+	if (ex)
+		ctx->executor = *ex;
+	else
+		ctx->executor.submit = 0;
+}
 
-	if (ctx->cwork)
-		free(ctx->cwork);
+void ZSTDCB_freeDCtx(ZSTDCB_DCtx * ctx)
+{
+	if (!ctx)
+		return;
 
+	free_workers(ctx);
 	free(ctx);
 	ctx = 0;
 
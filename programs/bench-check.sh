@@ -0,0 +1,88 @@
+#!/bin/sh
+##############################################################################
+# performance regression gate for the -mt programs
+#
+# bench-check.sh baseline   - benchmark and store the results in $BASELINE
+# bench-check.sh check      - benchmark and compare against $BASELINE
+#
+# The corpora come from datagen with a fixed seed, so the compressed sizes
+# must match the baseline exactly and the speeds within $TOLERANCE percent.
+# Speeds only compare well on the same machine, so keep one baseline file
+# per box and record it before the change under test.
+##############################################################################
+
+METHODS=${METHODS:-"brotli lizard lz4 lz5 zstd snappy lzfse"}
+TYPES=${TYPES:-"text log json binary sparse zero random mixed"}
+SIZES=${SIZES:-"1M 16M"}
+THREADS=${THREADS:-4}
+SEED=${SEED:-1}
+BENCHTIME=${BENCHTIME:-1}
+TOLERANCE=${TOLERANCE:-10}
+BASELINE=${BASELINE:-bench-baseline.txt}
+TMP=${TMPDIR:-/tmp}/bench-check.$$
+
+case "$1" in
+baseline|check) ;;
+*) echo "Usage: $0 baseline|check" >&2; exit 2 ;;
+esac
+
+if [ "$1" = check ] && [ ! -f "$BASELINE" ]; then
+	echo "$0: no baseline '$BASELINE', run '$0 baseline' first" >&2
+	exit 2
+fi
+
+mkdir -p $TMP || exit 2
+trap 'rm -rf $TMP' 0 1 2 15
+
+# results: corpus method level threads compressed comp-MB/s decomp-MB/s
+for t in $TYPES; do
+	for s in $SIZES; do
+		./datagen -t $t -s $s -S $SEED > $TMP/corpus || exit 2
+		for m in $METHODS; do
+			./$m-mt --bench -T $THREADS --bench-time=$BENCHTIME \
+			    $TMP/corpus > $TMP/out || {
+				echo "FAILING: $m $t-$s" >&2
+				exit 1
+			}
+			awk -v c="$t-$s" '$1 != "method" {
+				print c, $1, $2, $3, $5, $7, $8
+			}' $TMP/out
+		done
+	done
+done > $TMP/results
+
+if [ "$1" = baseline ]; then
+	cp $TMP/results "$BASELINE" || exit 2
+	echo "baseline written to $BASELINE ($(wc -l < "$BASELINE") results)"
+	exit 0
+fi
+
+awk -v tol=$TOLERANCE '
+	NR == FNR { size[$1 " " $2 " " $3 " " $4] = $5
+		    comp[$1 " " $2 " " $3 " " $4] = $6
+		    dec[$1 " " $2 " " $3 " " $4] = $7; next }
+	{
+		k = $1 " " $2 " " $3 " " $4
+		if (!(k in size)) { print "NEW:", k; next }
+		n++
+		if ($5 != size[k]) {
+			printf "REGRESSION: %s compressed %s, baseline %s\n",
+			    k, $5, size[k]
+			bad++
+		}
+		if ($6 < comp[k] * (100 - tol) / 100) {
+			printf "REGRESSION: %s comp %.1f MB/s, baseline %.1f\n",
+			    k, $6, comp[k]
+			bad++
+		}
+		if ($7 < dec[k] * (100 - tol) / 100) {
+			printf "REGRESSION: %s decomp %.1f MB/s, baseline %.1f\n",
+			    k, $7, dec[k]
+			bad++
+		}
+	}
+	END {
+		printf "%d results compared, %d regressions (tolerance %d%%)\n",
+		    n, bad, tol
+		exit bad ? 1 : 0
+	}' "$BASELINE" $TMP/results
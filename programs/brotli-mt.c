@@ -32,7 +32,21 @@
 #define MT_GetFramesCCtx   BROTLIMT_GetFramesCCtx
 #define MT_GetInsizeCCtx   BROTLIMT_GetInsizeCCtx
 #define MT_GetOutsizeCCtx  BROTLIMT_GetOutsizeCCtx
+#define MT_GetStatsCCtx    BROTLIMT_GetStatsCCtx
+#define MT_GetWorkerStatsCCtx BROTLIMT_GetWorkerStatsCCtx
+#define MT_setProgressCCtx BROTLIMT_setProgressCCtx
+#define MT_setTraceCCtx    BROTLIMT_setTraceCCtx
 #define MT_freeCCtx        BROTLIMT_freeCCtx
+#define MT_setCCtxParameter BROTLIMT_setCCtxParameter
+#define MT_p_window        BROTLIMT_p_window
+#define MT_p_block         BROTLIMT_p_block
+#define MT_p_mode          BROTLIMT_p_mode
+#define MT_p_large_window  BROTLIMT_p_large_window
+#define MT_MODE_GENERIC    BROTLIMT_MODE_GENERIC
+#define MT_MODE_TEXT       BROTLIMT_MODE_TEXT
+#define MT_MODE_FONT       BROTLIMT_MODE_FONT
+#define MT_MODE_AUTO       BROTLIMT_MODE_AUTO
+#define MT_setCCtxDictionary BROTLIMT_setCCtxDictionary
 
 #define MT_DCtx            BROTLIMT_DCtx
 #define MT_createDCtx      BROTLIMT_createDCtx
@@ -40,6 +54,12 @@
 #define MT_GetFramesDCtx   BROTLIMT_GetFramesDCtx
 #define MT_GetInsizeDCtx   BROTLIMT_GetInsizeDCtx
 #define MT_GetOutsizeDCtx  BROTLIMT_GetOutsizeDCtx
+#define MT_GetStatsDCtx    BROTLIMT_GetStatsDCtx
+#define MT_GetWorkerStatsDCtx BROTLIMT_GetWorkerStatsDCtx
+#define MT_setProgressDCtx BROTLIMT_setProgressDCtx
+#define MT_setTraceDCtx    BROTLIMT_setTraceDCtx
+#define MT_setOutputDCtx   BROTLIMT_setOutputDCtx
 #define MT_freeDCtx        BROTLIMT_freeDCtx
+#define MT_setDCtxDictionary BROTLIMT_setDCtxDictionary
 
 #include "main.c"
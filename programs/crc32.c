@@ -0,0 +1,255 @@
+/**
+ * Copyright (c) 2024 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+#include "../lib/memmt.h"
+#include "crc32.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define CRC32_PCLMUL 1
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+static U32 crc32_table[16][256];
+static U32 crc32_x2n[32];
+static int crc32_initdone = 0;
+static int crc32_haspclmul = 0;
+
+static U32 crc32_multmodp(U32 a, U32 b);
+
+void crc32_init(void)
+{
+	U32 b, i, r, poly32 = 0xEDB88320U;
+
+	for (b = 0; b < 256; ++b) {
+		r = b;
+		for (i = 0; i < 8; ++i) {
+			if (r & 1)
+				r = (r >> 1) ^ poly32;
+			else
+				r >>= 1;
+		}
+		crc32_table[0][b] = r;
+	}
+
+	/* table k gives the crc of a byte followed by k zero bytes */
+	for (i = 1; i < 16; ++i)
+		for (b = 0; b < 256; ++b) {
+			r = crc32_table[i - 1][b];
+			crc32_table[i][b] = (r >> 8) ^ crc32_table[0][r & 0xFF];
+		}
+
+	/* x^(2^k) modulo the polynomial, x^1 is bit 30 when reflected */
+	r = (U32)1 << 30;
+	for (i = 0; i < 32; ++i) {
+		crc32_x2n[i] = r;
+		r = crc32_multmodp(r, r);
+	}
+
+#ifdef CRC32_PCLMUL
+	__builtin_cpu_init();
+	crc32_haspclmul = __builtin_cpu_supports("pclmul")
+	    && __builtin_cpu_supports("sse4.1");
+#endif
+	crc32_initdone = 1;
+}
+
+/* slicing-by-16, works on the inverted crc */
+static U32 crc32_slice16(const unsigned char *buf, size_t size, U32 crc)
+{
+	const U32 (*t)[256] = (const U32 (*)[256])crc32_table;
+
+	while (size >= 16) {
+		U32 a = MEM_readLE32(buf) ^ crc;
+		U32 b = MEM_readLE32(buf + 4);
+		U32 c = MEM_readLE32(buf + 8);
+		U32 d = MEM_readLE32(buf + 12);
+
+		crc = t[15][a & 0xFF] ^ t[14][(a >> 8) & 0xFF] ^
+		    t[13][(a >> 16) & 0xFF] ^ t[12][a >> 24] ^
+		    t[11][b & 0xFF] ^ t[10][(b >> 8) & 0xFF] ^
+		    t[9][(b >> 16) & 0xFF] ^ t[8][b >> 24] ^
+		    t[7][c & 0xFF] ^ t[6][(c >> 8) & 0xFF] ^
+		    t[5][(c >> 16) & 0xFF] ^ t[4][c >> 24] ^
+		    t[3][d & 0xFF] ^ t[2][(d >> 8) & 0xFF] ^
+		    t[1][(d >> 16) & 0xFF] ^ t[0][d >> 24];
+
+		buf += 16;
+		size -= 16;
+	}
+
+	while (size != 0) {
+		crc = t[0][*buf++ ^ (crc & 0xFF)] ^ (crc >> 8);
+		--size;
+	}
+
+	return crc;
+}
+
+#ifdef CRC32_PCLMUL
+/**
+ * crc32_pclmul() - fold 4x128 bits per round with carry-less multiply
+ *
+ * Based on the Intel paper "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction", with the bit-reflected constants for the
+ * gzip polynomial. Works on the inverted crc, size must be a multiple of
+ * 16 and at least 64.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static U32 crc32_pclmul(const unsigned char *buf, size_t size, U32 crc)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+	const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	buf += 64;
+	size -= 64;
+
+	/* fold 512 bits in parallel */
+	while (size >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+			_mm_loadu_si128((const __m128i *)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+			_mm_loadu_si128((const __m128i *)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+			_mm_loadu_si128((const __m128i *)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+			_mm_loadu_si128((const __m128i *)(buf + 0x30)));
+
+		buf += 64;
+		size -= 64;
+	}
+
+	/* fold into 128 bits */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* single 128 bit folds */
+	while (size >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		size -= 16;
+	}
+
+	/* fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* barrett reduction to 32 bits */
+	x2 = _mm_and_si128(x1, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (U32)_mm_extract_epi32(x1, 1);
+}
+#endif
+
+unsigned int crc32(const unsigned char *buf, size_t size, unsigned int crc)
+{
+	if (unlikely(!crc32_initdone))
+		crc32_init();
+
+	crc = ~crc;
+
+#ifdef CRC32_PCLMUL
+	if (crc32_haspclmul && size >= 64) {
+		size_t len = size & ~(size_t)15;
+		crc = crc32_pclmul(buf, len, crc);
+		buf += len;
+		size -= len;
+	}
+#endif
+
+	return ~crc32_slice16(buf, size, crc);
+}
+
+/* a * b modulo the polynomial, both reflected, a must not be zero */
+static U32 crc32_multmodp(U32 a, U32 b)
+{
+	U32 m = (U32)1 << 31, p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ 0xEDB88320U : b >> 1;
+	}
+
+	return p;
+}
+
+/* x^(n * 2^k) modulo the polynomial */
+static U32 crc32_x2nmodp(size_t n, unsigned k)
+{
+	U32 p = (U32)1 << 31;
+
+	while (n) {
+		if (n & 1)
+			p = crc32_multmodp(crc32_x2n[k & 31], p);
+		n >>= 1;
+		k++;
+	}
+
+	return p;
+}
+
+unsigned int crc32_combine(unsigned int crc1, unsigned int crc2, size_t len2)
+{
+	if (unlikely(!crc32_initdone))
+		crc32_init();
+
+	/* crc1 shifted by len2 zero bytes, then the crc of the second part */
+	return crc32_multmodp(crc32_x2nmodp(len2, 3), crc1) ^ crc2;
+}
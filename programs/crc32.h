@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) 2024 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/**
+ * crc32() - crc32 (ISO 3309, like gzip) of buf, continuing from crc
+ *
+ * Uses PCLMULQDQ folding when the cpu supports it, slicing-by-16
+ * tables otherwise. The implementation is selected on the first call.
+ */
+extern unsigned int crc32(const unsigned char *buf, size_t size,
+			  unsigned int crc);
+
+/**
+ * crc32_combine() - crc32 of two parts, from the crc32 of each part
+ *
+ * crc1 is the crc of the first part, crc2 and len2 the crc and length
+ * of the second one, so the parts may be done in parallel.
+ */
+extern unsigned int crc32_combine(unsigned int crc1, unsigned int crc2,
+				  size_t len2);
+
+/**
+ * crc32_init() - fill the tables, done by the first call of crc32()
+ *
+ * Must be called before crc32() runs on several threads at once.
+ */
+extern void crc32_init(void);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* CRC32_H */
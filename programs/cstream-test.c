@@ -0,0 +1,246 @@
+/**
+ * Copyright (c) 2024 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+/**
+ * cstream-test - push, flush and end of ZSTDCB_CStream
+ *
+ * The input is pushed in pieces, some of them exact multiples of the
+ * chunk size, the output must decode to the input again. Failing frames
+ * and failing output must be reported by flush and end. A hanging
+ * stream is stopped by alarm(), so "make tests" fails instead of waiting.
+ *
+ * The Makefile links with -Wl,--wrap=ZSTD_compress2 for the failures.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "zstd.h"
+#include "zstd-mt.h"
+
+#define THREADS   4
+#define LEVEL     1
+#define CHUNK     (64 * 1024)
+#define TIMEOUT   60
+
+/* the output of the stream */
+static unsigned char *outbuf;
+static size_t outsize, outallocated;
+
+/* the compression of this frame or the output of this frame fails */
+static int fail_compress, fail_write;
+static int compressed, written;
+
+size_t __real_ZSTD_compress2(ZSTD_CCtx * cctx, void *dst, size_t dstSize,
+			     const void *src, size_t srcSize);
+
+size_t __wrap_ZSTD_compress2(ZSTD_CCtx * cctx, void *dst, size_t dstSize,
+			     const void *src, size_t srcSize)
+{
+	if (__sync_add_and_fetch(&compressed, 1) == fail_compress)
+		return (size_t)-1;
+
+	return __real_ZSTD_compress2(cctx, dst, dstSize, src, srcSize);
+}
+
+static int write_out(void *arg, ZSTDCB_Buffer * out)
+{
+	(void)arg;
+	if (++written == fail_write)
+		return -1;
+	if (outsize + out->size > outallocated) {
+		unsigned char *buf;
+		size_t size = (outsize + out->size) * 2;
+
+		buf = (unsigned char *)realloc(outbuf, size);
+		if (!buf)
+			return -3;
+		outbuf = buf;
+		outallocated = size;
+	}
+	memcpy(outbuf + outsize, out->buf, out->size);
+	outsize += out->size;
+
+	return 0;
+}
+
+static void timeout(int sig)
+{
+	static const char msg[] = "cstream-test: timeout, stream hangs\n";
+
+	(void)sig;
+	if (write(2, msg, sizeof(msg) - 1) < 0)
+		_exit(2);
+	_exit(1);
+}
+
+/* some compressible input, zero for the first half */
+static void fill(unsigned char *buf, size_t size)
+{
+	unsigned int seed = 1;
+	size_t i;
+
+	memset(buf, 0, size / 2);
+	for (i = size / 2; i < size; i++) {
+		seed = seed * 1103515245U + 12345U;
+		buf[i] = "abcdefgh \n"[(seed >> 16) % 10];
+	}
+}
+
+/* the output up to now must decode to the first size bytes of src */
+static int check(const char *name, const unsigned char *src, size_t size)
+{
+	unsigned char *dst = (unsigned char *)malloc(size + 1);
+	size_t result;
+
+	if (!dst) {
+		fprintf(stderr, "%s: out of memory\n", name);
+		return 1;
+	}
+
+	result = ZSTD_decompress(dst, size + 1, outbuf, outsize);
+	if (ZSTD_isError(result) || result != size ||
+	    memcmp(dst, src, size) != 0) {
+		fprintf(stderr, "%s: output does not match the input\n",
+			name);
+		free(dst);
+		return 1;
+	}
+
+	free(dst);
+	return 0;
+}
+
+/**
+ * push size bytes of src in pieces of step bytes, flush after each
+ * flush bytes, when nonzero, end the stream and check the output
+ */
+static int run(const char *name, const unsigned char *src, size_t size,
+	       size_t step, size_t flush)
+{
+	ZSTDCB_CStream *cs;
+	size_t pos, n, rv;
+
+	outsize = 0;
+	cs = ZSTDCB_createCStream(THREADS, LEVEL, CHUNK, 0, write_out, 0);
+	if (!cs) {
+		fprintf(stderr, "%s: ZSTDCB_createCStream() failed\n", name);
+		return 1;
+	}
+
+	for (pos = 0; pos < size; pos += n) {
+		n = size - pos < step ? size - pos : step;
+		rv = ZSTDCB_pushCStream(cs, src + pos, n);
+		if (ZSTDCB_isError(rv))
+			goto error;
+		if (flush && (pos + n) % flush == 0) {
+			rv = ZSTDCB_flushCStream(cs);
+			if (ZSTDCB_isError(rv))
+				goto error;
+			if (check(name, src, pos + n))
+				goto fail;
+		}
+	}
+
+	rv = ZSTDCB_endCStream(cs);
+	if (ZSTDCB_isError(rv))
+		goto error;
+	ZSTDCB_freeCStream(cs);
+
+	return check(name, src, size);
+
+ error:
+	fprintf(stderr, "%s: %s\n", name, ZSTDCB_getErrorString(rv));
+ fail:
+	ZSTDCB_freeCStream(cs);
+	return 1;
+}
+
+/* the frames of whole chunks fail, flush and end must return an error */
+static int run_fail(const char *name, const unsigned char *src)
+{
+	ZSTDCB_CStream *cs;
+	size_t rv;
+	int i;
+
+	compressed = written = 0;
+	cs = ZSTDCB_createCStream(THREADS, LEVEL, CHUNK, 0, write_out, 0);
+	if (!cs) {
+		fprintf(stderr, "%s: ZSTDCB_createCStream() failed\n", name);
+		return 1;
+	}
+
+	/* push may see the error already */
+	for (i = 0; i < 8; i++)
+		if (ZSTDCB_isError(ZSTDCB_pushCStream(cs, src, CHUNK)))
+			break;
+
+	rv = ZSTDCB_flushCStream(cs);
+	if (!ZSTDCB_isError(rv)) {
+		fprintf(stderr, "%s: flush reports no error\n", name);
+		ZSTDCB_freeCStream(cs);
+		return 1;
+	}
+
+	rv = ZSTDCB_endCStream(cs);
+	ZSTDCB_freeCStream(cs);
+	if (!ZSTDCB_isError(rv)) {
+		fprintf(stderr, "%s: end reports no error\n", name);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	size_t size = 200 * CHUNK + 1;
+	unsigned char *src = (unsigned char *)malloc(size);
+	int failed = 0;
+
+	if (!src)
+		return 1;
+	fill(src, size);
+	signal(SIGALRM, timeout);
+	alarm(TIMEOUT);
+
+	/* exact multiples of the chunk size, the end has nothing to add */
+	failed |= run("1 chunk", src, CHUNK, CHUNK, 0);
+	failed |= run("16 chunks", src, 16 * CHUNK, CHUNK, 0);
+	failed |= run("200 chunks", src, 200 * CHUNK, CHUNK, 0);
+	failed |= run("200 chunks at once", src, 200 * CHUNK, 200 * CHUNK, 0);
+
+	/* small pieces and a partly filled chunk at the end */
+	failed |= run("small pieces", src, 200 * CHUNK + 1, 1000, 0);
+	failed |= run("empty", src, 0, CHUNK, 0);
+
+	/* flushed after whole and after partly filled chunks */
+	failed |= run("flush chunks", src, 32 * CHUNK, CHUNK, 4 * CHUNK);
+	failed |= run("flush pieces", src, 32 * CHUNK, 5000, 50000);
+
+	/* a worker fails, the others must not wait for more input */
+	fail_compress = 2;
+	failed |= run_fail("failing frame", src);
+	fail_compress = 0;
+	fail_write = 3;
+	failed |= run_fail("failing output", src);
+	fail_write = 0;
+
+	free(src);
+	free(outbuf);
+	printf("%s: cstream\n", failed ? "FAILING" : "SUCCESS");
+
+	return failed;
+}
@@ -0,0 +1,380 @@
+/**
+ * Copyright (c) 2024 Tino Reichardt
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ * You can contact the author at:
+ * - zstdmt source repository: https://github.com/mcmilk/zstdmt
+ */
+
+/**
+ * datagen - deterministic test data for benchmarking
+ *
+ * The same type, size and seed give the same bytes on every platform, so
+ * the results of "make bench-check" can be compared against a baseline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER) || defined(__MINGW32__)
+#include <fcntl.h>
+#include <io.h>
+#define SET_BINARY(file) setmode(fileno(file),O_BINARY)
+#else
+#define SET_BINARY(file)
+#endif
+
+#include "../lib/memmt.h"
+
+#define BLOCKSIZE (64*1024)
+
+typedef struct {
+	U64 rng;		/* state of the random generator */
+	U64 left;		/* bytes still to write */
+	U64 id;			/* running number of records */
+	size_t pos;
+	unsigned char buf[BLOCKSIZE];
+} gen_t;
+
+typedef void (fn_gen)(gen_t * g);
+
+static const char *progname = "datagen";
+
+static const char *words[] = {
+	"the", "of", "and", "to", "in", "a", "is", "that", "for", "it",
+	"as", "was", "with", "be", "by", "on", "not", "he", "this", "are",
+	"or", "his", "from", "at", "which", "but", "have", "an", "had",
+	"they", "you", "were", "their", "one", "all", "we", "can", "her",
+	"has", "there", "been", "if", "more", "when", "will", "would",
+	"who", "so", "no", "thread", "worker", "buffer", "compress",
+	"stream", "frame", "level", "memory", "mutex", "queue", "block",
+	"window", "header", "checksum", "dictionary", "entropy", "literal",
+	"sequence", "offset", "length", "match", "output", "input", "error",
+	"result", "context", "parameter", "benchmark", "throughput"
+};
+#define WORDS (sizeof(words) / sizeof(words[0]))
+
+static const char *levels[] = {
+	"DEBUG", "INFO", "INFO", "INFO", "NOTICE", "WARN", "ERROR"
+};
+#define LEVELS (sizeof(levels) / sizeof(levels[0]))
+
+static const char *services[] = {
+	"sshd", "cron", "kernel", "nginx", "postfix", "systemd", "dbus"
+};
+#define SERVICES (sizeof(services) / sizeof(services[0]))
+
+/* splitmix64, good enough and the same on every platform */
+static U64 rnd(gen_t * g)
+{
+	U64 z = (g->rng += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/* random number in 0..n-1 */
+static unsigned rnd_n(gen_t * g, unsigned n)
+{
+	return (unsigned)(rnd(g) % n);
+}
+
+/* skewed towards small numbers, like the word frequencies of real text */
+static unsigned rnd_zipf(gen_t * g, unsigned n)
+{
+	return rnd_n(g, rnd_n(g, n) + 1);
+}
+
+static void flush(gen_t * g)
+{
+	if (g->pos && fwrite(g->buf, 1, g->pos, stdout) != g->pos) {
+		perror(progname);
+		exit(1);
+	}
+	g->pos = 0;
+}
+
+static void put(gen_t * g, const void *src, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)src;
+
+	if (len > g->left)
+		len = (size_t)g->left;
+	g->left -= len;
+
+	while (len) {
+		size_t n = BLOCKSIZE - g->pos;
+		if (n > len)
+			n = len;
+		memcpy(g->buf + g->pos, p, n);
+		g->pos += n;
+		p += n;
+		len -= n;
+		if (g->pos == BLOCKSIZE)
+			flush(g);
+	}
+}
+
+static void puts_(gen_t * g, const char *s)
+{
+	put(g, s, strlen(s));
+}
+
+/* one line of english like text */
+static void gen_text(gen_t * g)
+{
+	unsigned i, n = 4 + rnd_n(g, 12);
+
+	for (i = 0; i < n; i++) {
+		const char *w = words[rnd_zipf(g, WORDS)];
+		if (i == 0) {
+			char c = w[0] - 'a' + 'A';
+			put(g, &c, 1);
+			puts_(g, w + 1);
+		} else {
+			put(g, " ", 1);
+			puts_(g, w);
+		}
+	}
+	puts_(g, rnd_n(g, 4) ? ".\n" : ",");
+}
+
+/**
+ * syslog like lines with increasing time stamps, the random values are
+ * drawn one by one, the order of function arguments is unspecified
+ */
+static void gen_log(gen_t * g)
+{
+	char line[256];
+	U64 t = g->id * 37 + rnd_n(g, 37);
+	unsigned i, n = 2 + rnd_n(g, 6);
+	unsigned host = rnd_zipf(g, 16);
+	unsigned service = rnd_zipf(g, SERVICES);
+	unsigned pid = 1000 + rnd_zipf(g, 30000);
+	unsigned level = rnd_n(g, LEVELS);
+	unsigned id, size;
+
+	snprintf(line, sizeof(line),
+		 "2024-%02u-%02u %02u:%02u:%02u.%03u host%02u %s[%u]: %s: ",
+		 (unsigned)(t / 2678400000ULL) % 12 + 1,
+		 (unsigned)(t / 86400000) % 28 + 1,
+		 (unsigned)(t / 3600000) % 24,
+		 (unsigned)(t / 60000) % 60,
+		 (unsigned)(t / 1000) % 60,
+		 (unsigned)(t % 1000),
+		 host, services[service], pid, levels[level]);
+	puts_(g, line);
+	for (i = 0; i < n; i++) {
+		puts_(g, words[rnd_zipf(g, WORDS)]);
+		put(g, " ", 1);
+	}
+	id = rnd_n(g, 100000);
+	size = rnd_zipf(g, 1 << 20);
+	snprintf(line, sizeof(line), "id=%u size=%u\n", id, size);
+	puts_(g, line);
+	g->id++;
+}
+
+/* one json record per line, random values drawn one by one as above */
+static void gen_json(gen_t * g)
+{
+	char rec[512];
+	unsigned v = rnd_n(g, 1000000);
+	unsigned first = rnd_zipf(g, WORDS);
+	unsigned last = rnd_zipf(g, WORDS);
+	unsigned active = rnd_n(g, 2);
+	unsigned tag1 = rnd_zipf(g, WORDS);
+	unsigned tag2 = rnd_zipf(g, WORDS);
+	unsigned uid = 1000 + rnd_zipf(g, 64);
+	unsigned group = rnd_zipf(g, SERVICES);
+
+	snprintf(rec, sizeof(rec),
+		 "{\"id\":%llu,\"name\":\"%s %s\",\"active\":%s,"
+		 "\"score\":%u.%02u,\"tags\":[\"%s\",\"%s\"],"
+		 "\"owner\":{\"uid\":%u,\"group\":\"%s\"}}\n",
+		 (unsigned long long)g->id,
+		 words[first], words[last],
+		 active ? "true" : "false",
+		 v % 1000, v % 100,
+		 words[tag1], words[tag2],
+		 uid, services[group]);
+	puts_(g, rec);
+	g->id++;
+}
+
+/* structured binary data: records with counters, flags and random fields */
+static void gen_binary(gen_t * g)
+{
+	unsigned char rec[32];
+	U64 r = rnd(g);
+	unsigned i;
+
+	for (i = 0; i < 8; i++)
+		rec[i] = (unsigned char)(g->id >> (i * 8));
+	for (i = 8; i < 16; i++)
+		rec[i] = (unsigned char)rnd_zipf(g, 256);
+	for (i = 16; i < 24; i++)
+		rec[i] = (unsigned char)(r >> ((i - 16) * 8));
+	for (i = 24; i < 32; i++)
+		rec[i] = (i & 1) ? 0 : (unsigned char)rnd_n(g, 4);
+	put(g, rec, sizeof(rec));
+	g->id++;
+}
+
+/* mostly zeros, with some short random runs in between */
+static void gen_sparse(gen_t * g)
+{
+	unsigned char run[64];
+	unsigned i, zeros = 1 + rnd_n(g, 64), n = 1 + rnd_n(g, sizeof(run));
+
+	memset(run, 0, sizeof(run));
+	for (i = 0; i < zeros; i++)
+		put(g, run, sizeof(run));
+	for (i = 0; i < n; i++)
+		run[i] = (unsigned char)rnd(g);
+	put(g, run, n);
+}
+
+static void gen_zero(gen_t * g)
+{
+	static const unsigned char zero[4096];
+
+	put(g, zero, sizeof(zero));
+}
+
+static void gen_random(gen_t * g)
+{
+	U64 r = rnd(g);
+	unsigned char b[8];
+	unsigned i;
+
+	for (i = 0; i < 8; i++)
+		b[i] = (unsigned char)(r >> (i * 8));
+	put(g, b, sizeof(b));
+}
+
+static void gen_mixed(gen_t * g);
+
+static const struct {
+	const char *name;
+	fn_gen *fn;
+} types[] = {
+	{ "text", gen_text },
+	{ "log", gen_log },
+	{ "json", gen_json },
+	{ "binary", gen_binary },
+	{ "sparse", gen_sparse },
+	{ "zero", gen_zero },
+	{ "random", gen_random },
+	{ "mixed", gen_mixed }
+};
+#define TYPES (sizeof(types) / sizeof(types[0]))
+
+/* some other type, chosen again for every 256 KiB */
+static void gen_mixed(gen_t * g)
+{
+	fn_gen *fn = types[rnd_n(g, TYPES - 1)].fn;
+	U64 end = g->left > 256 * 1024 ? g->left - 256 * 1024 : 0;
+
+	while (g->left > end)
+		fn(g);
+}
+
+static void usage(void)
+{
+	unsigned i;
+
+	printf("Usage: %s [-t TYPE] [-s SIZE] [-S SEED]\n", progname);
+	printf("Write SIZE bytes of deterministic test data to stdout.\n\n");
+	printf("  -t TYPE  One of:");
+	for (i = 0; i < TYPES; i++)
+		printf(" %s", types[i].name);
+	printf(" (default: text)\n");
+	printf("  -s SIZE  Size in bytes, suffix K, M or G (default: 1M)\n");
+	printf("  -S SEED  Seed of the generator (default: 1)\n");
+	exit(0);
+}
+
+static U64 parse_size(const char *s)
+{
+	char *end;
+	U64 size = strtoull(s, &end, 10);
+
+	switch (*end) {
+	case 'G':
+	case 'g':
+		size *= 1024;
+		/* fallthrough */
+	case 'M':
+	case 'm':
+		size *= 1024;
+		/* fallthrough */
+	case 'K':
+	case 'k':
+		size *= 1024;
+		end++;
+	}
+
+	if (end == s || *end) {
+		fprintf(stderr, "%s: invalid size '%s'\n", progname, s);
+		exit(1);
+	}
+
+	return size;
+}
+
+int main(int argc, char **argv)
+{
+	static gen_t g;
+	const char *type = "text";
+	fn_gen *fn = 0;
+	U64 seed = 1;
+	int i;
+	unsigned t;
+
+	g.left = 1024 * 1024;
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (arg[0] != '-' || !arg[1] || arg[2])
+			usage();
+		if (arg[1] == 'h' || i + 1 == argc)
+			usage();
+
+		switch (arg[1]) {
+		case 't':
+			type = argv[++i];
+			break;
+		case 's':
+			g.left = parse_size(argv[++i]);
+			break;
+		case 'S':
+			seed = strtoull(argv[++i], 0, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	for (t = 0; t < TYPES; t++)
+		if (!strcmp(type, types[t].name))
+			fn = types[t].fn;
+	if (!fn) {
+		fprintf(stderr, "%s: unknown type '%s'\n", progname, type);
+		return 1;
+	}
+
+	SET_BINARY(stdout);
+	g.rng = seed;
+	while (g.left)
+		fn(&g);
+	flush(&g);
+
+	return 0;
+}
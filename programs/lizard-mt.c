@@ -32,6 +32,10 @@
 #define MT_GetFramesCCtx   LIZARDMT_GetFramesCCtx
 #define MT_GetInsizeCCtx   LIZARDMT_GetInsizeCCtx
 #define MT_GetOutsizeCCtx  LIZARDMT_GetOutsizeCCtx
+#define MT_GetStatsCCtx    LIZARDMT_GetStatsCCtx
+#define MT_GetWorkerStatsCCtx LIZARDMT_GetWorkerStatsCCtx
+#define MT_setProgressCCtx LIZARDMT_setProgressCCtx
+#define MT_setTraceCCtx    LIZARDMT_setTraceCCtx
 #define MT_freeCCtx        LIZARDMT_freeCCtx
 
 #define MT_DCtx            LIZARDMT_DCtx
@@ -40,6 +44,11 @@
 #define MT_GetFramesDCtx   LIZARDMT_GetFramesDCtx
 #define MT_GetInsizeDCtx   LIZARDMT_GetInsizeDCtx
 #define MT_GetOutsizeDCtx  LIZARDMT_GetOutsizeDCtx
+#define MT_GetStatsDCtx    LIZARDMT_GetStatsDCtx
+#define MT_GetWorkerStatsDCtx LIZARDMT_GetWorkerStatsDCtx
+#define MT_setProgressDCtx LIZARDMT_setProgressDCtx
+#define MT_setTraceDCtx    LIZARDMT_setTraceDCtx
+#define MT_setOutputDCtx   LIZARDMT_setOutputDCtx
 #define MT_freeDCtx        LIZARDMT_freeDCtx
 
 #include "main.c"
@@ -32,14 +32,27 @@
 #define MT_GetFramesCCtx   LZ4MT_GetFramesCCtx
 #define MT_GetInsizeCCtx   LZ4MT_GetInsizeCCtx
 #define MT_GetOutsizeCCtx  LZ4MT_GetOutsizeCCtx
+#define MT_GetStatsCCtx    LZ4MT_GetStatsCCtx
+#define MT_GetWorkerStatsCCtx LZ4MT_GetWorkerStatsCCtx
+#define MT_setProgressCCtx LZ4MT_setProgressCCtx
+#define MT_setTraceCCtx    LZ4MT_setTraceCCtx
 #define MT_freeCCtx        LZ4MT_freeCCtx
+#define MT_setCCtxParameter LZ4MT_setCCtxParameter
+#define MT_p_linked        LZ4MT_p_linked
+#define MT_p_blocks        LZ4MT_p_blocks
 
 #define MT_DCtx            LZ4MT_DCtx
 #define MT_createDCtx      LZ4MT_createDCtx
 #define MT_decompressDCtx  LZ4MT_decompressDCtx
+#define MT_listDCtx        LZ4MT_listDCtx
 #define MT_GetFramesDCtx   LZ4MT_GetFramesDCtx
 #define MT_GetInsizeDCtx   LZ4MT_GetInsizeDCtx
 #define MT_GetOutsizeDCtx  LZ4MT_GetOutsizeDCtx
+#define MT_GetStatsDCtx    LZ4MT_GetStatsDCtx
+#define MT_GetWorkerStatsDCtx LZ4MT_GetWorkerStatsDCtx
+#define MT_setProgressDCtx LZ4MT_setProgressDCtx
+#define MT_setTraceDCtx    LZ4MT_setTraceDCtx
+#define MT_setOutputDCtx   LZ4MT_setOutputDCtx
 #define MT_freeDCtx        LZ4MT_freeDCtx
 
 #include "main.c"
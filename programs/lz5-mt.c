@@ -32,6 +32,10 @@
 #define MT_GetFramesCCtx   LZ5MT_GetFramesCCtx
 #define MT_GetInsizeCCtx   LZ5MT_GetInsizeCCtx
 #define MT_GetOutsizeCCtx  LZ5MT_GetOutsizeCCtx
+#define MT_GetStatsCCtx    LZ5MT_GetStatsCCtx
+#define MT_GetWorkerStatsCCtx LZ5MT_GetWorkerStatsCCtx
+#define MT_setProgressCCtx LZ5MT_setProgressCCtx
+#define MT_setTraceCCtx    LZ5MT_setTraceCCtx
 #define MT_freeCCtx        LZ5MT_freeCCtx
 
 #define MT_DCtx            LZ5MT_DCtx
@@ -40,6 +44,11 @@
 #define MT_GetFramesDCtx   LZ5MT_GetFramesDCtx
 #define MT_GetInsizeDCtx   LZ5MT_GetInsizeDCtx
 #define MT_GetOutsizeDCtx  LZ5MT_GetOutsizeDCtx
+#define MT_GetStatsDCtx    LZ5MT_GetStatsDCtx
+#define MT_GetWorkerStatsDCtx LZ5MT_GetWorkerStatsDCtx
+#define MT_setProgressDCtx LZ5MT_setProgressDCtx
+#define MT_setTraceDCtx    LZ5MT_setTraceDCtx
+#define MT_setOutputDCtx   LZ5MT_setOutputDCtx
 #define MT_freeDCtx        LZ5MT_freeDCtx
 
 #include "main.c"
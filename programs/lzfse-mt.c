@@ -32,6 +32,10 @@
 #define MT_GetFramesCCtx   LZFSEMT_GetFramesCCtx
 #define MT_GetInsizeCCtx   LZFSEMT_GetInsizeCCtx
 #define MT_GetOutsizeCCtx  LZFSEMT_GetOutsizeCCtx
+#define MT_GetStatsCCtx    LZFSEMT_GetStatsCCtx
+#define MT_GetWorkerStatsCCtx LZFSEMT_GetWorkerStatsCCtx
+#define MT_setProgressCCtx LZFSEMT_setProgressCCtx
+#define MT_setTraceCCtx    LZFSEMT_setTraceCCtx
 #define MT_freeCCtx        LZFSEMT_freeCCtx
 
 #define MT_DCtx            LZFSEMT_DCtx
@@ -40,6 +44,11 @@
 #define MT_GetFramesDCtx   LZFSEMT_GetFramesDCtx
 #define MT_GetInsizeDCtx   LZFSEMT_GetInsizeDCtx
 #define MT_GetOutsizeDCtx  LZFSEMT_GetOutsizeDCtx
+#define MT_GetStatsDCtx    LZFSEMT_GetStatsDCtx
+#define MT_GetWorkerStatsDCtx LZFSEMT_GetWorkerStatsDCtx
+#define MT_setProgressDCtx LZFSEMT_setProgressDCtx
+#define MT_setTraceDCtx    LZFSEMT_setTraceDCtx
+#define MT_setOutputDCtx   LZFSEMT_setOutputDCtx
 #define MT_freeDCtx        LZFSEMT_freeDCtx
 
 #include "main.c"
@@ -16,11 +16,14 @@
  */
 
 #include "platform.h"
+#include "threading.h"
+#include "crc32.h"
 
 #define MODE_COMPRESS    1	/* -z (default) */
 #define MODE_DECOMPRESS  2	/* -d */
 #define MODE_LIST        3	/* -l */
 #define MODE_TEST        4	/* -t */
+#define MODE_BENCH       5	/* --bench */
 static int opt_mode = MODE_COMPRESS;
 
 /* for the -i option */
@@ -44,6 +47,92 @@ static int opt_verbose = 1;
 static int opt_bufsize = 0;
 static int opt_timings = 0;
 static int opt_nocrc = 0;
+static int opt_uncached = 0;
+static int opt_recursive = 0;
+static int opt_checksum = 0;
+static int opt_progress = 0;
+static char *opt_trace = 0;
+static int opt_flushms = 0;
+
+#ifdef MT_p_window
+/* encoder options of brotli, -1 keeps the default of the library */
+static int opt_window = -1;
+static int opt_block = -1;
+static int opt_bmode = -1;
+static int opt_largewin = 0;
+#endif
+
+#ifdef MT_p_linked
+/* lz4: frames with the input before them as dictionary */
+static int opt_linked = 0;
+#endif
+
+#ifdef MT_p_blocks
+/* lz4: one standard frame of independent blocks */
+static int opt_blocks = 0;
+#endif
+
+#ifdef MT_p_framed
+/* snappy: the official snappy framing format */
+static int opt_framed = 0;
+#endif
+
+#ifdef MT_setCCtxDictionary
+/* --dict=F, the whole file is loaded by dict_load() */
+static char *opt_dict = 0;
+static void *dict_buf = 0;
+static size_t dict_size = 0;
+#endif
+
+/* for --bench, levels are from opt_level .. opt_endlevel */
+static int opt_endlevel = 0;
+static int opt_benchtime = 1;
+
+/* long options, some of them are only valid for some methods */
+#define OPT_CHECK      256
+#define OPT_BENCH      257
+#define OPT_BENCHTIME  258
+#define OPT_PROGRESS   259
+#define OPT_TRACE      260
+#define OPT_FLUSHMS    261
+#define OPT_WINDOW     262
+#define OPT_BLOCK      263
+#define OPT_BMODE      264
+#define OPT_LARGEWIN   265
+#define OPT_DICT       266
+#define OPT_LINKED     267
+#define OPT_BLOCKS     268
+#define OPT_FRAMED     269
+
+static const struct option long_options[] = {
+#ifdef MT_p_checksum
+	{"check", no_argument, NULL, OPT_CHECK},
+#endif
+	{"bench", no_argument, NULL, OPT_BENCH},
+	{"bench-time", required_argument, NULL, OPT_BENCHTIME},
+	{"progress", no_argument, NULL, OPT_PROGRESS},
+	{"trace", required_argument, NULL, OPT_TRACE},
+	{"flush-ms", required_argument, NULL, OPT_FLUSHMS},
+#ifdef MT_p_window
+	{"window", required_argument, NULL, OPT_WINDOW},
+	{"block", required_argument, NULL, OPT_BLOCK},
+	{"mode", required_argument, NULL, OPT_BMODE},
+	{"large-window", no_argument, NULL, OPT_LARGEWIN},
+#endif
+#ifdef MT_setCCtxDictionary
+	{"dict", required_argument, NULL, OPT_DICT},
+#endif
+#ifdef MT_p_linked
+	{"linked", no_argument, NULL, OPT_LINKED},
+#endif
+#ifdef MT_p_blocks
+	{"blocks", no_argument, NULL, OPT_BLOCKS},
+#endif
+#ifdef MT_p_framed
+	{"framed", no_argument, NULL, OPT_FRAMED},
+#endif
+	{NULL, 0, NULL, 0}
+};
 
 static char *progname;
 static char *opt_filename;
@@ -59,6 +148,28 @@ static size_t bytes_written = 0;
 /* when set, do not change fout */
 static int global_fout = 0;
 
+/* kernel I/O hints for the current input and output stream */
+typedef struct {
+	FILE *file;
+	int is_pipe;		/* pipes are grown to the frame size */
+	int is_file;		/* regular files get readahead / fadvise */
+	U64 pos;		/* bytes read or written so far */
+	U64 ahead;		/* readahead was started up to here */
+	U64 dropped;		/* page cache was released up to here */
+	size_t window;		/* readahead window or current pipe size */
+	size_t chunk;		/* --flush-ms: read size, grows with the input */
+} io_state;
+
+static io_state io_in, io_out;
+
+/* limits for the progressive readahead and page cache dropping */
+#define IO_WINDOW_MIN  (128 * 1024)
+#define IO_WINDOW_MAX  (32 * 1024 * 1024)
+#define IO_DROP_STEP   (8 * 1024 * 1024)
+
+/* --flush-ms starts with small frames, they double while input flows */
+#define FLUSH_CHUNK_MIN (64 * 1024)
+
 static MT_CCtx *cctx = 0;
 static MT_DCtx *dctx = 0;
 
@@ -68,9 +179,6 @@ static struct timeval tms, tme, tm;
 /* for -l with verbose > 1 */
 static time_t mtime;
 static unsigned int crc = 0;
-static unsigned int crc32_table[1][256];
-static unsigned int crc32(const unsigned char *buf, size_t size,
-			  unsigned int crc);
 
 static void panic(const char *msg)
 {
@@ -137,6 +245,7 @@ static void usage(void)
 	       "\n  -l    List information for the specified compressed files."
 	       "\n  -L    Display License and quit."
 	       "\n  -q    Be quiet: suppress all messages."
+	       "\n  -r    Operate recursively on directories."
 	       "\n  -S X  Use suffix 'X' for compressed files. Default: \"%s\""
 	       "\n  -t    Test the integrity of each file leaving any files intact."
 	       "\n  -v    Be more verbose."
@@ -148,7 +257,51 @@ static void usage(void)
 	       "\n  -i N  Set number of iterations for testing (default: 1)."
 	       "\n  -B    Print timings and memory usage to stderr."
 	       "\n  -C    Disable crc32 calculation in verbose listing mode."
+	       "\n  -U    Drop consumed input and written output from page cache."
+	       "\n  --progress  Show the progress of each file on stderr."
+	       "\n  --trace=F   Write a Chrome trace of all frames to file F."
+	       "\n  --flush-ms=N  Cut a frame, when its input is N ms old."
 	       "\n"
+	       "\n Benchmark Options:"
+	       "\n  --bench   Benchmark in memory, levels -# .. -e and threads 1 .. -T."
+	       "\n  -e N      Set the last level of the benchmark (default: -#)."
+	       "\n  --bench-time=S  Repeat each run for at least S seconds (def: 1).",
+	       PROGNAME, LEVEL_MIN, LEVEL_MAX, LEVEL_DEF, SUFFIX);
+
+#ifdef MT_p_checksum
+	printf("\n"
+	       "\n Method Options:"
+	       "\n  --check   Add a checksum to each frame, checked when decoding.");
+#endif
+#ifdef MT_p_window
+	printf("\n"
+	       "\n Method Options:"
+	       "\n  --window=N  Set the window size to 2^N bytes (10 .. 24, 30)."
+	       "\n  --block=N   Set the input block size to 2^N bytes (16 .. 24)."
+	       "\n  --mode=M    Set the mode: generic, text, font or auto."
+	       "\n  --large-window  Allow windows above 2^24 bytes, the frames"
+	       "\n              can't be read by the standard brotli tools then.");
+#endif
+#ifdef MT_setCCtxDictionary
+	printf("\n  --dict=F    Use file F as dictionary, for (de)compression.");
+#endif
+#ifdef MT_p_linked
+	printf("\n"
+	       "\n Method Options:"
+	       "\n  --linked  Use the end of each frame as dictionary of the next,"
+	       "\n            the decompression runs in one thread then.");
+#endif
+#ifdef MT_p_blocks
+	printf("\n  --blocks  Write one standard lz4 frame of independent blocks.");
+#endif
+#ifdef MT_p_framed
+	printf("\n"
+	       "\n Method Options:"
+	       "\n  --framed  Write the official snappy framing format, with a"
+	       "\n            crc32c of each 64 KiB chunk.");
+#endif
+
+	printf("\n"
 	       "\n If invoked as '%s', default action is to compress."
 	       "\n             as '%s',  default action is to decompress."
 	       "\n             as '%s', then: force decompress to stdout."
@@ -157,7 +310,6 @@ static void usage(void)
 	       "\n"
 	       "\n Report bugs to: https://github.com/mcmilk/zstdmt/issues"
 	       "\n",
-	       PROGNAME, LEVEL_MIN, LEVEL_MAX, LEVEL_DEF, SUFFIX,
 	       PROGNAME, UNZIP, ZCAT);
 
 	exit(0);
@@ -169,27 +321,356 @@ static void headline(void)
 		fprintf(stderr, "Level;Threads;InSize;OutSize;Frames\n");
 }
 
+/**
+ * print_workers() - show the counters of each worker with -B -v
+ *
+ * times are in milliseconds, the latency line shows the histogram of
+ * the frame latencies of all workers together
+ */
+static void print_workers(mtstat_t * st, int workers)
+{
+	mtstat_t sum;
+	int t, i;
+
+	memset(&sum, 0, sizeof(sum));
+	fprintf(stderr, "Worker;Frames;InSize;OutSize;"
+		"Read;ReadWait;Codec;WriteWait;Write\n");
+	for (t = 0; t < workers; t++) {
+		fprintf(stderr, "%d;%llu;%llu;%llu;%.3f;%.3f;%.3f;%.3f;%.3f\n",
+			t, st[t].frames, st[t].insize, st[t].outsize,
+			st[t].read / 1e6, st[t].read_wait / 1e6,
+			st[t].codec / 1e6, st[t].write_wait / 1e6,
+			st[t].write / 1e6);
+		mtstat_add(&sum, &st[t]);
+	}
+
+	fprintf(stderr, "Latency");
+	for (i = 0; i < MTSTAT_HIST - 1; i++)
+		if (sum.hist[i])
+			fprintf(stderr, ";<%lluus:%llu", 1ULL << i, sum.hist[i]);
+	if (sum.hist[i])
+		fprintf(stderr, ";>=%lluus:%llu", 1ULL << (i - 1), sum.hist[i]);
+	fprintf(stderr, "\n");
+}
+
+/* size of the current input file for --progress, 0 when unknown */
+static unsigned long long progress_total;
+
+/**
+ * progress() - callback of the library for --progress
+ *
+ * called by the writer thread about twice a second and once at the end
+ */
+static void progress(void *arg, size_t insize, size_t outsize, size_t frames)
+{
+	(void)arg;
+
+	if (progress_total)
+		fprintf(stderr, "\r%3u%% ",
+			(unsigned)(insize * 100ULL / progress_total));
+	else
+		fprintf(stderr, "\r");
+	fprintf(stderr, "%llu MiB -> %llu MiB, %lu frames ",
+		(unsigned long long)insize >> 20,
+		(unsigned long long)outsize >> 20, (unsigned long)frames);
+}
+
+/**
+ * progress_setup() - remember the input size, when it is a regular file
+ */
+static void progress_setup(FILE * in)
+{
+	struct stat s;
+
+	progress_total = 0;
+	if (fstat(fileno(in), &s) == 0 && S_ISREG(s.st_mode))
+		progress_total = (unsigned long long)s.st_size;
+}
+
+/* --trace writes a json array of trace events, see trace_open() */
+static FILE *trace_file;
+static pthread_mutex_t trace_mutex;
+static unsigned long long trace_start;
+static int trace_events;
+static int trace_pid;
+
+/**
+ * trace() - callback of the library for --trace
+ *
+ * called by all workers, each context is one process of the trace and
+ * each worker one thread, the written frames are on thread 0
+ */
+static void trace(void *arg, mttrace_event event, int worker, size_t frame,
+		  size_t size, unsigned long long ns)
+{
+	static const char *name[] = {
+		"read", "read", "codec", "codec", "queued", "written"
+	};
+	static const char ph[] = "BEBEii";
+
+	pthread_mutex_lock(&trace_mutex);
+	fprintf(trace_file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+		"\"pid\":%d,\"tid\":%d,%s\"args\":{\"frame\":%lu,"
+		"\"size\":%lu}}", trace_events++ ? ",\n" : "",
+		name[event], ph[event], (ns - trace_start) / 1e3,
+		(int)(size_t)arg, worker + 1, ph[event] == 'i' ?
+		"\"s\":\"t\"," : "", (unsigned long)frame,
+		(unsigned long)size);
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+/**
+ * trace_setup() - start a new process in the trace for the next context
+ *
+ * return: the process id, which is passed to trace() as arg
+ */
+static void *trace_setup(const char *what)
+{
+	int pid, t;
+
+	pthread_mutex_lock(&trace_mutex);
+	pid = ++trace_pid;
+	fprintf(trace_file, "%s{\"name\":\"process_name\",\"ph\":\"M\","
+		"\"pid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+		trace_events++ ? ",\n" : "", pid, what, pid);
+	for (t = 0; t <= opt_threads; t++) {
+		char tname[32];
+
+		if (t)
+			snprintf(tname, sizeof(tname), "worker %d", t - 1);
+		else
+			snprintf(tname, sizeof(tname), "writer");
+		fprintf(trace_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+			"\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			pid, t, tname);
+	}
+	pthread_mutex_unlock(&trace_mutex);
+
+	return (void *)(size_t)pid;
+}
+
+static void trace_close(void)
+{
+	fprintf(trace_file, "\n]\n");
+	if (fclose(trace_file))
+		perror(opt_trace);
+}
+
+static void trace_open(void)
+{
+	trace_file = fopen(opt_trace, "w");
+	if (!trace_file)
+		panic("Opening trace file failed!");
+	fprintf(trace_file, "[\n");
+	pthread_mutex_init(&trace_mutex, NULL);
+	trace_start = mtstat_now();
+	atexit(trace_close);
+}
+
+/**
+ * io_setup() - check the type of a new stream and give the kernel some hints
+ */
+static void io_setup(io_state * io, FILE * file, size_t size)
+{
+	struct stat s;
+
+	memset(io, 0, sizeof(*io));
+	io->file = file;
+	io->window = size;
+	io->is_pipe = pipe_resize(fileno(file), size);
+	if (io->is_pipe) {
+		/* pipes are written directly, stdio must be empty */
+		fflush(file);
+		return;
+	}
+
+	if (fstat(fileno(file), &s) == 0 && S_ISREG(s.st_mode)) {
+		io->is_file = 1;
+		io->pos = ftell(file);
+		io->ahead = io->dropped = io->pos;
+		if (io->window < IO_WINDOW_MIN)
+			io->window = IO_WINDOW_MIN;
+		if (io == &io_in)
+			io_sequential(fileno(file));
+	}
+}
+
 static int ReadData(void *arg, MT_Buffer * in)
 {
 	FILE *fd = (FILE *) arg;
-	size_t done = fread(in->buf, 1, in->size, fd);
+	size_t done;
+
+	if (unlikely(fd != io_in.file))
+		io_setup(&io_in, fd, in->size);
+
+	/* keep the kernel one growing window ahead of us */
+	if (io_in.is_file && io_in.pos + io_in.window > io_in.ahead) {
+		io_readahead(fileno(fd), io_in.ahead, io_in.window);
+		io_in.ahead += io_in.window;
+		if (io_in.window < IO_WINDOW_MAX)
+			io_in.window *= 2;
+	}
+
+	if (opt_flushms && opt_mode == MODE_COMPRESS) {
+		/* live streams: a frame does not wait for a full chunk */
+		size_t want = io_in.chunk;
+
+		if (want < FLUSH_CHUNK_MIN)
+			want = FLUSH_CHUNK_MIN;
+		if (want > in->size)
+			want = in->size;
+		done = io_read_timed(fileno(fd), in->buf, want, opt_flushms);
+		io_in.chunk = done == want ? want * 2 : FLUSH_CHUNK_MIN;
+	} else
+		done = fread(in->buf, 1, in->size, fd);
 	in->size = done;
+	io_in.pos += done;
+
+	/* input is read only once, release it */
+	if (opt_uncached && io_in.is_file
+	    && io_in.pos - io_in.dropped >= IO_DROP_STEP) {
+		io_dontneed(fileno(fd), io_in.dropped,
+			    io_in.pos - io_in.dropped);
+		io_in.dropped = io_in.pos;
+	}
 
 	if (opt_mode == MODE_LIST && opt_verbose)
 		bytes_read += done;
 
+	/* live streams: the next read may block, the frame must not wait */
+	if (opt_flushms && opt_mode == MODE_COMPRESS)
+		return 1;
+
 	return 0;
 }
 
+/**
+ * crc32 of the listing: the workers do the crc32 of each frame, see
+ * crc_frame(), and the writer combines them in order, see crc_write()
+ *
+ * The frames, which are done but not written yet, wait in a ring, which
+ * grows when needed. Output without a crc32 of a worker, like the one of
+ * the single threaded paths, is summed up by the writer itself.
+ */
+typedef struct {
+	size_t frame;		/* frame + 1, zero when unused */
+	size_t size;
+	unsigned int crc;
+} crc_slot;
+
+static crc_slot *crc_ring;
+static size_t crc_ringsize;
+static size_t crc_next;		/* the next frame of the writer */
+static pthread_mutex_t crc_mutex;
+
+/* output callback of the library, called by all workers in parallel */
+static void crc_frame(void *arg, size_t frame, const void *buf, size_t size)
+{
+	unsigned int c = crc32((const unsigned char *)buf, size, 0);
+	crc_slot *ring;
+	size_t i, n;
+
+	(void)arg;
+	pthread_mutex_lock(&crc_mutex);
+	if (frame - crc_next >= crc_ringsize) {
+		n = crc_ringsize ? crc_ringsize : 64;
+		while (frame - crc_next >= n)
+			n *= 2;
+		ring = (crc_slot *) calloc(n, sizeof(crc_slot));
+		if (!ring) {
+			/* the writer does this frame itself */
+			pthread_mutex_unlock(&crc_mutex);
+			return;
+		}
+		for (i = 0; i < crc_ringsize; i++)
+			if (crc_ring[i].frame)
+				ring[(crc_ring[i].frame - 1) % n] = crc_ring[i];
+		free(crc_ring);
+		crc_ring = ring;
+		crc_ringsize = n;
+	}
+	crc_ring[frame % crc_ringsize].frame = frame + 1;
+	crc_ring[frame % crc_ringsize].size = size;
+	crc_ring[frame % crc_ringsize].crc = c;
+	pthread_mutex_unlock(&crc_mutex);
+}
+
+/* the writer adds the next output to crc, in order */
+static void crc_write(const void *buf, size_t size)
+{
+	crc_slot *slot = 0;
+	unsigned int c = 0;
+	int done = 0;
+
+	pthread_mutex_lock(&crc_mutex);
+	if (crc_ringsize)
+		slot = &crc_ring[crc_next % crc_ringsize];
+	if (slot && slot->frame == crc_next + 1 && slot->size == size) {
+		c = slot->crc;
+		slot->frame = 0;
+		done = 1;
+	}
+	crc_next++;
+	pthread_mutex_unlock(&crc_mutex);
+
+	if (done)
+		crc = crc32_combine(crc, c, size);
+	else
+		crc = crc32((const unsigned char *)buf, size, crc);
+}
+
+/* a new file starts with frame zero */
+static void crc_reset(void)
+{
+	crc = 0;
+	crc_next = 0;
+	if (crc_ring)
+		memset(crc_ring, 0, crc_ringsize * sizeof(crc_slot));
+}
+
+static void crc_open(void)
+{
+	pthread_mutex_init(&crc_mutex, NULL);
+	crc32_init();
+}
+
 static int WriteData(void *arg, MT_Buffer * out)
 {
 	FILE *fd = (FILE *) arg;
-	ssize_t done = fwrite(out->buf, 1, out->size, fd);
+	ssize_t done;
+
+	if (unlikely(fd != io_out.file)) {
+		io_setup(&io_out, fd, out->size);
+	} else if (io_out.is_pipe && out->size > io_out.window) {
+		io_out.window = out->size;
+		pipe_resize(fileno(fd), io_out.window);
+	}
+
+	if (io_out.is_pipe)
+		done = pipe_write(fileno(fd), out->buf, out->size);
+	else
+		done = fwrite(out->buf, 1, out->size, fd);
+	io_out.pos += done;
+
+	/* each frame is passed on at once */
+	if (opt_flushms && !io_out.is_pipe)
+		fflush(fd);
+
+	/**
+	 * written output: the first call starts the writeback, the
+	 * second one (one step later) drops the then clean pages
+	 */
+	if (opt_uncached && io_out.is_file
+	    && io_out.pos - io_out.dropped >= 2 * IO_DROP_STEP) {
+		fflush(fd);
+		io_dontneed(fileno(fd), io_out.dropped,
+			    io_out.pos - io_out.dropped);
+		io_out.dropped = io_out.pos - IO_DROP_STEP;
+	}
 
 	/* generate crc32 of uncompressed file */
-	if (opt_mode == MODE_LIST && opt_verbose > 1)
-		crc = crc32(out->buf, out->size, crc);
-	/* printf("crc for %zu bytes, %8x\n", out->size, crc); */
+	if (opt_mode == MODE_LIST && opt_verbose > 1 && !opt_nocrc)
+		crc_write(out->buf, out->size);
 
 	out->size = done;
 
@@ -199,6 +680,158 @@ static int WriteData(void *arg, MT_Buffer * out)
 	return 0;
 }
 
+#ifdef MT_listDCtx
+/* plain reading of the frame headers, no readahead needed */
+static int ListRead(void *arg, MT_Buffer * in)
+{
+	FILE *fd = (FILE *) arg;
+
+	in->size = fread(in->buf, 1, in->size, fd);
+	return 0;
+}
+
+static int ListSkip(void *arg, size_t size)
+{
+	FILE *fd = (FILE *) arg;
+
+	if (fseek64(fd, size, SEEK_CUR) != 0)
+		return -1;
+	return 0;
+}
+
+/**
+ * do_list() - get the sizes by walking the frame headers
+ *
+ * Skipping past the end of the file does not fail, so a truncated file
+ * is found by the position after the last frame.
+ *
+ * return: 1 when done, 0 when the data must be decompressed,
+ *        -1 when the file is truncated
+ */
+static int do_list(FILE * in)
+{
+	MT_RdWr_t rdwr;
+	struct stat st;
+	size_t ret;
+
+	/* the crc32 needs the data, seeking needs a regular file */
+	if (opt_verbose > 1 && !opt_nocrc)
+		return 0;
+	if (fstat(fileno(in), &st) != 0 || !S_ISREG(st.st_mode))
+		return 0;
+
+	rdwr.fn_read = ListRead;
+	rdwr.fn_write = 0;
+	rdwr.arg_read = (void *)in;
+	rdwr.arg_write = 0;
+
+	dctx = MT_createDCtx(1, opt_bufsize);
+	if (!dctx)
+		return 0;
+
+	ret = MT_listDCtx(dctx, &rdwr, ListSkip);
+	if (!MT_isError(ret)) {
+		bytes_read = MT_GetInsizeDCtx(dctx);
+		bytes_written = MT_GetOutsizeDCtx(dctx);
+	}
+	MT_freeDCtx(dctx);
+
+	if (!MT_isError(ret) && ftell64(in) > st.st_size)
+		return -1;
+
+	/* no luck, start again for decompression */
+	if (MT_isError(ret) && fseek64(in, 0, SEEK_SET) != 0)
+		return 0;
+
+	return !MT_isError(ret);
+}
+#endif
+
+#ifdef MT_setCCtxDictionary
+static void dict_load(void)
+{
+	FILE *f = fopen(opt_dict, "rb");
+	long size;
+
+	if (!f)
+		panic("Opening dictionary failed!");
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0
+	    || fseek(f, 0, SEEK_SET) != 0)
+		panic("Reading dictionary failed!");
+
+	dict_size = (size_t)size;
+	dict_buf = malloc(dict_size ? dict_size : 1);
+	if (!dict_buf)
+		panic("No memory for the dictionary!");
+	if (fread(dict_buf, 1, dict_size, f) != dict_size)
+		panic("Reading dictionary failed!");
+	fclose(f);
+}
+#endif
+
+/**
+ * setup_cctx() - apply the method options to a new context
+ *
+ * return: 0 for ok, or errmsg on error
+ */
+static const char *setup_cctx(MT_CCtx * c)
+{
+#ifdef MT_p_checksum
+	if (opt_checksum)
+		MT_setCCtxParameter(c, MT_p_checksum, 1);
+#endif
+#ifdef MT_p_window
+	if (MT_isError(MT_setCCtxParameter(c, MT_p_large_window, opt_largewin)))
+		return "Setting the large window failed!";
+	if (opt_window != -1 &&
+	    MT_isError(MT_setCCtxParameter(c, MT_p_window, opt_window)))
+		return "Invalid window size!";
+	if (opt_block != -1 &&
+	    MT_isError(MT_setCCtxParameter(c, MT_p_block, opt_block)))
+		return "Invalid block size!";
+	if (opt_bmode != -1 &&
+	    MT_isError(MT_setCCtxParameter(c, MT_p_mode, opt_bmode)))
+		return "Invalid mode!";
+#endif
+#ifdef MT_setCCtxDictionary
+	if (dict_size &&
+	    MT_isError(MT_setCCtxDictionary(c, dict_buf, dict_size)))
+		return "Setting the dictionary failed!";
+#endif
+#ifdef MT_p_linked
+	if (opt_linked)
+		MT_setCCtxParameter(c, MT_p_linked, 1);
+#endif
+#ifdef MT_p_blocks
+	if (opt_blocks)
+		MT_setCCtxParameter(c, MT_p_blocks, 1);
+#endif
+#ifdef MT_p_framed
+	if (opt_framed)
+		MT_setCCtxParameter(c, MT_p_framed, 1);
+#endif
+	(void)c;
+
+	return 0;
+}
+
+/**
+ * setup_dctx() - the same for decompression
+ *
+ * return: 0 for ok, or errmsg on error
+ */
+static const char *setup_dctx(MT_DCtx * d)
+{
+#ifdef MT_setCCtxDictionary
+	if (dict_size &&
+	    MT_isError(MT_setDCtxDictionary(d, dict_buf, dict_size)))
+		return "Setting the dictionary failed!";
+#endif
+	(void)d;
+
+	return 0;
+}
+
 /**
  * compress() - compress data from fin to fout
  *
@@ -207,6 +840,7 @@ static int WriteData(void *arg, MT_Buffer * out)
 static const char *do_compress(FILE * in, FILE * out)
 {
 	static int first = 1;
+	const char *msg;
 	MT_RdWr_t rdwr;
 	size_t ret;
 
@@ -229,8 +863,33 @@ static const char *do_compress(FILE * in, FILE * out)
 	if (!cctx)
 		return "Allocating compression context failed!";
 
+	msg = setup_cctx(cctx);
+	if (msg) {
+		MT_freeCCtx(cctx);
+		return msg;
+	}
+
+#ifdef MT_setSrcSize
+	/* zstd: small files use the workers of libzstd in their frames */
+	{
+		struct stat s;
+
+		if (fstat(fileno(in), &s) == 0 && S_ISREG(s.st_mode))
+			MT_setSrcSize(cctx, (unsigned long long)s.st_size);
+	}
+#endif
+
+	if (opt_progress) {
+		progress_setup(in);
+		MT_setProgressCCtx(cctx, progress, 0, 500, 0);
+	}
+	if (trace_file)
+		MT_setTraceCCtx(cctx, trace, trace_setup("compress"));
+
 	/* 3) compress */
 	ret = MT_compressCCtx(cctx, &rdwr);
+	if (opt_progress)
+		fprintf(stderr, "\n");
 	if (MT_isError(ret))
 		return MT_getErrorString(ret);
 
@@ -242,6 +901,17 @@ static const char *do_compress(FILE * in, FILE * out)
 			(unsigned long)MT_GetOutsizeCCtx(cctx),
 			(unsigned long)MT_GetFramesCCtx(cctx));
 
+	if (opt_timings && opt_verbose > 1 && opt_mode == MODE_COMPRESS) {
+		int n = MT_GetWorkerStatsCCtx(cctx, 0, 0);
+		mtstat_t *st = malloc(n * sizeof(mtstat_t));
+
+		if (st) {
+			MT_GetWorkerStatsCCtx(cctx, st, n);
+			print_workers(st, n);
+			free(st);
+		}
+	}
+
 	MT_freeCCtx(cctx);
 
 	return 0;
@@ -255,6 +925,7 @@ static const char *do_compress(FILE * in, FILE * out)
 static const char *do_decompress(FILE * in, FILE * out)
 {
 	static int first = 1;
+	const char *msg;
 	MT_RdWr_t rdwr;
 	size_t ret;
 
@@ -266,6 +937,18 @@ static const char *do_decompress(FILE * in, FILE * out)
 	if (opt_timings && opt_verbose && opt_mode == MODE_DECOMPRESS)
 		gettimeofday(&tms, NULL);
 
+#ifdef MT_listDCtx
+	/* listing without decompression, when possible */
+	if (opt_mode == MODE_LIST) {
+		int rv = do_list(in);
+
+		if (rv < 0)
+			return "Truncated input file!";
+		if (rv)
+			return 0;
+	}
+#endif
+
 	/* 1) setup read/write functions */
 	rdwr.fn_read = ReadData;
 	rdwr.fn_write = WriteData;
@@ -277,8 +960,30 @@ static const char *do_decompress(FILE * in, FILE * out)
 	if (!dctx)
 		return "Allocating decompression context failed!";
 
-	/* 3) compress */
-	ret = MT_decompressDCtx(dctx, &rdwr);
+	msg = setup_dctx(dctx);
+	if (msg) {
+		MT_freeDCtx(dctx);
+		return msg;
+	}
+
+	if (opt_progress) {
+		progress_setup(in);
+		MT_setProgressDCtx(dctx, progress, 0, 500, 0);
+	}
+	if (trace_file)
+		MT_setTraceDCtx(dctx, trace, trace_setup("decompress"));
+	if (opt_mode == MODE_LIST && opt_verbose > 1 && !opt_nocrc)
+		MT_setOutputDCtx(dctx, crc_frame, 0);
+
+	/* 3) decompress, testing needs no output at all */
+#ifdef MT_testDCtx
+	if (opt_mode == MODE_TEST)
+		ret = MT_testDCtx(dctx, &rdwr);
+	else
+#endif
+		ret = MT_decompressDCtx(dctx, &rdwr);
+	if (opt_progress)
+		fprintf(stderr, "\n");
 	if (MT_isError(ret))
 		return MT_getErrorString(ret);
 
@@ -290,6 +995,17 @@ static const char *do_decompress(FILE * in, FILE * out)
 			(unsigned long)MT_GetOutsizeDCtx(dctx),
 			(unsigned long)MT_GetFramesDCtx(dctx));
 
+	if (opt_timings && opt_verbose > 1 && opt_mode == MODE_DECOMPRESS) {
+		int n = MT_GetWorkerStatsDCtx(dctx, 0, 0);
+		mtstat_t *st = malloc(n * sizeof(mtstat_t));
+
+		if (st) {
+			MT_GetWorkerStatsDCtx(dctx, st, n);
+			print_workers(st, n);
+			free(st);
+		}
+	}
+
 	MT_freeDCtx(dctx);
 
 	return 0;
@@ -346,40 +1062,6 @@ static char *remove_suffix(const char *filename)
 	return newname;
 }
 
-static unsigned int crc32(const unsigned char *buf, size_t size,
-			  unsigned int crc)
-{
-	static int initdone = 0;
-
-	if (opt_nocrc)
-		return 0;
-
-	if (!initdone) {
-		unsigned int b, i, r, poly32 = 0xEDB88320U;
-
-		for (b = 0; b < 256; ++b) {
-			r = b;
-			for (i = 0; i < 8; ++i) {
-				if (r & 1)
-					r = (r >> 1) ^ poly32;
-				else
-					r >>= 1;
-			}
-
-			crc32_table[0][b] = r;
-		}
-		initdone++;
-	}
-	crc = ~crc;
-
-	while (size != 0) {
-		crc = crc32_table[0][*buf++ ^ (crc & 0xFF)] ^ (crc >> 8);
-		--size;
-	}
-
-	return ~crc;
-}
-
 static void print_listmode(int headline, const char *filename)
 {
 	if (headline && opt_verbose > 1)
@@ -495,7 +1177,7 @@ static char *check_overwrite(const char *filename)
 
 		if (c == 'y' || c == 'Y')
 			yes = 1;
-		if (c == 'n' || c == 'N')
+		if (c == 'n' || c == 'N' || c == EOF)
 			yes = 0;
 
 		while (c != '\n' && c != EOF)
@@ -614,7 +1296,12 @@ static void treat_file(char *filename)
 
 	/* reset errmsg */
 	errmsg = 0;
-	crc = 0;
+	crc_reset();
+
+	/* new streams, FILE pointers may be reused by fopen() */
+	io_in.file = NULL;
+	if (!global_fout)
+		io_out.file = NULL;
 
 	/* setup fin stream */
 	if (strcmp(filename, "-") == 0) {
@@ -725,6 +1412,625 @@ static void treat_file(char *filename)
 }
 
 
+/**
+ * recursive mode (-r)
+ *
+ * Small files are not split into several chunks, so compressing them
+ * one after another would use only one thread. When the output goes to
+ * one file per input, the small files are collected while walking the
+ * directories and then spread over a pool of opt_threads workers. Each
+ * worker handles whole files with a single threaded context, so every
+ * output is still written in order. Bigger files are done afterwards,
+ * one by one with all threads.
+ */
+
+/* files up to this size are handled by the worker pool */
+#define POOL_SMALLFILE (8 * 1024 * 1024)
+
+typedef struct {
+	char *filename;
+	char *outname;
+	struct stat st;
+} pool_job;
+
+static pool_job *pool_jobs = 0;
+static size_t pool_count = 0;
+static size_t pool_allocated = 0;
+static size_t pool_next = 0;
+static pthread_mutex_t pool_mutex;
+
+/* bigger files, done after the pool */
+static char **pool_big = 0;
+static size_t pool_bigcount = 0;
+static size_t pool_bigallocated = 0;
+
+static int pool_enabled(void)
+{
+	if (!opt_recursive || global_fout || opt_threads < 2)
+		return 0;
+
+	return opt_mode == MODE_COMPRESS || opt_mode == MODE_DECOMPRESS;
+}
+
+static char *str_dup(const char *str)
+{
+	char *s = malloc(strlen(str) + 1);
+
+	if (!s)
+		panic("nomem!");
+	strcpy(s, str);
+
+	return s;
+}
+
+static void pool_add_big(const char *filename)
+{
+	if (pool_bigcount == pool_bigallocated) {
+		pool_bigallocated = pool_bigallocated ? pool_bigallocated * 2 : 64;
+		pool_big = realloc(pool_big, pool_bigallocated * sizeof(char *));
+		if (!pool_big)
+			panic("nomem!");
+	}
+	pool_big[pool_bigcount++] = str_dup(filename);
+}
+
+/**
+ * pool_add() - check a small file like treat_file() does and queue it
+ */
+static void pool_add(const char *filename, struct stat *st)
+{
+	pool_job *job;
+	const char *msg;
+	char *fn2;
+
+	if (opt_mode == MODE_COMPRESS) {
+		if (has_suffix(filename, opt_suffix) && !opt_force) {
+			if (opt_verbose > 1)
+				fprintf(stderr,
+					"%s already has %s suffix -- unchanged\n",
+					filename, opt_suffix);
+			return;
+		}
+		fn2 = add_suffix(filename);
+	} else {
+		if (!has_suffix(filename, opt_suffix)) {
+			if (opt_verbose > 1)
+				fprintf(stderr,
+					"%s: unknown suffix -- ignored\n",
+					filename);
+			return;
+		}
+		fn2 = remove_suffix(filename);
+	}
+
+	/* may ask the user, so it's done here and not in the workers */
+	msg = check_overwrite(fn2);
+	if (msg) {
+		fprintf(stderr, "%s: %s: %s\n", progname, filename, msg);
+		exit_code = E_WARNING;
+		free(fn2);
+		return;
+	}
+
+	if (pool_count == pool_allocated) {
+		pool_allocated = pool_allocated ? pool_allocated * 2 : 256;
+		pool_jobs = realloc(pool_jobs, pool_allocated * sizeof(pool_job));
+		if (!pool_jobs)
+			panic("nomem!");
+	}
+
+	job = &pool_jobs[pool_count++];
+	job->filename = str_dup(filename);
+	job->outname = fn2;
+	job->st = *st;
+}
+
+static int PoolRead(void *arg, MT_Buffer * in)
+{
+	in->size = fread(in->buf, 1, in->size, (FILE *) arg);
+	return 0;
+}
+
+static int PoolWrite(void *arg, MT_Buffer * out)
+{
+	out->size = fwrite(out->buf, 1, out->size, (FILE *) arg);
+	return 0;
+}
+
+/**
+ * pool_treat() - (de)compress one queued file with one thread
+ */
+static void pool_treat(pool_job * job)
+{
+	const char *msg = 0;
+	MT_RdWr_t rdwr;
+	FILE *in, *out = NULL;
+	size_t ret;
+
+	in = fopen(job->filename, "rb");
+	if (!in)
+		msg = "Opening source file failed.";
+	else
+		out = fopen(job->outname, "wb");
+	if (in && !out)
+		msg = "Opening destination file failed.";
+
+	if (!msg) {
+		rdwr.fn_read = PoolRead;
+		rdwr.fn_write = PoolWrite;
+		rdwr.arg_read = (void *)in;
+		rdwr.arg_write = (void *)out;
+
+		if (opt_mode == MODE_COMPRESS) {
+			MT_CCtx *c = MT_createCCtx(1, opt_level, opt_bufsize);
+			if (!c) {
+				msg = "Allocating compression context failed!";
+			} else if ((msg = setup_cctx(c)) == 0) {
+				ret = MT_compressCCtx(c, &rdwr);
+				if (MT_isError(ret))
+					msg = MT_getErrorString(ret);
+				MT_freeCCtx(c);
+			} else {
+				MT_freeCCtx(c);
+			}
+		} else {
+			MT_DCtx *d = MT_createDCtx(1, opt_bufsize);
+			if (!d) {
+				msg = "Allocating decompression context failed!";
+			} else if ((msg = setup_dctx(d)) == 0) {
+				ret = MT_decompressDCtx(d, &rdwr);
+				if (MT_isError(ret))
+					msg = MT_getErrorString(ret);
+				MT_freeDCtx(d);
+			} else {
+				MT_freeDCtx(d);
+			}
+		}
+	}
+
+	if (in)
+		fclose(in);
+	if (out) {
+		fflush(out);
+		set_fstat(out, job->outname, &job->st);
+		if (fclose(out) != 0 && !msg)
+			msg = "Closing outfile failed.";
+	}
+
+	if (msg) {
+		fprintf(stderr, "%s: %s: %s\n", progname, job->filename, msg);
+		if (out)
+			remove(job->outname);
+		pthread_mutex_lock(&pool_mutex);
+		exit_code = E_ERROR;
+		pthread_mutex_unlock(&pool_mutex);
+	} else if (!opt_keep) {
+		remove(job->filename);
+	}
+}
+
+static void *pool_worker(void *arg)
+{
+	(void)arg;
+
+	for (;;) {
+		size_t n;
+
+		pthread_mutex_lock(&pool_mutex);
+		n = pool_next++;
+		pthread_mutex_unlock(&pool_mutex);
+		if (n >= pool_count)
+			break;
+
+		pool_treat(&pool_jobs[n]);
+	}
+
+	return 0;
+}
+
+/**
+ * treat_queued() - run the worker pool, then the bigger files
+ */
+static void treat_queued(void)
+{
+	pthread_t *threads;
+	size_t i;
+	int t, count = opt_threads;
+
+	if (pool_count) {
+		if ((size_t)count > pool_count)
+			count = (int)pool_count;
+
+		threads = malloc(sizeof(pthread_t) * count);
+		if (!threads)
+			panic("nomem!");
+
+		pool_next = 0;
+		pthread_mutex_init(&pool_mutex, NULL);
+		for (t = 0; t < count; t++)
+			pthread_create(&threads[t], NULL, pool_worker, 0);
+		for (t = 0; t < count; t++)
+			pthread_join(threads[t], NULL);
+		pthread_mutex_destroy(&pool_mutex);
+		free(threads);
+
+		for (i = 0; i < pool_count; i++) {
+			free(pool_jobs[i].filename);
+			free(pool_jobs[i].outname);
+		}
+		pool_count = 0;
+	}
+
+	for (i = 0; i < pool_bigcount; i++) {
+		treat_file(pool_big[i]);
+		free(pool_big[i]);
+	}
+	pool_bigcount = 0;
+}
+
+/**
+ * walk_wanted() - files found in directories, which are worth a look
+ */
+static int walk_wanted(const char *filename)
+{
+	if (opt_mode == MODE_COMPRESS)
+		return !has_suffix(filename, opt_suffix);
+
+	return has_suffix(filename, opt_suffix);
+}
+
+/**
+ * treat_path() - handle one file or, with -r, a whole directory tree
+ */
+static void treat_path(char *filename)
+{
+	struct stat s;
+	size_t small = POOL_SMALLFILE;
+
+	if (!opt_recursive || strcmp(filename, "-") == 0
+	    || stat(filename, &s) != 0) {
+		treat_file(filename);
+		return;
+	}
+
+	if (S_ISDIR(s.st_mode)) {
+		DIR *dir = opendir(filename);
+		struct dirent *de;
+		size_t flen = strlen(filename);
+
+		if (!dir) {
+			fprintf(stderr, "%s: %s: %s\n", progname, filename,
+				strerror(errno));
+			exit_code = E_WARNING;
+			return;
+		}
+
+		while ((de = readdir(dir)) != NULL) {
+			char *path;
+			size_t plen = flen;
+
+			if (strcmp(de->d_name, ".") == 0
+			    || strcmp(de->d_name, "..") == 0)
+				continue;
+
+			path = malloc(flen + strlen(de->d_name) + 2);
+			if (!path)
+				panic("nomem!");
+			strcpy(path, filename);
+			if (plen && filename[plen - 1] != PATH_SEPERATOR)
+				path[plen++] = PATH_SEPERATOR;
+			strcpy(path + plen, de->d_name);
+
+			/* do not follow symlinks, they may loop */
+			if (lstat(path, &s) != 0)
+				;
+			else if (S_ISDIR(s.st_mode))
+				treat_path(path);
+			else if (S_ISREG(s.st_mode) && walk_wanted(path))
+				treat_path(path);
+			free(path);
+		}
+		closedir(dir);
+		return;
+	}
+
+	if (!pool_enabled() || !S_ISREG(s.st_mode)) {
+		treat_file(filename);
+		return;
+	}
+
+	if (opt_bufsize > 0)
+		small = (size_t)opt_bufsize * 2;
+
+	if ((size_t)s.st_size <= small)
+		pool_add(filename, &s);
+	else
+		pool_add_big(filename);
+}
+
+/* in memory buffer for the benchmark */
+typedef struct {
+	unsigned char *buf;
+	size_t size;		/* filled bytes */
+	size_t pos;		/* read position */
+	size_t allocated;
+} bench_buf;
+
+static int BenchRead(void *arg, MT_Buffer * in)
+{
+	bench_buf *b = (bench_buf *) arg;
+	size_t len = b->size - b->pos;
+
+	if (len > in->size)
+		len = in->size;
+	memcpy(in->buf, b->buf + b->pos, len);
+	b->pos += len;
+	in->size = len;
+
+	return 0;
+}
+
+static int BenchWrite(void *arg, MT_Buffer * out)
+{
+	bench_buf *b = (bench_buf *) arg;
+
+	if (b->size + out->size > b->allocated) {
+		size_t len = (b->size + out->size) * 2;
+		unsigned char *buf = realloc(b->buf, len);
+		if (!buf)
+			return -3;
+		b->buf = buf;
+		b->allocated = len;
+	}
+	memcpy(b->buf + b->size, out->buf, out->size);
+	b->size += out->size;
+
+	return 0;
+}
+
+/**
+ * bench_load() - append the whole stream to the buffer
+ */
+static void bench_load(bench_buf * b, FILE * in)
+{
+	MT_Buffer chunk;
+	unsigned char buf[64 * 1024];
+
+	for (;;) {
+		chunk.buf = buf;
+		chunk.size = fread(buf, 1, sizeof(buf), in);
+		if (chunk.size == 0)
+			break;
+		if (BenchWrite(b, &chunk) != 0)
+			panic("nomem!");
+	}
+}
+
+static double bench_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000;
+}
+
+/**
+ * bench_run() - (de)compress src into dst, repeated for opt_benchtime
+ *
+ * return: best time of one run in seconds, or a negative value on error
+ * the worker timings of the best run are returned via st
+ */
+/**
+ * bench_stat_sub() - the statistic of one run
+ *
+ * some libraries keep the counters of the workers over all runs of a
+ * context, others start at zero, so take the difference to the last run
+ */
+static void bench_stat_sub(mtstat_t * st, const mtstat_t * cur,
+			   const mtstat_t * last)
+{
+	int i;
+
+	*st = *cur;
+	if (cur->frames <= last->frames)
+		return;
+	st->frames -= last->frames;
+	st->insize -= last->insize;
+	st->outsize -= last->outsize;
+	st->read -= last->read;
+	st->read_wait -= last->read_wait;
+	st->codec -= last->codec;
+	st->write_wait -= last->write_wait;
+	st->write -= last->write;
+	for (i = 0; i < MTSTAT_HIST; i++)
+		st->hist[i] -= last->hist[i];
+}
+
+static double bench_run(int compress, int level, int threads,
+			bench_buf * src, bench_buf * dst, mtstat_t * st)
+{
+	mtstat_t last, cur;
+	double start, now, t, best = -1;
+	MT_CCtx *c = 0;
+	MT_DCtx *d = 0;
+	MT_RdWr_t rdwr;
+	size_t ret;
+
+	memset(st, 0, sizeof(*st));
+	rdwr.fn_read = BenchRead;
+	rdwr.fn_write = BenchWrite;
+	rdwr.arg_read = (void *)src;
+	rdwr.arg_write = (void *)dst;
+
+	/* one context for all runs, only the (de)compression is timed */
+	if (compress) {
+		c = MT_createCCtx(threads, level, opt_bufsize);
+		if (!c)
+			return -1;
+		if (setup_cctx(c))
+			goto error;
+		MT_GetStatsCCtx(c, &last);
+	} else {
+		d = MT_createDCtx(threads, opt_bufsize);
+		if (!d)
+			return -1;
+		if (setup_dctx(d))
+			goto error;
+		MT_GetStatsDCtx(d, &last);
+	}
+
+	start = bench_now();
+	do {
+		src->pos = 0;
+		dst->size = 0;
+		if (compress) {
+#ifdef MT_setSrcSize
+			MT_setSrcSize(c, (unsigned long long)src->size);
+#endif
+			t = bench_now();
+			ret = MT_compressCCtx(c, &rdwr);
+			now = bench_now();
+			MT_GetStatsCCtx(c, &cur);
+		} else {
+			t = bench_now();
+			ret = MT_decompressDCtx(d, &rdwr);
+			now = bench_now();
+			MT_GetStatsDCtx(d, &cur);
+		}
+		if (MT_isError(ret)) {
+			fprintf(stderr, "%s: bench: %s\n", progname,
+				MT_getErrorString(ret));
+			goto error;
+		}
+		if (best < 0 || now - t < best) {
+			best = now - t;
+			bench_stat_sub(st, &cur, &last);
+		}
+		last = cur;
+	} while (now - start < opt_benchtime);
+
+	if (c)
+		MT_freeCCtx(c);
+	if (d)
+		MT_freeDCtx(d);
+	return best;
+
+ error:
+	if (c)
+		MT_freeCCtx(c);
+	if (d)
+		MT_freeDCtx(d);
+	return -1;
+}
+
+/**
+ * bench_stat() - print, where the workers did spend their time
+ *
+ * values are in percent of the wall time of all threads together:
+ * fn_read, waiting for the read mutex, waiting for the write mutex,
+ * pt_write() ordering and output, and the codec itself
+ */
+static void bench_stat(mtstat_t * st, int threads, double secs)
+{
+	double all = secs * threads * 1000000000;
+
+	printf(" %4.1f/%4.1f/%4.1f/%4.1f/%5.1f",
+	       st->read * 100 / all, st->read_wait * 100 / all,
+	       st->write_wait * 100 / all, st->write * 100 / all,
+	       st->codec * 100 / all);
+}
+
+/**
+ * bench() - in memory benchmark for a range of levels and threads
+ *
+ * All input files (or stdin) are loaded into memory once, so no file
+ * I/O is measured. Speeds are in MB/s of uncompressed data, efficiency
+ * is the speedup against one thread, divided by the number of threads.
+ * The last columns show the time shares of the worker phases.
+ */
+static void bench(int files, char **names)
+{
+	bench_buf src, cmp, dec;
+	double cspeed1 = 0, dspeed1 = 0;
+	int i, level, threads;
+
+	memset(&src, 0, sizeof(src));
+	memset(&cmp, 0, sizeof(cmp));
+	memset(&dec, 0, sizeof(dec));
+
+	if (files == 0) {
+		SET_BINARY(stdin);
+		bench_load(&src, stdin);
+	}
+	for (i = 0; i < files; i++) {
+		FILE *in = fopen(names[i], "rb");
+		if (!in) {
+			fprintf(stderr, "%s: %s: %s\n", progname, names[i],
+				strerror(errno));
+			exit_code = E_ERROR;
+			return;
+		}
+		bench_load(&src, in);
+		fclose(in);
+	}
+	if (src.size == 0)
+		panic("Nothing to benchmark, input is empty.");
+
+	printf("%6s %5s %7s %12s %12s %7s %12s %12s %8s %8s",
+	       "method", "level", "threads", "size", "compressed", "ratio",
+	       "comp MB/s", "decomp MB/s", "c-eff", "d-eff");
+	printf(" %25s %25s\n", "c-in/rd/wr/out/codec %",
+	       "d-in/rd/wr/out/codec %");
+
+	for (level = opt_level; level <= opt_endlevel; level++) {
+		for (threads = 1; threads <= opt_threads; threads++) {
+			double ctime, dtime, cspeed, dspeed;
+			mtstat_t cstat, dstat;
+
+			ctime = bench_run(1, level, threads, &src, &cmp, &cstat);
+			if (ctime < 0)
+				goto error;
+			dtime = bench_run(0, level, threads, &cmp, &dec, &dstat);
+			if (dtime < 0)
+				goto error;
+			if (dec.size != src.size
+			    || memcmp(dec.buf, src.buf, src.size) != 0) {
+				fprintf(stderr, "%s: bench: %s\n", progname,
+					"Decompressed data differs!");
+				goto error;
+			}
+
+			cspeed = (double)src.size / 1000000 / ctime;
+			dspeed = (double)src.size / 1000000 / dtime;
+			if (threads == 1) {
+				cspeed1 = cspeed;
+				dspeed1 = dspeed;
+			}
+
+			printf("%6s %5d %7d %12lu %12lu %6.2f%% "
+			       "%12.1f %12.1f %7.1f%% %7.1f%%",
+			       METHOD, level, threads,
+			       (unsigned long)src.size,
+			       (unsigned long)cmp.size,
+			       100 - (double)cmp.size * 100 / src.size,
+			       cspeed, dspeed,
+			       cspeed * 100 / cspeed1 / threads,
+			       dspeed * 100 / dspeed1 / threads);
+			bench_stat(&cstat, threads, ctime);
+			bench_stat(&dstat, threads, dtime);
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+	goto out;
+
+ error:
+	exit_code = E_ERROR;
+ out:
+	free(src.buf);
+	free(cmp.buf);
+	free(dec.buf);
+}
 
 int main(int argc, char **argv)
 {
@@ -759,8 +2065,9 @@ int main(int argc, char **argv)
 
 	/* same order as in help option -h */
 	while ((opt =
-		getopt(argc, argv,
-		       "1234567890cdzfo:hklLqrS:tvVT:b:i:BC")) != -1) {
+		getopt_long(argc, argv,
+			    "1234567890cdzfo:hklLqrS:tvVT:b:e:i:BCU",
+			    long_options, NULL)) != -1) {
 		switch (opt) {
 
 			/* 1) Gzip Like Options: */
@@ -824,6 +2131,10 @@ int main(int argc, char **argv)
 			opt_verbose = 0;
 			break;
 
+		case 'r':	/* recursive */
+			opt_recursive = 1;
+			break;
+
 		case 'S':	/* use specified suffix */
 			opt_suffix = optarg;
 			break;
@@ -850,6 +2161,10 @@ int main(int argc, char **argv)
 			opt_bufsize = atoi(optarg);
 			break;
 
+		case 'e':	/* last level for benchmarking */
+			opt_endlevel = atoi(optarg);
+			break;
+
 		case 'i':	/* iterations */
 			opt_iterations = atoi(optarg);
 			break;
@@ -862,6 +2177,86 @@ int main(int argc, char **argv)
 			opt_nocrc = 1;
 			break;
 
+		case 'U':	/* drop input and output from page cache */
+			opt_uncached = 1;
+			break;
+
+			/* 3) long options */
+		case OPT_CHECK:	/* checksum for each frame */
+			opt_checksum = 1;
+			break;
+
+		case OPT_BENCH:	/* in memory benchmark */
+			opt_mode = MODE_BENCH;
+			break;
+
+		case OPT_BENCHTIME:	/* minimal seconds per benchmark run */
+			opt_benchtime = atoi(optarg);
+			break;
+
+		case OPT_PROGRESS:	/* live progress on stderr */
+			opt_progress = 1;
+			break;
+
+		case OPT_TRACE:	/* chrome trace of the frames */
+			opt_trace = optarg;
+			break;
+
+		case OPT_FLUSHMS:	/* bounded latency for live streams */
+			opt_flushms = atoi(optarg);
+			break;
+
+#ifdef MT_p_window
+		case OPT_WINDOW:	/* brotli: lgwin */
+			opt_window = atoi(optarg);
+			break;
+
+		case OPT_BLOCK:	/* brotli: lgblock */
+			opt_block = atoi(optarg);
+			break;
+
+		case OPT_BMODE:	/* brotli: generic, text, font or auto */
+			if (!strcmp(optarg, "generic"))
+				opt_bmode = MT_MODE_GENERIC;
+			else if (!strcmp(optarg, "text"))
+				opt_bmode = MT_MODE_TEXT;
+			else if (!strcmp(optarg, "font"))
+				opt_bmode = MT_MODE_FONT;
+			else if (!strcmp(optarg, "auto"))
+				opt_bmode = MT_MODE_AUTO;
+			else
+				usage();
+			break;
+
+		case OPT_LARGEWIN:	/* brotli: windows above 16 MiB */
+			opt_largewin = 1;
+			break;
+#endif
+
+#ifdef MT_p_linked
+		case OPT_LINKED:	/* lz4: chained frames */
+			opt_linked = 1;
+			break;
+#endif
+
+#ifdef MT_p_blocks
+		case OPT_BLOCKS:	/* lz4: one frame of independent blocks */
+			opt_blocks = 1;
+			break;
+#endif
+
+#ifdef MT_p_framed
+		case OPT_FRAMED:	/* snappy: official framing format */
+			opt_framed = 1;
+			break;
+#endif
+
+#ifdef MT_setCCtxDictionary
+		case OPT_DICT:	/* dictionary for all frames */
+			opt_dict = optarg;
+			break;
+#endif
+
 		default:
 			usage();
 			/* not reached */
@@ -884,6 +2279,13 @@ int main(int argc, char **argv)
 	else if (opt_threads > THREAD_MAX)
 		opt_threads = THREAD_MAX;
 
+	/**
+	 * --flush-ms: the single threaded zstd decoder reads big blocks of
+	 * input, the threaded ones read frame by frame and pass each on
+	 */
+	if (opt_flushms && opt_mode == MODE_DECOMPRESS && opt_threads < 2)
+		opt_threads = 2;
+
 	/* opt_iterations = 1..MAX_ITERATIONS */
 	if (opt_iterations < 1)
 		opt_iterations = 1;
@@ -894,6 +2296,28 @@ int main(int argc, char **argv)
 	if (opt_bufsize > 0)
 		opt_bufsize *= 1024 * 1024;
 
+#ifdef MT_setCCtxDictionary
+	if (opt_dict)
+		dict_load();
+#endif
+
+	/* --bench needs no output at all */
+	if (opt_mode == MODE_BENCH) {
+		if (opt_endlevel < opt_level)
+			opt_endlevel = opt_level;
+		else if (opt_endlevel > LEVEL_MAX)
+			opt_endlevel = LEVEL_MAX;
+		if (opt_benchtime < 1)
+			opt_benchtime = 1;
+		bench(argc - optind, argv + optind);
+		exit(exit_code);
+	}
+
+	if (opt_trace)
+		trace_open();
+	if (opt_mode == MODE_LIST && opt_verbose > 1 && !opt_nocrc)
+		crc_open();
+
 	/* number of args, which are not options */
 	files = argc - optind;
 
@@ -953,8 +2377,9 @@ int main(int argc, char **argv)
 		for (;;) {
 			files = optind;
 			while (files < argc) {
-				treat_file(argv[files++]);
+				treat_path(argv[files++]);
 			}
+			treat_queued();
 			opt_iterations--;
 			if (opt_iterations == 0)
 				break;
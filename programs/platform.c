@@ -11,6 +11,7 @@
  * - zstdmt source repository: https://github.com/mcmilk/zstdmt
  */
 
+#define _GNU_SOURCE /* F_SETPIPE_SZ, readahead() */
 #include "platform.h"
 
 #if defined(_MSC_VER) || defined(__MINGW32__)
@@ -96,10 +97,213 @@ int fchmod(int fd, mode_t mode)
 	errno = ENOSYS;
 	return -1;
 }
+
+int pipe_resize(int fd, size_t size)
+{
+	(void)fd;
+	(void)size;
+	return 0;
+}
+
+size_t pipe_write(int fd, const void *buf, size_t size)
+{
+	int done = _write(fd, buf, (unsigned int)size);
+	return done < 0 ? 0 : (size_t)done;
+}
+
+/* no poll() for pipes here, so the chunk is just filled */
+size_t io_read_timed(int fd, void *buf, size_t size, int ms)
+{
+	char *p = (char *)buf;
+	size_t done = 0;
+
+	(void)ms;
+	while (done < size) {
+		int rv = _read(fd, p + done, (unsigned int)(size - done));
+		if (rv <= 0)
+			break;
+		done += rv;
+	}
+
+	return done;
+}
+
+void io_sequential(int fd)
+{
+	(void)fd;
+}
+
+void io_readahead(int fd, U64 offset, size_t size)
+{
+	(void)fd;
+	(void)offset;
+	(void)size;
+}
+
+void io_dontneed(int fd, U64 offset, U64 size)
+{
+	(void)fd;
+	(void)offset;
+	(void)size;
+}
 #else
 /* POSIX */
 int getcpucount(void)
 {
 	return sysconf(_SC_NPROCESSORS_ONLN);
 }
+
+/* upper limit for growing pipes, the kernel may allow less */
+#define PIPE_SIZE_MAX (64 * 1024 * 1024)
+
+/**
+ * pipe_resize() - check if fd is a pipe and grow it to hold size bytes
+ *
+ * Unprivileged processes are limited by /proc/sys/fs/pipe-max-size, so
+ * the size is halved until the kernel accepts it.
+ *
+ * return: 1 when fd is a pipe, 0 otherwise
+ */
+int pipe_resize(int fd, size_t size)
+{
+	struct stat s;
+
+	if (fstat(fd, &s) != 0 || !S_ISFIFO(s.st_mode))
+		return 0;
+
+#if defined(F_GETPIPE_SZ) && defined(F_SETPIPE_SZ)
+	{
+		int cur = fcntl(fd, F_GETPIPE_SZ);
+
+		if (size > PIPE_SIZE_MAX)
+			size = PIPE_SIZE_MAX;
+
+		while (cur > 0 && (size_t)cur < size) {
+			if (fcntl(fd, F_SETPIPE_SZ, (int)size) != -1)
+				break;
+			size /= 2;
+		}
+	}
+#else
+	(void)size;
+#endif
+
+	return 1;
+}
+
+/**
+ * pipe_write() - write all bytes of buf to fd, without stdio buffering
+ *
+ * return: number of bytes written
+ */
+size_t pipe_write(int fd, const void *buf, size_t size)
+{
+	const char *p = (const char *)buf;
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t rv = write(fd, p + done, size - done);
+		if (rv == -1 && errno == EINTR)
+			continue;
+		if (rv <= 0)
+			break;
+		done += rv;
+	}
+
+	return done;
+}
+
+/**
+ * io_read_timed() - fill buf from fd, but return early, when ms have
+ * passed since the first byte arrived
+ *
+ * Waiting for the first byte is not limited, so an idle stream does not
+ * produce empty chunks.
+ *
+ * return: number of bytes read, 0 on end of file or error
+ */
+size_t io_read_timed(int fd, void *buf, size_t size, int ms)
+{
+	char *p = (char *)buf;
+	struct timeval start, now;
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t rv;
+
+		if (done) {
+			struct pollfd pfd;
+			long left;
+
+			gettimeofday(&now, NULL);
+			left = ms - ((now.tv_sec - start.tv_sec) * 1000 +
+				     (now.tv_usec - start.tv_usec) / 1000);
+			if (left <= 0)
+				break;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			rv = poll(&pfd, 1, (int)left);
+			if (rv == -1 && errno == EINTR)
+				continue;
+			if (rv <= 0)
+				break;
+		}
+
+		rv = read(fd, p + done, size - done);
+		if (rv == -1 && errno == EINTR)
+			continue;
+		if (rv <= 0)
+			break;
+		if (!done)
+			gettimeofday(&start, NULL);
+		done += rv;
+	}
+
+	return done;
+}
+
+/**
+ * io_sequential() - tell the kernel, that fd is read once from start to end
+ */
+void io_sequential(int fd)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+	(void)fd;
+#endif
+}
+
+/**
+ * io_readahead() - start reading the given range into the page cache
+ */
+void io_readahead(int fd, U64 offset, size_t size)
+{
+#if defined(__linux__)
+	readahead(fd, (off_t)offset, size);
+#elif defined(POSIX_FADV_WILLNEED)
+	posix_fadvise(fd, (off_t)offset, (off_t)size, POSIX_FADV_WILLNEED);
+#else
+	(void)fd;
+	(void)offset;
+	(void)size;
+#endif
+}
+
+/**
+ * io_dontneed() - drop the given range from the page cache
+ *
+ * Dirty pages are not dropped, but their writeback gets started. So
+ * written ranges should be passed twice, the second call frees them.
+ */
+void io_dontneed(int fd, U64 offset, U64 size)
+{
+#ifdef POSIX_FADV_DONTNEED
+	posix_fadvise(fd, (off_t)offset, (off_t)size, POSIX_FADV_DONTNEED);
+#else
+	(void)fd;
+	(void)offset;
+	(void)size;
+#endif
+}
 #endif
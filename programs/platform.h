@@ -31,8 +31,16 @@ extern "C" {
 #include <errno.h>
 #include <time.h>
 #include <utime.h>
+#include <dirent.h>
+#include <getopt.h>
 
 extern int getcpucount(void);
+extern int pipe_resize(int fd, size_t size);
+extern size_t pipe_write(int fd, const void *buf, size_t size);
+extern size_t io_read_timed(int fd, void *buf, size_t size, int ms);
+extern void io_sequential(int fd);
+extern void io_readahead(int fd, U64 offset, size_t size);
+extern void io_dontneed(int fd, U64 offset, U64 size);
 
 #define _FILE_OFFSET_BITS 64
 
@@ -86,15 +94,21 @@ struct rusage {
 extern int getrusage(int who, struct rusage *uv_rusage);
 
 extern int fchmod(int fd, mode_t mode);
+#define lstat stat
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
 #else
 
 /* POSIX */
 
 #include <sys/resource.h> /* getrusage() */
+#include <poll.h> /* poll() */
 #define DEVNULL "/dev/null"
 #define PATH_SEPERATOR '/'
 #define SET_BINARY(file)
 #define IS_CONSOLE(stdStream) (isatty(fileno(stdStream)))
+#define fseek64 fseeko
+#define ftell64 ftello
 
 #endif /* POSIX */
 
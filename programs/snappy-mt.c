@@ -28,10 +28,16 @@
 
 #define MT_CCtx            SNAPPYMT_CCtx
 #define MT_createCCtx      SNAPPYMT_createCCtx
+#define MT_setCCtxParameter SNAPPYMT_setCCtxParameter
+#define MT_p_framed        SNAPPYMT_p_framed
 #define MT_compressCCtx    SNAPPYMT_compressCCtx
 #define MT_GetFramesCCtx   SNAPPYMT_GetFramesCCtx
 #define MT_GetInsizeCCtx   SNAPPYMT_GetInsizeCCtx
 #define MT_GetOutsizeCCtx  SNAPPYMT_GetOutsizeCCtx
+#define MT_GetStatsCCtx    SNAPPYMT_GetStatsCCtx
+#define MT_GetWorkerStatsCCtx SNAPPYMT_GetWorkerStatsCCtx
+#define MT_setProgressCCtx SNAPPYMT_setProgressCCtx
+#define MT_setTraceCCtx    SNAPPYMT_setTraceCCtx
 #define MT_freeCCtx        SNAPPYMT_freeCCtx
 
 #define MT_DCtx            SNAPPYMT_DCtx
@@ -40,6 +46,11 @@
 #define MT_GetFramesDCtx   SNAPPYMT_GetFramesDCtx
 #define MT_GetInsizeDCtx   SNAPPYMT_GetInsizeDCtx
 #define MT_GetOutsizeDCtx  SNAPPYMT_GetOutsizeDCtx
+#define MT_GetStatsDCtx    SNAPPYMT_GetStatsDCtx
+#define MT_GetWorkerStatsDCtx SNAPPYMT_GetWorkerStatsDCtx
+#define MT_setProgressDCtx SNAPPYMT_setProgressDCtx
+#define MT_setTraceDCtx    SNAPPYMT_setTraceDCtx
+#define MT_setOutputDCtx   SNAPPYMT_setOutputDCtx
 #define MT_freeDCtx        SNAPPYMT_freeDCtx
 
 #include "main.c"
@@ -32,14 +32,28 @@
 #define MT_GetFramesCCtx   ZSTDCB_GetFramesCCtx
 #define MT_GetInsizeCCtx   ZSTDCB_GetInsizeCCtx
 #define MT_GetOutsizeCCtx  ZSTDCB_GetOutsizeCCtx
+#define MT_GetStatsCCtx    ZSTDCB_GetStatsCCtx
+#define MT_GetWorkerStatsCCtx ZSTDCB_GetWorkerStatsCCtx
+#define MT_setProgressCCtx ZSTDCB_setProgressCCtx
+#define MT_setTraceCCtx    ZSTDCB_setTraceCCtx
 #define MT_freeCCtx        ZSTDCB_freeCCtx
+#define MT_setCCtxParameter ZSTDCB_setCCtxParameter
+#define MT_p_checksum      ZSTDCB_p_checksum
+#define MT_setSrcSize      ZSTDCB_setSrcSize
 
 #define MT_DCtx            ZSTDCB_DCtx
 #define MT_createDCtx      ZSTDCB_createDCtx
 #define MT_decompressDCtx  ZSTDCB_decompressDCtx
+#define MT_listDCtx        ZSTDCB_listDCtx
+#define MT_testDCtx        ZSTDCB_testDCtx
 #define MT_GetFramesDCtx   ZSTDCB_GetFramesDCtx
 #define MT_GetInsizeDCtx   ZSTDCB_GetInsizeDCtx
 #define MT_GetOutsizeDCtx  ZSTDCB_GetOutsizeDCtx
+#define MT_GetStatsDCtx    ZSTDCB_GetStatsDCtx
+#define MT_GetWorkerStatsDCtx ZSTDCB_GetWorkerStatsDCtx
+#define MT_setProgressDCtx ZSTDCB_setProgressDCtx
+#define MT_setTraceDCtx    ZSTDCB_setTraceDCtx
+#define MT_setOutputDCtx   ZSTDCB_setOutputDCtx
 #define MT_freeDCtx        ZSTDCB_freeDCtx
 
 #include "main.c"